@@ -0,0 +1,333 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        codecbench.c
+// Purpose:     Throughput of the codec per cipher, AES backend and page size
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file codecbench.c Codec micro-benchmark
+//
+// Times the codec on the host for page sizes from 512 bytes to 64 KiB,
+// for every cipher and, for the AES ciphers, every AES backend the CPU
+// supports. Each result is one line of key=value pairs:
+//
+//   record=kdf cipher=NAME kdf_ns
+//     key derivation from a password, once per database opened
+//
+//   record=page backend=NAME cipher=NAME page_size=N ...
+//     enc_ns, dec_ns      CodecEncryptTo/CodecDecrypt per page, with page
+//                         numbers that miss the page key cache
+//     enc_cached_ns       CodecEncryptTo per page with the page key cached
+//     enc_mbps, dec_mbps  the same as throughput, 10^6 bytes per second
+//     pagekey_ns          derivation of the page key from the database key
+//     iv_ns               generation of the initial vector of the page
+//     sched_ns            AES key schedule of the page key
+//     block_ns            the block cipher over the page (AES formats:
+//                         RijndaelBlockEncrypt, block_dec_ns for
+//                         RijndaelBlockDecrypt), block_mbps
+//   Steps a format does not take per page are reported as 0: XTS and GCM
+//   expand their keys once per database, ChaCha20 and LZ4 use neither an
+//   initial vector nor the AES backends (backend=none).
+//
+// Build and run on a Linux host:
+//   make codecbench && ./codecbench [millis per measurement] [cipher]
+*/
+
+typedef struct Btree Btree;
+#define SQLITE_MAX_PAGE_SIZE 65536
+
+#include "sqlite3.h"
+
+#include "rijndael.c"
+#include "chacha20.c"
+#include "gcm.c"
+#include "lz4.c"
+#include "codec.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MIN_PAGE 512
+#define BENCH_MAX_PAGE 65536
+
+/* Page numbers cycle through more entries than the key cache has */
+#define BENCH_COLD_PAGES (4 * CODEC_KEYCACHE_SIZE)
+
+typedef struct _BenchRun
+{
+  Codec*             m_codec;
+  const CodecCipher* m_cipher;
+  int                m_format;
+  int                m_len;
+  int                m_page;        /* Constant page number, 0 to cycle */
+  unsigned char*     m_plain;
+  unsigned char*     m_out;
+  unsigned char*     m_sealed;      /* Encrypted pages for the decrypt runs */
+  unsigned char      m_pagekey[KEYLENGTH];
+  unsigned char      m_iv[16];
+  Rijndael           m_aes;
+} BenchRun;
+
+/* Steps take the iteration number j, to vary the page, or none */
+typedef void (*BenchStep)(BenchRun* run, int j);
+typedef void (*BenchFixedStep)(BenchRun* run);
+
+static double benchMillis = 20;
+
+static double BenchNow(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+// Nanoseconds per call of step (or of fixed, if step is NULL), repeated
+// for at least benchMillis
+*/
+static double BenchTimeSteps(BenchStep step, BenchFixedStep fixed, BenchRun* run)
+{
+  double start = BenchNow();
+  double elapsed;
+  int n = 0;
+  int batch = 1;
+  int j;
+
+  do
+  {
+    for (j = 0; j < batch; j++)
+    {
+      if (step != NULL)
+      {
+        step(run, n + j);
+      }
+      else
+      {
+        fixed(run);
+      }
+    }
+    n += batch;
+    if (batch < 1024)
+    {
+      batch *= 2;
+    }
+    elapsed = BenchNow() - start;
+  }
+  while (elapsed * 1e3 < benchMillis);
+  return elapsed * 1e9 / n;
+}
+
+static double BenchTime(BenchStep step, BenchRun* run)
+{
+  return BenchTimeSteps(step, NULL, run);
+}
+
+static double BenchTimeFixed(BenchFixedStep fixed, BenchRun* run)
+{
+  return BenchTimeSteps(NULL, fixed, run);
+}
+
+static int BenchPage(BenchRun* run, int j)
+{
+  return (run->m_page > 0) ? run->m_page : 1 + j % BENCH_COLD_PAGES;
+}
+
+static void BenchEncrypt(BenchRun* run, int j)
+{
+  CodecEncryptTo(run->m_codec, BenchPage(run, j), run->m_plain, run->m_out, run->m_len, 1);
+}
+
+static void BenchCopy(BenchRun* run, int j)
+{
+  memcpy(run->m_out, run->m_sealed + (size_t) (j % BENCH_COLD_PAGES) * run->m_len, run->m_len);
+}
+
+static void BenchDecrypt(BenchRun* run, int j)
+{
+  /* Decryption is in place, so each run starts from a copy */
+  BenchCopy(run, j);
+  CodecDecrypt(run->m_codec, 1 + j % BENCH_COLD_PAGES, run->m_out, run->m_len, 0);
+}
+
+static void BenchPageKey(BenchRun* run, int j)
+{
+  CodecDerivePageKey(run->m_codec, run->m_cipher, BenchPage(run, j), run->m_codec->m_readKey, run->m_pagekey);
+}
+
+static void BenchIv(BenchRun* run, int j)
+{
+  CodecGenerateInitialVector(run->m_codec, BenchPage(run, j), run->m_iv);
+}
+
+static void BenchSchedule(BenchRun* run)
+{
+  CodecInitPageCipher(run->m_cipher, run->m_format, RIJNDAEL_Direction_Encrypt, run->m_pagekey, run->m_iv,
+                      &run->m_aes);
+}
+
+static void BenchBlockEncrypt(BenchRun* run)
+{
+  RijndaelBlockEncrypt(&run->m_aes, run->m_plain, run->m_len * 8, run->m_out);
+}
+
+static void BenchBlockDecrypt(BenchRun* run)
+{
+  RijndaelBlockDecrypt(&run->m_aes, run->m_plain, run->m_len * 8, run->m_out);
+}
+
+/*
+// Text-like page content, so that the LZ4 format compresses it
+*/
+static void BenchFill(unsigned char* data, int len)
+{
+  static const char* words[] = { "message ", "contact ", "the ", "of ", "android ", "received ", "12345 " };
+  int n = 0;
+  while (n < len)
+  {
+    const char* word = words[rand() % 7];
+    int k = (int) strlen(word);
+    memcpy(data + n, word, (k < len - n) ? k : len - n);
+    n += k;
+  }
+}
+
+static void BenchKdf(Codec* codec, const CodecCipher* cipher)
+{
+  unsigned char key[KEYLENGTH];
+  double start = BenchNow();
+  double elapsed;
+  int n = 0;
+
+  do
+  {
+    cipher->m_generateKey(codec, "benchmark", 9, key);
+    n++;
+    elapsed = BenchNow() - start;
+  }
+  while (elapsed * 1e3 < benchMillis);
+  printf("record=kdf cipher=%s kdf_ns=%.0f\n", cipher->m_name, elapsed * 1e9 / n);
+}
+
+static void BenchCipher(const CodecCipher* cipher, const char* backend, int len)
+{
+  BenchRun run;
+  Codec codec;
+  double enc, dec, copy, cached;
+  double pagekey = 0, iv = 0, sched = 0, block = 0, blockDec = 0;
+  int format = cipher->m_format;
+  int aes = (format == CODEC_FORMAT_CBC || format == CODEC_FORMAT_XEX);
+  int j;
+
+  CodecInit(&codec);
+  CodecSetIsEncrypted(&codec, 1);
+  CodecSetHasReadKey(&codec, 1);
+  CodecSetHasWriteKey(&codec, 1);
+  CodecSetReadCipher(&codec, cipher);
+  CodecSetWriteCipher(&codec, cipher);
+  CodecGenerateReadKey(&codec, "benchmark", 9);
+  CodecCopyKey(&codec, 1);
+  CodecSetFormat(&codec, format);
+  CodecSetReserve(&codec, CodecGetFormatReserve(format));
+  CodecSetPageSize(&codec, len);
+
+  memset(&run, 0, sizeof(run));
+  run.m_codec = &codec;
+  run.m_cipher = cipher;
+  run.m_format = format;
+  run.m_len = len;
+  run.m_plain = (unsigned char*) malloc(len);
+  run.m_out = (unsigned char*) malloc(len);
+  run.m_sealed = (unsigned char*) malloc((size_t) BENCH_COLD_PAGES * len);
+  if (run.m_plain == NULL || run.m_out == NULL || run.m_sealed == NULL)
+  {
+    fprintf(stderr, "codecbench: out of memory\n");
+    exit(1);
+  }
+  BenchFill(run.m_plain, len);
+  for (j = 0; j < BENCH_COLD_PAGES; j++)
+  {
+    CodecEncryptTo(&codec, j + 1, run.m_plain, run.m_sealed + (size_t) j * len, len, 1);
+  }
+
+  enc = BenchTime(BenchEncrypt, &run);
+  copy = BenchTime(BenchCopy, &run);
+  dec = BenchTime(BenchDecrypt, &run) - copy;
+  run.m_page = 1;
+  cached = BenchTime(BenchEncrypt, &run);
+  run.m_page = 0;
+
+  if (format != CODEC_FORMAT_XTS && format != CODEC_FORMAT_GCM)
+  {
+    pagekey = BenchTime(BenchPageKey, &run);
+  }
+  if (aes)
+  {
+    iv = BenchTime(BenchIv, &run);
+    sched = BenchTimeFixed(BenchSchedule, &run);
+    block = BenchTimeFixed(BenchBlockEncrypt, &run);
+    CodecInitPageCipher(cipher, format, RIJNDAEL_Direction_Decrypt, run.m_pagekey, run.m_iv, &run.m_aes);
+    blockDec = BenchTimeFixed(BenchBlockDecrypt, &run);
+  }
+
+  printf("record=page backend=%s cipher=%s page_size=%d enc_ns=%.0f dec_ns=%.0f enc_cached_ns=%.0f "
+         "enc_mbps=%.1f dec_mbps=%.1f pagekey_ns=%.0f iv_ns=%.0f sched_ns=%.0f block_ns=%.0f "
+         "block_dec_ns=%.0f block_mbps=%.1f\n",
+         backend, cipher->m_name, len, enc, dec, cached,
+         len * 1e3 / enc, len * 1e3 / dec, pagekey, iv, sched, block,
+         blockDec, (block > 0) ? len * 1e3 / block : 0.0);
+  fflush(stdout);
+
+  free(run.m_plain);
+  free(run.m_out);
+  free(run.m_sealed);
+  CodecTerm(&codec);
+}
+
+int main(int argc, char** argv)
+{
+  static const struct { int m_backend; const char* m_name; } backends[] =
+  {
+    { RIJNDAEL_Backend_Table,    "table" },
+    { RIJNDAEL_Backend_Bitslice, "bitslice" },
+    { RIJNDAEL_Backend_AESNI,    "aesni" },
+    { RIJNDAEL_Backend_ARMv8,    "armv8" }
+  };
+  const char* only = (argc > 2) ? argv[2] : NULL;
+  int initial;
+  int c, b, len;
+  Codec codec;
+
+  if (argc > 1 && atof(argv[1]) > 0)
+  {
+    benchMillis = atof(argv[1]);
+  }
+  sqlite3_initialize();
+  srand(1);
+  initial = RijndaelGetBackend();
+
+  CodecInit(&codec);
+  for (c = 0; c < CODEC_CIPHER_COUNT; c++)
+  {
+    const CodecCipher* cipher = &codecCiphers[c];
+    int aes = (cipher->m_format != CODEC_FORMAT_CHACHA20 && cipher->m_format != CODEC_FORMAT_LZ4);
+    if (only != NULL && strcmp(only, cipher->m_name) != 0)
+    {
+      continue;
+    }
+    BenchKdf(&codec, cipher);
+    for (b = 0; b < (int) (sizeof(backends) / sizeof(backends[0])); b++)
+    {
+      if (aes ? RijndaelSetBackend(backends[b].m_backend) != RIJNDAEL_SUCCESS : b > 0)
+      {
+        continue;
+      }
+      for (len = BENCH_MIN_PAGE; len <= BENCH_MAX_PAGE; len *= 2)
+      {
+        BenchCipher(cipher, aes ? backends[b].m_name : "none", len);
+      }
+    }
+    RijndaelSetBackend(initial);
+  }
+  CodecTerm(&codec);
+  return 0;
+}
@@ -0,0 +1,209 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        compressbench.c
+// Purpose:     Compare the LZ4 page format with the AES and ChaCha20 formats
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file compressbench.c Page compression benchmark
+//
+// Builds a text-heavy database with the host's SQLite, then encrypts and
+// decrypts all of its pages with the codec in each format. For every
+// format one line of key=value pairs is printed:
+//   file_bytes     bytes the pages take in the database file
+//   stored_bytes   bytes left when the zeros before the reserved area are
+//                  dropped, as by a compressing file system or backup
+//   enc_ns, dec_ns time per page
+//
+// Build and run on a Linux host:
+//   cc -O2 -I../jni -DSQLITE_HAS_CODEC compressbench.c -o compressbench -lsqlite3 -lpthread
+//   ./compressbench [page size] [rows]
+*/
+
+typedef struct Btree Btree;
+#define SQLITE_MAX_PAGE_SIZE 65536
+
+#include "sqlite3.h"
+
+#include "rijndael.c"
+#include "chacha20.c"
+#include "gcm.c"
+#include "lz4.c"
+#include "codec.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* benchWords[] =
+{
+  "account", "address", "android", "balance", "contact", "message", "the", "a", "of", "to",
+  "and", "in", "is", "for", "on", "with", "received", "sent", "draft", "meeting",
+  "tomorrow", "please", "thanks", "report", "attached", "status", "pending", "delivered", "error", "update"
+};
+
+#define BENCH_WORDS ((int) (sizeof(benchWords) / sizeof(benchWords[0])))
+
+static double BenchNow(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchText(char* text, int len)
+{
+  int n = 0;
+  while (n < len - 16)
+  {
+    const char* word = benchWords[rand() % BENCH_WORDS];
+    n += (rand() % 8 == 0) ? sprintf(text + n, "%d ", rand() % 100000) : sprintf(text + n, "%s ", word);
+  }
+  text[n] = 0;
+}
+
+/*
+// Create the database and return its pages, NULL on failure
+*/
+static unsigned char* BenchDatabase(const char* path, int pageSize, int rows, int* nPages)
+{
+  sqlite3* db;
+  sqlite3_stmt* stmt;
+  char sql[64];
+  char text[600];
+  unsigned char* pages;
+  FILE* fp;
+  long size;
+  int j;
+
+  unlink(path);
+  if (sqlite3_open(path, &db) != SQLITE_OK)
+  {
+    return NULL;
+  }
+  sprintf(sql, "PRAGMA page_size=%d", pageSize);
+  sqlite3_exec(db, sql, 0, 0, 0);
+  sqlite3_exec(db, "CREATE TABLE message(id INTEGER PRIMARY KEY, sender TEXT, subject TEXT, body TEXT);"
+                   "CREATE INDEX message_sender ON message(sender); BEGIN", 0, 0, 0);
+  sqlite3_prepare_v2(db, "INSERT INTO message(sender, subject, body) VALUES(?, ?, ?)", -1, &stmt, 0);
+  for (j = 0; j < rows; j++)
+  {
+    BenchText(text, 24);
+    sqlite3_bind_text(stmt, 1, text, -1, SQLITE_TRANSIENT);
+    BenchText(text, 48);
+    sqlite3_bind_text(stmt, 2, text, -1, SQLITE_TRANSIENT);
+    BenchText(text, 100 + rand() % 480);
+    sqlite3_bind_text(stmt, 3, text, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_exec(db, "COMMIT", 0, 0, 0);
+  sqlite3_close(db);
+
+  fp = fopen(path, "rb");
+  if (fp == NULL)
+  {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  *nPages = (int) (size / pageSize);
+  pages = (unsigned char*) malloc((size_t) *nPages * pageSize);
+  if (pages != NULL && fread(pages, pageSize, *nPages, fp) != (size_t) *nPages)
+  {
+    free(pages);
+    pages = NULL;
+  }
+  fclose(fp);
+  unlink(path);
+  return pages;
+}
+
+static void BenchFormat(const char* cipherName, const unsigned char* pages, int nPages, int pageSize)
+{
+  const CodecCipher* cipher = CodecFindCipher(cipherName, (int) strlen(cipherName));
+  unsigned char* data = (unsigned char*) malloc((size_t) nPages * pageSize);
+  Codec codec;
+  sqlite3_int64 stored = 0;
+  double start, encrypt, decrypt;
+  int reserve, failed = 0;
+  int j, n;
+
+  CodecInit(&codec);
+  CodecSetIsEncrypted(&codec, 1);
+  CodecSetHasReadKey(&codec, 1);
+  CodecSetHasWriteKey(&codec, 1);
+  CodecSetReadCipher(&codec, cipher);
+  CodecSetWriteCipher(&codec, cipher);
+  CodecGenerateReadKey(&codec, "benchmark", 9);
+  CodecCopyKey(&codec, 1);
+  CodecSetFormat(&codec, cipher->m_format);
+  reserve = CodecGetFormatReserve(cipher->m_format);
+  CodecSetReserve(&codec, reserve);
+
+  /* The reserved area of the pages is taken by the format */
+  memcpy(data, pages, (size_t) nPages * pageSize);
+  start = BenchNow();
+  for (j = 0; j < nPages; j++)
+  {
+    CodecEncrypt(&codec, j + 1, data + (size_t) j * pageSize, pageSize, 1);
+  }
+  encrypt = BenchNow() - start;
+
+  for (j = 0; j < nPages; j++)
+  {
+    const unsigned char* page = data + (size_t) j * pageSize;
+    for (n = pageSize - reserve; n > 0 && page[n-1] == 0; n--)
+      ;
+    stored += (n < pageSize - reserve) ? n + reserve : pageSize;
+  }
+
+  start = BenchNow();
+  for (j = 0; j < nPages; j++)
+  {
+    CodecDecrypt(&codec, j + 1, data + (size_t) j * pageSize, pageSize, 0);
+  }
+  decrypt = BenchNow() - start;
+  for (j = 0; j < nPages; j++)
+  {
+    if (memcmp(data + (size_t) j * pageSize, pages + (size_t) j * pageSize, pageSize - reserve) != 0)
+    {
+      failed++;
+    }
+  }
+
+  printf("format=%s page_size=%d pages=%d file_bytes=%lld stored_bytes=%lld ratio=%.2f "
+         "enc_ns=%.0f dec_ns=%.0f enc_mbps=%.1f dec_mbps=%.1f failed=%d\n",
+         cipherName, pageSize, nPages, (long long) nPages * pageSize, (long long) stored,
+         (double) nPages * pageSize / (double) stored,
+         encrypt * 1e9 / nPages, decrypt * 1e9 / nPages,
+         (double) nPages * pageSize / encrypt / 1e6, (double) nPages * pageSize / decrypt / 1e6, failed);
+  CodecTerm(&codec);
+  free(data);
+}
+
+int main(int argc, char** argv)
+{
+  static const char* formats[] = { "aes128", "aes256", "chacha20", "chacha20-lz4" };
+  int pageSize = (argc > 1) ? atoi(argv[1]) : 4096;
+  int rows = (argc > 2) ? atoi(argv[2]) : 20000;
+  unsigned char* pages;
+  int nPages = 0;
+  int j;
+
+  srand(1);
+  pages = BenchDatabase("compressbench.db", pageSize, rows, &nPages);
+  if (pages == NULL || nPages == 0)
+  {
+    fprintf(stderr, "compressbench: cannot create the database\n");
+    return 1;
+  }
+  for (j = 0; j < (int) (sizeof(formats) / sizeof(formats[0])); j++)
+  {
+    BenchFormat(formats[j], pages, nPages, pageSize);
+  }
+  free(pages);
+  return 0;
+}
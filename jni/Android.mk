@@ -31,6 +31,13 @@ SQLITE3_OPT_DEFINES := -DSQLITE_THREADSAFE=1 \
 	-DSQLITE_ENABLE_FTS3_PARENTHESIS=1
 
 SQLITE3_OPT_DEFINES += -DCANT_PASS_VALIST_AS_CHARPTR=1
+
+#	Let the compiler see the ARMv8 Crypto Extensions; rijndael.c and
+#	gcm.c only use them after checking the CPU at runtime
+SQLITE3_ARCH_FLAGS :=
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+SQLITE3_ARCH_FLAGS += -march=armv8-a+crypto
+endif
 	
 ifneq ($(TARGET_ARCH),arm)
 LOCAL_LDLIBS += -ldl
@@ -42,7 +49,8 @@ endif
 
 LOCAL_CFLAGS := $(SQLITE3_INCLUDE_DIRS) \
 	$(SQLITE3_OPT_DEFINES) \
-	$(SQLITE3_ANDROID_ADDITIONAL_FLAGS)\
+	$(SQLITE3_ANDROID_ADDITIONAL_FLAGS) \
+	$(SQLITE3_ARCH_FLAGS)
 
 	
 LOCAL_SRC_FILES := $(SQLITE3_SOURCES)
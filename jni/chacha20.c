@@ -0,0 +1,291 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        chacha20.c
+// Purpose:     ChaCha20 stream cipher (RFC 7539)
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file chacha20.c Implementation of the ChaCha20 stream cipher
+//
+// The portable code computes one 64 byte block at a time. The vectorized
+// core keeps the state of four consecutive blocks in 16 vectors, one state
+// word of all four blocks per vector, so that the rounds need nothing but
+// 32 bit adds, XORs and shifts, and transposes the result when storing.
+// Like the rest of ChaCha20 it runs in constant time.
+*/
+
+#include "chacha20.h"
+
+#include <string.h>
+
+/*
+// Vector primitives of the four block core: SSE2 on x86, NEON on arm64 and
+// on little endian armeabi-v7a builds that enable NEON.
+*/
+#if !defined(CHACHA20_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA20_HAVE_SIMD 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#define CHACHA20_TARGET_SIMD __attribute__((target("sse2")))
+typedef __m128i CCVEC;
+#define CC_LOAD(p)      _mm_loadu_si128((const __m128i*) (p))
+#define CC_STORE(p, v)  _mm_storeu_si128((__m128i*) (p), v)
+#define CC_ADD(a, b)    _mm_add_epi32(a, b)
+#define CC_XOR(a, b)    _mm_xor_si128(a, b)
+#define CC_SET1(w)      _mm_set1_epi32((int) (w))
+#define CC_SET4(a, b, c, d) _mm_set_epi32((int) (d), (int) (c), (int) (b), (int) (a))
+#define CC_ROTL(v, n)   _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32-(n)))
+#define CC_TRANSPOSE(a, b, c, d) \
+  { __m128i t0_ = _mm_unpacklo_epi32(a, b), t1_ = _mm_unpacklo_epi32(c, d); \
+    __m128i t2_ = _mm_unpackhi_epi32(a, b), t3_ = _mm_unpackhi_epi32(c, d); \
+    a = _mm_unpacklo_epi64(t0_, t1_); b = _mm_unpackhi_epi64(t0_, t1_); \
+    c = _mm_unpacklo_epi64(t2_, t3_); d = _mm_unpackhi_epi64(t2_, t3_); }
+#endif
+
+#if !defined(CHACHA20_NO_SIMD) && defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+    defined(__linux__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CHACHA20_HAVE_SIMD 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#if !defined(__aarch64__) && !defined(HWCAP_NEON)
+#define HWCAP_NEON (1 << 12)
+#endif
+#define CHACHA20_TARGET_SIMD
+typedef uint32x4_t CCVEC;
+#define CC_LOAD(p)      vreinterpretq_u32_u8(vld1q_u8(p))
+#define CC_STORE(p, v)  vst1q_u8(p, vreinterpretq_u8_u32(v))
+#define CC_ADD(a, b)    vaddq_u32(a, b)
+#define CC_XOR(a, b)    veorq_u32(a, b)
+#define CC_SET1(w)      vdupq_n_u32(w)
+static __inline uint32x4_t CC_SET4(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+  uint32_t w[4];
+  w[0] = a; w[1] = b; w[2] = c; w[3] = d;
+  return vld1q_u32(w);
+}
+#define CC_ROTL(v, n)   vsriq_n_u32(vshlq_n_u32(v, n), v, 32-(n))
+#define CC_TRANSPOSE(a, b, c, d) \
+  { uint32x4x2_t p_ = vtrnq_u32(a, b), q_ = vtrnq_u32(c, d); \
+    a = vcombine_u32(vget_low_u32(p_.val[0]), vget_low_u32(q_.val[0])); \
+    b = vcombine_u32(vget_low_u32(p_.val[1]), vget_low_u32(q_.val[1])); \
+    c = vcombine_u32(vget_high_u32(p_.val[0]), vget_high_u32(q_.val[0])); \
+    d = vcombine_u32(vget_high_u32(p_.val[1]), vget_high_u32(q_.val[1])); }
+#endif
+
+#define CHACHA20_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA20_QR(a, b, c, d) \
+  a += b; d ^= a; d = CHACHA20_ROTL(d, 16); \
+  c += d; b ^= c; b = CHACHA20_ROTL(b, 12); \
+  a += b; d ^= a; d = CHACHA20_ROTL(d,  8); \
+  c += d; b ^= c; b = CHACHA20_ROTL(b,  7);
+
+static unsigned int ChaCha20Load32(const unsigned char* p)
+{
+  return (unsigned int) p[0] | ((unsigned int) p[1] << 8) |
+         ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static void ChaCha20Setup(unsigned int state[16], const unsigned char* key, int keyLength,
+                          const unsigned char nonce[CHACHA20_NONCE_LENGTH], unsigned int counter)
+{
+  static const unsigned char sigma[16] = "expand 32-byte k";
+  static const unsigned char tau[16]   = "expand 16-byte k";
+  const unsigned char* constants = (keyLength == 32) ? sigma : tau;
+  const unsigned char* key2 = (keyLength == 32) ? key + 16 : key;
+  int j;
+
+  for (j = 0; j < 4; j++)
+  {
+    state[j]    = ChaCha20Load32(constants + 4*j);
+    state[4+j]  = ChaCha20Load32(key + 4*j);
+    state[8+j]  = ChaCha20Load32(key2 + 4*j);
+  }
+  state[12] = counter;
+  state[13] = ChaCha20Load32(nonce);
+  state[14] = ChaCha20Load32(nonce + 4);
+  state[15] = ChaCha20Load32(nonce + 8);
+}
+
+/*
+// Compute one key stream block
+*/
+static void ChaCha20Block(const unsigned int state[16], unsigned char out[64])
+{
+  unsigned int x[16];
+  int j;
+
+  memcpy(x, state, sizeof(x));
+  for (j = 0; j < 10; j++)
+  {
+    CHACHA20_QR(x[0], x[4], x[ 8], x[12])
+    CHACHA20_QR(x[1], x[5], x[ 9], x[13])
+    CHACHA20_QR(x[2], x[6], x[10], x[14])
+    CHACHA20_QR(x[3], x[7], x[11], x[15])
+    CHACHA20_QR(x[0], x[5], x[10], x[15])
+    CHACHA20_QR(x[1], x[6], x[11], x[12])
+    CHACHA20_QR(x[2], x[7], x[ 8], x[13])
+    CHACHA20_QR(x[3], x[4], x[ 9], x[14])
+  }
+  for (j = 0; j < 16; j++)
+  {
+    unsigned int w = x[j] + state[j];
+    out[4*j+0] = (unsigned char) w;
+    out[4*j+1] = (unsigned char) (w >> 8);
+    out[4*j+2] = (unsigned char) (w >> 16);
+    out[4*j+3] = (unsigned char) (w >> 24);
+  }
+}
+
+static void ChaCha20XorScalar(unsigned int state[16], const unsigned char* in, int len, unsigned char* out)
+{
+  unsigned char block[64];
+  int n, j;
+
+  while (len > 0)
+  {
+    ChaCha20Block(state, block);
+    state[12]++;
+    n = (len < 64) ? len : 64;
+    for (j = 0; j < n; j++)
+    {
+      out[j] = in[j] ^ block[j];
+    }
+    in  += n;
+    out += n;
+    len -= n;
+  }
+}
+
+#if CHACHA20_HAVE_SIMD
+
+#define CC_QR(a, b, c, d) \
+  a = CC_ADD(a, b); d = CC_XOR(d, a); d = CC_ROTL(d, 16); \
+  c = CC_ADD(c, d); b = CC_XOR(b, c); b = CC_ROTL(b, 12); \
+  a = CC_ADD(a, b); d = CC_XOR(d, a); d = CC_ROTL(d,  8); \
+  c = CC_ADD(c, d); b = CC_XOR(b, c); b = CC_ROTL(b,  7);
+
+/*
+// Store words 4*g..4*g+3 of the four blocks, XORed with the input
+*/
+#define CC_OUTPUT(g) \
+  CC_TRANSPOSE(x[4*(g)], x[4*(g)+1], x[4*(g)+2], x[4*(g)+3]) \
+  CC_STORE(out +   0 + 16*(g), CC_XOR(x[4*(g)],   CC_LOAD(in +   0 + 16*(g)))); \
+  CC_STORE(out +  64 + 16*(g), CC_XOR(x[4*(g)+1], CC_LOAD(in +  64 + 16*(g)))); \
+  CC_STORE(out + 128 + 16*(g), CC_XOR(x[4*(g)+2], CC_LOAD(in + 128 + 16*(g)))); \
+  CC_STORE(out + 192 + 16*(g), CC_XOR(x[4*(g)+3], CC_LOAD(in + 192 + 16*(g))));
+
+/*
+// Process 256 byte chunks, four blocks at a time; returns the number of
+// bytes done. The rest is left to the scalar code.
+*/
+CHACHA20_TARGET_SIMD
+static int ChaCha20XorSimd(unsigned int state[16], const unsigned char* in, int len, unsigned char* out)
+{
+  CCVEC s[16];
+  CCVEC x[16];
+  int done = 0;
+  int j;
+
+  for (j = 0; j < 16; j++)
+  {
+    s[j] = CC_SET1(state[j]);
+  }
+  while (len - done >= 256)
+  {
+    s[12] = CC_SET4(state[12], state[12] + 1, state[12] + 2, state[12] + 3);
+    for (j = 0; j < 16; j++)
+    {
+      x[j] = s[j];
+    }
+    for (j = 0; j < 10; j++)
+    {
+      CC_QR(x[0], x[4], x[ 8], x[12])
+      CC_QR(x[1], x[5], x[ 9], x[13])
+      CC_QR(x[2], x[6], x[10], x[14])
+      CC_QR(x[3], x[7], x[11], x[15])
+      CC_QR(x[0], x[5], x[10], x[15])
+      CC_QR(x[1], x[6], x[11], x[12])
+      CC_QR(x[2], x[7], x[ 8], x[13])
+      CC_QR(x[3], x[4], x[ 9], x[14])
+    }
+    for (j = 0; j < 16; j++)
+    {
+      x[j] = CC_ADD(x[j], s[j]);
+    }
+    CC_OUTPUT(0)
+    CC_OUTPUT(1)
+    CC_OUTPUT(2)
+    CC_OUTPUT(3)
+    state[12] += 4;
+    in   += 256;
+    out  += 256;
+    done += 256;
+  }
+  return done;
+}
+
+#endif /* CHACHA20_HAVE_SIMD */
+
+static int chacha20Backend = -1;
+
+static int ChaCha20HasBackend(int backend)
+{
+#if CHACHA20_HAVE_SIMD && (defined(__x86_64__) || defined(__i386__))
+  unsigned int eax, ebx, ecx, edx;
+#endif
+  switch (backend)
+  {
+    case CHACHA20_Backend_Scalar:
+      return 1;
+#if CHACHA20_HAVE_SIMD
+    case CHACHA20_Backend_SIMD:
+#if defined(__x86_64__) || defined(__i386__)
+      return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+#elif defined(__aarch64__)
+      return 1;
+#else
+      return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+#endif
+    default:
+      return 0;
+  }
+}
+
+int ChaCha20GetBackend(void)
+{
+  if (chacha20Backend < 0)
+  {
+    if (ChaCha20HasBackend(CHACHA20_Backend_SIMD))
+      chacha20Backend = CHACHA20_Backend_SIMD;
+    else
+      chacha20Backend = CHACHA20_Backend_Scalar;
+  }
+  return chacha20Backend;
+}
+
+int ChaCha20SetBackend(int backend)
+{
+  if (!ChaCha20HasBackend(backend))
+  {
+    return CHACHA20_UNSUPPORTED_BACKEND;
+  }
+  chacha20Backend = backend;
+  return CHACHA20_SUCCESS;
+}
+
+void ChaCha20Xor(const unsigned char* key, int keyLength, const unsigned char nonce[CHACHA20_NONCE_LENGTH],
+                 unsigned int counter, const unsigned char* in, int len, unsigned char* out)
+{
+  unsigned int state[16];
+  int done = 0;
+
+  ChaCha20Setup(state, key, keyLength, nonce, counter);
+#if CHACHA20_HAVE_SIMD
+  if (ChaCha20GetBackend() == CHACHA20_Backend_SIMD)
+  {
+    done = ChaCha20XorSimd(state, in, len, out);
+  }
+#endif
+  ChaCha20XorScalar(state, in + done, len - done, out + done);
+}
@@ -0,0 +1,39 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        chacha20.h
+// Purpose:     ChaCha20 stream cipher (RFC 7539)
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file chacha20.h Interface of the ChaCha20 stream cipher
+*/
+
+#ifndef _CHACHA20_H_
+#define _CHACHA20_H_
+
+#define CHACHA20_NONCE_LENGTH 12
+
+#define CHACHA20_SUCCESS              0
+#define CHACHA20_UNSUPPORTED_BACKEND -1
+
+#define CHACHA20_Backend_Scalar 0
+#define CHACHA20_Backend_SIMD   1
+
+/*
+// XOR len bytes of the key stream for key and nonce into in, starting with
+// block number counter, and store the result in out (in and out may be the
+// same buffer). keyLength is 32 or 16 bytes; 16 byte keys use the original
+// "expand 16-byte k" constants. The block counter must not wrap.
+*/
+void ChaCha20Xor(const unsigned char* key, int keyLength, const unsigned char nonce[CHACHA20_NONCE_LENGTH],
+                 unsigned int counter, const unsigned char* in, int len, unsigned char* out);
+
+/*
+// Backend used by ChaCha20Xor. On first use the vectorized core (SSE2 on
+// x86, NEON on ARM) is selected if the CPU has it, the portable code
+// otherwise. ChaCha20SetBackend forces a backend (e.g. for benchmarks) and
+// returns CHACHA20_UNSUPPORTED_BACKEND if the CPU lacks it.
+*/
+int ChaCha20GetBackend(void);
+int ChaCha20SetBackend(int backend);
+
+#endif /* _CHACHA20_H_ */
@@ -39,10 +39,8 @@
 
 #include "codec.h"
 
-#if CODEC_TYPE == CODEC_TYPE_AES256
 #include "sha2.h"
 #include "sha2.c"
-#endif
 
 /*
 // ----------------
@@ -56,6 +54,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if CODEC_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #define MD5_HASHBYTES 16
 
 /*
@@ -343,6 +346,250 @@ static void MD5Transform(unsigned int buf[4], unsigned int in[16])
   buf[2] += c;
   buf[3] += d;
 }
+
+/*
+// Four lane MD5: one message per 32 bit lane of the SSE2 resp. NEON
+// registers, for deriving several page keys at once. The steps are the
+// ones of MD5Transform.
+*/
+#if !defined(CODEC_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CODEC_HAVE_SIMD 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#define CODEC_TARGET_SIMD __attribute__((target("sse2")))
+typedef __m128i MDVEC;
+#define MD_STORE(p, v)  _mm_storeu_si128((__m128i*) (p), v)
+#define MD_ADD(a, b)    _mm_add_epi32(a, b)
+#define MD_XOR(a, b)    _mm_xor_si128(a, b)
+#define MD_AND(a, b)    _mm_and_si128(a, b)
+#define MD_OR(a, b)     _mm_or_si128(a, b)
+#define MD_SET1(w)      _mm_set1_epi32((int) (w))
+#define MD_LOAD(p)      _mm_loadu_si128((const __m128i*) (p))
+#define MD_TRANSPOSE(a, b, c, d) \
+  { __m128i t0_ = _mm_unpacklo_epi32(a, b), t1_ = _mm_unpacklo_epi32(c, d); \
+    __m128i t2_ = _mm_unpackhi_epi32(a, b), t3_ = _mm_unpackhi_epi32(c, d); \
+    a = _mm_unpacklo_epi64(t0_, t1_); b = _mm_unpackhi_epi64(t0_, t1_); \
+    c = _mm_unpacklo_epi64(t2_, t3_); d = _mm_unpackhi_epi64(t2_, t3_); }
+#define MD_ROTL(v, n)   _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32-(n)))
+#endif
+
+#if !defined(CODEC_NO_SIMD) && defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+    defined(__linux__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CODEC_HAVE_SIMD 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#if !defined(__aarch64__) && !defined(HWCAP_NEON)
+#define HWCAP_NEON (1 << 12)
+#endif
+#define CODEC_TARGET_SIMD
+typedef uint32x4_t MDVEC;
+#define MD_STORE(p, v)  vst1q_u8(p, vreinterpretq_u8_u32(v))
+#define MD_ADD(a, b)    vaddq_u32(a, b)
+#define MD_XOR(a, b)    veorq_u32(a, b)
+#define MD_AND(a, b)    vandq_u32(a, b)
+#define MD_OR(a, b)     vorrq_u32(a, b)
+#define MD_SET1(w)      vdupq_n_u32(w)
+#define MD_LOAD(p)      vreinterpretq_u32_u8(vld1q_u8(p))
+#define MD_TRANSPOSE(a, b, c, d) \
+  { uint32x4x2_t p_ = vtrnq_u32(a, b), q_ = vtrnq_u32(c, d); \
+    a = vcombine_u32(vget_low_u32(p_.val[0]), vget_low_u32(q_.val[0])); \
+    b = vcombine_u32(vget_low_u32(p_.val[1]), vget_low_u32(q_.val[1])); \
+    c = vcombine_u32(vget_high_u32(p_.val[0]), vget_high_u32(q_.val[0])); \
+    d = vcombine_u32(vget_high_u32(p_.val[1]), vget_high_u32(q_.val[1])); }
+#define MD_ROTL(v, n)   vsliq_n_u32(vshrq_n_u32(v, 32-(n)), v, n)
+#endif
+
+#if CODEC_HAVE_SIMD
+
+#define MF1(x, y, z) MD_XOR(z, MD_AND(x, MD_XOR(y, z)))
+#define MF2(x, y, z) MF1(z, x, y)
+#define MF3(x, y, z) MD_XOR(MD_XOR(x, y), z)
+#define MF4(x, y, z) MD_XOR(y, MD_OR(x, MD_XOR(z, ones)))
+
+#define MD5STEP4(f, w, x, y, z, data, k, s) \
+        ( w = MD_ADD(MD_ADD(w, f(x, y, z)), MD_ADD(data, MD_SET1(k))), w = MD_ADD(MD_ROTL(w, s), x) )
+
+/*
+// One block of each of the four lanes. buf[j] holds word j of the state
+// of all four messages.
+*/
+static CODEC_TARGET_SIMD void MD5Transform4(MDVEC buf[4], const unsigned char* block[CODEC_HASH_LANES])
+{
+  MDVEC in[16];
+  MDVEC a, b, c, d;
+  MDVEC ones = MD_SET1(0xffffffff);
+  int j;
+
+  /* Both backends are little endian, so the words are loaded as they are */
+  for (j = 0; j < 16; j += 4)
+  {
+    in[j]   = MD_LOAD(block[0] + 4*j);
+    in[j+1] = MD_LOAD(block[1] + 4*j);
+    in[j+2] = MD_LOAD(block[2] + 4*j);
+    in[j+3] = MD_LOAD(block[3] + 4*j);
+    MD_TRANSPOSE(in[j], in[j+1], in[j+2], in[j+3]);
+  }
+  a = buf[0];
+  b = buf[1];
+  c = buf[2];
+  d = buf[3];
+
+  MD5STEP4(MF1, a, b, c, d, in[0], 0xd76aa478, 7);
+  MD5STEP4(MF1, d, a, b, c, in[1], 0xe8c7b756, 12);
+  MD5STEP4(MF1, c, d, a, b, in[2], 0x242070db, 17);
+  MD5STEP4(MF1, b, c, d, a, in[3], 0xc1bdceee, 22);
+  MD5STEP4(MF1, a, b, c, d, in[4], 0xf57c0faf, 7);
+  MD5STEP4(MF1, d, a, b, c, in[5], 0x4787c62a, 12);
+  MD5STEP4(MF1, c, d, a, b, in[6], 0xa8304613, 17);
+  MD5STEP4(MF1, b, c, d, a, in[7], 0xfd469501, 22);
+  MD5STEP4(MF1, a, b, c, d, in[8], 0x698098d8, 7);
+  MD5STEP4(MF1, d, a, b, c, in[9], 0x8b44f7af, 12);
+  MD5STEP4(MF1, c, d, a, b, in[10], 0xffff5bb1, 17);
+  MD5STEP4(MF1, b, c, d, a, in[11], 0x895cd7be, 22);
+  MD5STEP4(MF1, a, b, c, d, in[12], 0x6b901122, 7);
+  MD5STEP4(MF1, d, a, b, c, in[13], 0xfd987193, 12);
+  MD5STEP4(MF1, c, d, a, b, in[14], 0xa679438e, 17);
+  MD5STEP4(MF1, b, c, d, a, in[15], 0x49b40821, 22);
+
+  MD5STEP4(MF2, a, b, c, d, in[1], 0xf61e2562, 5);
+  MD5STEP4(MF2, d, a, b, c, in[6], 0xc040b340, 9);
+  MD5STEP4(MF2, c, d, a, b, in[11], 0x265e5a51, 14);
+  MD5STEP4(MF2, b, c, d, a, in[0], 0xe9b6c7aa, 20);
+  MD5STEP4(MF2, a, b, c, d, in[5], 0xd62f105d, 5);
+  MD5STEP4(MF2, d, a, b, c, in[10], 0x02441453, 9);
+  MD5STEP4(MF2, c, d, a, b, in[15], 0xd8a1e681, 14);
+  MD5STEP4(MF2, b, c, d, a, in[4], 0xe7d3fbc8, 20);
+  MD5STEP4(MF2, a, b, c, d, in[9], 0x21e1cde6, 5);
+  MD5STEP4(MF2, d, a, b, c, in[14], 0xc33707d6, 9);
+  MD5STEP4(MF2, c, d, a, b, in[3], 0xf4d50d87, 14);
+  MD5STEP4(MF2, b, c, d, a, in[8], 0x455a14ed, 20);
+  MD5STEP4(MF2, a, b, c, d, in[13], 0xa9e3e905, 5);
+  MD5STEP4(MF2, d, a, b, c, in[2], 0xfcefa3f8, 9);
+  MD5STEP4(MF2, c, d, a, b, in[7], 0x676f02d9, 14);
+  MD5STEP4(MF2, b, c, d, a, in[12], 0x8d2a4c8a, 20);
+
+  MD5STEP4(MF3, a, b, c, d, in[5], 0xfffa3942, 4);
+  MD5STEP4(MF3, d, a, b, c, in[8], 0x8771f681, 11);
+  MD5STEP4(MF3, c, d, a, b, in[11], 0x6d9d6122, 16);
+  MD5STEP4(MF3, b, c, d, a, in[14], 0xfde5380c, 23);
+  MD5STEP4(MF3, a, b, c, d, in[1], 0xa4beea44, 4);
+  MD5STEP4(MF3, d, a, b, c, in[4], 0x4bdecfa9, 11);
+  MD5STEP4(MF3, c, d, a, b, in[7], 0xf6bb4b60, 16);
+  MD5STEP4(MF3, b, c, d, a, in[10], 0xbebfbc70, 23);
+  MD5STEP4(MF3, a, b, c, d, in[13], 0x289b7ec6, 4);
+  MD5STEP4(MF3, d, a, b, c, in[0], 0xeaa127fa, 11);
+  MD5STEP4(MF3, c, d, a, b, in[3], 0xd4ef3085, 16);
+  MD5STEP4(MF3, b, c, d, a, in[6], 0x04881d05, 23);
+  MD5STEP4(MF3, a, b, c, d, in[9], 0xd9d4d039, 4);
+  MD5STEP4(MF3, d, a, b, c, in[12], 0xe6db99e5, 11);
+  MD5STEP4(MF3, c, d, a, b, in[15], 0x1fa27cf8, 16);
+  MD5STEP4(MF3, b, c, d, a, in[2], 0xc4ac5665, 23);
+
+  MD5STEP4(MF4, a, b, c, d, in[0], 0xf4292244, 6);
+  MD5STEP4(MF4, d, a, b, c, in[7], 0x432aff97, 10);
+  MD5STEP4(MF4, c, d, a, b, in[14], 0xab9423a7, 15);
+  MD5STEP4(MF4, b, c, d, a, in[5], 0xfc93a039, 21);
+  MD5STEP4(MF4, a, b, c, d, in[12], 0x655b59c3, 6);
+  MD5STEP4(MF4, d, a, b, c, in[3], 0x8f0ccc92, 10);
+  MD5STEP4(MF4, c, d, a, b, in[10], 0xffeff47d, 15);
+  MD5STEP4(MF4, b, c, d, a, in[1], 0x85845dd1, 21);
+  MD5STEP4(MF4, a, b, c, d, in[8], 0x6fa87e4f, 6);
+  MD5STEP4(MF4, d, a, b, c, in[15], 0xfe2ce6e0, 10);
+  MD5STEP4(MF4, c, d, a, b, in[6], 0xa3014314, 15);
+  MD5STEP4(MF4, b, c, d, a, in[13], 0x4e0811a1, 21);
+  MD5STEP4(MF4, a, b, c, d, in[4], 0xf7537e82, 6);
+  MD5STEP4(MF4, d, a, b, c, in[11], 0xbd3af235, 10);
+  MD5STEP4(MF4, c, d, a, b, in[2], 0x2ad7d2bb, 15);
+  MD5STEP4(MF4, b, c, d, a, in[9], 0xeb86d391, 21);
+
+  buf[0] = MD_ADD(buf[0], a);
+  buf[1] = MD_ADD(buf[1], b);
+  buf[2] = MD_ADD(buf[2], c);
+  buf[3] = MD_ADD(buf[3], d);
+}
+
+/*
+// MD5 of four messages of the same length: the full blocks are read in
+// place, the final one or two blocks are padded as MD5Final does in a
+// buffer per lane
+*/
+static CODEC_TARGET_SIMD void MD5Hash4(unsigned char* data[CODEC_HASH_LANES], int length,
+                                       unsigned char* digest[CODEC_HASH_LANES])
+{
+  MDVEC buf[4];
+  unsigned char tail[CODEC_HASH_LANES][128];
+  const unsigned char* block[CODEC_HASH_LANES];
+  unsigned int bits = (unsigned int) length << 3;
+  int offset, rest, tailLen;
+  int j, k;
+
+  buf[0] = MD_SET1(0x67452301);
+  buf[1] = MD_SET1(0xefcdab89);
+  buf[2] = MD_SET1(0x98badcfe);
+  buf[3] = MD_SET1(0x10325476);
+  for (offset = 0; length - offset >= 64; offset += 64)
+  {
+    for (k = 0; k < CODEC_HASH_LANES; k++)
+    {
+      block[k] = data[k] + offset;
+    }
+    MD5Transform4(buf, block);
+  }
+
+  rest = length - offset;
+  tailLen = (rest < 56) ? 64 : 128;
+  for (k = 0; k < CODEC_HASH_LANES; k++)
+  {
+    memcpy(tail[k], data[k] + offset, rest);
+    tail[k][rest] = 0x80;
+    memset(tail[k] + rest + 1, 0, tailLen - rest - 1);
+    for (j = 0; j < 4; j++)
+    {
+      tail[k][tailLen-8+j] = 0xff & (bits >> (8*j));
+      tail[k][tailLen-4+j] = 0xff & (((unsigned int) length >> 29) >> (8*j));
+    }
+    block[k] = tail[k];
+  }
+  MD5Transform4(buf, block);
+  if (tailLen > 64)
+  {
+    for (k = 0; k < CODEC_HASH_LANES; k++)
+    {
+      block[k] = tail[k] + 64;
+    }
+    MD5Transform4(buf, block);
+  }
+
+  /* Lane k of the transposed state is the digest of message k */
+  MD_TRANSPOSE(buf[0], buf[1], buf[2], buf[3]);
+  for (k = 0; k < CODEC_HASH_LANES; k++)
+  {
+    MD_STORE(digest[k], buf[k]);
+  }
+}
+
+static int codecHasSIMD = -1;
+
+static int
+CodecHasSIMD(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+#endif
+  if (codecHasSIMD < 0)
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    codecHasSIMD = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+#elif defined(__aarch64__)
+    codecHasSIMD = 1;
+#else
+    codecHasSIMD = (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+  }
+  return codecHasSIMD;
+}
+
+#endif /* CODEC_HAVE_SIMD */
  
 /*
 // ---------------------------
@@ -402,20 +649,51 @@ CodecGetMD5Binary(Codec* codec, unsigned char* data, int length, unsigned char*
   MD5Final(digest,&ctx);
 }
 
-#if CODEC_TYPE == CODEC_TYPE_AES256
 void
 CodecGetSHABinary(Codec* codec, unsigned char* data, int length, unsigned char* digest)
 {
   sha256(data, (unsigned int) length, digest);
 }
+
+/*
+// MD5 of CODEC_HASH_LANES messages of the same length
+*/
+void
+CodecGetMD5Binary4(Codec* codec, unsigned char* data[CODEC_HASH_LANES], int length,
+                   unsigned char* digest[CODEC_HASH_LANES])
+{
+  int k;
+#if CODEC_HAVE_SIMD
+  if (CodecHasSIMD())
+  {
+    MD5Hash4(data, length, digest);
+    return;
+  }
 #endif
+  for (k = 0; k < CODEC_HASH_LANES; k++)
+  {
+    CodecGetMD5Binary(codec, data[k], length, digest[k]);
+  }
+}
+
+/*
+// SHA-256 of CODEC_HASH_LANES messages of the same length
+*/
+void
+CodecGetSHABinary4(Codec* codec, unsigned char* data[CODEC_HASH_LANES], int length,
+                   unsigned char* digest[CODEC_HASH_LANES])
+{
+  sha256_x4((const unsigned char**) data, (unsigned int) length, digest);
+}
 
 #define MODMULT(a, b, c, m, s) q = s / a; s = b * (s - a * q) - c * q; if (s < 0) s += m
 
-void
-CodecGenerateInitialVector(Codec* codec, int seed, unsigned char iv[16])
+/*
+// Input of the initial vector hash of a page
+*/
+static void
+CodecInitialVectorSeed(int seed, unsigned char initkey[16])
 {
-  unsigned char initkey[16];
   int j, q;
   int z = seed + 1;
   for (j = 0; j < 4; j++)
@@ -426,21 +704,26 @@ CodecGenerateInitialVector(Codec* codec, int seed, unsigned char iv[16])
     initkey[4*j+2] = 0xff & (z >> 16);
     initkey[4*j+3] = 0xff & (z >> 24);
   }
-  CodecGetMD5Binary(codec, (unsigned char*) initkey, 16, iv);
 }
 
 void
-CodecAES(Codec* codec, int page, int encrypt, unsigned char encryptionKey[KEYLENGTH],
-         unsigned char* datain, int datalen, unsigned char* dataout)
+CodecGenerateInitialVector(Codec* codec, int seed, unsigned char iv[16])
 {
-  unsigned char initial[16];
-  unsigned char pagekey[KEYLENGTH];
-  unsigned char nkey[KEYLENGTH+4+4];
-  int keyLength = KEYLENGTH;
-  int nkeylen = keyLength + 4 + 4;
+  unsigned char initkey[16];
+  CodecInitialVectorSeed(seed, initkey);
+  CodecGetMD5Binary(codec, (unsigned char*) initkey, 16, iv);
+}
+
+/*
+// Input of the page key hash: the database key, the page number and a
+// salt. Returns its length.
+*/
+static int
+CodecPageKeyInput(const CodecCipher* cipher, int page, unsigned char encryptionKey[KEYLENGTH],
+                  unsigned char nkey[KEYLENGTH+4+4])
+{
+  int keyLength = cipher->m_keyLength;
   int j;
-  int direction = (encrypt) ? RIJNDAEL_Direction_Encrypt : RIJNDAEL_Direction_Decrypt;
-  int len = 0;
 
   for (j = 0; j < keyLength; j++)
   {
@@ -457,259 +740,1987 @@ CodecAES(Codec* codec, int page, int encrypt, unsigned char encryptionKey[KEYLEN
   nkey[keyLength+6] = 0x6c;
   nkey[keyLength+7] = 0x54;
 
-#if CODEC_TYPE == CODEC_TYPE_AES256
-  CodecGetSHABinary(codec, nkey, nkeylen, pagekey);
-#else
-  CodecGetMD5Binary(codec, nkey, nkeylen, pagekey);
-#endif  
-  CodecGenerateInitialVector(codec, page, initial);
-
-#if CODEC_TYPE == CODEC_TYPE_AES256
-  RijndaelInit(codec->m_aes, RIJNDAEL_Direction_Mode_CBC, direction, pagekey, RIJNDAEL_Direction_KeyLength_Key32Bytes, initial);
-#else
-  RijndaelInit(codec->m_aes, RIJNDAEL_Direction_Mode_CBC, direction, pagekey, RIJNDAEL_Direction_KeyLength_Key16Bytes, initial);
-#endif  
-  if (encrypt)
-  {
-    len = RijndaelBlockEncrypt(codec->m_aes, datain, datalen*8, dataout);
-  }
-  else
-  {
-    len = RijndaelBlockDecrypt(codec->m_aes, datain, datalen*8, dataout);
-  }
-  
-  /* It is a good idea to check the error code */
-  if (len < 0)
-  {
-    /* AES: Error on encrypting. */
-  }
+  return keyLength + 4 + 4;
 }
 
-static unsigned char padding[] =
-  "\x28\xBF\x4E\x5E\x4E\x75\x8A\x41\x64\x00\x4E\x56\xFF\xFA\x01\x08\x2E\x2E\x00\xB6\xD0\x68\x3E\x80\x2F\x0C\xA9\xFE\x64\x53\x69\x7A";
-
-void
-CodecInit(Codec* codec)
+/*
+// Derive the key of a page from the database key
+*/
+static void
+CodecDerivePageKey(Codec* codec, const CodecCipher* cipher, int page, unsigned char encryptionKey[KEYLENGTH],
+                   unsigned char pagekey[KEYLENGTH])
 {
-  codec->m_isEncrypted = 0;
-  codec->m_hasReadKey  = 0;
-  codec->m_hasWriteKey = 0;
-  codec->m_aes = (Rijndael*) sqlite3_malloc(sizeof(Rijndael));
-  RijndaelCreate(codec->m_aes);
-}
+  unsigned char nkey[KEYLENGTH+4+4];
+  int nkeylen = CodecPageKeyInput(cipher, page, encryptionKey, nkey);
 
-void
-CodecTerm(Codec* codec)
-{
-  sqlite3_free(codec->m_aes);
+  cipher->m_hash(codec, nkey, nkeylen, pagekey);
 }
 
-void
-CodecSetIsEncrypted(Codec* codec, int isEncrypted)
+/*
+// Set up the cipher for a page from its page key and initial vector
+*/
+static void
+CodecInitPageCipher(const CodecCipher* cipher, int format, int direction,
+                    unsigned char pagekey[KEYLENGTH], unsigned char initial[16], Rijndael* aes)
 {
-  codec->m_isEncrypted = isEncrypted;
-}
+  int mode = (format == CODEC_FORMAT_XEX) ? RIJNDAEL_Direction_Mode_XEX : RIJNDAEL_Direction_Mode_CBC;
 
-void
-CodecSetHasReadKey(Codec* codec, int hasReadKey)
-{
-  codec->m_hasReadKey = hasReadKey;
+  RijndaelInit(aes, mode, direction, pagekey,
+               (cipher->m_keyLength == 32) ? RIJNDAEL_Direction_KeyLength_Key32Bytes
+                                           : RIJNDAEL_Direction_KeyLength_Key16Bytes, initial);
 }
 
-void
-CodecSetHasWriteKey(Codec* codec, int hasWriteKey)
+static void
+CodecSetupPageCipher(Codec* codec, const CodecCipher* cipher, int format, int page, int direction,
+                     unsigned char pagekey[KEYLENGTH], Rijndael* aes)
 {
-  codec->m_hasWriteKey = hasWriteKey;
-}
+  unsigned char initial[16];
 
-void
-CodecSetBtree(Codec* codec, Btree* bt)
-{
-  codec->m_bt = bt;
+  CodecGenerateInitialVector(codec, page, initial);
+  CodecInitPageCipher(cipher, format, direction, pagekey, initial, aes);
 }
 
-int
-CodecIsEncrypted(Codec* codec)
+/*
+// Count bytes allocated (bytes > 0) or freed (bytes < 0) for a codec;
+// buffer marks page buffers, which are reported separately as well.
+*/
+static void
+CodecAccount(Codec* codec, int bytes, int buffer)
 {
-  return codec->m_isEncrypted;
+  codec->m_memoryUsed += bytes;
+  if (codec->m_memoryUsed > codec->m_memoryHighwater)
+  {
+    codec->m_memoryHighwater = codec->m_memoryUsed;
+  }
+  if (buffer)
+  {
+    codec->m_bufferUsed += bytes;
+    if (codec->m_bufferUsed > codec->m_bufferHighwater)
+    {
+      codec->m_bufferHighwater = codec->m_bufferUsed;
+    }
+  }
 }
 
-int
-CodecHasReadKey(Codec* codec)
+#if CODEC_KEYCACHE_SIZE > 0
+/*
+// Allocate the key cache on first use. Returns NULL if it could not be allocated.
+*/
+static CodecPageKey*
+CodecGetKeyCache(Codec* codec)
 {
-  return codec->m_hasReadKey;
+  if (codec->m_keyCache == NULL)
+  {
+    codec->m_keyCache = (CodecPageKey*) sqlite3_malloc(CODEC_KEYCACHE_SIZE * sizeof(CodecPageKey));
+    if (codec->m_keyCache != NULL)
+    {
+      memset(codec->m_keyCache, 0, CODEC_KEYCACHE_SIZE * sizeof(CodecPageKey));
+      CodecAccount(codec, CODEC_KEYCACHE_SIZE * sizeof(CodecPageKey), 0);
+    }
+  }
+  return codec->m_keyCache;
 }
 
-int
-CodecHasWriteKey(Codec* codec)
+/*
+// Nonzero if the key cache entry holds the key of the page
+*/
+static int
+CodecPageKeyMatches(CodecPageKey* entry, const CodecCipher* cipher, int format, int page,
+                    unsigned char encryptionKey[KEYLENGTH])
 {
-  return codec->m_hasWriteKey;
+  return entry->m_page == page && entry->m_cipher == cipher && entry->m_format == format &&
+         memcmp(entry->m_key, encryptionKey, cipher->m_keyLength) == 0;
 }
+#endif
 
-Btree*
-CodecGetBtree(Codec* codec)
+/*
+// Look up the key cache entry of a page, deriving the page key (and for
+// the AES formats the encryption schedule) on a miss.
+// Returns NULL if the cache is disabled or could not be allocated.
+*/
+static CodecPageKey*
+CodecGetPageKey(Codec* codec, const CodecCipher* cipher, int format, int page,
+                unsigned char encryptionKey[KEYLENGTH])
 {
-  return codec->m_bt;
-}
+#if CODEC_KEYCACHE_SIZE > 0
+  CodecPageKey* entry;
 
-unsigned char*
-CodecGetPageBuffer(Codec* codec)
-{
-  return &codec->m_page[4];
+  if (CodecGetKeyCache(codec) != NULL)
+  {
+    entry = &codec->m_keyCache[page & (CODEC_KEYCACHE_SIZE-1)];
+    if (!CodecPageKeyMatches(entry, cipher, format, page, encryptionKey))
+    {
+      codec->m_keyCacheMisses++;
+      CodecDerivePageKey(codec, cipher, page, encryptionKey, entry->m_pageKey);
+      if (format != CODEC_FORMAT_CHACHA20)
+      {
+        CodecSetupPageCipher(codec, cipher, format, page, RIJNDAEL_Direction_Encrypt,
+                             entry->m_pageKey, &entry->m_encrypt);
+      }
+      memcpy(entry->m_key, encryptionKey, cipher->m_keyLength);
+      entry->m_cipher = cipher;
+      entry->m_format = format;
+      entry->m_page = page;
+      entry->m_hasDecrypt = 0;
+    }
+    else
+    {
+      codec->m_keyCacheHits++;
+    }
+    return entry;
+  }
+#endif
+  return NULL;
 }
 
-void
-CodecCopy(Codec* codec, Codec* other)
+/*
+// Get the cipher for a page, either from the key cache or freshly derived
+*/
+static Rijndael*
+CodecGetPageCipher(Codec* codec, const CodecCipher* cipher, int format, int page, int encrypt,
+                   unsigned char encryptionKey[KEYLENGTH])
 {
-  int j;
-  codec->m_isEncrypted = other->m_isEncrypted;
-  codec->m_hasReadKey  = other->m_hasReadKey;
-  codec->m_hasWriteKey = other->m_hasWriteKey;
-  for (j = 0; j < KEYLENGTH; j++)
+  unsigned char pagekey[KEYLENGTH];
+  CodecPageKey* entry = CodecGetPageKey(codec, cipher, format, page, encryptionKey);
+
+  if (entry != NULL)
   {
-    codec->m_readKey[j]  = other->m_readKey[j];
-    codec->m_writeKey[j] = other->m_writeKey[j];
+    if (encrypt)
+    {
+      return &entry->m_encrypt;
+    }
+    if (!entry->m_hasDecrypt)
+    {
+      /* The decryption schedule is the inverted encryption schedule */
+      entry->m_decrypt = entry->m_encrypt;
+      entry->m_decrypt.m_direction = RIJNDAEL_Direction_Decrypt;
+      RijndaelKeyEncToDec(&entry->m_decrypt);
+      entry->m_hasDecrypt = 1;
+    }
+    return &entry->m_decrypt;
   }
-  codec->m_bt = other->m_bt;
-  RijndaelInvalidate(codec->m_aes);
+  codec->m_keyCacheMisses++;
+  CodecDerivePageKey(codec, cipher, page, encryptionKey, pagekey);
+  CodecSetupPageCipher(codec, cipher, format, page,
+                       (encrypt) ? RIJNDAEL_Direction_Encrypt : RIJNDAEL_Direction_Decrypt,
+                       pagekey, codec->m_aes);
+  return codec->m_aes;
 }
 
-void
-CodecCopyKey(Codec* codec, int read2write)
+#if CODEC_KEYCACHE_SIZE > 0
+/*
+// Fill the key cache entries of CODEC_HASH_LANES pages with one call of
+// the multi-buffer hash for the page keys and, for the AES formats, one
+// for the initial vectors
+*/
+static void
+CodecPreparePageKeys(Codec* codec, const CodecCipher* cipher, int format, unsigned char encryptionKey[KEYLENGTH],
+                     int pages[CODEC_HASH_LANES])
 {
-  int j;
-  if (read2write)
+  unsigned char nkey[CODEC_HASH_LANES][KEYLENGTH+4+4];
+  unsigned char seed[CODEC_HASH_LANES][16];
+  unsigned char iv[CODEC_HASH_LANES][16];
+  unsigned char* in[CODEC_HASH_LANES];
+  unsigned char* out[CODEC_HASH_LANES];
+  CodecPageKey* entry[CODEC_HASH_LANES];
+  int nkeylen = 0;
+  int k;
+
+  for (k = 0; k < CODEC_HASH_LANES; k++)
   {
-    for (j = 0; j < KEYLENGTH; j++)
+    entry[k] = &codec->m_keyCache[pages[k] & (CODEC_KEYCACHE_SIZE-1)];
+    nkeylen = CodecPageKeyInput(cipher, pages[k], encryptionKey, nkey[k]);
+    in[k] = nkey[k];
+    out[k] = entry[k]->m_pageKey;
+  }
+  cipher->m_hash4(codec, in, nkeylen, out);
+
+  if (format != CODEC_FORMAT_CHACHA20)
+  {
+    for (k = 0; k < CODEC_HASH_LANES; k++)
     {
-      codec->m_writeKey[j] = codec->m_readKey[j];
+      CodecInitialVectorSeed(pages[k], seed[k]);
+      in[k] = seed[k];
+      out[k] = iv[k];
     }
+    CodecGetMD5Binary4(codec, in, 16, out);
   }
-  else
+
+  for (k = 0; k < CODEC_HASH_LANES; k++)
   {
-    for (j = 0; j < KEYLENGTH; j++)
+    if (format != CODEC_FORMAT_CHACHA20)
     {
-      codec->m_readKey[j] = codec->m_writeKey[j];
+      CodecInitPageCipher(cipher, format, RIJNDAEL_Direction_Encrypt, entry[k]->m_pageKey, iv[k],
+                          &entry[k]->m_encrypt);
     }
+    memcpy(entry[k]->m_key, encryptionKey, cipher->m_keyLength);
+    entry[k]->m_cipher = cipher;
+    entry[k]->m_format = format;
+    entry[k]->m_page = pages[k];
+    entry[k]->m_hasDecrypt = 0;
   }
+  codec->m_keyCacheMisses += CODEC_HASH_LANES;
+  memset(nkey, 0, sizeof(nkey));
 }
+#endif
 
+/*
+// Derive the keys of pages page..page+nPages-1 into the key cache ahead
+// of processing them, CODEC_HASH_LANES pages per hash call. Pages whose
+// keys are cached are skipped; a remainder of less than CODEC_HASH_LANES
+// pages is left to be derived on demand. Only the formats with per-page
+// keys (CBC, XEX, ChaCha20 and LZ4) have anything to prepare.
+*/
 void
-CodecPadPassword(Codec* codec, char* password, int pswdlen, unsigned char pswd[32])
+CodecPrepareKeys(Codec* codec, int page, int nPages, int useWriteKey)
 {
+#if CODEC_KEYCACHE_SIZE > 0
+  unsigned char* key = (useWriteKey) ? codec->m_writeKey : codec->m_readKey;
+  const CodecCipher* cipher = (useWriteKey) ? codec->m_writeCipher : codec->m_readCipher;
+  int format = (useWriteKey) ? codec->m_writeFormat : codec->m_format;
+  int pages[CODEC_HASH_LANES];
+  int nLanes = 0;
   int j;
-  int p = 0;
-  int m = pswdlen;
-  if (m > 32) m = 32;
 
-  for (j = 0; j < m; j++)
+  if (format == CODEC_FORMAT_LZ4)
   {
-    pswd[p++] = (unsigned char) password[j];
+    /* Same page keys as ChaCha20 */
+    format = CODEC_FORMAT_CHACHA20;
   }
-  for (j = 0; p < 32 && j < 32; j++)
+  if (cipher == NULL || (format != CODEC_FORMAT_CBC && format != CODEC_FORMAT_XEX &&
+                         format != CODEC_FORMAT_CHACHA20))
   {
-    pswd[p++] = padding[j];
+    return;
+  }
+  if (nPages > CODEC_KEYCACHE_SIZE)
+  {
+    /* More pages would evict each other */
+    nPages = CODEC_KEYCACHE_SIZE;
+  }
+  if (nPages < CODEC_HASH_LANES || CodecGetKeyCache(codec) == NULL)
+  {
+    return;
+  }
+  for (j = page; j < page + nPages; j++)
+  {
+    if (j > 0 && !CodecPageKeyMatches(&codec->m_keyCache[j & (CODEC_KEYCACHE_SIZE-1)], cipher, format, j, key))
+    {
+      pages[nLanes++] = j;
+      if (nLanes == CODEC_HASH_LANES)
+      {
+        CodecPreparePageKeys(codec, cipher, format, key, pages);
+        nLanes = 0;
+      }
+    }
   }
+#endif
 }
 
 void
-CodecGenerateReadKey(Codec* codec, char* userPassword, int passwordLength)
+CodecAES(Codec* codec, const CodecCipher* cipher, int format, int page, int encrypt,
+         unsigned char encryptionKey[KEYLENGTH],
+         unsigned char* datain, int datalen, unsigned char* dataout)
 {
-  CodecGenerateEncryptionKey(codec, userPassword, passwordLength, codec->m_readKey);
-}
+  Rijndael* aes = CodecGetPageCipher(codec, cipher, format, page, encrypt, encryptionKey);
+  int len = 0;
 
-void
-CodecGenerateWriteKey(Codec* codec, char* userPassword, int passwordLength)
+  if (encrypt)
+  {
+    len = RijndaelBlockEncrypt(aes, datain, datalen*8, dataout);
+  }
+  else
+  {
+    len = RijndaelBlockDecrypt(aes, datain, datalen*8, dataout);
+  }
+  
+  /* It is a good idea to check the error code */
+  if (len < 0)
+  {
+    /* AES: Error on encrypting. */
+  }
+}
+
+/*
+// Page key of the ChaCha20 and LZ4 formats, from the key cache or derived
+// into pagekey
+*/
+static unsigned char*
+CodecGetStreamKey(Codec* codec, const CodecCipher* cipher, int page, unsigned char encryptionKey[KEYLENGTH],
+                  unsigned char pagekey[KEYLENGTH])
+{
+  CodecPageKey* entry = CodecGetPageKey(codec, cipher, CODEC_FORMAT_CHACHA20, page, encryptionKey);
+  if (entry != NULL)
+  {
+    return entry->m_pageKey;
+  }
+  codec->m_keyCacheMisses++;
+  CodecDerivePageKey(codec, cipher, page, encryptionKey, pagekey);
+  return pagekey;
+}
+
+/*
+// ChaCha20 page format: the last CODEC_CHACHA20_NONCE bytes of a page (the
+// reserved area) hold a random nonce that is renewed on every write, the
+// rest of the page is XORed with the key stream of the page key.
+// Like the other formats below it encrypts datain into dataout, which may
+// be the same buffer, and decrypts in place.
+*/
+void
+CodecChaCha20(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+              unsigned char encryptionKey[KEYLENGTH],
+              unsigned char* datain, int datalen, unsigned char* dataout)
+{
+  unsigned char pagekey[KEYLENGTH];
+  unsigned char* key;
+  unsigned char* nonce = dataout + datalen - CODEC_CHACHA20_NONCE;
+
+  if (datalen <= CODEC_CHACHA20_NONCE)
+  {
+    return;
+  }
+  key = CodecGetStreamKey(codec, cipher, page, encryptionKey, pagekey);
+  if (encrypt)
+  {
+    sqlite3_randomness(CODEC_CHACHA20_NONCE, nonce);
+  }
+  ChaCha20Xor(key, cipher->m_keyLength, nonce, 0, datain, datalen - CODEC_CHACHA20_NONCE, dataout);
+}
+
+static void
+CodecFreeZip(Codec* codec)
+{
+  sqlite3_free(codec->m_zip);
+  CodecAccount(codec, -codec->m_zipSize, 1);
+  codec->m_zip = NULL;
+  codec->m_zipSize = 0;
+}
+
+/*
+// LZ4 page format: the page up to the reserved area is compressed, the
+// compressed data is encrypted as in the ChaCha20 format with the same
+// page key and followed by zeros. The reserved area holds the compressed
+// length (big endian, 0 for a page that did not compress and is stored
+// whole) followed by the nonce. Returns 0 if a page does not decompress.
+*/
+int
+CodecLz4(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+         unsigned char encryptionKey[KEYLENGTH],
+         unsigned char* datain, int datalen, unsigned char* dataout)
+{
+  unsigned char pagekey[KEYLENGTH];
+  unsigned char* key;
+  unsigned char* data = dataout;
+  int size = datalen - CODEC_LZ4_RESERVE;
+  unsigned char* length = data + size;
+  unsigned char* nonce = length + 4;
+  unsigned int zipped = 0;
+
+  if (size <= 0)
+  {
+    return 0;
+  }
+  if (codec->m_zipSize < size && (!encrypt || datain == dataout))
+  {
+    CodecFreeZip(codec);
+    codec->m_zip = (unsigned char*) sqlite3_malloc(size);
+    codec->m_zipSize = (codec->m_zip != NULL) ? size : 0;
+    CodecAccount(codec, codec->m_zipSize, 1);
+  }
+  key = CodecGetStreamKey(codec, cipher, page, encryptionKey, pagekey);
+  if (encrypt)
+  {
+    if (datain != dataout)
+    {
+      /* Compress straight into the output */
+      zipped = (unsigned int) Lz4Compress(datain, size, dataout, size - 1);
+    }
+    else if (codec->m_zip != NULL)
+    {
+      zipped = (unsigned int) Lz4Compress(data, size, codec->m_zip, size - 1);
+      if (zipped > 0)
+      {
+        memcpy(data, codec->m_zip, zipped);
+      }
+    }
+    if (zipped > 0)
+    {
+      memset(data + zipped, 0, size - zipped);
+    }
+    length[0] = 0xff & (zipped >> 24);
+    length[1] = 0xff & (zipped >> 16);
+    length[2] = 0xff & (zipped >>  8);
+    length[3] = 0xff &  zipped;
+    sqlite3_randomness(CODEC_CHACHA20_NONCE, nonce);
+    if (zipped > 0)
+    {
+      ChaCha20Xor(key, cipher->m_keyLength, nonce, 0, data, (int) zipped, data);
+    }
+    else
+    {
+      ChaCha20Xor(key, cipher->m_keyLength, nonce, 0, datain, size, data);
+    }
+    return 1;
+  }
+
+  zipped = ((unsigned int) length[0] << 24) | ((unsigned int) length[1] << 16) |
+           ((unsigned int) length[2] << 8) | (unsigned int) length[3];
+  if (zipped >= (unsigned int) size)
+  {
+    return 0;
+  }
+  ChaCha20Xor(key, cipher->m_keyLength, nonce, 0, data, (zipped > 0) ? (int) zipped : size, data);
+  if (zipped == 0)
+  {
+    return 1;
+  }
+  if (codec->m_zip == NULL)
+  {
+    return 0;
+  }
+  memcpy(codec->m_zip, data, zipped);
+  return Lz4Decompress(codec->m_zip, (int) zipped, data, size) == size;
+}
+
+/*
+// Get the expanded XTS or GCM keys for a database key. The two most
+// recently used keys are kept, i.e. the read and the write key while
+// rekeying.
+*/
+static CodecDbKey*
+CodecGetDbKey(Codec* codec, const CodecCipher* cipher, int format, unsigned char encryptionKey[KEYLENGTH])
+{
+  static const unsigned char salt[3][4] = { { 'x', 't', 's', '1' }, { 'x', 't', 's', '2' }, { 'g', 'c', 'm', '1' } };
+  unsigned char nkey[KEYLENGTH+4];
+  unsigned char subkey[KEYLENGTH];
+  unsigned char iv[16];
+  CodecDbKey* entry = codec->m_dbKeys;
+  int keyLength = cipher->m_keyLength;
+  int keyLen = (keyLength == 32) ? RIJNDAEL_Direction_KeyLength_Key32Bytes
+                                 : RIJNDAEL_Direction_KeyLength_Key16Bytes;
+  CodecDbKey swap;
+
+  if (entry[0].m_cipher == cipher && entry[0].m_format == format &&
+      memcmp(entry[0].m_key, encryptionKey, keyLength) == 0)
+  {
+    codec->m_keyCacheHits++;
+    return &entry[0];
+  }
+  if (entry[1].m_cipher == cipher && entry[1].m_format == format &&
+      memcmp(entry[1].m_key, encryptionKey, keyLength) == 0)
+  {
+    codec->m_keyCacheHits++;
+    swap = entry[0];
+    entry[0] = entry[1];
+    entry[1] = swap;
+    return &entry[0];
+  }
+
+  codec->m_keyCacheMisses++;
+  entry[1] = entry[0];
+  memset(iv, 0, 16);
+  memcpy(nkey, encryptionKey, keyLength);
+
+  if (format == CODEC_FORMAT_GCM)
+  {
+    memcpy(nkey + keyLength, salt[2], 4);
+    cipher->m_hash(codec, nkey, keyLength + 4, subkey);
+    GcmInit(&entry[0].m_gcm, subkey, keyLen);
+  }
+  else
+  {
+    /* Data key */
+    memcpy(nkey + keyLength, salt[0], 4);
+    cipher->m_hash(codec, nkey, keyLength + 4, subkey);
+    RijndaelInit(&entry[0].m_encrypt, RIJNDAEL_Direction_Mode_XEX, RIJNDAEL_Direction_Encrypt, subkey, keyLen, iv);
+    entry[0].m_decrypt = entry[0].m_encrypt;
+    entry[0].m_decrypt.m_direction = RIJNDAEL_Direction_Decrypt;
+    RijndaelKeyEncToDec(&entry[0].m_decrypt);
+
+    /* Tweak key */
+    memcpy(nkey + keyLength, salt[1], 4);
+    cipher->m_hash(codec, nkey, keyLength + 4, subkey);
+    RijndaelInit(&entry[0].m_tweak, RIJNDAEL_Direction_Mode_ECB, RIJNDAEL_Direction_Encrypt, subkey, keyLen, iv);
+  }
+
+  memcpy(entry[0].m_key, encryptionKey, keyLength);
+  entry[0].m_cipher = cipher;
+  entry[0].m_format = format;
+  memset(subkey, 0, sizeof(subkey));
+  memset(nkey, 0, sizeof(nkey));
+  return &entry[0];
+}
+
+/*
+// XTS page format: AES-XTS with the page as data unit, the page number is
+// the tweak. The per-page setup is a single block encryption.
+*/
+void
+CodecXTS(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+         unsigned char encryptionKey[KEYLENGTH],
+         unsigned char* datain, int datalen, unsigned char* dataout)
+{
+  CodecDbKey* entry = CodecGetDbKey(codec, cipher, CODEC_FORMAT_XTS, encryptionKey);
+  Rijndael* aes = (encrypt) ? &entry->m_encrypt : &entry->m_decrypt;
+  unsigned char tweak[16];
+
+  /* The page number as 128 bit little endian data unit number */
+  memset(tweak, 0, 16);
+  tweak[0] = 0xff &  page;
+  tweak[1] = 0xff & (page >>  8);
+  tweak[2] = 0xff & (page >> 16);
+  tweak[3] = 0xff & (page >> 24);
+  RijndaelBlockEncrypt(&entry->m_tweak, tweak, 128, aes->m_initVector);
+
+  if (encrypt)
+  {
+    RijndaelBlockEncrypt(aes, datain, datalen*8, dataout);
+  }
+  else
+  {
+    RijndaelBlockDecrypt(aes, datain, datalen*8, dataout);
+  }
+}
+
+/*
+// GCM page format: the reserved area at the end of a page holds a random
+// nonce, renewed on every write, followed by the authentication tag. The
+// page number is authenticated as additional data, so that a page cannot
+// be moved to another position either. Returns 0 if the tag does not match.
+// With random 96-bit nonces NIST SP 800-38D allows at most 2^32 encryptions
+// per key, and every page write is one: a database should be rekeyed long
+// before 2^32 page writes (16 TiB written with 4 KiB pages). A nonce from
+// the page number and a write counter would lift the limit, but there is
+// no place to keep the counter across connections.
+*/
+int
+CodecGCM(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+         unsigned char encryptionKey[KEYLENGTH],
+         unsigned char* datain, int datalen, unsigned char* dataout)
+{
+  unsigned char* nonce = dataout + datalen - CODEC_GCM_RESERVE;
+  unsigned char* tag = nonce + GCM_NONCE_LENGTH;
+  unsigned char pageNumber[4];
+  CodecDbKey* entry;
+
+  if (datalen <= CODEC_GCM_RESERVE)
+  {
+    return 0;
+  }
+  entry = CodecGetDbKey(codec, cipher, CODEC_FORMAT_GCM, encryptionKey);
+  pageNumber[0] = 0xff &  page;
+  pageNumber[1] = 0xff & (page >>  8);
+  pageNumber[2] = 0xff & (page >> 16);
+  pageNumber[3] = 0xff & (page >> 24);
+  if (encrypt)
+  {
+    sqlite3_randomness(GCM_NONCE_LENGTH, nonce);
+    GcmEncrypt(&entry->m_gcm, nonce, pageNumber, 4, datain, datalen - CODEC_GCM_RESERVE, dataout, tag);
+    return 1;
+  }
+  return GcmDecrypt(&entry->m_gcm, nonce, pageNumber, 4, dataout, datalen - CODEC_GCM_RESERVE, tag) == GCM_SUCCESS;
+}
+
+void
+CodecClearKeyCache(Codec* codec)
+{
+  if (codec->m_keyCache != NULL)
+  {
+    memset(codec->m_keyCache, 0, CODEC_KEYCACHE_SIZE * sizeof(CodecPageKey));
+    sqlite3_free(codec->m_keyCache);
+    codec->m_keyCache = NULL;
+    CodecAccount(codec, -(int) (CODEC_KEYCACHE_SIZE * sizeof(CodecPageKey)), 0);
+  }
+  memset(codec->m_dbKeys, 0, sizeof(codec->m_dbKeys));
+}
+
+void
+CodecGetKeyCacheStats(Codec* codec, sqlite3_int64* hits, sqlite3_int64* misses)
+{
+  *hits   = codec->m_keyCacheHits;
+  *misses = codec->m_keyCacheMisses;
+}
+
+sqlite3_int64
+CodecGetAuthFailures(Codec* codec)
+{
+  return codec->m_authFailures;
+}
+
+static void CodecTeamFree(struct _CodecTeam* team);
+
+static unsigned char padding[] =
+  "\x28\xBF\x4E\x5E\x4E\x75\x8A\x41\x64\x00\x4E\x56\xFF\xFA\x01\x08\x2E\x2E\x00\xB6\xD0\x68\x3E\x80\x2F\x0C\xA9\xFE\x64\x53\x69\x7A";
+
+void
+CodecInit(Codec* codec)
+{
+  codec->m_isEncrypted = 0;
+  codec->m_format      = CODEC_FORMAT_DEFAULT;
+  codec->m_writeFormat = CODEC_FORMAT_DEFAULT;
+  codec->m_reserve     = 0;
+  codec->m_hasReadKey  = 0;
+  codec->m_hasWriteKey = 0;
+  codec->m_readCipher  = CodecGetDefaultCipher();
+  codec->m_writeCipher = CodecGetDefaultCipher();
+  codec->m_memoryUsed = 0;
+  codec->m_memoryHighwater = 0;
+  codec->m_bufferUsed = 0;
+  codec->m_bufferHighwater = 0;
+  CodecAccount(codec, sizeof(Codec), 0);
+  codec->m_aes = (Rijndael*) sqlite3_malloc(sizeof(Rijndael));
+  RijndaelCreate(codec->m_aes);
+  CodecAccount(codec, sizeof(Rijndael), 0);
+  codec->m_keyCache = NULL;
+  codec->m_keyCacheHits = 0;
+  codec->m_keyCacheMisses = 0;
+  memset(codec->m_dbKeys, 0, sizeof(codec->m_dbKeys));
+  codec->m_authFailures = 0;
+  codec->m_team = NULL;
+  codec->m_rekey = NULL;
+  codec->m_rekeyStep = NULL;
+  codec->m_zip = NULL;
+  codec->m_zipSize = 0;
+  memset(codec->m_ring, 0, sizeof(codec->m_ring));
+  memset(codec->m_ringSizes, 0, sizeof(codec->m_ringSizes));
+  codec->m_ringNext = 0;
+}
+
+static void
+CodecFreeRingBuffer(Codec* codec, int j)
+{
+  if (codec->m_ring[j] != NULL)
+  {
+    sqlite3_free(codec->m_ring[j]);
+    codec->m_ring[j] = NULL;
+    CodecAccount(codec, -(codec->m_ringSizes[j] + 8), 1);
+  }
+  codec->m_ringSizes[j] = 0;
+}
+
+static void
+CodecFreeRing(Codec* codec)
+{
+  int j;
+  for (j = 0; j < CODEC_RING_SIZE; j++)
+  {
+    CodecFreeRingBuffer(codec, j);
+  }
+  codec->m_ringNext = 0;
+}
+
+void
+CodecTerm(Codec* codec)
+{
+  CodecTeamFree(codec->m_team);
+  codec->m_team = NULL;
+  CodecClearKeyCache(codec);
+  sqlite3_free(codec->m_aes);
+  CodecFreeZip(codec);
+  CodecFreeRing(codec);
+}
+
+void
+CodecSetIsEncrypted(Codec* codec, int isEncrypted)
+{
+  codec->m_isEncrypted = isEncrypted;
+}
+
+void
+CodecSetHasReadKey(Codec* codec, int hasReadKey)
+{
+  codec->m_hasReadKey = hasReadKey;
+}
+
+void
+CodecSetHasWriteKey(Codec* codec, int hasWriteKey)
+{
+  codec->m_hasWriteKey = hasWriteKey;
+}
+
+void
+CodecSetBtree(Codec* codec, Btree* bt)
+{
+  codec->m_bt = bt;
+}
+
+void
+CodecSetFormat(Codec* codec, int format)
+{
+  /* Cached page ciphers record their format, so the cache stays valid */
+  codec->m_format = format;
+  codec->m_writeFormat = format;
+}
+
+void
+CodecSetWriteFormat(Codec* codec, int format)
+{
+  codec->m_writeFormat = format;
+}
+
+void
+CodecSetReserve(Codec* codec, int reserve)
+{
+  codec->m_reserve = reserve;
+}
+
+int
+CodecIsEncrypted(Codec* codec)
+{
+  return codec->m_isEncrypted;
+}
+
+int
+CodecHasReadKey(Codec* codec)
+{
+  return codec->m_hasReadKey;
+}
+
+int
+CodecHasWriteKey(Codec* codec)
+{
+  return codec->m_hasWriteKey;
+}
+
+Btree*
+CodecGetBtree(Codec* codec)
+{
+  return codec->m_bt;
+}
+
+int
+CodecGetFormat(Codec* codec)
+{
+  return codec->m_format;
+}
+
+int
+CodecGetWriteFormat(Codec* codec)
+{
+  return codec->m_writeFormat;
+}
+
+int
+CodecGetReserve(Codec* codec)
+{
+  return codec->m_reserve;
+}
+
+/*
+// Reserved bytes per page a format needs
+*/
+int
+CodecGetFormatReserve(int format)
+{
+  switch (format)
+  {
+    case CODEC_FORMAT_CHACHA20:
+      return CODEC_CHACHA20_NONCE;
+    case CODEC_FORMAT_GCM:
+      return CODEC_GCM_RESERVE;
+    case CODEC_FORMAT_LZ4:
+      return CODEC_LZ4_RESERVE;
+    default:
+      return 0;
+  }
+}
+
+/*
+// Next output buffer of the ring for a page of len bytes, NULL if out of
+// memory. The buffers are allocated on first use at the page size in use
+// rather than SQLITE_MAX_PAGE_SIZE, and again when the page size grows;
+// only the buffer handed out is reallocated, the others stay valid.
+*/
+unsigned char*
+CodecGetPageBuffer(Codec* codec, int len)
+{
+  int j = codec->m_ringNext;
+  unsigned char* buffer;
+  if (len > codec->m_ringSizes[j])
+  {
+    CodecFreeRingBuffer(codec, j);
+  }
+  buffer = codec->m_ring[j];
+  if (buffer == NULL)
+  {
+    /* Same layout as the former fixed buffer: 4 bytes before the page */
+    buffer = (unsigned char*) sqlite3_malloc(len + 8);
+    if (buffer == NULL)
+    {
+      return NULL;
+    }
+    codec->m_ring[j] = buffer;
+    codec->m_ringSizes[j] = len;
+    CodecAccount(codec, len + 8, 1);
+  }
+  codec->m_ringNext = (j + 1) % CODEC_RING_SIZE;
+  return &buffer[4];
+}
+
+void
+CodecCopy(Codec* codec, Codec* other)
+{
+  int j;
+  codec->m_isEncrypted = other->m_isEncrypted;
+  codec->m_format      = other->m_format;
+  codec->m_writeFormat = other->m_writeFormat;
+  codec->m_reserve     = other->m_reserve;
+  codec->m_hasReadKey  = other->m_hasReadKey;
+  codec->m_hasWriteKey = other->m_hasWriteKey;
+  codec->m_readCipher  = other->m_readCipher;
+  codec->m_writeCipher = other->m_writeCipher;
+  for (j = 0; j < KEYLENGTH; j++)
+  {
+    codec->m_readKey[j]  = other->m_readKey[j];
+    codec->m_writeKey[j] = other->m_writeKey[j];
+  }
+  codec->m_bt = other->m_bt;
+  RijndaelInvalidate(codec->m_aes);
+}
+
+void
+CodecCopyKey(Codec* codec, int read2write)
+{
+  int j;
+  if (read2write)
+  {
+    codec->m_writeCipher = codec->m_readCipher;
+    codec->m_writeFormat = codec->m_format;
+    for (j = 0; j < KEYLENGTH; j++)
+    {
+      codec->m_writeKey[j] = codec->m_readKey[j];
+    }
+  }
+  else
+  {
+    codec->m_readCipher = codec->m_writeCipher;
+    codec->m_format = codec->m_writeFormat;
+    for (j = 0; j < KEYLENGTH; j++)
+    {
+      codec->m_readKey[j] = codec->m_writeKey[j];
+    }
+  }
+}
+
+void
+CodecPadPassword(Codec* codec, char* password, int pswdlen, unsigned char pswd[32])
+{
+  int j;
+  int p = 0;
+  int m = pswdlen;
+  if (m > 32) m = 32;
+
+  for (j = 0; j < m; j++)
+  {
+    pswd[p++] = (unsigned char) password[j];
+  }
+  for (j = 0; p < 32 && j < 32; j++)
+  {
+    pswd[p++] = padding[j];
+  }
+}
+
+void
+CodecGenerateReadKey(Codec* codec, char* userPassword, int passwordLength)
+{
+  memset(codec->m_readKey, 0, KEYLENGTH);
+  CodecDeriveKey(codec, codec->m_readCipher, userPassword, passwordLength, codec->m_readKey);
+}
+
+void
+CodecGenerateWriteKey(Codec* codec, char* userPassword, int passwordLength)
+{
+  memset(codec->m_writeKey, 0, KEYLENGTH);
+  CodecDeriveKey(codec, codec->m_writeCipher, userPassword, passwordLength, codec->m_writeKey);
+}
+
+/*
+// Use a key derived beforehand (see CodecDeriveKey) as read key.
+// keyLength must be the key length of the read cipher.
+*/
+void
+CodecSetRawReadKey(Codec* codec, const unsigned char* key, int keyLength)
+{
+  memset(codec->m_readKey, 0, KEYLENGTH);
+  memcpy(codec->m_readKey, key, keyLength);
+}
+
+/*
+// ----------------
+// Derived key cache
+// ----------------
+*/
+
+#if CODEC_KDF_CACHE_SIZE > 0
+/*
+/// Derived key of a password. (For internal use only)
+/// Entries are looked up by cipher and SHA-256 digest of the password.
+*/
+typedef struct _CodecKdfEntry
+{
+  const CodecCipher* m_cipher;  /* NULL if the entry is unused */
+  unsigned int  m_lastUse;
+  unsigned char m_digest[SHA256_DIGEST_SIZE];
+  unsigned char m_key[KEYLENGTH];
+} CodecKdfEntry;
+
+static CodecKdfEntry codecKdfCache[CODEC_KDF_CACHE_SIZE];
+static unsigned int  codecKdfClock = 0;
+static int           codecKdfEnabled = 0;
+#endif
+
+/*
+// Enable or disable the derived key cache. Disabling it wipes all entries.
+*/
+void
+CodecSetKdfCache(int enable)
+{
+#if CODEC_KDF_CACHE_SIZE > 0
+  sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(mutex);
+  codecKdfEnabled = enable;
+  if (!enable)
+  {
+    memset(codecKdfCache, 0, sizeof(codecKdfCache));
+  }
+  sqlite3_mutex_leave(mutex);
+#endif
+}
+
+/*
+// Derive the database key of a password with the key derivation of the
+// cipher, or take it from the derived key cache. The derivation itself
+// runs outside the mutex, so other connections are not held up by it.
+*/
+void
+CodecDeriveKey(Codec* codec, const CodecCipher* cipher, char* userPassword, int passwordLength,
+               unsigned char encryptionKey[KEYLENGTH])
+{
+#if CODEC_KDF_CACHE_SIZE > 0
+  sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  CodecKdfEntry* entry;
+  int enabled;
+  int j;
+
+  sqlite3_mutex_enter(mutex);
+  enabled = codecKdfEnabled;
+  sqlite3_mutex_leave(mutex);
+  if (!enabled)
+  {
+    cipher->m_generateKey(codec, userPassword, passwordLength, encryptionKey);
+    return;
+  }
+
+  sha256((unsigned char*) userPassword, (passwordLength > 0) ? (unsigned int) passwordLength : 0, digest);
+  sqlite3_mutex_enter(mutex);
+  for (j = 0; j < CODEC_KDF_CACHE_SIZE; j++)
+  {
+    entry = &codecKdfCache[j];
+    if (entry->m_cipher == cipher && memcmp(entry->m_digest, digest, SHA256_DIGEST_SIZE) == 0)
+    {
+      memcpy(encryptionKey, entry->m_key, cipher->m_keyLength);
+      entry->m_lastUse = ++codecKdfClock;
+      sqlite3_mutex_leave(mutex);
+      memset(digest, 0, sizeof(digest));
+      return;
+    }
+  }
+  sqlite3_mutex_leave(mutex);
+
+  cipher->m_generateKey(codec, userPassword, passwordLength, encryptionKey);
+
+  /* Replace an unused or the least recently used entry */
+  sqlite3_mutex_enter(mutex);
+  if (codecKdfEnabled)
+  {
+    entry = &codecKdfCache[0];
+    for (j = 1; j < CODEC_KDF_CACHE_SIZE && entry->m_cipher != NULL; j++)
+    {
+      if (codecKdfCache[j].m_cipher == NULL || codecKdfCache[j].m_lastUse < entry->m_lastUse)
+      {
+        entry = &codecKdfCache[j];
+      }
+    }
+    entry->m_cipher = cipher;
+    entry->m_lastUse = ++codecKdfClock;
+    memcpy(entry->m_digest, digest, SHA256_DIGEST_SIZE);
+    memset(entry->m_key, 0, KEYLENGTH);
+    memcpy(entry->m_key, encryptionKey, cipher->m_keyLength);
+  }
+  sqlite3_mutex_leave(mutex);
+  memset(digest, 0, sizeof(digest));
+#else
+  cipher->m_generateKey(codec, userPassword, passwordLength, encryptionKey);
+#endif
+}
+
+/*
+// Original key derivation of the AES-128 cipher, based on MD5 and RC4
+*/
+void
+CodecGenerateEncryptionKey(Codec* codec, char* userPassword, int passwordLength, 
+                           unsigned char encryptionKey[KEYLENGTH])
+{
+  unsigned char userPad[32];
+  unsigned char ownerPad[32];
+  unsigned char ownerKey[32];
+
+  unsigned char mkey[MD5_HASHBYTES];
+  unsigned char digest[MD5_HASHBYTES];
+  int keyLength = MD5_HASHBYTES;
+  int i, j, k;
+  MD5_CTX ctx;
+
+  /* Pad passwords */
+  CodecPadPassword(codec, userPassword, passwordLength, userPad);
+  CodecPadPassword(codec, "", 0, ownerPad);
+
+  /* Compute owner key */
+
+  MD5Init(&ctx);
+  MD5Update(&ctx, ownerPad, 32);
+  MD5Final(digest,&ctx);
+
+  /* only use for the input as many bit as the key consists of */
+  for (k = 0; k < 50; ++k)
+  {
+    MD5Init(&ctx);
+    MD5Update(&ctx, digest, keyLength);
+    MD5Final(digest,&ctx);
+  }
+  memcpy(ownerKey, userPad, 32);
+  for (i = 0; i < 20; ++i)
+  {
+    for (j = 0; j < keyLength ; ++j)
+    {
+      mkey[j] = (digest[j] ^ i);
+    }
+    CodecRC4(codec, mkey, keyLength, ownerKey, 32, ownerKey);
+  }
+
+  /* Compute encryption key */
+
+  MD5Init(&ctx);
+  MD5Update(&ctx, userPad, 32);
+  MD5Update(&ctx, ownerKey, 32);
+  MD5Final(digest,&ctx);
+
+  /* only use the really needed bits as input for the hash */
+  for (k = 0; k < 50; ++k)
+  {
+    MD5Init(&ctx);
+    MD5Update(&ctx, digest, keyLength);
+    MD5Final(digest, &ctx);
+  }
+  memcpy(encryptionKey, digest, keyLength);
+}
+
+/*
+// Key derivation of the AES-256 and ChaCha20 ciphers: iterated SHA-256
+*/
+void
+CodecGenerateEncryptionKeySHA(Codec* codec, char* userPassword, int passwordLength,
+                              unsigned char encryptionKey[KEYLENGTH])
+{
+  unsigned char userPad[32];
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  int keyLength = SHA256_DIGEST_SIZE;
+  int k;
+
+  /* Pad password */
+  CodecPadPassword(codec, userPassword, passwordLength, userPad);
+
+  sha256(userPad, 32, digest);
+  for (k = 0; k < CODEC_SHA_ITER; ++k)
+  {
+    sha256(digest, SHA256_DIGEST_SIZE, digest);
+  }
+  memcpy(encryptionKey, digest, keyLength);
+}
+
+/*
+// Available ciphers. "aes128" and "aes256" are the ciphers of builds with
+// CODEC_TYPE_AES128 resp. CODEC_TYPE_AES256 and read their databases.
+*/
+static const CodecCipher codecCiphers[] =
+{
+  { "aes128",     16, CODEC_FORMAT_DEFAULT,  CodecGenerateEncryptionKey,    CodecGetMD5Binary, CodecGetMD5Binary4 },
+  { "aes256",     32, CODEC_FORMAT_DEFAULT,  CodecGenerateEncryptionKeySHA, CodecGetSHABinary, CodecGetSHABinary4 },
+  { "aes128-xex", 16, CODEC_FORMAT_XEX,      CodecGenerateEncryptionKey,    CodecGetMD5Binary, CodecGetMD5Binary4 },
+  { "aes256-xex", 32, CODEC_FORMAT_XEX,      CodecGenerateEncryptionKeySHA, CodecGetSHABinary, CodecGetSHABinary4 },
+  { "aes128-xts", 16, CODEC_FORMAT_XTS,      CodecGenerateEncryptionKey,    CodecGetMD5Binary, CodecGetMD5Binary4 },
+  { "aes256-xts", 32, CODEC_FORMAT_XTS,      CodecGenerateEncryptionKeySHA, CodecGetSHABinary, CodecGetSHABinary4 },
+  { "aes128-gcm", 16, CODEC_FORMAT_GCM,      CodecGenerateEncryptionKey,    CodecGetMD5Binary, CodecGetMD5Binary4 },
+  { "aes256-gcm", 32, CODEC_FORMAT_GCM,      CodecGenerateEncryptionKeySHA, CodecGetSHABinary, CodecGetSHABinary4 },
+  { "chacha20",   32, CODEC_FORMAT_CHACHA20, CodecGenerateEncryptionKeySHA, CodecGetSHABinary, CodecGetSHABinary4 },
+  { "chacha20-lz4", 32, CODEC_FORMAT_LZ4,    CodecGenerateEncryptionKeySHA, CodecGetSHABinary, CodecGetSHABinary4 }
+};
+
+#define CODEC_CIPHER_COUNT ((int) (sizeof(codecCiphers) / sizeof(codecCiphers[0])))
+
+const CodecCipher*
+CodecFindCipher(const char* name, int nameLength)
+{
+  int j;
+  for (j = 0; j < CODEC_CIPHER_COUNT; j++)
+  {
+    if ((int) strlen(codecCiphers[j].m_name) == nameLength &&
+        sqlite3_strnicmp(codecCiphers[j].m_name, name, nameLength) == 0)
+    {
+      return &codecCiphers[j];
+    }
+  }
+  return NULL;
+}
+
+const CodecCipher*
+CodecGetDefaultCipher(void)
+{
+#if CODEC_TYPE == CODEC_TYPE_AES256
+  return &codecCiphers[1];
+#else
+  return &codecCiphers[0];
+#endif
+}
+
+/*
+// A key may start with "cipher=<name>;" to select the cipher, the password
+// follows the semicolon. Strips the prefix from the key and returns the
+// cipher, the default cipher if there is no prefix, or NULL if the named
+// cipher does not exist.
+*/
+const CodecCipher*
+CodecParseKey(const char** key, int* keyLength)
+{
+  static const char prefix[] = "cipher=";
+  int prefixLength = (int) sizeof(prefix) - 1;
+  const char* name;
+  const CodecCipher* cipher;
+  int j;
+
+  if (*key == NULL || *keyLength <= prefixLength || sqlite3_strnicmp(*key, prefix, prefixLength) != 0)
+  {
+    return CodecGetDefaultCipher();
+  }
+  name = *key + prefixLength;
+  j = prefixLength;
+  while (j < *keyLength && (*key)[j] != ';')
+  {
+    j++;
+  }
+  if (j == *keyLength)
+  {
+    return NULL;
+  }
+  cipher = CodecFindCipher(name, j - prefixLength);
+  if (cipher != NULL)
+  {
+    *key += j + 1;
+    *keyLength -= j + 1;
+  }
+  return cipher;
+}
+
+void
+CodecSetReadCipher(Codec* codec, const CodecCipher* cipher)
+{
+  codec->m_readCipher = cipher;
+}
+
+void
+CodecSetWriteCipher(Codec* codec, const CodecCipher* cipher)
+{
+  codec->m_writeCipher = cipher;
+}
+
+const CodecCipher*
+CodecGetReadCipher(Codec* codec)
+{
+  return codec->m_readCipher;
+}
+
+const CodecCipher*
+CodecGetWriteCipher(Codec* codec)
+{
+  return codec->m_writeCipher;
+}
+
+/*
+// Encrypt the page in into out, which must not overlap it unless both are
+// the same buffer. The pager's page is left untouched, so that writing it
+// does not take a copy first.
+*/
+void
+CodecEncryptTo(Codec* codec, int page, const unsigned char* in, unsigned char* out, int len,
+               int useWriteKey)
+{
+  unsigned char* key = (useWriteKey) ? codec->m_writeKey : codec->m_readKey;
+  const CodecCipher* cipher = (useWriteKey) ? codec->m_writeCipher : codec->m_readCipher;
+  int format = (useWriteKey) ? codec->m_writeFormat : codec->m_format;
+  unsigned char* data = (unsigned char*) in;
+  switch (format)
+  {
+    case CODEC_FORMAT_CHACHA20:
+      CodecChaCha20(codec, cipher, page, 1, key, data, len, out);
+      break;
+    case CODEC_FORMAT_XTS:
+      CodecXTS(codec, cipher, page, 1, key, data, len, out);
+      break;
+    case CODEC_FORMAT_GCM:
+      CodecGCM(codec, cipher, page, 1, key, data, len, out);
+      break;
+    case CODEC_FORMAT_LZ4:
+      CodecLz4(codec, cipher, page, 1, key, data, len, out);
+      break;
+    default:
+      CodecAES(codec, cipher, format, page, 1, key, data, len, out);
+      break;
+  }
+}
+
+void
+CodecEncrypt(Codec* codec, int page, unsigned char* data, int len, int useWriteKey)
+{
+  CodecEncryptTo(codec, page, data, data, len, useWriteKey);
+}
+
+/*
+// Decrypt a page. Returns 0 if the page failed authentication, which only
+// the GCM format checks.
+*/
+static int
+CodecDecryptPage(Codec* codec, int page, unsigned char* data, int len, int useWriteKey)
+{
+  unsigned char* key = (useWriteKey) ? codec->m_writeKey : codec->m_readKey;
+  const CodecCipher* cipher = (useWriteKey) ? codec->m_writeCipher : codec->m_readCipher;
+  int format = (useWriteKey) ? codec->m_writeFormat : codec->m_format;
+  switch (format)
+  {
+    case CODEC_FORMAT_CHACHA20:
+      CodecChaCha20(codec, cipher, page, 0, key, data, len, data);
+      break;
+    case CODEC_FORMAT_XTS:
+      CodecXTS(codec, cipher, page, 0, key, data, len, data);
+      break;
+    case CODEC_FORMAT_GCM:
+      return CodecGCM(codec, cipher, page, 0, key, data, len, data);
+    case CODEC_FORMAT_LZ4:
+      return CodecLz4(codec, cipher, page, 0, key, data, len, data);
+    default:
+      CodecAES(codec, cipher, format, page, 0, key, data, len, data);
+      break;
+  }
+  return 1;
+}
+
+/*
+// Decrypt a page. A page that fails authentication is cleared, so that
+// SQLite reports it as corrupt (or page 1 as not a database) instead of
+// using tampered content, and the failure is logged.
+*/
+int
+CodecDecrypt(Codec* codec, int page, unsigned char* data, int len, int useWriteKey)
+{
+  if (!CodecDecryptPage(codec, page, data, len, useWriteKey))
+  {
+    memset(data, 0, len);
+    codec->m_authFailures++;
+    sqlite3_log(SQLITE_CORRUPT, "codec: authentication failed for page %d", page);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+// Change the format of the read or the write key. Both change together
+// unless a rekey is migrating the database to another format.
+*/
+static void
+CodecSwitchFormat(Codec* codec, int useWriteKey, int together, int format)
+{
+  if (together)
+  {
+    CodecSetFormat(codec, format);
+  }
+  else if (useWriteKey)
+  {
+    codec->m_writeFormat = format;
+  }
+  else
+  {
+    codec->m_format = format;
+  }
+}
+
+/*
+// Nonzero if a decrypted page 1 starts with a database header, or with the
+// header of an incomplete incremental rekey
+*/
+static int
+CodecIsFirstPage(const unsigned char* data)
+{
+  static const char header[] = "SQLite format 3";
+  return memcmp(data, header, sizeof(header)) == 0 ||
+         memcmp(data, CODEC_REKEY_HEADER, CODEC_REKEY_HEADER_LENGTH) == 0;
+}
+
+/*
+// Decrypt page 1 and make sure the codec uses the format the database was
+// created with: if the page does not decrypt to a database header, the
+// other formats are tried on a copy of the encrypted page. Returns 0 and
+// leaves page and format unchanged if no format yields a header; nothing
+// is logged, so that callers can probe for the page size.
+*/
+int
+CodecProbeFirstPage(Codec* codec, unsigned char* data, int len, int useWriteKey)
+{
+  unsigned char* encrypted = CodecGetPageBuffer(codec, len);
+  int together = (codec->m_format == codec->m_writeFormat);
+  int format = (useWriteKey) ? codec->m_writeFormat : codec->m_format;
+  int other;
+
+  if (encrypted == NULL)
+  {
+    /* No copy to retry with, only the current format is tried */
+    return CodecDecryptPage(codec, 1, data, len, useWriteKey) && CodecIsFirstPage(data);
+  }
+  memcpy(encrypted, data, len);
+  if (CodecDecryptPage(codec, 1, data, len, useWriteKey) && CodecIsFirstPage(data))
+  {
+    return 1;
+  }
+  for (other = 0; other < CODEC_FORMAT_COUNT; other++)
+  {
+    if (other == format) continue;
+    CodecSwitchFormat(codec, useWriteKey, together, other);
+    memcpy(data, encrypted, len);
+    if (CodecDecryptPage(codec, 1, data, len, useWriteKey) && CodecIsFirstPage(data))
+    {
+      return 1;
+    }
+  }
+  CodecSwitchFormat(codec, useWriteKey, together, format);
+  memcpy(data, encrypted, len);
+  return 0;
+}
+
+void
+CodecDecryptFirstPage(Codec* codec, unsigned char* data, int len, int useWriteKey)
+{
+  if (!CodecProbeFirstPage(codec, data, len, useWriteKey))
+  {
+    /* Wrong key or not a database, leave it to SQLite to complain */
+    CodecDecrypt(codec, 1, data, len, useWriteKey);
+  }
+}
+
+/*
+// ----------------
+// Worker pool
+// ----------------
+*/
+
+struct _CodecPool
+{
+  int             m_nThreads;   /* Number of pool threads, excluding the caller */
+#if CODEC_THREADS
+  pthread_t       m_threads[CODEC_MAX_THREADS];
+  pthread_mutex_t m_mutex;
+  pthread_cond_t  m_start;      /* Signalled when a new run begins */
+  pthread_cond_t  m_done;       /* Signalled when the last thread finishes a run */
+  int             m_generation; /* Incremented for each run */
+  int             m_active;     /* Pool threads still working on the current run */
+  int             m_shutdown;
+  int             m_busy;       /* Nonzero while a run is in progress */
+#endif
+  CodecPoolTask   m_task;
+  void*           m_arg;
+  int             m_nItems;
+  int             m_next;       /* Next item to hand out */
+};
+
+int
+CodecGetCpuCount(void)
+{
+#if CODEC_THREADS && defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (int) n : 1;
+#else
+  return 1;
+#endif
+}
+
+#if CODEC_THREADS
+typedef struct _CodecPoolThread
+{
+  CodecPool* m_pool;
+  int        m_worker;
+} CodecPoolThread;
+
+static void
+CodecPoolWork(CodecPool* pool, int worker)
+{
+  /* Called with the mutex held; returns with the mutex held */
+  while (pool->m_next < pool->m_nItems)
+  {
+    int item = pool->m_next++;
+    pthread_mutex_unlock(&pool->m_mutex);
+    pool->m_task(pool->m_arg, worker, item);
+    pthread_mutex_lock(&pool->m_mutex);
+  }
+}
+
+static void*
+CodecPoolMain(void* arg)
+{
+  CodecPool* pool = (CodecPool*) arg;
+  int worker;
+  int generation;
+
+  pthread_mutex_lock(&pool->m_mutex);
+  worker = ++pool->m_active;
+  generation = pool->m_generation;
+  if (worker == pool->m_nThreads)
+  {
+    pthread_cond_signal(&pool->m_done);
+  }
+  for (;;)
+  {
+    while (!pool->m_shutdown && pool->m_generation == generation)
+    {
+      pthread_cond_wait(&pool->m_start, &pool->m_mutex);
+    }
+    if (pool->m_shutdown) break;
+    generation = pool->m_generation;
+    CodecPoolWork(pool, worker);
+    if (--pool->m_active == 0)
+    {
+      pthread_cond_signal(&pool->m_done);
+    }
+  }
+  pthread_mutex_unlock(&pool->m_mutex);
+  return NULL;
+}
+#endif
+
+/*
+// Creates a pool with up to nThreads threads in addition to the caller.
+// Returns NULL if out of memory; a pool with fewer threads than requested
+// (possibly none) if threads cannot be started.
+*/
+CodecPool*
+CodecPoolCreate(int nThreads)
 {
-  CodecGenerateEncryptionKey(codec, userPassword, passwordLength, codec->m_writeKey);
+  CodecPool* pool = (CodecPool*) sqlite3_malloc(sizeof(CodecPool));
+  if (pool == NULL)
+  {
+    return NULL;
+  }
+  memset(pool, 0, sizeof(CodecPool));
+#if CODEC_THREADS
+  if (nThreads > CODEC_MAX_THREADS) nThreads = CODEC_MAX_THREADS;
+  pthread_mutex_init(&pool->m_mutex, NULL);
+  pthread_cond_init(&pool->m_start, NULL);
+  pthread_cond_init(&pool->m_done, NULL);
+  pthread_mutex_lock(&pool->m_mutex);
+  for (pool->m_nThreads = 0; pool->m_nThreads < nThreads; pool->m_nThreads++)
+  {
+    if (pthread_create(&pool->m_threads[pool->m_nThreads], NULL, CodecPoolMain, pool) != 0) break;
+  }
+  /* Wait until every thread has taken its worker number */
+  while (pool->m_active < pool->m_nThreads)
+  {
+    pthread_cond_wait(&pool->m_done, &pool->m_mutex);
+  }
+  pool->m_active = 0;
+  pthread_mutex_unlock(&pool->m_mutex);
+#endif
+  return pool;
 }
 
 void
-CodecGenerateEncryptionKey(Codec* codec, char* userPassword, int passwordLength, 
-                           unsigned char encryptionKey[KEYLENGTH])
+CodecPoolDestroy(CodecPool* pool)
 {
-#if CODEC_TYPE == CODEC_TYPE_AES256
-  unsigned char userPad[32];
-  unsigned char digest[KEYLENGTH];
-  int keyLength = KEYLENGTH;
-  int k;
+#if CODEC_THREADS
+  int j;
+#endif
+  if (pool == NULL)
+  {
+    return;
+  }
+#if CODEC_THREADS
+  pthread_mutex_lock(&pool->m_mutex);
+  pool->m_shutdown = 1;
+  pthread_cond_broadcast(&pool->m_start);
+  pthread_mutex_unlock(&pool->m_mutex);
+  for (j = 0; j < pool->m_nThreads; j++)
+  {
+    pthread_join(pool->m_threads[j], NULL);
+  }
+  pthread_cond_destroy(&pool->m_done);
+  pthread_cond_destroy(&pool->m_start);
+  pthread_mutex_destroy(&pool->m_mutex);
+#endif
+  sqlite3_free(pool);
+}
 
-  /* Pad password */
-  CodecPadPassword(codec, userPassword, passwordLength, userPad);
+int
+CodecPoolSize(CodecPool* pool)
+{
+  return (pool != NULL) ? pool->m_nThreads + 1 : 1;
+}
 
-  sha256(userPad, 32, digest);
-  for (k = 0; k < CODEC_SHA_ITER; ++k)
+/*
+// Runs xTask for items 0..nItems-1 and returns when all of them are done.
+// The calling thread takes part as worker 0. pool may be NULL. A pool may
+// be shared by several threads: a caller finding it busy with the run of
+// another one does all the work itself.
+*/
+void
+CodecPoolRun(CodecPool* pool, int nItems, CodecPoolTask xTask, void* pArg)
+{
+  int item;
+#if CODEC_THREADS
+  int busy = 1;
+  if (pool != NULL && pool->m_nThreads > 0 && nItems > 1)
   {
-    sha256(digest, KEYLENGTH, digest);
+    pthread_mutex_lock(&pool->m_mutex);
+    busy = pool->m_busy;
+    pool->m_busy = 1;
+    if (busy)
+    {
+      pthread_mutex_unlock(&pool->m_mutex);
+    }
   }
-  memcpy(encryptionKey, digest, keyLength);
-#else
-  unsigned char userPad[32];
-  unsigned char ownerPad[32];
-  unsigned char ownerKey[32];
+  if (busy)
+#endif
+  {
+    for (item = 0; item < nItems; item++)
+    {
+      xTask(pArg, 0, item);
+    }
+    return;
+  }
+#if CODEC_THREADS
+  pool->m_task = xTask;
+  pool->m_arg = pArg;
+  pool->m_nItems = nItems;
+  pool->m_next = 0;
+  pool->m_active = pool->m_nThreads;
+  pool->m_generation++;
+  pthread_cond_broadcast(&pool->m_start);
+  CodecPoolWork(pool, 0);
+  while (pool->m_active > 0)
+  {
+    pthread_cond_wait(&pool->m_done, &pool->m_mutex);
+  }
+  pool->m_busy = 0;
+  pthread_mutex_unlock(&pool->m_mutex);
+#endif
+}
 
-  unsigned char mkey[MD5_HASHBYTES];
-  unsigned char digest[MD5_HASHBYTES];
-  int keyLength = MD5_HASHBYTES;
-  int i, j, k;
-  MD5_CTX ctx;
+/*
+// The pool shared by all codecs of the process, created on first use with
+// a thread per additional CPU and kept until the process ends. A child
+// process does not inherit the threads, so after fork() the pool is left
+// behind and a new one created. Returns NULL if there is only one CPU or
+// the pool cannot be created.
+*/
+static CodecPool* codecPool = NULL;
+#if CODEC_THREADS
+static pid_t codecPoolPid = 0;
+#endif
 
-  /* Pad passwords */
-  CodecPadPassword(codec, userPassword, passwordLength, userPad);
-  CodecPadPassword(codec, "", 0, ownerPad);
+static CodecPool*
+CodecGetPool(void)
+{
+  CodecPool* pool;
+  if (CodecGetCpuCount() < 2)
+  {
+    return NULL;
+  }
+  sqlite3_mutex_enter(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+#if CODEC_THREADS
+  if (codecPool != NULL && codecPoolPid != getpid())
+  {
+    codecPool = NULL;
+  }
+#endif
+  if (codecPool == NULL)
+  {
+    codecPool = CodecPoolCreate(CodecGetCpuCount() - 1);
+#if CODEC_THREADS
+    codecPoolPid = getpid();
+#endif
+  }
+  pool = codecPool;
+  sqlite3_mutex_leave(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+  return pool;
+}
 
-  /* Compute owner key */
+/*
+// ----------------
+// Page batches
+// ----------------
+*/
 
-  MD5Init(&ctx);
-  MD5Update(&ctx, ownerPad, 32);
-  MD5Final(digest,&ctx);
+/*
+/// Worker codecs for spreading a batch over the threads of the shared pool.
+/// (For internal use only)
+/// Member j is used by worker j of the pool; worker 0, the caller, uses the
+/// codec itself. The members get the keys of the codec before each batch
+/// and keep their own key caches.
+*/
+typedef struct _CodecTeam
+{
+  Codec*     m_members[CODEC_MAX_THREADS+1];
+} CodecTeam;
 
-  /* only use for the input as many bit as the key consists of */
-  for (k = 0; k < 50; ++k)
+typedef struct _CodecBatch
+{
+  Codec*        m_codec;
+  CodecTeam*    m_team;
+  CodecPageRef* m_pages;
+  int           m_nPages;
+  int           m_len;
+  int           m_useWriteKey;
+  int           m_encrypt;
+  int           m_failed[CODEC_MAX_THREADS+1]; /* Pages failing authentication, per worker */
+} CodecBatch;
+
+static void
+CodecTeamFree(CodecTeam* team)
+{
+  int j;
+  if (team == NULL)
   {
-    MD5Init(&ctx);
-    MD5Update(&ctx, digest, keyLength);
-    MD5Final(digest,&ctx);
+    return;
   }
-  memcpy(ownerKey, userPad, 32);
-  for (i = 0; i < 20; ++i)
+  for (j = 1; j < CODEC_MAX_THREADS+1; j++)
   {
-    for (j = 0; j < keyLength ; ++j)
+    if (team->m_members[j] != NULL)
     {
-      mkey[j] = (digest[j] ^ i);
+      CodecTerm(team->m_members[j]);
+      sqlite3_free(team->m_members[j]);
     }
-    CodecRC4(codec, mkey, keyLength, ownerKey, 32, ownerKey);
   }
+  sqlite3_free(team);
+}
 
-  /* Compute encryption key */
-
-  MD5Init(&ctx);
-  MD5Update(&ctx, userPad, 32);
-  MD5Update(&ctx, ownerKey, 32);
-  MD5Final(digest,&ctx);
+/*
+// Create the team of a codec for the workers of pool on first use. Returns
+// NULL if the team cannot be set up; the batch then runs on the caller.
+*/
+static CodecTeam*
+CodecGetTeam(Codec* codec, CodecPool* pool)
+{
+  CodecTeam* team = codec->m_team;
+  int j, nWorkers;
 
-  /* only use the really needed bits as input for the hash */
-  for (k = 0; k < 50; ++k)
+  if (team != NULL)
   {
-    MD5Init(&ctx);
-    MD5Update(&ctx, digest, keyLength);
-    MD5Final(digest, &ctx);
+    return team;
   }
-  memcpy(encryptionKey, digest, keyLength);
-#endif  
+  team = (CodecTeam*) sqlite3_malloc(sizeof(CodecTeam));
+  if (team == NULL)
+  {
+    return NULL;
+  }
+  memset(team, 0, sizeof(CodecTeam));
+  nWorkers = CodecPoolSize(pool);
+  for (j = 1; j < nWorkers; j++)
+  {
+    team->m_members[j] = (Codec*) sqlite3_malloc(sizeof(Codec));
+    if (team->m_members[j] == NULL)
+    {
+      CodecTeamFree(team);
+      return NULL;
+    }
+    CodecInit(team->m_members[j]);
+  }
+  codec->m_team = team;
+  return team;
 }
 
+/*
+// Called when the page size changes: page buffers of another size are
+// released, they are allocated again at the new size when needed.
+*/
 void
-CodecEncrypt(Codec* codec, int page, unsigned char* data, int len, int useWriteKey)
+CodecSetPageSize(Codec* codec, int pageSize)
+{
+  int j;
+  for (j = 0; j < CODEC_RING_SIZE; j++)
+  {
+    if (codec->m_ringSizes[j] != pageSize)
+    {
+      CodecFreeRingBuffer(codec, j);
+    }
+  }
+  if (codec->m_zipSize > pageSize)
+  {
+    CodecFreeZip(codec);
+  }
+  if (codec->m_team != NULL)
+  {
+    for (j = 1; j < CODEC_MAX_THREADS+1; j++)
+    {
+      if (codec->m_team->m_members[j] != NULL)
+      {
+        CodecSetPageSize(codec->m_team->m_members[j], pageSize);
+      }
+    }
+  }
+}
+
+/*
+// Bytes allocated for a codec and its worker codecs, or only the part of
+// them in page buffers. The highwater mark is the sum of the highwater
+// marks, which may not all have been reached at the same time; reset sets
+// them to the current values.
+*/
+int
+CodecGetMemory(Codec* codec, int buffersOnly, int* highwater, int reset)
+{
+  int* used = (buffersOnly) ? &codec->m_bufferUsed : &codec->m_memoryUsed;
+  int* peak = (buffersOnly) ? &codec->m_bufferHighwater : &codec->m_memoryHighwater;
+  int current = *used;
+  int j, n;
+
+  *highwater = *peak;
+  if (reset)
+  {
+    *peak = *used;
+  }
+  if (codec->m_team != NULL)
+  {
+    if (!buffersOnly)
+    {
+      current += sizeof(CodecTeam);
+      *highwater += sizeof(CodecTeam);
+    }
+    for (j = 1; j < CODEC_MAX_THREADS+1; j++)
+    {
+      if (codec->m_team->m_members[j] != NULL)
+      {
+        current += CodecGetMemory(codec->m_team->m_members[j], buffersOnly, &n, reset);
+        *highwater += n;
+      }
+    }
+  }
+  return current;
+}
+
+/*
+// Derive the keys of a group of CODEC_HASH_LANES pages together, provided
+// that none of them is cached and that they use different cache entries.
+// Otherwise the keys are derived on demand.
+*/
+static void
+CodecPrepareGroupKeys(Codec* codec, CodecPageRef* group, int useWriteKey)
+{
+#if CODEC_KEYCACHE_SIZE > 0
+  unsigned char* key = (useWriteKey) ? codec->m_writeKey : codec->m_readKey;
+  const CodecCipher* cipher = (useWriteKey) ? codec->m_writeCipher : codec->m_readCipher;
+  int format = (useWriteKey) ? codec->m_writeFormat : codec->m_format;
+  int pages[CODEC_HASH_LANES];
+  int j, k;
+
+  if (format == CODEC_FORMAT_LZ4)
+  {
+    format = CODEC_FORMAT_CHACHA20;
+  }
+  if (cipher == NULL || (format != CODEC_FORMAT_CBC && format != CODEC_FORMAT_XEX &&
+                         format != CODEC_FORMAT_CHACHA20) || CodecGetKeyCache(codec) == NULL)
+  {
+    return;
+  }
+  for (k = 0; k < CODEC_HASH_LANES; k++)
+  {
+    pages[k] = group[k].m_page;
+    if (pages[k] <= 0 ||
+        CodecPageKeyMatches(&codec->m_keyCache[pages[k] & (CODEC_KEYCACHE_SIZE-1)], cipher, format, pages[k], key))
+    {
+      return;
+    }
+    for (j = 0; j < k; j++)
+    {
+      if (((pages[j] ^ pages[k]) & (CODEC_KEYCACHE_SIZE-1)) == 0)
+      {
+        return;
+      }
+    }
+  }
+  CodecPreparePageKeys(codec, cipher, format, key, pages);
+#endif
+}
+
+/*
+// CBC encryption of a group of CODEC_HASH_LANES pages with interleaved
+// AES. Returns 0 if the pages have to be encrypted one by one, i.e. for the
+// other formats or if the page keys cannot be held in the cache together.
+*/
+static int
+CodecEncryptGroup(Codec* codec, CodecPageRef* group, int len, int useWriteKey)
 {
+#if CODEC_KEYCACHE_SIZE > 0
   unsigned char* key = (useWriteKey) ? codec->m_writeKey : codec->m_readKey;
-  CodecAES(codec, page, 1, key, data, len, data);
+  const CodecCipher* cipher = (useWriteKey) ? codec->m_writeCipher : codec->m_readCipher;
+  int format = (useWriteKey) ? codec->m_writeFormat : codec->m_format;
+  Rijndael* aes[CODEC_HASH_LANES];
+  unsigned char* data[CODEC_HASH_LANES];
+  CodecPageKey* entry;
+  int j, k;
+
+  if (format != CODEC_FORMAT_CBC || CODEC_HASH_LANES != RIJNDAEL_STREAMS)
+  {
+    return 0;
+  }
+  for (k = 0; k < CODEC_HASH_LANES; k++)
+  {
+    for (j = 0; j < k; j++)
+    {
+      if (((group[j].m_page ^ group[k].m_page) & (CODEC_KEYCACHE_SIZE-1)) == 0)
+      {
+        return 0;
+      }
+    }
+  }
+  for (k = 0; k < CODEC_HASH_LANES; k++)
+  {
+    entry = CodecGetPageKey(codec, cipher, format, group[k].m_page, key);
+    if (entry == NULL)
+    {
+      return 0;
+    }
+    aes[k] = &entry->m_encrypt;
+    data[k] = group[k].m_data;
+  }
+  RijndaelBlockEncrypt4(aes, data, len*8, data);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/*
+// Encrypt or decrypt up to CODEC_HASH_LANES pages of a batch.
+// Returns the number of pages that failed authentication.
+*/
+static int
+CodecProcessGroup(Codec* codec, CodecPageRef* group, int nGroup, int len, int useWriteKey, int encrypt)
+{
+  int failed = 0;
+  int k;
+
+  if (nGroup == CODEC_HASH_LANES)
+  {
+    CodecPrepareGroupKeys(codec, group, useWriteKey);
+    if (encrypt && CodecEncryptGroup(codec, group, len, useWriteKey))
+    {
+      return 0;
+    }
+  }
+  for (k = 0; k < nGroup; k++)
+  {
+    if (encrypt)
+    {
+      CodecEncrypt(codec, group[k].m_page, group[k].m_data, len, useWriteKey);
+    }
+    else if (!CodecDecrypt(codec, group[k].m_page, group[k].m_data, len, useWriteKey))
+    {
+      failed++;
+    }
+  }
+  return failed;
+}
+
+static void
+CodecBatchTask(void* pArg, int worker, int group)
+{
+  CodecBatch* batch = (CodecBatch*) pArg;
+  Codec* codec = (worker == 0) ? batch->m_codec : batch->m_team->m_members[worker];
+  int first = group * CODEC_HASH_LANES;
+  int count = batch->m_nPages - first;
+
+  if (count > CODEC_HASH_LANES) count = CODEC_HASH_LANES;
+  batch->m_failed[worker] += CodecProcessGroup(codec, batch->m_pages + first, count, batch->m_len,
+                                               batch->m_useWriteKey, batch->m_encrypt);
+}
 
+/*
+// Process the pages of a batch in groups of CODEC_HASH_LANES pages, on the
+// shared pool with the team of the codec if the batch is large enough.
+// Returns the number of pages that failed authentication.
+*/
+static int
+CodecProcessPages(Codec* codec, CodecPageRef* pages, int nPages, int len, int useWriteKey, int encrypt)
+{
+  CodecBatch batch;
+  CodecPool* pool = NULL;
+  CodecTeam* team = NULL;
+  Codec* member;
+  int nGroups = (nPages + CODEC_HASH_LANES - 1) / CODEC_HASH_LANES;
+  int j, nWorkers = 1, failed = 0;
+
+  if (nGroups > 1 && (sqlite3_int64) nPages * len >= CODEC_BATCH_PARALLEL &&
+      (pool = CodecGetPool()) != NULL)
+  {
+    team = CodecGetTeam(codec, pool);
+  }
+  if (team != NULL)
+  {
+    nWorkers = CodecPoolSize(pool);
+    for (j = 1; j < nWorkers; j++)
+    {
+      CodecCopy(team->m_members[j], codec);
+    }
+  }
+  memset(&batch, 0, sizeof(batch));
+  batch.m_codec = codec;
+  batch.m_team = team;
+  batch.m_pages = pages;
+  batch.m_nPages = nPages;
+  batch.m_len = len;
+  batch.m_useWriteKey = useWriteKey;
+  batch.m_encrypt = encrypt;
+  CodecPoolRun((team != NULL) ? pool : NULL, nGroups, CodecBatchTask, &batch);
+
+  for (j = 0; j < nWorkers; j++)
+  {
+    failed += batch.m_failed[j];
+    if (j > 0)
+    {
+      /* Account the work of the members to the codec */
+      member = team->m_members[j];
+      codec->m_keyCacheHits += member->m_keyCacheHits;
+      codec->m_keyCacheMisses += member->m_keyCacheMisses;
+      codec->m_authFailures += member->m_authFailures;
+      member->m_keyCacheHits = 0;
+      member->m_keyCacheMisses = 0;
+      member->m_authFailures = 0;
+    }
+  }
+  return failed;
 }
 
+/*
+// Encrypt the pages of a batch in place. Page keys are derived
+// CODEC_HASH_LANES pages at a time, CBC pages are encrypted with
+// interleaved AES, and large batches are spread over worker threads.
+*/
 void
-CodecDecrypt(Codec* codec, int page, unsigned char* data, int len)
+CodecEncryptPages(Codec* codec, CodecPageRef* pages, int nPages, int len, int useWriteKey)
 {
-  CodecAES(codec, page, 0, codec->m_readKey, data, len, data);
+  CodecProcessPages(codec, pages, nPages, len, useWriteKey, 1);
 }
 
+/*
+// Decrypt the pages of a batch in place, like CodecDecrypt for each page.
+// Returns the number of pages that failed authentication.
+*/
+int
+CodecDecryptPages(Codec* codec, CodecPageRef* pages, int nPages, int len, int useWriteKey)
+{
+  return CodecProcessPages(codec, pages, nPages, len, useWriteKey, 0);
+}
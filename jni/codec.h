@@ -38,46 +38,269 @@ extern "C" {
 #endif
 
 #include "rijndael.h"
+#include "chacha20.h"
+#include "gcm.h"
+#include "lz4.h"
 
 #define CODEC_TYPE_AES128 1
 #define CODEC_TYPE_AES256 2
 
+/*
+// CODEC_TYPE selects the cipher used for keys that do not name one (see
+// CodecParseKey); the other ciphers are available at runtime as well.
+*/
 #ifndef CODEC_TYPE
 #define CODEC_TYPE CODEC_TYPE_AES128
 #endif
 
-#if CODEC_TYPE == CODEC_TYPE_AES256
+/*
+// Key buffers have room for the longest key of all ciphers
+*/
 #define KEYLENGTH 32
 #define CODEC_SHA_ITER 4001
-#else
-#define KEYLENGTH 16
+
+/*
+// Page formats. The format is chosen when a database is created, changed by
+// a rekey with a cipher prefix, and detected from page 1 on open: only the
+// right format decrypts page 1 to a database header. GCM pages that were
+// modified, or moved to another page number, fail the tag check when they
+// are loaded. LZ4 pages keep their full size in the file, so only a
+// compressing file system or backup shrinks the zeros, and the length of a
+// compressed page, i.e. how well its content compresses, is visible.
+*/
+#define CODEC_FORMAT_CBC      0 /* AES-CBC under a page key, the original format */
+#define CODEC_FORMAT_XEX      1 /* AES blocks whitened by a page key tweak, encrypted independently */
+#define CODEC_FORMAT_CHACHA20 2 /* ChaCha20, per-write nonce in the reserved bytes */
+#define CODEC_FORMAT_XTS      3 /* AES-XTS, page number as tweak, keys expanded once per database */
+#define CODEC_FORMAT_GCM      4 /* AES-GCM, random nonce and tag, rekey before 2^32 writes */
+#define CODEC_FORMAT_LZ4      5 /* ChaCha20 of the LZ4-compressed page, zeros up to the reserved bytes */
+#define CODEC_FORMAT_COUNT    6
+
+/*
+// Reserved bytes per page needed by the ChaCha20 format (nonce), by the
+// GCM format (nonce and tag) and by the LZ4 format (length and nonce)
+*/
+#define CODEC_CHACHA20_NONCE CHACHA20_NONCE_LENGTH
+#define CODEC_GCM_RESERVE    (GCM_NONCE_LENGTH + GCM_TAG_LENGTH)
+#define CODEC_LZ4_RESERVE    (4 + CHACHA20_NONCE_LENGTH)
+
+#ifndef CODEC_FORMAT_DEFAULT
+#define CODEC_FORMAT_DEFAULT CODEC_FORMAT_CBC
 #endif
 
-typedef struct _Codec
+typedef struct _Codec Codec;
+
+/*
+// Number of page keys derived together by the multi-buffer hashes
+// (m_hash4 of a cipher, see CodecPrepareKeys)
+*/
+#define CODEC_HASH_LANES 4
+
+/*
+/// Cipher implementation. (For internal use only)
+/// A cipher determines the key length, how the database key is derived from
+/// the password, how the page keys are derived from the database key, and
+/// the page format of new databases. Existing databases keep their format.
+*/
+typedef struct _CodecCipher
+{
+  const char* m_name;
+  int         m_keyLength;
+  int         m_format;
+  void (*m_generateKey)(Codec* codec, char* userPassword, int passwordLength,
+                        unsigned char encryptionKey[KEYLENGTH]);
+  void (*m_hash)(Codec* codec, unsigned char* data, int length, unsigned char* digest);
+  void (*m_hash4)(Codec* codec, unsigned char* data[CODEC_HASH_LANES], int length,
+                  unsigned char* digest[CODEC_HASH_LANES]);
+} CodecCipher;
+
+/*
+// Number of expanded per-page key schedules kept per codec.
+// Must be a power of two; 0 disables the cache.
+*/
+#ifndef CODEC_KEYCACHE_SIZE
+#define CODEC_KEYCACHE_SIZE 32
+#endif
+
+/*
+// On disk, page 1 of a database with an incomplete incremental rekey has
+// this header instead of "SQLite format 3", followed by the 4 byte mark
+// (see codecext.c). Connections that do not take part in the rekey thus
+// see no database rather than pages under two keys.
+*/
+#define CODEC_REKEY_HEADER        "SQLite rekey"
+#define CODEC_REKEY_HEADER_LENGTH 12
+
+/*
+// Number of derived database keys kept process-wide, so that opening a
+// database again with the same password skips the key derivation. The
+// cache is off until CodecSetKdfCache enables it; 0 compiles it out.
+*/
+#ifndef CODEC_KDF_CACHE_SIZE
+#define CODEC_KDF_CACHE_SIZE 8
+#endif
+
+/*
+/// Cached key state for one page. (For internal use only)
+/// The entry is valid for the database key it was derived from; the
+/// decryption schedule is derived from the encryption schedule on demand.
+/// The AES schedules are not set up for the ChaCha20 format.
+*/
+typedef struct _CodecPageKey
+{
+  int           m_page;  /* Page number, 0 if the entry is unused */
+  int           m_hasDecrypt;
+  int           m_format;
+  const CodecCipher* m_cipher;
+  unsigned char m_key[KEYLENGTH];
+  unsigned char m_pageKey[KEYLENGTH];
+  Rijndael      m_encrypt;
+  Rijndael      m_decrypt;
+} CodecPageKey;
+
+/*
+/// Keys of the XTS or GCM format, expanded once per database key. (For internal use only)
+*/
+typedef struct _CodecDbKey
+{
+  const CodecCipher* m_cipher;  /* NULL if the entry is unused */
+  int           m_format;
+  unsigned char m_key[KEYLENGTH];
+  Rijndael      m_encrypt;      /* XTS */
+  Rijndael      m_decrypt;      /* XTS */
+  Rijndael      m_tweak;        /* XTS */
+  GcmKey        m_gcm;          /* GCM */
+} CodecDbKey;
+
+/*
+// Number of output buffers of CodecGetPageBuffer. A buffer returned by it
+// stays valid while the next CODEC_RING_SIZE-1 buffers are handed out.
+*/
+#ifndef CODEC_RING_SIZE
+#define CODEC_RING_SIZE 4
+#endif
+
+struct _Codec
 {
   int           m_isEncrypted;
+  int           m_format;         /* Page format of the read key */
+  int           m_writeFormat;    /* Page format of the write key, differs while migrating */
+  int           m_reserve;        /* Reserved bytes per page, as reported by the pager */
   int           m_hasReadKey;
+  const CodecCipher* m_readCipher;
   unsigned char m_readKey[KEYLENGTH];
   int           m_hasWriteKey;
+  const CodecCipher* m_writeCipher;
   unsigned char m_writeKey[KEYLENGTH];
   Rijndael*     m_aes;
 
+  CodecPageKey* m_keyCache;       /* Direct-mapped by page number */
+  sqlite3_int64 m_keyCacheHits;
+  sqlite3_int64 m_keyCacheMisses;
+  CodecDbKey    m_dbKeys[2];      /* Read and write key while rekeying */
+  sqlite3_int64 m_authFailures;   /* Pages that failed the GCM tag check */
+
+  struct _CodecTeam* m_team;      /* Worker codecs for large page batches, else NULL */
+  struct _CodecRekey* m_rekey;    /* Staged pages while rekeying, else NULL */
+  struct _CodecRekeyStep* m_rekeyStep; /* Incremental rekey in progress, else NULL */
+  unsigned char* m_zip;           /* Compressed page of the LZ4 format, allocated on first use */
+  int           m_zipSize;
+
   Btree*        m_bt; /* Pointer to B-tree used by DB */
-  unsigned char m_page[SQLITE_MAX_PAGE_SIZE+8];
-} Codec;
+  unsigned char* m_ring[CODEC_RING_SIZE]; /* Output buffers, allocated on first use */
+  int           m_ringSizes[CODEC_RING_SIZE]; /* Page size each buffer has room for */
+  int           m_ringNext;
+
+  int           m_memoryUsed;     /* Bytes allocated for the codec, see CodecGetMemory */
+  int           m_memoryHighwater;
+  int           m_bufferUsed;     /* Part of it in page buffers */
+  int           m_bufferHighwater;
+};
+
+/*
+// Worker threads used to spread page encryption over several cores.
+// Disabled on Windows and when CODEC_NO_THREADS is defined; the pool then
+// runs all tasks on the calling thread.
+*/
+#if !defined(CODEC_NO_THREADS) && !defined(_WIN32)
+#define CODEC_THREADS 1
+#else
+#define CODEC_THREADS 0
+#endif
+
+/*
+// Upper limit for the number of worker threads of a pool.
+*/
+#ifndef CODEC_MAX_THREADS
+#define CODEC_MAX_THREADS 8
+#endif
+
+typedef struct _CodecPool CodecPool;
+
+/*
+// A page of a batch for CodecEncryptPages/CodecDecryptPages
+*/
+typedef struct _CodecPageRef
+{
+  int            m_page;
+  unsigned char* m_data;
+} CodecPageRef;
+
+/*
+// Batches of at least this many bytes are spread over worker threads
+*/
+#ifndef CODEC_BATCH_PARALLEL
+#define CODEC_BATCH_PARALLEL (64*1024)
+#endif
+
+/*
+// Task run for each item of a CodecPoolRun call. worker identifies the
+// thread (0 is the caller, 1..CodecPoolSize()-1 the pool threads), so that
+// tasks can use per-worker state without locking.
+*/
+typedef void (*CodecPoolTask)(void* pArg, int worker, int item);
 
 void CodecInit(Codec* codec);
 void CodecTerm(Codec* codec);
 
 void CodecCopy(Codec* codec, Codec* other);
 
+const CodecCipher* CodecFindCipher(const char* name, int nameLength);
+const CodecCipher* CodecGetDefaultCipher(void);
+const CodecCipher* CodecParseKey(const char** key, int* keyLength);
+
+void CodecSetReadCipher(Codec* codec, const CodecCipher* cipher);
+void CodecSetWriteCipher(Codec* codec, const CodecCipher* cipher);
+const CodecCipher* CodecGetReadCipher(Codec* codec);
+const CodecCipher* CodecGetWriteCipher(Codec* codec);
+
 void CodecGenerateReadKey(Codec* codec, char* userPassword, int passwordLength);
 
 void CodecGenerateWriteKey(Codec* codec, char* userPassword, int passwordLength);
 
+void CodecSetRawReadKey(Codec* codec, const unsigned char* key, int keyLength);
+
+void CodecDeriveKey(Codec* codec, const CodecCipher* cipher, char* userPassword, int passwordLength,
+                    unsigned char encryptionKey[KEYLENGTH]);
+
+void CodecSetKdfCache(int enable);
+
 void CodecEncrypt(Codec* codec, int page, unsigned char* data, int len, int useWriteKey);
 
-void CodecDecrypt(Codec* codec, int page, unsigned char* data, int len);
+void CodecEncryptTo(Codec* codec, int page, const unsigned char* in, unsigned char* out, int len,
+                    int useWriteKey);
+
+int CodecDecrypt(Codec* codec, int page, unsigned char* data, int len, int useWriteKey);
+
+int CodecProbeFirstPage(Codec* codec, unsigned char* data, int len, int useWriteKey);
+
+void CodecDecryptFirstPage(Codec* codec, unsigned char* data, int len, int useWriteKey);
+
+void CodecPrepareKeys(Codec* codec, int page, int nPages, int useWriteKey);
+
+void CodecEncryptPages(Codec* codec, CodecPageRef* pages, int nPages, int len, int useWriteKey);
+
+int CodecDecryptPages(Codec* codec, CodecPageRef* pages, int nPages, int len, int useWriteKey);
 
 void CodecCopyKey(Codec* codec, int read2write);
 
@@ -85,16 +308,38 @@ void CodecSetIsEncrypted(Codec* codec, int isEncrypted);
 void CodecSetHasReadKey(Codec* codec, int hasReadKey);
 void CodecSetHasWriteKey(Codec* codec, int hasWriteKey);
 void CodecSetBtree(Codec* codec, Btree* bt);
+void CodecSetFormat(Codec* codec, int format);
+void CodecSetWriteFormat(Codec* codec, int format);
+void CodecSetReserve(Codec* codec, int reserve);
+void CodecSetPageSize(Codec* codec, int pageSize);
 
 int CodecIsEncrypted(Codec* codec);
 int CodecHasReadKey(Codec* codec);
 int CodecHasWriteKey(Codec* codec);
 Btree* CodecGetBtree(Codec* codec);
-unsigned char* CodecGetPageBuffer(Codec* codec);
+int CodecGetFormat(Codec* codec);
+int CodecGetWriteFormat(Codec* codec);
+int CodecGetReserve(Codec* codec);
+int CodecGetFormatReserve(int format);
+unsigned char* CodecGetPageBuffer(Codec* codec, int len);
+
+CodecPool* CodecPoolCreate(int nThreads);
+void CodecPoolDestroy(CodecPool* pool);
+int CodecPoolSize(CodecPool* pool);
+void CodecPoolRun(CodecPool* pool, int nItems, CodecPoolTask xTask, void* pArg);
+int CodecGetCpuCount(void);
+
+void CodecClearKeyCache(Codec* codec);
+void CodecGetKeyCacheStats(Codec* codec, sqlite3_int64* hits, sqlite3_int64* misses);
+sqlite3_int64 CodecGetAuthFailures(Codec* codec);
+int CodecGetMemory(Codec* codec, int buffersOnly, int* highwater, int reset);
 
 void CodecGenerateEncryptionKey(Codec* codec, char* userPassword, int passwordLength, 
                                 unsigned char encryptionKey[KEYLENGTH]);
 
+void CodecGenerateEncryptionKeySHA(Codec* codec, char* userPassword, int passwordLength,
+                                   unsigned char encryptionKey[KEYLENGTH]);
+
 void CodecPadPassword(Codec* codec, char* password, int pswdlen, unsigned char pswd[32]);
 
 void CodecRC4(Codec* codec, unsigned char* key, int keylen,
@@ -103,13 +348,34 @@ void CodecRC4(Codec* codec, unsigned char* key, int keylen,
 
 void CodecGetMD5Binary(Codec* codec, unsigned char* data, int length, unsigned char* digest);
 
-#if CODEC_TYPE == CODEC_TYPE_AES256
 void CodecGetSHABinary(Codec* codec, unsigned char* data, int length, unsigned char* digest);
-#endif
+
+void CodecGetMD5Binary4(Codec* codec, unsigned char* data[CODEC_HASH_LANES], int length,
+                        unsigned char* digest[CODEC_HASH_LANES]);
+
+void CodecGetSHABinary4(Codec* codec, unsigned char* data[CODEC_HASH_LANES], int length,
+                        unsigned char* digest[CODEC_HASH_LANES]);
   
 void CodecGenerateInitialVector(Codec* codec, int seed, unsigned char iv[16]);
 
-void CodecAES(Codec* codec, int page, int encrypt, unsigned char encryptionKey[KEYLENGTH],
+void CodecAES(Codec* codec, const CodecCipher* cipher, int format, int page, int encrypt,
+              unsigned char encryptionKey[KEYLENGTH],
               unsigned char* datain, int datalen, unsigned char* dataout);
 
+void CodecXTS(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+              unsigned char encryptionKey[KEYLENGTH],
+              unsigned char* datain, int datalen, unsigned char* dataout);
+
+void CodecChaCha20(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+                   unsigned char encryptionKey[KEYLENGTH],
+                   unsigned char* datain, int datalen, unsigned char* dataout);
+
+int CodecLz4(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+             unsigned char encryptionKey[KEYLENGTH],
+             unsigned char* datain, int datalen, unsigned char* dataout);
+
+int CodecGCM(Codec* codec, const CodecCipher* cipher, int page, int encrypt,
+             unsigned char encryptionKey[KEYLENGTH],
+             unsigned char* datain, int datalen, unsigned char* dataout);
+
 #endif
@@ -15,6 +15,7 @@ void sqlite3CodecFree(void *pCodecArg)
 {
   if (pCodecArg)
   {
+    sqlite3_free(((Codec*) pCodecArg)->m_rekeyStep);
     CodecTerm(pCodecArg);
     sqlite3_free(pCodecArg);
   }
@@ -22,6 +23,332 @@ void sqlite3CodecFree(void *pCodecArg)
 
 void sqlite3CodecSizeChange(void *pArg, int pageSize, int reservedSize)
 {
+  if (pArg != NULL)
+  {
+    CodecSetReserve((Codec*) pArg, reservedSize);
+    CodecSetPageSize((Codec*) pArg, pageSize);
+  }
+}
+
+/*
+// Rekeying reads and rewrites every page of the database. To take the
+// cryptography off the pager's single thread, sqlite3_rekey_v2 reads the
+// database file in batches and decrypts each batch with CodecDecryptPages
+// before the pager asks for the pages; when the pager writes pages back,
+// the pages following the requested one are encrypted as a batch as well.
+// A staged result is only used if the buffer handed in by the pager
+// matches the staged input byte for byte, otherwise the codec falls back
+// to its normal path. In WAL mode the current version of a page may be in
+// the WAL rather than the database file, so nothing is staged.
+*/
+
+/* Bytes of page data staged per batch */
+#ifndef CODEC_REKEY_BATCH_SIZE
+#define CODEC_REKEY_BATCH_SIZE (256*1024)
+#endif
+
+typedef struct _CodecRekeyBatch
+{
+  Pgno           m_first;   /* First page number of the batch */
+  int            m_count;   /* Number of pages staged */
+  unsigned char* m_valid;   /* Nonzero if the page was staged */
+  unsigned char* m_in;      /* Pages as read from disk, resp. as given to mode 6 */
+  unsigned char* m_out;     /* Pages decrypted with the read key, resp. encrypted with the write key */
+} CodecRekeyBatch;
+
+typedef struct _CodecRekey
+{
+  Codec*          m_codec;
+  Pager*          m_pager;
+  int             m_pageSize;
+  int             m_nBatch;   /* Pages per batch */
+  CodecPageRef*   m_refs;     /* Staged pages handed to the batch codec */
+  CodecRekeyBatch m_read;
+  CodecRekeyBatch m_write;
+} CodecRekey;
+
+static void CodecRekeyFree(CodecRekey* rekey)
+{
+  if (rekey == NULL)
+  {
+    return;
+  }
+  sqlite3_free(rekey->m_refs);
+  sqlite3_free(rekey->m_read.m_valid);
+  sqlite3_free(rekey->m_read.m_in);
+  sqlite3_free(rekey->m_read.m_out);
+  sqlite3_free(rekey->m_write.m_valid);
+  sqlite3_free(rekey->m_write.m_in);
+  sqlite3_free(rekey->m_write.m_out);
+  sqlite3_free(rekey);
+}
+
+static int CodecRekeyBatchAlloc(CodecRekeyBatch* batch, int nBatch, int pageSize)
+{
+  batch->m_valid = (unsigned char*) sqlite3_malloc(nBatch);
+  batch->m_in  = (unsigned char*) sqlite3_malloc(nBatch * pageSize);
+  batch->m_out = (unsigned char*) sqlite3_malloc(nBatch * pageSize);
+  batch->m_count = 0;
+  return (batch->m_valid != NULL && batch->m_in != NULL && batch->m_out != NULL);
+}
+
+/*
+// Sets up the staging area for rekeying the database of codec.
+// Returns NULL in WAL mode or if it cannot be allocated; the rekey then
+// runs sequentially.
+*/
+static CodecRekey* CodecRekeyCreate(Codec* codec, Pager* pPager, int pageSize)
+{
+  CodecRekey* rekey;
+  if (sqlite3PagerGetJournalMode(pPager) == PAGER_JOURNALMODE_WAL)
+  {
+    return NULL;
+  }
+  rekey = (CodecRekey*) sqlite3_malloc(sizeof(CodecRekey));
+  if (rekey == NULL)
+  {
+    return NULL;
+  }
+  memset(rekey, 0, sizeof(CodecRekey));
+  rekey->m_codec = codec;
+  rekey->m_pager = pPager;
+  rekey->m_pageSize = pageSize;
+  rekey->m_nBatch = CODEC_REKEY_BATCH_SIZE / pageSize;
+  if (rekey->m_nBatch < 4) rekey->m_nBatch = 4;
+
+  rekey->m_refs = (CodecPageRef*) sqlite3_malloc(rekey->m_nBatch * sizeof(CodecPageRef));
+  if (rekey->m_refs == NULL ||
+      !CodecRekeyBatchAlloc(&rekey->m_read, rekey->m_nBatch, pageSize) ||
+      !CodecRekeyBatchAlloc(&rekey->m_write, rekey->m_nBatch, pageSize))
+  {
+    CodecRekeyFree(rekey);
+    return NULL;
+  }
+  return rekey;
+}
+
+/*
+// Copies the staged pages of a batch to the output area and returns them
+// as the page list for the batch codec
+*/
+static int CodecRekeyStage(CodecRekey* rekey, CodecRekeyBatch* batch)
+{
+  int pageSize = rekey->m_pageSize;
+  int j, nRefs = 0;
+
+  for (j = 0; j < batch->m_count; j++)
+  {
+    if (batch->m_valid[j])
+    {
+      memcpy(batch->m_out + j * pageSize, batch->m_in + j * pageSize, pageSize);
+      rekey->m_refs[nRefs].m_page = (int) (batch->m_first + j);
+      rekey->m_refs[nRefs].m_data = batch->m_out + j * pageSize;
+      nRefs++;
+    }
+  }
+  return nRefs;
+}
+
+/*
+// Reads pages first..first+count-1 from the database file with a single
+// read and decrypts those not already in the page cache.
+*/
+static void CodecRekeyLoad(CodecRekey* rekey, Pgno first, int count, Pgno nSkip)
+{
+  CodecRekeyBatch* batch = &rekey->m_read;
+  sqlite3_file* fd = sqlite3PagerFile(rekey->m_pager);
+  i64 offset = ((i64) first - 1) * rekey->m_pageSize;
+  i64 fileSize = 0;
+  DbPage* pPage;
+  int j, rc;
+
+  batch->m_count = 0;
+  if (fd->pMethods == NULL || sqlite3OsFileSize(fd, &fileSize) != SQLITE_OK)
+  {
+    return;
+  }
+  if (count > rekey->m_nBatch) count = rekey->m_nBatch;
+  if (offset + (i64) count * rekey->m_pageSize > fileSize)
+  {
+    count = (int) ((fileSize - offset) / rekey->m_pageSize);
+  }
+  if (count <= 0)
+  {
+    return;
+  }
+  rc = sqlite3OsRead(fd, batch->m_in, count * rekey->m_pageSize, offset);
+  if (rc != SQLITE_OK)
+  {
+    return;
+  }
+  batch->m_first = first;
+  batch->m_count = count;
+  for (j = 0; j < count; j++)
+  {
+    pPage = sqlite3PagerLookup(rekey->m_pager, first + j);
+    batch->m_valid[j] = (pPage == NULL && first + j != nSkip);
+    if (pPage != NULL)
+    {
+      sqlite3PagerUnref(pPage);
+    }
+  }
+  CodecDecryptPages(rekey->m_codec, rekey->m_refs, CodecRekeyStage(rekey, batch), rekey->m_pageSize, 0);
+}
+
+/*
+// Mode 3: returns the staged plaintext if data is the staged disk image
+*/
+static unsigned char* CodecRekeyGetRead(CodecRekey* rekey, Pgno nPageNum, unsigned char* data)
+{
+  CodecRekeyBatch* batch = &rekey->m_read;
+  int j = (int) (nPageNum - batch->m_first);
+  int pageSize = rekey->m_pageSize;
+  if (nPageNum >= batch->m_first && j < batch->m_count && batch->m_valid[j] &&
+      memcmp(data, batch->m_in + j * pageSize, pageSize) == 0)
+  {
+    return batch->m_out + j * pageSize;
+  }
+  return NULL;
+}
+
+/*
+// Mode 7: the journal gets the page encrypted with the read key, which is
+// the staged disk image as long as the page has not been modified
+*/
+static unsigned char* CodecRekeyGetJournal(CodecRekey* rekey, Pgno nPageNum, unsigned char* data)
+{
+  CodecRekeyBatch* batch = &rekey->m_read;
+  int j = (int) (nPageNum - batch->m_first);
+  int pageSize = rekey->m_pageSize;
+  if (nPageNum >= batch->m_first && j < batch->m_count && batch->m_valid[j] &&
+      memcmp(data, batch->m_out + j * pageSize, pageSize) == 0)
+  {
+    return batch->m_in + j * pageSize;
+  }
+  return NULL;
+}
+
+/*
+// Mode 6: returns the page encrypted with the write key. On a miss the
+// dirty pages following nPageNum in the page cache are encrypted as well,
+// as the pager writes pages in ascending order.
+*/
+static unsigned char* CodecRekeyGetWrite(CodecRekey* rekey, Pgno nPageNum, unsigned char* data)
+{
+  CodecRekeyBatch* batch = &rekey->m_write;
+  int j = (int) (nPageNum - batch->m_first);
+  int pageSize = rekey->m_pageSize;
+  DbPage* pPage;
+
+  if (nPageNum < batch->m_first || j >= batch->m_count || !batch->m_valid[j])
+  {
+    batch->m_first = nPageNum;
+    batch->m_count = rekey->m_nBatch;
+    memcpy(batch->m_in, data, pageSize);
+    batch->m_valid[0] = 1;
+    for (j = 1; j < batch->m_count; j++)
+    {
+      pPage = sqlite3PagerLookup(rekey->m_pager, nPageNum + j);
+      batch->m_valid[j] = (pPage != NULL && (((PgHdr*) pPage)->flags & PGHDR_DIRTY) != 0);
+      if (batch->m_valid[j])
+      {
+        memcpy(batch->m_in + j * pageSize, sqlite3PagerGetData(pPage), pageSize);
+      }
+      if (pPage != NULL)
+      {
+        sqlite3PagerUnref(pPage);
+      }
+    }
+    CodecEncryptPages(rekey->m_codec, rekey->m_refs, CodecRekeyStage(rekey, batch), pageSize, 1);
+    j = 0;
+  }
+  if (memcmp(data, batch->m_in + j * pageSize, pageSize) != 0)
+  {
+    return NULL;
+  }
+  batch->m_valid[j] = 0;
+  return batch->m_out + j * pageSize;
+}
+
+/*
+// Incremental rekeying (sqlite3_rekey_begin/sqlite3_rekey_step).
+// Each step moves a range of pages to the write key in its own transaction.
+// Pages 2..mark are stored with the write key; page 1 and the pages after
+// the mark still use the read key. The mark is stored in page 1 on disk:
+// CODEC_REKEY_HEADER and the mark replace the first 16 bytes of the
+// header, the "SQLite format 3" magic, when page 1 is encrypted (mode 6,
+// and mode 7 with the committed mark for the journal), and the magic is
+// put back when it is decrypted, so the pager never sees the mark and it
+// is committed atomically with the pages of each step. A connection
+// without a rekey step gets no magic and fails with SQLITE_NOTADB instead
+// of reading pages under the wrong key. Page 1 moves to the write key in
+// the last step, which also drops the mark.
+*/
+
+typedef struct _CodecRekeyStep
+{
+  Pgno           m_mark;      /* Committed high-water mark */
+  Pgno           m_target;    /* Mark committed by the running step, m_mark otherwise */
+  int            m_final;     /* The running step also moves page 1 to the write key */
+  Pgno           m_pageCount; /* Database size seen by the last step */
+  unsigned char* m_spilled;   /* Pages m_mark+1..m_target written during the step */
+} CodecRekeyStep;
+
+/* The mark of a decrypted page 1, 0 if there is none */
+static Pgno CodecRekeyGetMark(const unsigned char* page1)
+{
+  return (memcmp(page1, CODEC_REKEY_HEADER, CODEC_REKEY_HEADER_LENGTH) == 0)
+         ? sqlite3Get4byte(page1 + CODEC_REKEY_HEADER_LENGTH) : 0;
+}
+
+/*
+// Encrypts page 1 with the mark in place of the magic into a page buffer,
+// the pager's page stays unchanged. Returns NULL if out of memory.
+*/
+static unsigned char* CodecRekeyPutMark(Codec* codec, const unsigned char* page1, int pageSize, Pgno mark,
+                                        int useWriteKey)
+{
+  unsigned char* pageBuffer = CodecGetPageBuffer(codec, pageSize);
+  if (pageBuffer != NULL)
+  {
+    memcpy(pageBuffer, page1, pageSize);
+    memcpy(pageBuffer, CODEC_REKEY_HEADER, CODEC_REKEY_HEADER_LENGTH);
+    sqlite3Put4byte(pageBuffer + CODEC_REKEY_HEADER_LENGTH, mark);
+    CodecEncrypt(codec, 1, pageBuffer, pageSize, useWriteKey);
+  }
+  return pageBuffer;
+}
+
+/* Nonzero if the page is currently stored with the write key */
+static int CodecRekeyStepStored(CodecRekeyStep* step, Pgno nPageNum)
+{
+  Pgno j;
+  if (nPageNum == 1)
+  {
+    return 0;
+  }
+  if (nPageNum <= step->m_mark)
+  {
+    return 1;
+  }
+  if (step->m_spilled != NULL && nPageNum <= step->m_target)
+  {
+    j = nPageNum - step->m_mark - 1;
+    return (step->m_spilled[j / 8] >> (j % 8)) & 1;
+  }
+  return 0;
+}
+
+/* Nonzero if the page has to be written with the write key */
+static int CodecRekeyStepWrite(CodecRekeyStep* step, Pgno nPageNum)
+{
+  if (step->m_spilled != NULL && nPageNum > step->m_mark && nPageNum <= step->m_target)
+  {
+    /* Written before commit: later reloads in this step must use the write key */
+    Pgno j = nPageNum - step->m_mark - 1;
+    step->m_spilled[j / 8] |= (unsigned char) (1 << (j % 8));
+  }
+  return (nPageNum == 1) ? step->m_final : (nPageNum <= step->m_target);
 }
 
 /*
@@ -30,7 +357,9 @@ void sqlite3CodecSizeChange(void *pArg, int pageSize, int reservedSize)
 void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
 {
   Codec* codec = NULL;
+  CodecRekeyStep* step;
   int pageSize;
+  int useWriteKey;
   if (pCodecArg == NULL)
   {
     return data;
@@ -42,25 +371,93 @@ void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
   }
   
   pageSize = sqlite3BtreeGetPageSize(CodecGetBtree(codec));
+  step = codec->m_rekeyStep;
+
+  if ((nMode == 6 || nMode == 7) &&
+      (CodecGetReserve(codec) < CodecGetFormatReserve(CodecGetFormat(codec)) ||
+       CodecGetReserve(codec) < CodecGetFormatReserve(CodecGetWriteFormat(codec))))
+  {
+    /* Nonce or tag would overwrite page content */
+    return NULL;
+  }
 
   switch(nMode)
   {
     case 0: /* Undo a "case 7" journal file encryption */
     case 2: /* Reload a page */
     case 3: /* Load a page */
-      if (CodecHasReadKey(codec))
+      useWriteKey = (step != NULL && CodecRekeyStepStored(step, nPageNum));
+      if (useWriteKey ? CodecHasWriteKey(codec) : CodecHasReadKey(codec))
       {
-        CodecDecrypt(codec, nPageNum, (unsigned char*) data, pageSize);
+        unsigned char* staged = NULL;
+        if (codec->m_rekey != NULL)
+        {
+          staged = CodecRekeyGetRead(codec->m_rekey, nPageNum, (unsigned char*) data);
+        }
+        if (staged != NULL)
+        {
+          memcpy(data, staged, pageSize);
+        }
+        else if (nPageNum == 1)
+        {
+          CodecDecryptFirstPage(codec, (unsigned char*) data, pageSize, useWriteKey);
+        }
+        else
+        {
+          CodecDecrypt(codec, nPageNum, (unsigned char*) data, pageSize, useWriteKey);
+        }
+      }
+      if (nPageNum == 1 && CodecRekeyGetMark((unsigned char*) data) > 0)
+      {
+        if (step == NULL)
+        {
+          /* Pages are under two keys, SQLite reports SQLITE_NOTADB */
+          sqlite3_log(SQLITE_NOTADB, "codec: incremental rekey incomplete, call sqlite3_rekey_begin()");
+          break;
+        }
+        if (step->m_spilled == NULL)
+        {
+          /* Another connection may have advanced the rekey */
+          step->m_mark = CodecRekeyGetMark((unsigned char*) data);
+          step->m_target = step->m_mark;
+        }
+        memcpy(data, SQLITE_FILE_HEADER, 16);
+      }
+      else if (nPageNum == 1 && step != NULL && step->m_spilled == NULL)
+      {
+        step->m_mark = 0;
+        step->m_target = 0;
       }
       break;
 
     case 6: /* Encrypt a page for the main database file */
-      if (CodecHasWriteKey(codec))
+      useWriteKey = (step == NULL || CodecRekeyStepWrite(step, nPageNum));
+      if (useWriteKey ? CodecHasWriteKey(codec) : CodecHasReadKey(codec))
       {
-        unsigned char* pageBuffer = CodecGetPageBuffer(codec);
-        memcpy(pageBuffer, data, pageSize);
+        unsigned char* pageBuffer;
+        if (step != NULL && nPageNum == 1 && !step->m_final && step->m_target > 0)
+        {
+          /* Store the mark with page 1, returns NULL if out of memory */
+          data = CodecRekeyPutMark(codec, (unsigned char*) data, pageSize, step->m_target, useWriteKey);
+          break;
+        }
+        if (codec->m_rekey != NULL)
+        {
+          pageBuffer = CodecRekeyGetWrite(codec->m_rekey, nPageNum, (unsigned char*) data);
+          if (pageBuffer != NULL)
+          {
+            data = pageBuffer;
+            break;
+          }
+        }
+        pageBuffer = CodecGetPageBuffer(codec, pageSize);
+        if (pageBuffer == NULL)
+        {
+          /* The pager reports SQLITE_NOMEM */
+          return NULL;
+        }
+        CodecEncryptTo(codec, nPageNum, (unsigned char*) data, pageBuffer, pageSize, useWriteKey);
         data = pageBuffer;
-        CodecEncrypt(codec, nPageNum, (unsigned char*) data, pageSize, 1);
       }
       break;
 
@@ -72,13 +469,36 @@ void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
          Therefore, for case 7, when the rollback is being written, always encrypt using
          the database's readkey, which is guaranteed to be the same key that was used to
          read the original data.
+         During an incremental rekey the original key of pages before the mark
+         is the writekey.
       */
-      if (CodecHasReadKey(codec))
+      useWriteKey = (step != NULL && CodecRekeyStepStored(step, nPageNum));
+      if (useWriteKey ? CodecHasWriteKey(codec) : CodecHasReadKey(codec))
       {
-        unsigned char* pageBuffer = CodecGetPageBuffer(codec);
-        memcpy(pageBuffer, data, pageSize);
+        unsigned char* pageBuffer;
+        if (step != NULL && nPageNum == 1 && step->m_mark > 0)
+        {
+          /* A rollback restores page 1 with the committed mark */
+          data = CodecRekeyPutMark(codec, (unsigned char*) data, pageSize, step->m_mark, useWriteKey);
+          break;
+        }
+        if (codec->m_rekey != NULL)
+        {
+          pageBuffer = CodecRekeyGetJournal(codec->m_rekey, nPageNum, (unsigned char*) data);
+          if (pageBuffer != NULL)
+          {
+            data = pageBuffer;
+            break;
+          }
+        }
+        pageBuffer = CodecGetPageBuffer(codec, pageSize);
+        if (pageBuffer == NULL)
+        {
+          /* The pager reports SQLITE_NOMEM */
+          return NULL;
+        }
+        CodecEncryptTo(codec, nPageNum, (unsigned char*) data, pageBuffer, pageSize, useWriteKey);
         data = pageBuffer;
-        CodecEncrypt(codec, nPageNum, (unsigned char*) data, pageSize, 0);
       }
       break;
   }
@@ -97,9 +517,67 @@ void mySqlite3PagerSetCodec(
   void *pCodec
 );
 
-int sqlite3CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey)
+/*
+// Reserve room at the end of each page for the nonce of the ChaCha20
+// format resp. nonce and tag of the GCM format. Existing databases take
+// the reserve from their header instead.
+*/
+static int CodecReserveBytes(sqlite3* db, int nDb, Codec* codec)
+{
+  int rc = SQLITE_OK;
+  int reserve = CodecGetFormatReserve(CodecGetFormat(codec));
+  if (CodecGetReserve(codec) < reserve)
+  {
+    sqlite3_mutex_enter(db->mutex);
+    rc = sqlite3BtreeSetPageSize(db->aDb[nDb].pBt, 0, reserve, 0);
+    sqlite3_mutex_leave(db->mutex);
+  }
+  return rc;
+}
+
+/*
+// Hands the codec to the database file if it was opened through the
+// codec VFS, otherwise installs it as the codec of the pager.
+*/
+static void CodecInstall(sqlite3* db, int nDb, Codec* codec)
+{
+  Pager* pPager = sqlite3BtreePager(db->aDb[nDb].pBt);
+  sqlite3_file* fd = sqlite3PagerFile(pPager);
+  if (CodecVfsIsFile(fd) && mySqlite3PagerGetCodec(pPager) == NULL)
+  {
+    CodecVfsSetCodec(fd, codec);
+    return;
+  }
+#if (SQLITE_VERSION_NUMBER >= 3006016)
+  mySqlite3PagerSetCodec(pPager, sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, codec);
+#else
+#if (SQLITE_VERSION_NUMBER >= 3003014)
+  sqlite3PagerSetCodec(pPager, sqlite3Codec, codec);
+#else
+  sqlite3pager_set_codec(pPager, sqlite3Codec, codec);
+#endif
+  db->aDb[nDb].pAux = codec;
+  db->aDb[nDb].xFreeAux = sqlite3CodecFree;
+#endif
+}
+
+/*
+// The codec of a database, whether installed in the pager or in the
+// codec VFS
+*/
+static Codec* CodecGetDbCodec(sqlite3* db, int nDb)
+{
+  Pager* pPager = sqlite3BtreePager(db->aDb[nDb].pBt);
+  Codec* codec = (Codec*) mySqlite3PagerGetCodec(pPager);
+  return (codec != NULL) ? codec : CodecVfsGetCodec(sqlite3PagerFile(pPager));
+}
+
+/*
+// Attach a key to a database. A raw key is the derived key itself and
+// must have the key length of the cipher.
+*/
+static int CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey, int raw)
 {
-  /* Attach a key to a database. */
   Codec* codec = (Codec*) sqlite3_malloc(sizeof(Codec));
   CodecInit(codec);
 
@@ -109,23 +587,14 @@ int sqlite3CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey)
     /* No key specified */
     if (nDb != 0 && nKey < 0)
     {
-      Codec* mainCodec = (Codec*) mySqlite3PagerGetCodec(sqlite3BtreePager(db->aDb[0].pBt));
+      Codec* mainCodec = CodecGetDbCodec(db, 0);
       /* Attached database, therefore use the key of main database, if main database is encrypted */
       if (mainCodec != NULL && CodecIsEncrypted(mainCodec))
       {
         CodecCopy(codec, mainCodec);
         CodecSetBtree(codec, db->aDb[nDb].pBt);
-#if (SQLITE_VERSION_NUMBER >= 3006016)
-        mySqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, codec);
-#else
-#if (SQLITE_VERSION_NUMBER >= 3003014)
-        sqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#else
-        sqlite3pager_set_codec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#endif
-        db->aDb[nDb].pAux = codec;
-        db->aDb[nDb].xFreeAux = sqlite3CodecFree;
-#endif
+        CodecInstall(db, nDb, codec);
+        CodecReserveBytes(db, nDb, codec);
       }
       else
       {
@@ -137,23 +606,33 @@ int sqlite3CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey)
   else
   {
     /* Key specified, setup encryption key for database */
+    const char* zPassword = (const char*) zKey;
+    const CodecCipher* cipher = CodecParseKey(&zPassword, &nKey);
+    if (cipher == NULL || (raw && nKey != cipher->m_keyLength))
+    {
+      /* Unknown cipher, or raw key of the wrong length */
+      CodecTerm(codec);
+      sqlite3_free(codec);
+      return (cipher == NULL) ? SQLITE_ERROR : SQLITE_MISUSE;
+    }
     CodecSetIsEncrypted(codec, 1);
     CodecSetHasReadKey(codec, 1);
     CodecSetHasWriteKey(codec, 1);
-    CodecGenerateReadKey(codec, (char*) zKey, nKey);
+    CodecSetReadCipher(codec, cipher);
+    if (raw)
+    {
+      CodecSetRawReadKey(codec, (const unsigned char*) zPassword, nKey);
+    }
+    else
+    {
+      CodecGenerateReadKey(codec, (char*) zPassword, nKey);
+    }
     CodecCopyKey(codec, 1);
+    /* New databases get the page format of the cipher, existing ones are detected on open */
+    CodecSetFormat(codec, cipher->m_format);
     CodecSetBtree(codec, db->aDb[nDb].pBt);
-#if (SQLITE_VERSION_NUMBER >= 3006016)
-    mySqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, codec);
-#else
-#if (SQLITE_VERSION_NUMBER >= 3003014)
-    sqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#else
-    sqlite3pager_set_codec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#endif
-    db->aDb[nDb].pAux = codec;
-    db->aDb[nDb].xFreeAux = sqlite3CodecFree;
-#endif
+    CodecInstall(db, nDb, codec);
+    CodecReserveBytes(db, nDb, codec);
   }
   return SQLITE_OK;
 }
@@ -168,29 +647,187 @@ void sqlite3CodecGetKey(sqlite3* db, int nDb, void** zKey, int* nKey)
   *nKey = -1;
 }
 
+int sqlite3CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey)
+{
+  return CodecAttach(db, nDb, zKey, nKey, 0);
+}
+
 int sqlite3_key(sqlite3 *db, const void *zKey, int nKey)
 {
   /* The key is only set for the main database, not the temp database  */
   return sqlite3CodecAttach(db, 0, zKey, nKey);
 }
 
-int sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
+int sqlite3_key_raw(sqlite3 *db, const void *zKey, int nKey)
 {
-  /* Changes the encryption key for an existing database. */
-  int rc = SQLITE_ERROR;
-  Btree* pbt = db->aDb[0].pBt;
-  Pager* pPager = sqlite3BtreePager(pbt);
-  Codec* codec = (Codec*) mySqlite3PagerGetCodec(pPager);
+  if (zKey == NULL || nKey <= 0)
+  {
+    return SQLITE_MISUSE;
+  }
+  return CodecAttach(db, 0, zKey, nKey, 1);
+}
 
-  if ((zKey == NULL || nKey == 0) && (codec == NULL || !CodecIsEncrypted(codec)))
+int sqlite3_key_derive(const void *zKey, int nKey, unsigned char *pRaw)
+{
+  const char* zPassword = (const char*) zKey;
+  const CodecCipher* cipher = CodecParseKey(&zPassword, &nKey);
+  if (cipher == NULL)
+  {
+    return 0;
+  }
+  CodecDeriveKey(NULL, cipher, (char*) zPassword, nKey, pRaw);
+  return cipher->m_keyLength;
+}
+
+int sqlite3_key_cache(int bEnable)
+{
+  CodecSetKdfCache(bEnable);
+  return SQLITE_OK;
+}
+
+int sqlite3_codec_format(sqlite3 *db, int nFormat)
+{
+  int rc = SQLITE_OK;
+  Pager* pPager = sqlite3BtreePager(db->aDb[0].pBt);
+  Codec* codec;
+  i64 nSize = 0;
+
+  if (nFormat < 0 || nFormat >= CODEC_FORMAT_COUNT)
+  {
+    return SQLITE_RANGE;
+  }
+  sqlite3_mutex_enter(db->mutex);
+  codec = CodecGetDbCodec(db, 0);
+  if (codec == NULL || !CodecIsEncrypted(codec))
+  {
+    rc = SQLITE_MISUSE;
+  }
+  else if (CodecGetFormat(codec) != nFormat)
+  {
+    /* Existing databases keep the format they were created with */
+    sqlite3_file* fd = sqlite3PagerFile(pPager);
+    if (fd->pMethods != NULL && sqlite3OsFileSize(fd, &nSize) == SQLITE_OK && nSize > 0)
+    {
+      rc = SQLITE_MISUSE;
+    }
+    else
+    {
+      CodecSetFormat(codec, nFormat);
+    }
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = CodecReserveBytes(db, 0, codec);
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+int sqlite3_codec_pages(sqlite3 *db, int nPage, const unsigned int *aPgno, void **apData, int bEncrypt)
+{
+  int rc = SQLITE_OK;
+  CodecPageRef* pages;
+  Codec* codec;
+  int j;
+
+  if (nPage <= 0)
   {
-    /*
-    // Database not encrypted and key not specified
-    // therefore do nothing
-	*/
     return SQLITE_OK;
   }
+  for (j = 0; j < nPage; j++)
+  {
+    if (aPgno[j] == 0 || aPgno[j] > 0x7fffffff)
+    {
+      return SQLITE_RANGE;
+    }
+  }
+  pages = (CodecPageRef*) sqlite3_malloc(nPage * sizeof(CodecPageRef));
+  if (pages == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  for (j = 0; j < nPage; j++)
+  {
+    pages[j].m_page = (int) aPgno[j];
+    pages[j].m_data = (unsigned char*) apData[j];
+  }
+  sqlite3_mutex_enter(db->mutex);
+  codec = CodecGetDbCodec(db, 0);
+  if (codec == NULL || !CodecIsEncrypted(codec) || codec->m_rekeyStep != NULL ||
+      !(bEncrypt ? CodecHasWriteKey(codec) : CodecHasReadKey(codec)))
+  {
+    rc = SQLITE_MISUSE;
+  }
+  else if (bEncrypt && CodecGetReserve(codec) < CodecGetFormatReserve(CodecGetWriteFormat(codec)))
+  {
+    /* Nonce or tag would overwrite page content */
+    rc = SQLITE_MISUSE;
+  }
+  else
+  {
+    int pageSize = sqlite3BtreeGetPageSize(db->aDb[0].pBt);
+    if (bEncrypt)
+    {
+      CodecEncryptPages(codec, pages, nPage, pageSize, 1);
+    }
+    else if (CodecDecryptPages(codec, pages, nPage, pageSize, 0) > 0)
+    {
+      rc = SQLITE_CORRUPT;
+    }
+  }
+  sqlite3_mutex_leave(db->mutex);
+  sqlite3_free(pages);
+  return rc;
+}
+
+int sqlite3_codec_write_behind(sqlite3 *db, int nMillis)
+{
+  int rc;
+  sqlite3_mutex_enter(db->mutex);
+  rc = CodecVfsSetWriteBehind(sqlite3PagerFile(sqlite3BtreePager(db->aDb[0].pBt)), nMillis);
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+int sqlite3_codec_status(sqlite3 *db, int op, int *pCurrent, int *pHighwater, int resetFlag)
+{
+  Codec* codec;
+  int current = 0;
+  int highwater = 0;
+  int j, n;
+
+  if (op != SQLITE_CODEC_STATUS_MEMORY_USED && op != SQLITE_CODEC_STATUS_BUFFER_USED)
+  {
+    return SQLITE_ERROR;
+  }
+  sqlite3_mutex_enter(db->mutex);
+  for (j = 0; j < db->nDb; j++)
+  {
+    codec = (db->aDb[j].pBt != NULL) ? CodecGetDbCodec(db, j) : NULL;
+    if (codec != NULL)
+    {
+      current += CodecGetMemory(codec, op == SQLITE_CODEC_STATUS_BUFFER_USED, &n, resetFlag);
+      highwater += n;
+    }
+  }
+  sqlite3_mutex_leave(db->mutex);
+  *pCurrent = current;
+  *pHighwater = highwater;
+  return SQLITE_OK;
+}
 
+/*
+// Sets up the keys for changing the encryption of the main database:
+// the read key stays the key the database is encrypted with, the write key
+// becomes the new key (or none, if the database is to be decrypted).
+// If nFormat is not negative, the pages are rewritten in that format,
+// which migrates the database; otherwise the format is kept.
+// Returns the codec of the database, NULL if out of memory.
+*/
+static Codec* CodecRekeySetup(sqlite3* db, Pager* pPager, Codec* codec, const CodecCipher* cipher,
+                              int nFormat, const void* zKey, int nKey)
+{
+  Btree* pbt = db->aDb[0].pBt;
   if (codec == NULL || !CodecIsEncrypted(codec))
   {
     /*
@@ -200,12 +837,17 @@ int sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
     if (codec == NULL)
     {
       codec = (Codec*) sqlite3_malloc(sizeof(Codec));
+      if (codec == NULL)
+      {
+        return NULL;
+      }
 	    CodecInit(codec);
     }
 
     CodecSetIsEncrypted(codec, 1);
     CodecSetHasReadKey(codec, 0); /* Original database is not encrypted */
     CodecSetHasWriteKey(codec, 1);
+    CodecSetWriteCipher(codec, cipher);
     CodecGenerateWriteKey(codec, (char*) zKey, nKey);
     CodecSetBtree(codec, pbt);
 #if (SQLITE_VERSION_NUMBER >= 3006016)
@@ -219,6 +861,8 @@ int sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
     db->aDb[0].pAux = codec;
     db->aDb[0].xFreeAux = sqlite3CodecFree;
 #endif
+    /* CodecRekeyCheckReserve refuses formats the pages have no room for */
+    CodecSetFormat(codec, cipher->m_format);
   }
   else if (zKey == NULL || nKey == 0)
   {
@@ -236,66 +880,59 @@ int sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
     // therefore re-encrypt database with new key
     // Keep read key, change write key to new key
 	*/
+    CodecSetWriteCipher(codec, cipher);
     CodecGenerateWriteKey(codec, (char*) zKey, nKey);
-    CodecSetHasWriteKey(codec, 1);
-  }
-
-  /* Start transaction */
-  rc = sqlite3BtreeBeginTrans(pbt, 1);
-  if (!rc)
-  {
-    /* Rewrite all pages using the new encryption key (if specified) */
-#if (SQLITE_VERSION_NUMBER >= 3006000)
-    int nPageCount = -1;
-    int rc = SQLITE_OK;
-	sqlite3PagerPagecount(pPager, &nPageCount);
-    Pgno nPage = (Pgno) nPageCount;
-#elif (SQLITE_VERSION_NUMBER >= 3003014)
-    Pgno nPage = sqlite3PagerPagecount(pPager);
-#else
-    Pgno nPage = sqlite3pager_pagecount(pPager);
-#endif
-    int pageSize = sqlite3BtreeGetPageSize(pbt);
-    Pgno nSkip = WX_PAGER_MJ_PGNO(pageSize);
-#if (SQLITE_VERSION_NUMBER >= 3003014)
-    DbPage *pPage;
-#else
-    void *pPage;
-#endif
-    Pgno n;
-
-    for (n = 1; rc == SQLITE_OK && n <= nPage; n++)
+    if (nFormat < 0)
     {
-      if (n == nSkip) continue;
-#if (SQLITE_VERSION_NUMBER >= 3003014)
-      rc = sqlite3PagerGet(pPager, n, &pPage);
-#else
-      rc = sqlite3pager_get(pPager, n, &pPage);
-#endif
-      if (!rc)
-      {
-#if (SQLITE_VERSION_NUMBER >= 3003014)
-        rc = sqlite3PagerWrite(pPage);
-        sqlite3PagerUnref(pPage);
-#else
-        rc = sqlite3pager_write(pPage);
-        sqlite3pager_unref(pPage);
-#endif
-      }
+      nFormat = CodecGetFormat(codec);
     }
+    CodecSetWriteFormat(codec, nFormat);
+    CodecSetHasWriteKey(codec, 1);
   }
+  return codec;
+}
 
-  if (rc == SQLITE_OK)
+/*
+// Pages are rewritten in place and keep the reserved bytes of the
+// database, so only an empty database can make room for the nonce or
+// tag of the new format. Call before the transaction of the rekey starts.
+*/
+static void CodecRekeyReserve(Btree* pbt, Codec* codec)
+{
+  int reserve = CodecHasWriteKey(codec) ? CodecGetFormatReserve(CodecGetWriteFormat(codec)) : 0;
+  sqlite3_file* fd = sqlite3PagerFile(sqlite3BtreePager(pbt));
+  i64 nSize = 0;
+  if (reserve > sqlite3BtreeGetReserve(pbt) &&
+      (fd->pMethods == NULL || (sqlite3OsFileSize(fd, &nSize) == SQLITE_OK && nSize == 0)))
   {
-    /* Commit transaction if all pages could be rewritten */
-    rc = sqlite3BtreeCommit(pbt);
+    sqlite3BtreeSetPageSize(pbt, 0, reserve, 0);
   }
-  if (rc != SQLITE_OK)
+}
+
+/*
+// Fails the rekey if the pages lack the reserved bytes the format of the
+// new key needs, rather than falling back to a format without nonce or
+// tag. Call once the transaction has read the database header.
+*/
+static int CodecRekeyCheckReserve(sqlite3* db, Btree* pbt, Codec* codec)
+{
+  int format = CodecGetWriteFormat(codec);
+  if (CodecHasWriteKey(codec) && sqlite3BtreeGetReserve(pbt) < CodecGetFormatReserve(format))
   {
-    /* Rollback in case of error */
-    sqlite3BtreeRollback(pbt);
+    sqlite3Error(db, SQLITE_ERROR, "codec: format %d needs %d reserved bytes per page, the database has %d",
+                 format, CodecGetFormatReserve(format), sqlite3BtreeGetReserve(pbt));
+    return SQLITE_ERROR;
   }
+  return SQLITE_OK;
+}
 
+/*
+// Makes the new key the only key after a successful rekey, or restores
+// the old key after a failed one. The codec is removed (and freed) if the
+// database ends up unencrypted.
+*/
+static void CodecRekeyFinish(sqlite3* db, Pager* pPager, Codec* codec, int rc)
+{
   if (rc == SQLITE_OK)
   {
     /* Set read key equal to write key if necessary */
@@ -338,9 +975,384 @@ int sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
     sqlite3CodecFree(codec);
 #endif
   }
+}
+
+static Pgno CodecGetPageCount(Pager* pPager)
+{
+#if (SQLITE_VERSION_NUMBER >= 3006000)
+  int nPageCount = -1;
+  sqlite3PagerPagecount(pPager, &nPageCount);
+  return (Pgno) nPageCount;
+#elif (SQLITE_VERSION_NUMBER >= 3003014)
+  return sqlite3PagerPagecount(pPager);
+#else
+  return sqlite3pager_pagecount(pPager);
+#endif
+}
+
+/*
+// Marks a page as written, so that it is journalled and written back
+// with the key chosen by sqlite3Codec.
+*/
+static int CodecTouchPage(Pager* pPager, Pgno n)
+{
+#if (SQLITE_VERSION_NUMBER >= 3003014)
+  DbPage *pPage;
+  int rc = sqlite3PagerGet(pPager, n, &pPage);
+  if (!rc)
+  {
+    rc = sqlite3PagerWrite(pPage);
+    sqlite3PagerUnref(pPage);
+  }
+#else
+  void *pPage;
+  int rc = sqlite3pager_get(pPager, n, &pPage);
+  if (!rc)
+  {
+    rc = sqlite3pager_write(pPage);
+    sqlite3pager_unref(pPage);
+  }
+#endif
   return rc;
 }
 
+int sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
+{
+  return sqlite3_rekey_v2(db, zKey, nKey, NULL, NULL);
+}
+
+int sqlite3_rekey_v2(sqlite3 *db, const void *zKey, int nKey,
+                     int (*xProgress)(void*, int, int), void *pArg)
+{
+  /* Changes the encryption key for an existing database. */
+  int rc = SQLITE_ERROR;
+  Btree* pbt = db->aDb[0].pBt;
+  Pager* pPager = sqlite3BtreePager(pbt);
+  Codec* codec = (Codec*) mySqlite3PagerGetCodec(pPager);
+  const char* zPassword = (const char*) zKey;
+  const CodecCipher* cipher = CodecParseKey(&zPassword, &nKey);
+  int nFormat;
+
+  if (cipher == NULL)
+  {
+    /* Unknown cipher */
+    return SQLITE_ERROR;
+  }
+  if (CodecVfsGetCodec(sqlite3PagerFile(pPager)) != NULL)
+  {
+    /* The codec VFS does not rewrite pages under a new key */
+    return SQLITE_MISUSE;
+  }
+  /* A key naming a cipher migrates the database to the format of the cipher */
+  nFormat = (zPassword != (const char*) zKey) ? cipher->m_format : -1;
+  if (nFormat >= 0 && nKey <= 0)
+  {
+    /* A cipher without a password does not decrypt the database */
+    return SQLITE_MISUSE;
+  }
+  zKey = zPassword;
+  if ((zKey == NULL || nKey == 0) && (codec == NULL || !CodecIsEncrypted(codec)))
+  {
+    /*
+    // Database not encrypted and key not specified
+    // therefore do nothing
+	*/
+    return SQLITE_OK;
+  }
+
+  sqlite3_mutex_enter(db->mutex);
+  if (codec != NULL && codec->m_rekeyStep != NULL)
+  {
+    /* An incremental rekey is in progress */
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_MISUSE;
+  }
+  codec = CodecRekeySetup(db, pPager, codec, cipher, nFormat, zKey, nKey);
+  if (codec == NULL)
+  {
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_NOMEM;
+  }
+
+  /* Start transaction */
+  CodecRekeyReserve(pbt, codec);
+  rc = sqlite3BtreeBeginTrans(pbt, 1);
+  if (!rc)
+  {
+    rc = CodecRekeyCheckReserve(db, pbt, codec);
+  }
+  if (!rc)
+  {
+    /* Rewrite all pages using the new encryption key (if specified) */
+    Pgno nPage = CodecGetPageCount(pPager);
+    int pageSize = sqlite3BtreeGetPageSize(pbt);
+    Pgno nSkip = WX_PAGER_MJ_PGNO(pageSize);
+    Pgno n;
+    CodecRekey* rekey = CodecRekeyCreate(codec, pPager, pageSize);
+    int nBatch = (rekey != NULL) ? rekey->m_nBatch : 256;
+    codec->m_rekey = rekey;
+
+    for (n = 1; rc == SQLITE_OK && n <= nPage; n++)
+    {
+      if ((n - 1) % nBatch == 0)
+      {
+        if (xProgress != NULL && n > 1 && xProgress(pArg, (int) n - 1, (int) nPage))
+        {
+          rc = SQLITE_ABORT;
+          break;
+        }
+        if (rekey != NULL && CodecHasReadKey(codec))
+        {
+          CodecRekeyLoad(rekey, n, nBatch, nSkip);
+        }
+      }
+      if (n == nSkip) continue;
+      rc = CodecTouchPage(pPager, n);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+      /* Commit transaction if all pages could be rewritten */
+      rc = sqlite3BtreeCommit(pbt);
+    }
+    if (rc == SQLITE_OK && xProgress != NULL)
+    {
+      xProgress(pArg, (int) nPage, (int) nPage);
+    }
+    codec->m_rekey = NULL;
+    CodecRekeyFree(rekey);
+  }
+  if (rc != SQLITE_OK)
+  {
+    /* Rollback in case of error */
+    sqlite3BtreeRollback(pbt);
+  }
+
+  CodecRekeyFinish(db, pPager, codec, rc);
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+int sqlite3_rekey_begin(sqlite3 *db, const void *zKey, int nKey)
+{
+  int rc;
+  Btree* pbt = db->aDb[0].pBt;
+  Pager* pPager = sqlite3BtreePager(pbt);
+  Codec* codec;
+  CodecRekeyStep* step;
+  DbPage* pPage;
+  const char* zPassword = (const char*) zKey;
+  const CodecCipher* cipher = CodecParseKey(&zPassword, &nKey);
+  int nFormat;
+
+  if (cipher == NULL)
+  {
+    /* Unknown cipher */
+    return SQLITE_ERROR;
+  }
+  if (CodecVfsGetCodec(sqlite3PagerFile(pPager)) != NULL)
+  {
+    /* The codec VFS does not rewrite pages under a new key */
+    return SQLITE_MISUSE;
+  }
+  /* A key naming a cipher migrates the database to the format of the cipher */
+  nFormat = (zPassword != (const char*) zKey) ? cipher->m_format : -1;
+  if (nFormat >= 0 && nKey <= 0)
+  {
+    /* A cipher without a password does not decrypt the database */
+    return SQLITE_MISUSE;
+  }
+  zKey = zPassword;
+  sqlite3_mutex_enter(db->mutex);
+  codec = (Codec*) mySqlite3PagerGetCodec(pPager);
+  if ((zKey == NULL || nKey == 0) && (codec == NULL || !CodecIsEncrypted(codec)))
+  {
+    /* Database not encrypted and key not specified, nothing to do */
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_OK;
+  }
+  if (codec == NULL || !CodecIsEncrypted(codec) || !CodecHasReadKey(codec) || codec->m_rekeyStep != NULL)
+  {
+    /*
+    // Only an encrypted database: a plaintext page 1 cannot carry the mark,
+    // so other connections and a later resume could not tell which pages
+    // are encrypted already
+    */
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_MISUSE;
+  }
+  step = (CodecRekeyStep*) sqlite3_malloc(sizeof(CodecRekeyStep));
+  if (step == NULL || (codec = CodecRekeySetup(db, pPager, codec, cipher, nFormat, zKey, nKey)) == NULL)
+  {
+    sqlite3_free(step);
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_NOMEM;
+  }
+  memset(step, 0, sizeof(CodecRekeyStep));
+  codec->m_rekeyStep = step;
+
+  /* Pick up the mark of an interrupted rekey, reading page 1 loads it */
+  CodecRekeyReserve(pbt, codec);
+  rc = sqlite3BtreeBeginTrans(pbt, 0);
+  if (rc == SQLITE_OK)
+  {
+    rc = CodecRekeyCheckReserve(db, pbt, codec);
+    if (rc == SQLITE_OK)
+    {
+      rc = sqlite3PagerGet(pPager, 1, &pPage);
+    }
+    if (rc == SQLITE_OK)
+    {
+      /* Page 1 may have been cached by a failed access without a step */
+      unsigned char* page1 = (unsigned char*) sqlite3PagerGetData(pPage);
+      if (CodecRekeyGetMark(page1) > 0)
+      {
+        step->m_mark = CodecRekeyGetMark(page1);
+        step->m_target = step->m_mark;
+        memcpy(page1, SQLITE_FILE_HEADER, 16);
+      }
+      sqlite3PagerUnref(pPage);
+    }
+    step->m_pageCount = CodecGetPageCount(pPager);
+    sqlite3BtreeCommit(pbt);
+  }
+  if (rc != SQLITE_OK)
+  {
+    codec->m_rekeyStep = NULL;
+    sqlite3_free(step);
+    CodecRekeyFinish(db, pPager, codec, rc);
+  }
+  else if (step->m_mark > 0 && db->activeVdbeCnt == 0)
+  {
+    /* Cached pages of a resumed rekey may have been decrypted with the wrong key */
+    sqlite3PagerClearCache(pPager);
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+int sqlite3_rekey_step(sqlite3 *db, int nPage)
+{
+  int rc;
+  Btree* pbt = db->aDb[0].pBt;
+  Pager* pPager = sqlite3BtreePager(pbt);
+  Codec* codec;
+  CodecRekeyStep* step;
+  Pgno nTotal, nSkip, first, last, n;
+  DbPage* pPage;
+
+  sqlite3_mutex_enter(db->mutex);
+  codec = (Codec*) mySqlite3PagerGetCodec(pPager);
+  if (codec == NULL || codec->m_rekeyStep == NULL)
+  {
+    /* No rekey in progress */
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_DONE;
+  }
+  step = codec->m_rekeyStep;
+
+  /* Starting the transaction reloads page 1, and with it the mark, if another connection stepped */
+  rc = sqlite3BtreeBeginTrans(pbt, 1);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_mutex_leave(db->mutex);
+    return rc;
+  }
+
+  nTotal = CodecGetPageCount(pPager);
+  nSkip = WX_PAGER_MJ_PGNO(sqlite3BtreeGetPageSize(pbt));
+  step->m_pageCount = nTotal;
+  first = (step->m_mark < 2) ? 2 : step->m_mark + 1;
+  last = (nPage < 0 || step->m_mark + nPage >= nTotal) ? nTotal : step->m_mark + nPage;
+  if (last < step->m_mark) last = step->m_mark;
+
+  step->m_spilled = (unsigned char*) sqlite3_malloc((last - step->m_mark) / 8 + 1);
+  if (step->m_spilled == NULL)
+  {
+    rc = SQLITE_NOMEM;
+  }
+  else
+  {
+    memset(step->m_spilled, 0, (last - step->m_mark) / 8 + 1);
+    step->m_target = last;
+    step->m_final = (last >= nTotal);
+  }
+
+  for (n = first; rc == SQLITE_OK && n <= last; n++)
+  {
+    if (n == nSkip) continue;
+    rc = CodecTouchPage(pPager, n);
+  }
+  if (rc == SQLITE_OK)
+  {
+    /* Page 1 is written with the new mark, or without one in the last step */
+    rc = sqlite3PagerGet(pPager, 1, &pPage);
+    if (rc == SQLITE_OK)
+    {
+      rc = sqlite3PagerWrite(pPage);
+      sqlite3PagerUnref(pPage);
+    }
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3BtreeCommit(pbt);
+  }
+
+  /* Pages written early are either committed now or restored by the rollback */
+  sqlite3_free(step->m_spilled);
+  step->m_spilled = NULL;
+  if (rc == SQLITE_OK)
+  {
+    step->m_mark = last;
+  }
+  else
+  {
+    step->m_target = step->m_mark;
+    step->m_final = 0;
+    sqlite3BtreeRollback(pbt);
+  }
+
+  if (rc == SQLITE_OK && step->m_final)
+  {
+    codec->m_rekeyStep = NULL;
+    sqlite3_free(step);
+    CodecRekeyFinish(db, pPager, codec, SQLITE_OK);
+    rc = SQLITE_DONE;
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+int sqlite3_rekey_remaining(sqlite3 *db)
+{
+  int nRemaining = 0;
+  Codec* codec;
+  sqlite3_mutex_enter(db->mutex);
+  codec = (Codec*) mySqlite3PagerGetCodec(sqlite3BtreePager(db->aDb[0].pBt));
+  if (codec != NULL && codec->m_rekeyStep != NULL)
+  {
+    /* Pages after the mark, plus page 1 */
+    CodecRekeyStep* step = codec->m_rekeyStep;
+    nRemaining = (int) step->m_pageCount - ((step->m_mark > 1) ? (int) step->m_mark - 1 : 0);
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return nRemaining;
+}
+
+int sqlite3_rekey_pagecount(sqlite3 *db)
+{
+  int nPage = 0;
+  Codec* codec;
+  sqlite3_mutex_enter(db->mutex);
+  codec = (Codec*) mySqlite3PagerGetCodec(sqlite3BtreePager(db->aDb[0].pBt));
+  if (codec != NULL && codec->m_rekeyStep != NULL)
+  {
+    nPage = (int) codec->m_rekeyStep->m_pageCount;
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return nPage;
+}
+
 #endif /* SQLITE_HAS_CODEC */
 
 #endif /* SQLITE_OMIT_DISKIO */
@@ -0,0 +1,2312 @@
+#ifndef SQLITE_OMIT_DISKIO
+#ifdef SQLITE_HAS_CODEC
+
+#include "codec.h"
+
+#if CODEC_THREADS
+#include <sys/time.h>
+#endif
+
+/*
+// Encrypting VFS
+// The "codec" VFS is a shim over another VFS that encrypts at the file
+// level instead of through the pager codec hook. A key given to
+// sqlite3_key() for a database opened through it is handed to the VFS
+// (see CodecAttach). The main database keeps the format of the codec
+// hook, page by page, so a database can be opened either way. The VFS
+// sees whole runs of pages: adjacent page writes are collected and
+// encrypted as one batch with a single write, and multi-page reads are
+// decrypted as a batch.
+// Page images in the rollback journal and the WAL are encrypted with the
+// database key as well, keyed by their file offset as page numbers of
+// their own, at 2^30 and above. Temporary files are encrypted with AES-XTS
+// under a random per-file key. Journals and WAL files are not
+// interchangeable with those written by the codec hook.
+// Reserved bytes of decrypted pages are cleared, so that the checksums
+// SQLite keeps in the journal and the WAL match after a round trip.
+// SQLite computes those checksums over the plain text; they are stored
+// masked with a key derived value (see CodecVfsChecksumMask), so they do
+// not confirm guesses of page content. Page numbers, commit sizes and
+// salts of journal records and WAL frames remain in clear.
+*/
+
+#define CODEC_VFS_PLAIN   0
+#define CODEC_VFS_MAIN    1
+#define CODEC_VFS_JOURNAL 2
+#define CODEC_VFS_WAL     3
+#define CODEC_VFS_TEMP    4
+
+/* Bytes of adjacent page writes collected before they are encrypted and written */
+#ifndef CODEC_VFS_RUN_SIZE
+#define CODEC_VFS_RUN_SIZE (256*1024)
+#endif
+
+/* Size of the WAL header and of a WAL frame header */
+#define CODEC_VFS_WAL_HEADER   32
+#define CODEC_VFS_FRAME_HEADER 24
+
+typedef struct _CodecVfsFile CodecVfsFile;
+
+struct _CodecVfsFile
+{
+  sqlite3_file   m_base;
+  sqlite3_file*  m_real;       /* File of the underlying VFS, follows this structure */
+  const char*    m_name;
+  int            m_type;       /* CODEC_VFS_xxx */
+  Codec*         m_codec;      /* Main database: codec set by sqlite3_key, else NULL;
+                                  journal and WAL: private copy if m_main is NULL */
+  CodecVfsFile*  m_main;       /* Journal and WAL: file of the main database of the same pager */
+  int            m_pageSize;   /* 0 until known */
+  int            m_lock;       /* Main database: lock level */
+  int            m_shm;        /* Main database: nonzero once the WAL index is used */
+  CodecVfsFile*  m_next;       /* List of open main database files */
+  struct _CodecVfsTemp* m_temp; /* Temporary files: random key and size */
+  unsigned char* m_buffer;     /* Scratch space */
+  int            m_nBuffer;
+  unsigned char* m_run;        /* Main database: page writes not yet written */
+  sqlite3_int64  m_runOffset;
+  int            m_runLength;
+  struct _CodecVfsAhead* m_ahead; /* Main database: read-ahead, once sequential reads were seen */
+  sqlite3_int64  m_nextRead;   /* Offset of the page following the last one read */
+  int            m_streak;     /* Number of sequential page reads */
+  struct _CodecVfsQueue* m_queue; /* Main database and WAL: write-behind, NULL if off */
+  int            m_window;     /* Main database: durability window in ms, -1 if write-behind is off */
+  CodecVfsFile*  m_wal;        /* Main database: its WAL while open */
+  int            m_commit;     /* WAL: the frame being written ends a transaction */
+  sqlite3_int64  m_imageOffset;/* Journal: offset of the last page image read or written, -1 if none */
+  unsigned char  m_imageEdges[32]; /* Journal: first and last 16 bytes of that image as stored */
+};
+
+static sqlite3_vfs codecVfs;
+static CodecVfsFile* codecVfsFiles = NULL;
+
+static const sqlite3_io_methods codecVfsMethods1;
+static const sqlite3_io_methods codecVfsMethods2;
+
+static void CodecVfsAheadStop(CodecVfsFile* p);
+
+static sqlite3_vfs* CodecVfsParent(sqlite3_vfs* pVfs)
+{
+  return (sqlite3_vfs*) pVfs->pAppData;
+}
+
+/*
+// Nonzero if fd is a file opened through the codec VFS
+*/
+static int CodecVfsIsFile(sqlite3_file* fd)
+{
+  return fd != NULL && (fd->pMethods == &codecVfsMethods1 || fd->pMethods == &codecVfsMethods2);
+}
+
+/*
+// The codec of a main database opened through the codec VFS, else NULL
+*/
+static Codec* CodecVfsGetCodec(sqlite3_file* fd)
+{
+  return (CodecVfsIsFile(fd)) ? ((CodecVfsFile*) fd)->m_codec : NULL;
+}
+
+/*
+// Hands a codec to a main database opened through the codec VFS, which
+// takes ownership. Any previous codec is freed.
+*/
+static void CodecVfsSetCodec(sqlite3_file* fd, Codec* codec)
+{
+  CodecVfsFile* p = (CodecVfsFile*) fd;
+  CodecVfsAheadStop(p);
+  if (p->m_codec != NULL)
+  {
+    CodecTerm(p->m_codec);
+    sqlite3_free(p->m_codec);
+  }
+  p->m_codec = codec;
+  p->m_pageSize = 0;
+}
+
+static unsigned char* CodecVfsBuffer(CodecVfsFile* p, int n)
+{
+  if (n > p->m_nBuffer)
+  {
+    unsigned char* buffer = (unsigned char*) sqlite3_realloc(p->m_buffer, n);
+    if (buffer == NULL)
+    {
+      return NULL;
+    }
+    p->m_buffer = buffer;
+    p->m_nBuffer = n;
+  }
+  return p->m_buffer;
+}
+
+/*
+// The unix VFS moves less than 128 KiB per call, so runs of pages are
+// transferred in pieces of whole pages below that size.
+*/
+#define CODEC_VFS_MAX_IO 0x1ffff
+
+static int CodecVfsReadRun(sqlite3_file* real, unsigned char* data, int amt, sqlite3_int64 off, int pageSize)
+{
+  int chunk = CODEC_VFS_MAX_IO / pageSize * pageSize;
+  int rc = SQLITE_OK;
+  int n;
+
+  while (rc == SQLITE_OK && amt > 0)
+  {
+    n = (amt < chunk) ? amt : chunk;
+    rc = real->pMethods->xRead(real, data, n, off);
+    data += n;
+    off += n;
+    amt -= n;
+  }
+  return rc;
+}
+
+static int CodecVfsWriteRun(sqlite3_file* real, const unsigned char* data, int amt, sqlite3_int64 off, int pageSize)
+{
+  int chunk = CODEC_VFS_MAX_IO / pageSize * pageSize;
+  int rc = SQLITE_OK;
+  int n;
+
+  while (rc == SQLITE_OK && amt > 0)
+  {
+    n = (amt < chunk) ? amt : chunk;
+    rc = real->pMethods->xWrite(real, data, n, off);
+    data += n;
+    off += n;
+    amt -= n;
+  }
+  return rc;
+}
+
+/*
+// The codec for the pages of a file, or NULL if they are not encrypted
+*/
+static Codec* CodecVfsFileCodec(CodecVfsFile* p)
+{
+  Codec* codec = (p->m_main != NULL) ? p->m_main->m_codec : p->m_codec;
+  return (codec != NULL && CodecIsEncrypted(codec) && CodecHasReadKey(codec)) ? codec : NULL;
+}
+
+static int CodecVfsValidPageSize(int pageSize)
+{
+  return pageSize >= 512 && pageSize <= SQLITE_MAX_PAGE_SIZE && (pageSize & (pageSize - 1)) == 0;
+}
+
+/*
+// Takes page size and reserved bytes from the plain text of page 1
+*/
+static void CodecVfsReadHeader(CodecVfsFile* p, const unsigned char* page1)
+{
+  static const char header[] = "SQLite format 3";
+  int pageSize = (page1[16] << 8) | (page1[17] << 16);
+  if (memcmp(page1, header, sizeof(header)) == 0 && CodecVfsValidPageSize(pageSize))
+  {
+    p->m_pageSize = pageSize;
+    CodecSetReserve(p->m_codec, page1[20]);
+  }
+}
+
+/*
+// Clears the nonce resp. tag left in the reserved bytes by decryption
+*/
+static void CodecVfsClearReserve(Codec* codec, unsigned char* data, int len)
+{
+  int reserve = CodecGetFormatReserve(CodecGetFormat(codec));
+  if (reserve > 0 && len > reserve)
+  {
+    memset(data + len - reserve, 0, reserve);
+  }
+}
+
+static void CodecVfsEncryptPages(Codec* codec, unsigned char* data, int nPages, int pageSize, int page)
+{
+  CodecPageRef* pages = NULL;
+  int j;
+
+  if (nPages >= CODEC_HASH_LANES)
+  {
+    pages = (CodecPageRef*) sqlite3_malloc(nPages * sizeof(CodecPageRef));
+  }
+  if (pages != NULL)
+  {
+    for (j = 0; j < nPages; j++)
+    {
+      pages[j].m_page = page + j;
+      pages[j].m_data = data + j * pageSize;
+    }
+    CodecEncryptPages(codec, pages, nPages, pageSize, 1);
+    sqlite3_free(pages);
+    return;
+  }
+  for (j = 0; j < nPages; j++)
+  {
+    CodecEncrypt(codec, page + j, data + j * pageSize, pageSize, 1);
+  }
+}
+
+/*
+// Decrypts nPages pages, returns the number of pages that failed authentication
+*/
+static int CodecVfsDecryptPages(Codec* codec, unsigned char* data, int nPages, int pageSize, int page)
+{
+  CodecPageRef* pages = NULL;
+  int failed = 0;
+  int j;
+
+  if (nPages >= CODEC_HASH_LANES)
+  {
+    pages = (CodecPageRef*) sqlite3_malloc(nPages * sizeof(CodecPageRef));
+  }
+  if (pages != NULL)
+  {
+    for (j = 0; j < nPages; j++)
+    {
+      pages[j].m_page = page + j;
+      pages[j].m_data = data + j * pageSize;
+    }
+    failed = CodecDecryptPages(codec, pages, nPages, pageSize, 0);
+    sqlite3_free(pages);
+  }
+  else
+  {
+    for (j = 0; j < nPages; j++)
+    {
+      if (!CodecDecrypt(codec, page + j, data + j * pageSize, pageSize, 0))
+      {
+        failed++;
+      }
+    }
+  }
+  for (j = 0; j < nPages; j++)
+  {
+    CodecVfsClearReserve(codec, data + j * pageSize, pageSize);
+  }
+  return failed;
+}
+
+/*
+// ----------------
+// Main database
+// ----------------
+*/
+
+/*
+// Finds the page size of an existing database by decrypting page 1 with
+// each possible size. Leaves the page size 0 if the key does not fit.
+*/
+static int CodecVfsProbe(CodecVfsFile* p)
+{
+  sqlite3_int64 fileSize = 0;
+  unsigned char* page1 = CodecVfsBuffer(p, SQLITE_MAX_PAGE_SIZE);
+  int pageSize, rc;
+
+  if (page1 == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  rc = p->m_real->pMethods->xFileSize(p->m_real, &fileSize);
+  for (pageSize = 512; rc == SQLITE_OK && pageSize <= SQLITE_MAX_PAGE_SIZE && pageSize <= fileSize; pageSize *= 2)
+  {
+    rc = p->m_real->pMethods->xRead(p->m_real, page1, pageSize, 0);
+    if (rc == SQLITE_OK && CodecProbeFirstPage(p->m_codec, page1, pageSize, 0))
+    {
+      CodecVfsReadHeader(p, page1);
+      if (p->m_pageSize == pageSize)
+      {
+        break;
+      }
+      p->m_pageSize = 0;
+    }
+  }
+  return rc;
+}
+
+/*
+// ----------------
+// Read-ahead
+// ----------------
+*/
+
+/*
+// Once the main database is read page by page in sequence, the pages that
+// follow are read with one large read and decrypted in advance into one
+// of two staging windows, so that a scan finds its pages decrypted. The
+// windows are filled by a thread of their own if threads are available,
+// which uses its own handle of the file and its own copy of the codec.
+// Staged pages are only valid under the lock they were read with: they
+// are dropped on every write and on every change of the file lock or of
+// the WAL index locks.
+*/
+
+/* Bytes read ahead at a time, 0 disables read-ahead */
+#ifndef CODEC_VFS_AHEAD_SIZE
+#define CODEC_VFS_AHEAD_SIZE (256*1024)
+#endif
+
+/* Sequential page reads before read-ahead starts */
+#ifndef CODEC_VFS_AHEAD_TRIGGER
+#define CODEC_VFS_AHEAD_TRIGGER 4
+#endif
+
+#define CODEC_VFS_WINDOW_EMPTY   0
+#define CODEC_VFS_WINDOW_PENDING 1
+#define CODEC_VFS_WINDOW_READY   2
+
+typedef struct _CodecVfsWindow
+{
+  unsigned char* m_data;
+  sqlite3_int64  m_offset;
+  int            m_length;     /* Bytes requested */
+  int            m_pageSize;
+  int            m_valid;      /* Bytes decrypted, once ready */
+  int            m_state;      /* CODEC_VFS_WINDOW_xxx */
+  int            m_stale;      /* Dropped while pending */
+} CodecVfsWindow;
+
+typedef struct _CodecVfsAhead
+{
+  sqlite3_file*   m_real;      /* Own handle of the database file, follows this structure */
+  Codec           m_codec;     /* Own copy of the codec */
+  CodecVfsWindow  m_window[2];
+#if CODEC_THREADS
+  int             m_hasThread;
+  int             m_shutdown;
+  pthread_t       m_thread;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t  m_cond;      /* Signalled when a window is requested or filled */
+#endif
+} CodecVfsAhead;
+
+static void CodecVfsAheadEnter(CodecVfsAhead* ahead)
+{
+#if CODEC_THREADS
+  if (ahead->m_hasThread) pthread_mutex_lock(&ahead->m_mutex);
+#endif
+}
+
+static void CodecVfsAheadLeave(CodecVfsAhead* ahead)
+{
+#if CODEC_THREADS
+  if (ahead->m_hasThread) pthread_mutex_unlock(&ahead->m_mutex);
+#endif
+}
+
+/*
+// Reads and decrypts the pages of a window. Pages beyond the end of the
+// file and pages failing authentication are left to the synchronous path.
+*/
+static void CodecVfsAheadFill(CodecVfsAhead* ahead, CodecVfsWindow* window)
+{
+  sqlite3_file* real = ahead->m_real;
+  sqlite3_int64 fileSize = 0;
+  int length = window->m_length;
+  int rc;
+
+  window->m_valid = 0;
+  if (real->pMethods->xFileSize(real, &fileSize) != SQLITE_OK || fileSize <= window->m_offset)
+  {
+    return;
+  }
+  if (fileSize - window->m_offset < length)
+  {
+    length = (int) (fileSize - window->m_offset) / window->m_pageSize * window->m_pageSize;
+  }
+  if (length == 0)
+  {
+    return;
+  }
+  rc = CodecVfsReadRun(real, window->m_data, length, window->m_offset, window->m_pageSize);
+  if (rc == SQLITE_OK &&
+      CodecVfsDecryptPages(&ahead->m_codec, window->m_data, length / window->m_pageSize, window->m_pageSize,
+                           (int) (window->m_offset / window->m_pageSize) + 1) == 0)
+  {
+    window->m_valid = length;
+  }
+}
+
+#if CODEC_THREADS
+static void* CodecVfsAheadMain(void* arg)
+{
+  CodecVfsAhead* ahead = (CodecVfsAhead*) arg;
+  CodecVfsWindow* window;
+  int j;
+
+  pthread_mutex_lock(&ahead->m_mutex);
+  while (!ahead->m_shutdown)
+  {
+    /* The earlier of the requested windows first */
+    window = NULL;
+    for (j = 0; j < 2; j++)
+    {
+      if (ahead->m_window[j].m_state == CODEC_VFS_WINDOW_PENDING &&
+          (window == NULL || ahead->m_window[j].m_offset < window->m_offset))
+      {
+        window = &ahead->m_window[j];
+      }
+    }
+    if (window == NULL)
+    {
+      pthread_cond_wait(&ahead->m_cond, &ahead->m_mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&ahead->m_mutex);
+    if (!window->m_stale)
+    {
+      CodecVfsAheadFill(ahead, window);
+    }
+    pthread_mutex_lock(&ahead->m_mutex);
+    window->m_state = (window->m_stale) ? CODEC_VFS_WINDOW_EMPTY : CODEC_VFS_WINDOW_READY;
+    window->m_stale = 0;
+    pthread_cond_broadcast(&ahead->m_cond);
+  }
+  pthread_mutex_unlock(&ahead->m_mutex);
+  return NULL;
+}
+#endif
+
+static int CodecVfsAheadStart(CodecVfsFile* p)
+{
+  sqlite3_vfs* parent = CodecVfsParent(&codecVfs);
+  int size = (CODEC_VFS_AHEAD_SIZE > SQLITE_MAX_PAGE_SIZE) ? CODEC_VFS_AHEAD_SIZE : SQLITE_MAX_PAGE_SIZE;
+  CodecVfsAhead* ahead = (CodecVfsAhead*) sqlite3_malloc((int) sizeof(CodecVfsAhead) + parent->szOsFile);
+  int flags = 0;
+  int j;
+
+  if (ahead == NULL)
+  {
+    return 0;
+  }
+  memset(ahead, 0, sizeof(CodecVfsAhead) + parent->szOsFile);
+  ahead->m_real = (sqlite3_file*) &ahead[1];
+  CodecInit(&ahead->m_codec);
+  CodecCopy(&ahead->m_codec, p->m_codec);
+  p->m_ahead = ahead;
+  for (j = 0; j < 2; j++)
+  {
+    ahead->m_window[j].m_data = (unsigned char*) sqlite3_malloc(size);
+    if (ahead->m_window[j].m_data == NULL)
+    {
+      CodecVfsAheadStop(p);
+      return 0;
+    }
+  }
+  if (parent->xOpen(parent, p->m_name, ahead->m_real, SQLITE_OPEN_READONLY | SQLITE_OPEN_MAIN_DB, &flags) != SQLITE_OK)
+  {
+    CodecVfsAheadStop(p);
+    return 0;
+  }
+#if CODEC_THREADS
+  pthread_mutex_init(&ahead->m_mutex, NULL);
+  pthread_cond_init(&ahead->m_cond, NULL);
+  /* With a single core the pages are read ahead without a thread */
+  ahead->m_hasThread = (CodecGetCpuCount() > 1 &&
+                        pthread_create(&ahead->m_thread, NULL, CodecVfsAheadMain, ahead) == 0);
+  if (!ahead->m_hasThread)
+  {
+    pthread_cond_destroy(&ahead->m_cond);
+    pthread_mutex_destroy(&ahead->m_mutex);
+  }
+#endif
+  return 1;
+}
+
+static void CodecVfsAheadStop(CodecVfsFile* p)
+{
+  CodecVfsAhead* ahead = p->m_ahead;
+  int j;
+
+  p->m_streak = 0;
+  if (ahead == NULL)
+  {
+    return;
+  }
+#if CODEC_THREADS
+  if (ahead->m_hasThread)
+  {
+    pthread_mutex_lock(&ahead->m_mutex);
+    ahead->m_shutdown = 1;
+    pthread_cond_broadcast(&ahead->m_cond);
+    pthread_mutex_unlock(&ahead->m_mutex);
+    pthread_join(ahead->m_thread, NULL);
+    pthread_cond_destroy(&ahead->m_cond);
+    pthread_mutex_destroy(&ahead->m_mutex);
+  }
+#endif
+  if (ahead->m_real->pMethods != NULL)
+  {
+    ahead->m_real->pMethods->xClose(ahead->m_real);
+  }
+  for (j = 0; j < 2; j++)
+  {
+    sqlite3_free(ahead->m_window[j].m_data);
+  }
+  CodecTerm(&ahead->m_codec);
+  sqlite3_free(ahead);
+  p->m_ahead = NULL;
+}
+
+/*
+// Drops the staged pages, which may no longer match the file
+*/
+static void CodecVfsAheadDrop(CodecVfsFile* p)
+{
+  CodecVfsAhead* ahead = p->m_ahead;
+  int j;
+
+  p->m_streak = 0;
+  if (ahead == NULL)
+  {
+    return;
+  }
+  CodecVfsAheadEnter(ahead);
+  for (j = 0; j < 2; j++)
+  {
+    if (ahead->m_window[j].m_state == CODEC_VFS_WINDOW_PENDING)
+    {
+      ahead->m_window[j].m_stale = 1;
+    }
+    else
+    {
+      ahead->m_window[j].m_state = CODEC_VFS_WINDOW_EMPTY;
+    }
+  }
+  CodecVfsAheadLeave(ahead);
+}
+
+static void CodecVfsAheadRequest(CodecVfsAhead* ahead, CodecVfsWindow* window, sqlite3_int64 offset, int pageSize)
+{
+  int nPages = CODEC_VFS_AHEAD_SIZE / pageSize;
+  window->m_offset = offset;
+  window->m_length = ((nPages > 0) ? nPages : 1) * pageSize;
+  window->m_pageSize = pageSize;
+  window->m_valid = 0;
+  window->m_stale = 0;
+  window->m_state = CODEC_VFS_WINDOW_PENDING;
+#if CODEC_THREADS
+  if (ahead->m_hasThread)
+  {
+    pthread_cond_broadcast(&ahead->m_cond);
+    return;
+  }
+#endif
+  CodecVfsAheadFill(ahead, window);
+  window->m_state = CODEC_VFS_WINDOW_READY;
+}
+
+/*
+// Serves a page read from the staged pages if possible, and keeps the
+// pages following a sequential read staged. Returns nonzero if the page
+// was copied to buf.
+*/
+static int CodecVfsAheadRead(CodecVfsFile* p, unsigned char* buf, sqlite3_int64 off)
+{
+  CodecVfsAhead* ahead;
+  CodecVfsWindow* window = NULL;
+  CodecVfsWindow* other = NULL;
+  int pageSize = p->m_pageSize;
+  sqlite3_int64 next = off + pageSize;
+  int served = 0;
+  int j;
+
+  p->m_streak = (off == p->m_nextRead) ? p->m_streak + 1 : 0;
+  p->m_nextRead = next;
+  if (CODEC_VFS_AHEAD_SIZE <= 0 || p->m_streak < CODEC_VFS_AHEAD_TRIGGER ||
+      (p->m_ahead == NULL && !CodecVfsAheadStart(p)))
+  {
+    return 0;
+  }
+  ahead = p->m_ahead;
+  CodecVfsAheadEnter(ahead);
+  for (j = 0; j < 2; j++)
+  {
+    CodecVfsWindow* w = &ahead->m_window[j];
+    if (w->m_state != CODEC_VFS_WINDOW_EMPTY && !w->m_stale && w->m_pageSize == pageSize &&
+        off >= w->m_offset && off < w->m_offset + w->m_length)
+    {
+      window = w;
+      other = &ahead->m_window[1 - j];
+    }
+  }
+  if (window != NULL)
+  {
+#if CODEC_THREADS
+    while (window->m_state == CODEC_VFS_WINDOW_PENDING)
+    {
+      pthread_cond_wait(&ahead->m_cond, &ahead->m_mutex);
+    }
+#endif
+    if (window->m_state == CODEC_VFS_WINDOW_READY && off + pageSize <= window->m_offset + window->m_valid)
+    {
+      memcpy(buf, window->m_data + (off - window->m_offset), pageSize);
+      served = 1;
+    }
+    /* Stop at the end of the file */
+    next = (window->m_valid == window->m_length) ? window->m_offset + window->m_length : -1;
+  }
+  else
+  {
+    /* Start with the window that is not busy */
+    other = (ahead->m_window[0].m_state != CODEC_VFS_WINDOW_PENDING) ? &ahead->m_window[0] : &ahead->m_window[1];
+  }
+  if (next >= 0 && other->m_state != CODEC_VFS_WINDOW_PENDING &&
+      !(other->m_state == CODEC_VFS_WINDOW_READY && other->m_offset == next && other->m_pageSize == pageSize))
+  {
+    CodecVfsAheadRequest(ahead, other, next, pageSize);
+  }
+  CodecVfsAheadLeave(ahead);
+  return served;
+}
+
+/*
+// ----------------
+// Write-behind
+// ----------------
+*/
+
+/*
+// With write-behind (sqlite3_codec_write_behind) the encrypted pages of
+// the main database and the frames of the WAL are handed to an I/O thread
+// of the file: they are copied to one of two blocks, and a full block is
+// written while the next pages are encrypted into the other one. Reads,
+// syncs, unlocking and the commit frame of a WAL transaction wait for the
+// blocks to be written, the latter before the WAL index makes the frames
+// visible. A write that failed behind is reported by the next call.
+// With a durability window the syncs of the WAL are deferred and carried
+// out by the I/O thread once the window has passed, so that back-to-back
+// commits share one sync. Any write to the database file syncs the WAL
+// first, which keeps checkpoints behind the frames they copy. A crash may
+// lose the transactions committed within the window; the checksums of
+// the WAL keep the database consistent.
+*/
+
+#define CODEC_VFS_BLOCK_SIZE \
+  ((CODEC_VFS_RUN_SIZE > SQLITE_MAX_PAGE_SIZE + CODEC_VFS_FRAME_HEADER) ? \
+   CODEC_VFS_RUN_SIZE : SQLITE_MAX_PAGE_SIZE + CODEC_VFS_FRAME_HEADER)
+
+typedef struct _CodecVfsBlock
+{
+  unsigned char* m_data;
+  sqlite3_int64  m_offset;
+  int            m_length;
+  int            m_unit;       /* Size of a page resp. WAL frame */
+  int            m_queued;     /* Handed to the I/O thread */
+} CodecVfsBlock;
+
+typedef struct _CodecVfsQueue
+{
+  sqlite3_file*   m_real;
+  CodecVfsBlock   m_block[2];
+  int             m_fill;      /* Block being filled */
+  int             m_write;     /* Block written next */
+  int             m_error;     /* First error of a write behind */
+  int             m_syncFlags; /* Flags of the deferred sync, 0 if none */
+  sqlite3_int64   m_syncDue;   /* Time the deferred sync is due, in ms */
+  int             m_syncing;   /* The I/O thread is syncing */
+  int             m_hasThread;
+#if CODEC_THREADS
+  int             m_shutdown;
+  pthread_t       m_thread;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t  m_cond;      /* Signalled when a block or a sync is queued or done */
+#endif
+} CodecVfsQueue;
+
+static sqlite3_int64 CodecVfsNow(void)
+{
+  sqlite3_vfs* parent = CodecVfsParent(&codecVfs);
+  sqlite3_int64 now = 0;
+  double day = 0;
+
+  if (parent->iVersion >= 2 && parent->xCurrentTimeInt64 != NULL)
+  {
+    parent->xCurrentTimeInt64(parent, &now);
+  }
+  else
+  {
+    parent->xCurrentTime(parent, &day);
+    now = (sqlite3_int64) (day * 86400000.0);
+  }
+  return now;
+}
+
+static void CodecVfsQueueEnter(CodecVfsQueue* queue)
+{
+#if CODEC_THREADS
+  if (queue->m_hasThread) pthread_mutex_lock(&queue->m_mutex);
+#endif
+}
+
+static void CodecVfsQueueLeave(CodecVfsQueue* queue)
+{
+#if CODEC_THREADS
+  if (queue->m_hasThread) pthread_mutex_unlock(&queue->m_mutex);
+#endif
+}
+
+#if CODEC_THREADS
+static void CodecVfsQueueWait(CodecVfsQueue* queue, sqlite3_int64 ms)
+{
+  struct timeval now;
+  struct timespec until;
+
+  if (ms < 0)
+  {
+    pthread_cond_wait(&queue->m_cond, &queue->m_mutex);
+    return;
+  }
+  gettimeofday(&now, NULL);
+  until.tv_sec = now.tv_sec + (time_t) (ms / 1000);
+  until.tv_nsec = now.tv_usec * 1000L + (long) (ms % 1000) * 1000000L;
+  if (until.tv_nsec >= 1000000000L)
+  {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
+  }
+  pthread_cond_timedwait(&queue->m_cond, &queue->m_mutex, &until);
+}
+
+static void* CodecVfsQueueMain(void* arg)
+{
+  CodecVfsQueue* queue = (CodecVfsQueue*) arg;
+  CodecVfsBlock* block;
+  sqlite3_int64 wait;
+  int flags, rc;
+
+  pthread_mutex_lock(&queue->m_mutex);
+  while (!queue->m_shutdown)
+  {
+    block = &queue->m_block[queue->m_write];
+    if (block->m_queued)
+    {
+      pthread_mutex_unlock(&queue->m_mutex);
+      rc = CodecVfsWriteRun(queue->m_real, block->m_data, block->m_length, block->m_offset, block->m_unit);
+      pthread_mutex_lock(&queue->m_mutex);
+      if (rc != SQLITE_OK && queue->m_error == SQLITE_OK)
+      {
+        queue->m_error = rc;
+      }
+      block->m_length = 0;
+      block->m_queued = 0;
+      queue->m_write ^= 1;
+      pthread_cond_broadcast(&queue->m_cond);
+    }
+    else if (queue->m_syncFlags != 0)
+    {
+      wait = queue->m_syncDue - CodecVfsNow();
+      if (wait > 0)
+      {
+        CodecVfsQueueWait(queue, wait);
+        continue;
+      }
+      flags = queue->m_syncFlags;
+      queue->m_syncFlags = 0;
+      queue->m_syncing = 1;
+      pthread_mutex_unlock(&queue->m_mutex);
+      rc = queue->m_real->pMethods->xSync(queue->m_real, flags);
+      pthread_mutex_lock(&queue->m_mutex);
+      if (rc != SQLITE_OK && queue->m_error == SQLITE_OK)
+      {
+        queue->m_error = rc;
+      }
+      queue->m_syncing = 0;
+      pthread_cond_broadcast(&queue->m_cond);
+    }
+    else
+    {
+      CodecVfsQueueWait(queue, -1);
+    }
+  }
+  pthread_mutex_unlock(&queue->m_mutex);
+  return NULL;
+}
+#endif
+
+static CodecVfsQueue* CodecVfsQueueCreate(sqlite3_file* real)
+{
+  CodecVfsQueue* queue = (CodecVfsQueue*) sqlite3_malloc(sizeof(CodecVfsQueue));
+  if (queue == NULL)
+  {
+    return NULL;
+  }
+  memset(queue, 0, sizeof(CodecVfsQueue));
+  queue->m_real = real;
+#if CODEC_THREADS
+  queue->m_block[0].m_data = (unsigned char*) sqlite3_malloc(CODEC_VFS_BLOCK_SIZE);
+  queue->m_block[1].m_data = (unsigned char*) sqlite3_malloc(CODEC_VFS_BLOCK_SIZE);
+  if (queue->m_block[0].m_data != NULL && queue->m_block[1].m_data != NULL)
+  {
+    pthread_mutex_init(&queue->m_mutex, NULL);
+    pthread_cond_init(&queue->m_cond, NULL);
+    queue->m_hasThread = (pthread_create(&queue->m_thread, NULL, CodecVfsQueueMain, queue) == 0);
+    if (!queue->m_hasThread)
+    {
+      pthread_cond_destroy(&queue->m_cond);
+      pthread_mutex_destroy(&queue->m_mutex);
+    }
+  }
+#endif
+  /* Without a thread writes and syncs are carried out at once */
+  return queue;
+}
+
+/*
+// Hands a write to the I/O thread. Adjacent writes share a block.
+*/
+static int CodecVfsQueueWrite(CodecVfsQueue* queue, const unsigned char* data, int amt, sqlite3_int64 off, int unit)
+{
+  CodecVfsBlock* block;
+  int rc;
+
+  if (!queue->m_hasThread || amt > CODEC_VFS_BLOCK_SIZE)
+  {
+    return CodecVfsWriteRun(queue->m_real, data, amt, off, unit);
+  }
+#if CODEC_THREADS
+  pthread_mutex_lock(&queue->m_mutex);
+  block = &queue->m_block[queue->m_fill];
+  if (block->m_length > 0 &&
+      (off != block->m_offset + block->m_length || block->m_length + amt > CODEC_VFS_BLOCK_SIZE ||
+       unit != block->m_unit))
+  {
+    block->m_queued = 1;
+    queue->m_fill ^= 1;
+    pthread_cond_broadcast(&queue->m_cond);
+    block = &queue->m_block[queue->m_fill];
+    while (block->m_queued)
+    {
+      pthread_cond_wait(&queue->m_cond, &queue->m_mutex);
+    }
+  }
+  if (block->m_length == 0)
+  {
+    block->m_offset = off;
+    block->m_unit = unit;
+  }
+  memcpy(block->m_data + block->m_length, data, amt);
+  block->m_length += amt;
+  rc = queue->m_error;
+  queue->m_error = SQLITE_OK;
+  pthread_mutex_unlock(&queue->m_mutex);
+#else
+  (void) block;
+  rc = SQLITE_OK;
+#endif
+  return rc;
+}
+
+/*
+// Waits until every write handed to the I/O thread is written
+*/
+static int CodecVfsQueueDrain(CodecVfsQueue* queue)
+{
+  int rc = SQLITE_OK;
+
+  CodecVfsQueueEnter(queue);
+#if CODEC_THREADS
+  if (queue->m_hasThread)
+  {
+    if (queue->m_block[queue->m_fill].m_length > 0)
+    {
+      queue->m_block[queue->m_fill].m_queued = 1;
+      queue->m_fill ^= 1;
+      pthread_cond_broadcast(&queue->m_cond);
+    }
+    while (queue->m_block[0].m_queued || queue->m_block[1].m_queued)
+    {
+      pthread_cond_wait(&queue->m_cond, &queue->m_mutex);
+    }
+  }
+#endif
+  rc = queue->m_error;
+  queue->m_error = SQLITE_OK;
+  CodecVfsQueueLeave(queue);
+  return rc;
+}
+
+/*
+// Carries out the deferred sync now
+*/
+static int CodecVfsQueueSync(CodecVfsQueue* queue)
+{
+  int rc = CodecVfsQueueDrain(queue);
+  int flags;
+
+  CodecVfsQueueEnter(queue);
+#if CODEC_THREADS
+  while (queue->m_syncing)
+  {
+    pthread_cond_wait(&queue->m_cond, &queue->m_mutex);
+  }
+#endif
+  flags = queue->m_syncFlags;
+  queue->m_syncFlags = 0;
+  if (rc == SQLITE_OK)
+  {
+    rc = queue->m_error;
+  }
+  queue->m_error = SQLITE_OK;
+  CodecVfsQueueLeave(queue);
+  if (flags != 0 && rc == SQLITE_OK)
+  {
+    rc = queue->m_real->pMethods->xSync(queue->m_real, flags);
+  }
+  return rc;
+}
+
+/*
+// Defers a sync by up to window ms. Without a thread nothing would carry
+// out the sync once the window ends, so it is not deferred.
+*/
+static int CodecVfsQueueDefer(CodecVfsQueue* queue, int flags, int window)
+{
+  int rc = CodecVfsQueueDrain(queue);
+  int now;
+
+  CodecVfsQueueEnter(queue);
+  if (queue->m_syncFlags == 0)
+  {
+    queue->m_syncDue = CodecVfsNow() + window;
+  }
+  queue->m_syncFlags |= flags;
+  now = !queue->m_hasThread;
+#if CODEC_THREADS
+  if (queue->m_hasThread) pthread_cond_broadcast(&queue->m_cond);
+#endif
+  CodecVfsQueueLeave(queue);
+  if (now && rc == SQLITE_OK)
+  {
+    rc = CodecVfsQueueSync(queue);
+  }
+  return rc;
+}
+
+static int CodecVfsQueueDestroy(CodecVfsQueue* queue)
+{
+  int rc;
+
+  if (queue == NULL)
+  {
+    return SQLITE_OK;
+  }
+  rc = CodecVfsQueueSync(queue);
+#if CODEC_THREADS
+  if (queue->m_hasThread)
+  {
+    pthread_mutex_lock(&queue->m_mutex);
+    queue->m_shutdown = 1;
+    pthread_cond_broadcast(&queue->m_cond);
+    pthread_mutex_unlock(&queue->m_mutex);
+    pthread_join(queue->m_thread, NULL);
+    pthread_cond_destroy(&queue->m_cond);
+    pthread_mutex_destroy(&queue->m_mutex);
+  }
+#endif
+  sqlite3_free(queue->m_block[0].m_data);
+  sqlite3_free(queue->m_block[1].m_data);
+  sqlite3_free(queue);
+  return rc;
+}
+
+/*
+// The write-behind queue of a main database or WAL file, NULL if off
+*/
+static CodecVfsQueue* CodecVfsGetQueue(CodecVfsFile* p)
+{
+  CodecVfsFile* main = (p->m_type == CODEC_VFS_WAL) ? p->m_main : p;
+  if (p->m_queue == NULL && main != NULL && main->m_window >= 0)
+  {
+    p->m_queue = CodecVfsQueueCreate(p->m_real);
+  }
+  return p->m_queue;
+}
+
+/*
+// Carries out a deferred sync of the WAL of a main database
+*/
+static int CodecVfsSyncWal(CodecVfsFile* p)
+{
+  return (p->m_wal != NULL && p->m_wal->m_queue != NULL) ? CodecVfsQueueSync(p->m_wal->m_queue) : SQLITE_OK;
+}
+
+/*
+// Encrypts the collected page writes and writes them with one call, or
+// hands them to the I/O thread
+*/
+static int CodecVfsSubmit(CodecVfsFile* p)
+{
+  int rc = SQLITE_OK;
+  if (p->m_runLength > 0)
+  {
+    CodecVfsEncryptPages(p->m_codec, p->m_run, p->m_runLength / p->m_pageSize, p->m_pageSize,
+                         (int) (p->m_runOffset / p->m_pageSize) + 1);
+    rc = (p->m_queue != NULL)
+       ? CodecVfsQueueWrite(p->m_queue, p->m_run, p->m_runLength, p->m_runOffset, p->m_pageSize)
+       : CodecVfsWriteRun(p->m_real, p->m_run, p->m_runLength, p->m_runOffset, p->m_pageSize);
+    p->m_runLength = 0;
+  }
+  return rc;
+}
+
+/*
+// Writes out the collected page writes and waits for the writes behind
+*/
+static int CodecVfsFlush(CodecVfsFile* p)
+{
+  int rc = CodecVfsSubmit(p);
+  if (p->m_queue != NULL)
+  {
+    int rc2 = CodecVfsQueueDrain(p->m_queue);
+    if (rc == SQLITE_OK) rc = rc2;
+  }
+  return rc;
+}
+
+/*
+// Turns write-behind on with a durability window of window ms for the
+// syncs of the WAL (window >= 0), or off (window < 0)
+*/
+static int CodecVfsSetWriteBehind(sqlite3_file* fd, int window)
+{
+  CodecVfsFile* p = (CodecVfsFile*) fd;
+  int rc = SQLITE_OK;
+  int rc2;
+
+  if (!CodecVfsIsFile(fd) || p->m_type != CODEC_VFS_MAIN)
+  {
+    return SQLITE_MISUSE;
+  }
+  if (window <= 0)
+  {
+    /* Syncs are no longer deferred */
+    rc = CodecVfsSyncWal(p);
+  }
+  p->m_window = window;
+  if (window < 0)
+  {
+    rc2 = CodecVfsFlush(p);
+    if (rc == SQLITE_OK) rc = rc2;
+    rc2 = CodecVfsQueueDestroy(p->m_queue);
+    if (rc == SQLITE_OK) rc = rc2;
+    p->m_queue = NULL;
+    if (p->m_wal != NULL)
+    {
+      rc2 = CodecVfsQueueDestroy(p->m_wal->m_queue);
+      if (rc == SQLITE_OK) rc = rc2;
+      p->m_wal->m_queue = NULL;
+    }
+  }
+  return rc;
+}
+
+static int CodecVfsReadMain(CodecVfsFile* p, unsigned char* buf, int amt, sqlite3_int64 off)
+{
+  sqlite3_file* real = p->m_real;
+  unsigned char* page;
+  int pageSize, offset, n, rc;
+
+  rc = CodecVfsFlush(p);
+  if (rc == SQLITE_OK && p->m_pageSize == 0)
+  {
+    rc = CodecVfsProbe(p);
+  }
+  pageSize = p->m_pageSize;
+  if (rc != SQLITE_OK || pageSize == 0)
+  {
+    /* Not a database or the wrong key, leave it to SQLite to complain */
+    return (rc != SQLITE_OK) ? rc : real->pMethods->xRead(real, buf, amt, off);
+  }
+
+  if (off % pageSize == 0 && amt % pageSize == 0)
+  {
+    if (amt == pageSize && CodecVfsAheadRead(p, buf, off))
+    {
+      return SQLITE_OK;
+    }
+    rc = CodecVfsReadRun(real, buf, amt, off, pageSize);
+    if (rc == SQLITE_OK)
+    {
+      CodecVfsDecryptPages(p->m_codec, buf, amt / pageSize, pageSize, (int) (off / pageSize) + 1);
+      if (off == 0)
+      {
+        CodecVfsReadHeader(p, buf);
+      }
+    }
+    else if (rc == SQLITE_IOERR_SHORT_READ)
+    {
+      memset(buf, 0, amt);
+    }
+    return rc;
+  }
+
+  /* Part of a page, e.g. the database header: decrypt the whole page */
+  page = CodecVfsBuffer(p, pageSize);
+  if (page == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  while (amt > 0)
+  {
+    offset = (int) (off % pageSize);
+    n = (amt < pageSize - offset) ? amt : pageSize - offset;
+    rc = real->pMethods->xRead(real, page, pageSize, off - offset);
+    if (rc != SQLITE_OK)
+    {
+      if (rc == SQLITE_IOERR_SHORT_READ)
+      {
+        memset(buf, 0, amt);
+      }
+      return rc;
+    }
+    CodecVfsDecryptPages(p->m_codec, page, 1, pageSize, (int) (off / pageSize) + 1);
+    memcpy(buf, page + offset, n);
+    buf += n;
+    off += n;
+    amt -= n;
+  }
+  return SQLITE_OK;
+}
+
+static int CodecVfsWriteMain(CodecVfsFile* p, const unsigned char* buf, int amt, sqlite3_int64 off)
+{
+  sqlite3_file* real = p->m_real;
+  Codec* codec = p->m_codec;
+  unsigned char* page;
+  int pageSize, offset, n, rc = SQLITE_OK;
+
+  CodecVfsAheadDrop(p);
+  /* Checkpoints may only copy frames that are synced */
+  rc = CodecVfsSyncWal(p);
+  if (off == 0 && amt >= 100)
+  {
+    CodecVfsReadHeader(p, buf);
+  }
+  if (rc == SQLITE_OK && p->m_pageSize == 0)
+  {
+    rc = CodecVfsProbe(p);
+  }
+  pageSize = p->m_pageSize;
+  if (rc != SQLITE_OK || pageSize == 0)
+  {
+    return (rc != SQLITE_OK) ? rc : SQLITE_IOERR_WRITE;
+  }
+  if (CodecGetReserve(codec) < CodecGetFormatReserve(CodecGetWriteFormat(codec)))
+  {
+    /* Nonce or tag would overwrite page content */
+    return SQLITE_IOERR_WRITE;
+  }
+
+  if (off % pageSize == 0 && amt % pageSize == 0)
+  {
+    /* Collect adjacent pages while the lock keeps other connections out */
+    if (p->m_lock >= SQLITE_LOCK_RESERVED && !p->m_shm && amt <= CODEC_VFS_RUN_SIZE)
+    {
+      CodecVfsGetQueue(p);
+      if (p->m_runLength > 0 &&
+          (off != p->m_runOffset + p->m_runLength || p->m_runLength + amt > CODEC_VFS_RUN_SIZE))
+      {
+        rc = CodecVfsSubmit(p);
+      }
+      if (p->m_run == NULL)
+      {
+        p->m_run = (unsigned char*) sqlite3_malloc(CODEC_VFS_RUN_SIZE);
+      }
+      if (rc == SQLITE_OK && p->m_run != NULL)
+      {
+        if (p->m_runLength == 0)
+        {
+          p->m_runOffset = off;
+        }
+        memcpy(p->m_run + p->m_runLength, buf, amt);
+        p->m_runLength += amt;
+        return SQLITE_OK;
+      }
+    }
+    if (rc == SQLITE_OK)
+    {
+      rc = CodecVfsFlush(p);
+    }
+    page = CodecVfsBuffer(p, amt);
+    if (rc != SQLITE_OK || page == NULL)
+    {
+      return (rc != SQLITE_OK) ? rc : SQLITE_NOMEM;
+    }
+    if (amt == pageSize)
+    {
+      CodecEncryptTo(codec, (int) (off / pageSize) + 1, buf, page, pageSize, 1);
+    }
+    else
+    {
+      memcpy(page, buf, amt);
+      CodecVfsEncryptPages(codec, page, amt / pageSize, pageSize, (int) (off / pageSize) + 1);
+    }
+    return CodecVfsWriteRun(real, page, amt, off, pageSize);
+  }
+
+  /* Part of a page: read, patch and rewrite the whole page */
+  while (amt > 0)
+  {
+    offset = (int) (off % pageSize);
+    n = (amt < pageSize - offset) ? amt : pageSize - offset;
+    page = CodecVfsBuffer(p, pageSize);
+    if (page == NULL)
+    {
+      return SQLITE_NOMEM;
+    }
+    rc = CodecVfsReadMain(p, page, pageSize, off - offset);
+    if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+    {
+      return rc;
+    }
+    memcpy(page + offset, buf, n);
+    CodecVfsEncryptPages(codec, page, 1, pageSize, (int) (off / pageSize) + 1);
+    rc = real->pMethods->xWrite(real, page, pageSize, off - offset);
+    if (rc != SQLITE_OK)
+    {
+      return rc;
+    }
+    buf += n;
+    off += n;
+    amt -= n;
+  }
+  return SQLITE_OK;
+}
+
+/*
+// ----------------
+// Journal and WAL
+// ----------------
+*/
+
+/*
+// Page size of a journal or WAL file, taken from its header: the page
+// size is stored at offset 24 of a journal header and at offset 8 of the
+// WAL header, big-endian.
+*/
+static int CodecVfsLogPageSize(CodecVfsFile* p)
+{
+  unsigned char header[4];
+  sqlite3_int64 offset = (p->m_type == CODEC_VFS_WAL) ? 8 : 24;
+  int pageSize;
+
+  if (p->m_pageSize == 0 &&
+      p->m_real->pMethods->xRead(p->m_real, header, 4, offset) == SQLITE_OK)
+  {
+    pageSize = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+    if (CodecVfsValidPageSize(pageSize))
+    {
+      p->m_pageSize = pageSize;
+    }
+  }
+  return p->m_pageSize;
+}
+
+/*
+// Offset of the page image within an I/O request, or -1 if the request
+// holds no page image. Journal records are a 4 byte page number, the page
+// and a 4 byte checksum following a header of a multiple of 512 bytes, so
+// page images start at offsets 4 modulo 8. WAL frames are a 24 byte
+// header and the page, following the 32 byte WAL header; recovery reads
+// whole frames.
+*/
+static int CodecVfsLogImage(CodecVfsFile* p, int amt, sqlite3_int64 off)
+{
+  int pageSize = CodecVfsLogPageSize(p);
+  int frameSize = pageSize + CODEC_VFS_FRAME_HEADER;
+
+  if (pageSize == 0)
+  {
+    return -1;
+  }
+  if (p->m_type == CODEC_VFS_JOURNAL)
+  {
+    return (amt == pageSize && off % 8 == 4) ? 0 : -1;
+  }
+  if (amt == pageSize && off >= CODEC_VFS_WAL_HEADER + CODEC_VFS_FRAME_HEADER &&
+      (off - CODEC_VFS_WAL_HEADER - CODEC_VFS_FRAME_HEADER) % frameSize == 0)
+  {
+    return 0;
+  }
+  if (amt == frameSize && off >= CODEC_VFS_WAL_HEADER && (off - CODEC_VFS_WAL_HEADER) % frameSize == 0)
+  {
+    return CODEC_VFS_FRAME_HEADER;
+  }
+  return -1;
+}
+
+/*
+// Page images of journal and WAL are keyed by offset. Records are more
+// than a page apart, so each gets a different key. Bit 30 is set in the
+// page number: database pages stay below it (SQLITE_MAX_PAGE_COUNT), so
+// a log image never shares key and tweak with a database page, and an
+// image copied into the database does not decrypt there.
+*/
+#define CODEC_VFS_LOG_PAGE 0x40000000
+
+#if defined(SQLITE_MAX_PAGE_COUNT) && SQLITE_MAX_PAGE_COUNT >= CODEC_VFS_LOG_PAGE
+#error "the codec VFS needs SQLITE_MAX_PAGE_COUNT below 2^30"
+#endif
+
+static int CodecVfsLogPage(sqlite3_int64 off, int pageSize)
+{
+  return CODEC_VFS_LOG_PAGE | (int) ((off / pageSize + 1) & (CODEC_VFS_LOG_PAGE - 1));
+}
+
+/*
+// The mask of the checksum of a journal record or WAL frame at offset off:
+// SHA-256 of the database key, the offset and a seed that changes with
+// every write, the stored page image of a journal record resp. the salts
+// of a WAL frame. Checksums are stored XORed with it.
+*/
+static void CodecVfsChecksumMask(Codec* codec, sqlite3_int64 off, const unsigned char* seed, int nSeed,
+                                 unsigned char mask[8])
+{
+  static const char label[] = "codec log checksum";
+  unsigned char data[sizeof(label) + KEYLENGTH + 8 + 32];
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  int n = (int) sizeof(label);
+  int j;
+
+  memcpy(data, label, n);
+  memcpy(data + n, codec->m_readKey, KEYLENGTH);
+  n += KEYLENGTH;
+  for (j = 7; j >= 0; j--)
+  {
+    data[n++] = (unsigned char) (off >> (8 * j));
+  }
+  memcpy(data + n, seed, nSeed);
+  sha256(data, (unsigned int) (n + nSeed), digest);
+  memcpy(mask, digest, 8);
+  memset(data, 0, sizeof(data));
+  memset(digest, 0, sizeof(digest));
+}
+
+/*
+// Masks resp. unmasks the checksum of a WAL frame header at off (bytes
+// 16..23, after page number, commit size and salts)
+*/
+static void CodecVfsMaskFrame(Codec* codec, unsigned char* header, sqlite3_int64 off)
+{
+  unsigned char mask[8];
+  int j;
+  CodecVfsChecksumMask(codec, off, header + 8, 8, mask);
+  for (j = 0; j < 8; j++)
+  {
+    header[16 + j] ^= mask[j];
+  }
+}
+
+/*
+// Masks resp. unmasks the checksum of a journal record, which follows the
+// page image last read or written
+*/
+static void CodecVfsMaskRecord(CodecVfsFile* p, Codec* codec, unsigned char* checksum, sqlite3_int64 off)
+{
+  unsigned char mask[8];
+  int j;
+  CodecVfsChecksumMask(codec, off, p->m_imageEdges, 32, mask);
+  for (j = 0; j < 4; j++)
+  {
+    checksum[j] ^= mask[j];
+  }
+}
+
+/*
+// Nonzero if an I/O request is a WAL frame header (alone or with its page)
+// resp. the checksum of a journal record. SQLite writes and reads a journal
+// record as page number, page image and checksum in this order, so the
+// checksum directly follows the last page image.
+*/
+static int CodecVfsIsFrameHeader(CodecVfsFile* p, int amt, sqlite3_int64 off)
+{
+  int frameSize = p->m_pageSize + CODEC_VFS_FRAME_HEADER;
+  return p->m_type == CODEC_VFS_WAL && p->m_pageSize > 0 &&
+         (amt == CODEC_VFS_FRAME_HEADER || amt == frameSize) &&
+         off >= CODEC_VFS_WAL_HEADER && (off - CODEC_VFS_WAL_HEADER) % frameSize == 0;
+}
+
+static int CodecVfsIsRecordChecksum(CodecVfsFile* p, int amt, sqlite3_int64 off)
+{
+  return p->m_type == CODEC_VFS_JOURNAL && p->m_pageSize > 0 && amt == 4 &&
+         p->m_imageOffset >= 0 && off == p->m_imageOffset + p->m_pageSize;
+}
+
+/*
+// Remembers the edges of a journal page image as stored, the seed of the
+// mask of the checksum that follows it
+*/
+static void CodecVfsKeepImage(CodecVfsFile* p, const unsigned char* image, sqlite3_int64 off)
+{
+  if (p->m_type == CODEC_VFS_JOURNAL)
+  {
+    memcpy(p->m_imageEdges, image, 16);
+    memcpy(p->m_imageEdges + 16, image + p->m_pageSize - 16, 16);
+    p->m_imageOffset = off;
+  }
+}
+
+static int CodecVfsReadLog(CodecVfsFile* p, Codec* codec, unsigned char* buf, int amt, sqlite3_int64 off)
+{
+  int rc = p->m_real->pMethods->xRead(p->m_real, buf, amt, off);
+  int image;
+
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  if ((image = CodecVfsLogImage(p, amt, off)) >= 0)
+  {
+    CodecVfsKeepImage(p, buf + image, off + image);
+    CodecVfsDecryptPages(codec, buf + image, 1, p->m_pageSize, CodecVfsLogPage(off + image, p->m_pageSize));
+  }
+  if (CodecVfsIsFrameHeader(p, amt, off))
+  {
+    CodecVfsMaskFrame(codec, buf, off);
+  }
+  else if (CodecVfsIsRecordChecksum(p, amt, off))
+  {
+    CodecVfsMaskRecord(p, codec, buf, off);
+  }
+  return rc;
+}
+
+/*
+// WAL writes behind: the frames of a transaction are queued, and the
+// page of its commit frame waits until all of them are written. A new
+// WAL header starts after the deferred sync of the previous frames.
+*/
+static int CodecVfsWriteWal(CodecVfsFile* p, CodecVfsQueue* queue, const unsigned char* data, int amt, sqlite3_int64 off, int image)
+{
+  int pageSize = p->m_pageSize;
+  int unit = (pageSize > 0) ? pageSize + CODEC_VFS_FRAME_HEADER : SQLITE_MAX_PAGE_SIZE;
+  int rc = SQLITE_OK;
+
+  if (off == 0)
+  {
+    rc = CodecVfsQueueSync(queue);
+  }
+  if (pageSize > 0 && amt == CODEC_VFS_FRAME_HEADER && off >= CODEC_VFS_WAL_HEADER &&
+      (off - CODEC_VFS_WAL_HEADER) % unit == 0)
+  {
+    /* The size of the database after commit, 0 for other frames */
+    p->m_commit = (data[4] | data[5] | data[6] | data[7]) != 0;
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = CodecVfsQueueWrite(queue, data, amt, off, unit);
+  }
+  if (rc == SQLITE_OK && image >= 0 && p->m_commit)
+  {
+    p->m_commit = 0;
+    rc = CodecVfsQueueDrain(queue);
+  }
+  return rc;
+}
+
+static int CodecVfsWriteLog(CodecVfsFile* p, Codec* codec, const unsigned char* buf, int amt, sqlite3_int64 off)
+{
+  CodecVfsQueue* queue = (p->m_type == CODEC_VFS_WAL) ? CodecVfsGetQueue(p) : NULL;
+  unsigned char masked[CODEC_VFS_FRAME_HEADER];
+  unsigned char* data;
+  int image;
+
+  if (off == 0 && amt >= 28)
+  {
+    /* A new header, possibly with another page size */
+    const unsigned char* header = buf + ((p->m_type == CODEC_VFS_WAL) ? 8 : 24);
+    int pageSize = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+    p->m_pageSize = (CodecVfsValidPageSize(pageSize)) ? pageSize : 0;
+  }
+  image = CodecVfsLogImage(p, amt, off);
+  if (image < 0)
+  {
+    if (CodecVfsIsFrameHeader(p, amt, off) || CodecVfsIsRecordChecksum(p, amt, off))
+    {
+      memcpy(masked, buf, amt);
+      if (amt == 4)
+      {
+        CodecVfsMaskRecord(p, codec, masked, off);
+      }
+      else
+      {
+        CodecVfsMaskFrame(codec, masked, off);
+      }
+      buf = masked;
+    }
+    return (queue != NULL) ? CodecVfsWriteWal(p, queue, buf, amt, off, image)
+                           : p->m_real->pMethods->xWrite(p->m_real, buf, amt, off);
+  }
+  data = CodecVfsBuffer(p, amt);
+  if (data == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  /* Record header and trailer are copied, the page is encrypted across */
+  memcpy(data, buf, image);
+  memcpy(data + image + p->m_pageSize, buf + image + p->m_pageSize, amt - image - p->m_pageSize);
+  CodecEncryptTo(codec, CodecVfsLogPage(off + image, p->m_pageSize), buf + image, data + image, p->m_pageSize, 1);
+  CodecVfsKeepImage(p, data + image, off + image);
+  if (image > 0)
+  {
+    CodecVfsMaskFrame(codec, data, off);
+  }
+  return (queue != NULL) ? CodecVfsWriteWal(p, queue, data, amt, off, image)
+                         : p->m_real->pMethods->xWrite(p->m_real, data, amt, off);
+}
+
+/*
+// ----------------
+// Temporary files
+// ----------------
+*/
+
+/*
+// Temporary files are encrypted with AES-XTS under a random per-file key,
+// in data units of CODEC_VFS_TEMP_UNIT bytes, the unit number being the
+// tweak. Every 16-byte block is encrypted on its own, so that SQLite may
+// rewrite any range of the file: partial blocks at the edges of a write
+// are read back, merged and encrypted again. A stream cipher with a fixed
+// nonce would reuse its key stream on such rewrites. The file is padded to
+// whole blocks; the size SQLite sees is kept in m_size.
+*/
+
+#define CODEC_VFS_TEMP_UNIT 512
+
+typedef struct _CodecVfsTemp
+{
+  Rijndael      m_encrypt;     /* XEX data key */
+  Rijndael      m_decrypt;
+  Rijndael      m_tweak;       /* ECB tweak key */
+  sqlite3_int64 m_size;        /* Size of the file as written by SQLite */
+} CodecVfsTemp;
+
+static int CodecVfsTempOpen(CodecVfsFile* p)
+{
+  unsigned char key[32];
+  unsigned char iv[16];
+
+  p->m_temp = (CodecVfsTemp*) sqlite3_malloc(sizeof(CodecVfsTemp));
+  if (p->m_temp == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  memset(p->m_temp, 0, sizeof(CodecVfsTemp));
+  memset(iv, 0, sizeof(iv));
+  sqlite3_randomness(sizeof(key), key);
+  RijndaelInit(&p->m_temp->m_encrypt, RIJNDAEL_Direction_Mode_XEX, RIJNDAEL_Direction_Encrypt,
+               key, RIJNDAEL_Direction_KeyLength_Key16Bytes, iv);
+  p->m_temp->m_decrypt = p->m_temp->m_encrypt;
+  p->m_temp->m_decrypt.m_direction = RIJNDAEL_Direction_Decrypt;
+  RijndaelKeyEncToDec(&p->m_temp->m_decrypt);
+  RijndaelInit(&p->m_temp->m_tweak, RIJNDAEL_Direction_Mode_ECB, RIJNDAEL_Direction_Encrypt,
+               key + 16, RIJNDAEL_Direction_KeyLength_Key16Bytes, iv);
+  memset(key, 0, sizeof(key));
+  return SQLITE_OK;
+}
+
+static void CodecVfsTempClose(CodecVfsFile* p)
+{
+  if (p->m_temp != NULL)
+  {
+    memset(p->m_temp, 0, sizeof(CodecVfsTemp));
+    sqlite3_free(p->m_temp);
+    p->m_temp = NULL;
+  }
+}
+
+/*
+// Encrypt or decrypt len bytes of a temporary file in place; off and len
+// are multiples of 16
+*/
+static void CodecVfsTempCrypt(CodecVfsFile* p, int encrypt, unsigned char* data, int len, sqlite3_int64 off)
+{
+  Rijndael* aes = (encrypt) ? &p->m_temp->m_encrypt : &p->m_temp->m_decrypt;
+  unsigned char tweak[16];
+  sqlite3_int64 unit;
+  UINT32 carry;
+  int first, n, j;
+
+  while (len > 0)
+  {
+    unit = off / CODEC_VFS_TEMP_UNIT;
+    first = (int) (off % CODEC_VFS_TEMP_UNIT);
+    n = (len < CODEC_VFS_TEMP_UNIT - first) ? len : CODEC_VFS_TEMP_UNIT - first;
+
+    /* The unit number as 128 bit little endian tweak, doubled once per block skipped */
+    memset(tweak, 0, 16);
+    for (j = 0; j < 8; j++)
+    {
+      tweak[j] = (unsigned char) (unit >> (8 * j));
+    }
+    RijndaelBlockEncrypt(&p->m_temp->m_tweak, tweak, 128, aes->m_initVector);
+    for (; first > 0; first -= 16)
+    {
+      carry = aes->m_initVector[15] >> 7;
+      for (j = 15; j > 0; j--)
+      {
+        aes->m_initVector[j] = (unsigned char) ((aes->m_initVector[j] << 1) | (aes->m_initVector[j-1] >> 7));
+      }
+      aes->m_initVector[0] = (unsigned char) ((aes->m_initVector[0] << 1) ^ (carry * 0x87));
+    }
+
+    if (encrypt)
+    {
+      RijndaelBlockEncrypt(aes, data, n * 8, data);
+    }
+    else
+    {
+      RijndaelBlockDecrypt(aes, data, n * 8, data);
+    }
+    data += n;
+    off += n;
+    len -= n;
+  }
+}
+
+/*
+// Read the 16-byte block at off of a temporary file into block; bytes at
+// or beyond the size of the file read as zero
+*/
+static int CodecVfsTempBlock(CodecVfsFile* p, unsigned char* block, sqlite3_int64 off)
+{
+  sqlite3_int64 size = p->m_temp->m_size;
+  int rc;
+
+  memset(block, 0, 16);
+  if (off >= size)
+  {
+    return SQLITE_OK;
+  }
+  rc = p->m_real->pMethods->xRead(p->m_real, block, 16, off);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  CodecVfsTempCrypt(p, 0, block, 16, off);
+  if (off + 16 > size)
+  {
+    memset(block + (size - off), 0, (size_t) (off + 16 - size));
+  }
+  return SQLITE_OK;
+}
+
+static int CodecVfsTempRead(CodecVfsFile* p, unsigned char* buf, int amt, sqlite3_int64 off)
+{
+  sqlite3_int64 size = p->m_temp->m_size;
+  sqlite3_int64 lo = off & ~15;
+  sqlite3_int64 hi = (off + amt + 15) & ~15;
+  unsigned char* data;
+  int avail;
+  int rc;
+
+  if (off >= size)
+  {
+    memset(buf, 0, amt);
+    return SQLITE_IOERR_SHORT_READ;
+  }
+  if (hi > ((size + 15) & ~15))
+  {
+    hi = (size + 15) & ~15;
+  }
+  data = CodecVfsBuffer(p, (int) (hi - lo));
+  if (data == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  rc = p->m_real->pMethods->xRead(p->m_real, data, (int) (hi - lo), lo);
+  if (rc != SQLITE_OK)
+  {
+    if (rc == SQLITE_IOERR_SHORT_READ)
+    {
+      memset(buf, 0, amt);
+    }
+    return rc;
+  }
+  CodecVfsTempCrypt(p, 0, data, (int) (hi - lo), lo);
+  avail = (off + amt > size) ? (int) (size - off) : amt;
+  memcpy(buf, data + (off - lo), avail);
+  if (avail < amt)
+  {
+    memset(buf + avail, 0, amt - avail);
+    return SQLITE_IOERR_SHORT_READ;
+  }
+  return SQLITE_OK;
+}
+
+static int CodecVfsTempWrite(CodecVfsFile* p, const unsigned char* buf, int amt, sqlite3_int64 off)
+{
+  /* A gap between the end of the file and off is written as zeros */
+  sqlite3_int64 start = (off > p->m_temp->m_size) ? p->m_temp->m_size : off;
+  sqlite3_int64 lo = start & ~15;
+  sqlite3_int64 hi = (off + amt + 15) & ~15;
+  unsigned char* data = CodecVfsBuffer(p, (int) (hi - lo));
+  int rc = SQLITE_OK;
+
+  if (data == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  memset(data, 0, (size_t) (hi - lo));
+  /* Partial blocks at the edges are merged with their content */
+  if (lo < start)
+  {
+    rc = CodecVfsTempBlock(p, data, lo);
+  }
+  if (rc == SQLITE_OK && hi > off + amt && (hi - 16 > lo || lo == start))
+  {
+    rc = CodecVfsTempBlock(p, data + (hi - 16 - lo), hi - 16);
+  }
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  if (amt > 0)
+  {
+    memcpy(data + (off - lo), buf, amt);
+  }
+  CodecVfsTempCrypt(p, 1, data, (int) (hi - lo), lo);
+  rc = p->m_real->pMethods->xWrite(p->m_real, data, (int) (hi - lo), lo);
+  if (rc == SQLITE_OK && off + amt > p->m_temp->m_size)
+  {
+    p->m_temp->m_size = off + amt;
+  }
+  return rc;
+}
+
+static int CodecVfsTempTruncate(CodecVfsFile* p, sqlite3_int64 size)
+{
+  int rc;
+  if (size > p->m_temp->m_size)
+  {
+    /* Growing the file appends zeros */
+    return CodecVfsTempWrite(p, NULL, 0, size);
+  }
+  rc = p->m_real->pMethods->xTruncate(p->m_real, (size + 15) & ~15);
+  if (rc == SQLITE_OK)
+  {
+    p->m_temp->m_size = size;
+  }
+  return rc;
+}
+
+/*
+// ----------------
+// I/O methods
+// ----------------
+*/
+
+static int CodecVfsClose(sqlite3_file* pFile)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  CodecVfsFile** pp;
+  int rc = SQLITE_OK;
+
+  if (p->m_type == CODEC_VFS_MAIN)
+  {
+    if (p->m_codec != NULL)
+    {
+      rc = CodecVfsFlush(p);
+    }
+    CodecVfsAheadStop(p);
+    if (p->m_wal != NULL)
+    {
+      p->m_wal->m_main = NULL;
+    }
+    sqlite3_mutex_enter(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+    for (pp = &codecVfsFiles; *pp != NULL; pp = &(*pp)->m_next)
+    {
+      if (*pp == p)
+      {
+        *pp = p->m_next;
+        break;
+      }
+    }
+    sqlite3_mutex_leave(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+  }
+  else if (p->m_type == CODEC_VFS_WAL && p->m_main != NULL && p->m_main->m_wal == p)
+  {
+    p->m_main->m_wal = NULL;
+  }
+  if (p->m_queue != NULL)
+  {
+    int rc2 = CodecVfsQueueDestroy(p->m_queue);
+    if (rc == SQLITE_OK) rc = rc2;
+  }
+  if (p->m_codec != NULL)
+  {
+    CodecTerm(p->m_codec);
+    sqlite3_free(p->m_codec);
+  }
+  sqlite3_free(p->m_buffer);
+  sqlite3_free(p->m_run);
+  CodecVfsTempClose(p);
+  if (p->m_real->pMethods != NULL)
+  {
+    int rc2 = p->m_real->pMethods->xClose(p->m_real);
+    if (rc == SQLITE_OK) rc = rc2;
+  }
+  return rc;
+}
+
+static int CodecVfsRead(sqlite3_file* pFile, void* buf, int amt, sqlite3_int64 off)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  Codec* codec;
+  int rc;
+
+  switch (p->m_type)
+  {
+    case CODEC_VFS_MAIN:
+      if (CodecVfsFileCodec(p) != NULL)
+      {
+        return CodecVfsReadMain(p, (unsigned char*) buf, amt, off);
+      }
+      break;
+    case CODEC_VFS_JOURNAL:
+    case CODEC_VFS_WAL:
+      if ((codec = CodecVfsFileCodec(p)) != NULL)
+      {
+        rc = (p->m_queue != NULL) ? CodecVfsQueueDrain(p->m_queue) : SQLITE_OK;
+        return (rc != SQLITE_OK) ? rc : CodecVfsReadLog(p, codec, (unsigned char*) buf, amt, off);
+      }
+      break;
+    case CODEC_VFS_TEMP:
+      return CodecVfsTempRead(p, (unsigned char*) buf, amt, off);
+    default:
+      break;
+  }
+  return p->m_real->pMethods->xRead(p->m_real, buf, amt, off);
+}
+
+static int CodecVfsWrite(sqlite3_file* pFile, const void* buf, int amt, sqlite3_int64 off)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  Codec* codec;
+
+  switch (p->m_type)
+  {
+    case CODEC_VFS_MAIN:
+      if (CodecVfsFileCodec(p) != NULL && CodecHasWriteKey(p->m_codec))
+      {
+        return CodecVfsWriteMain(p, (const unsigned char*) buf, amt, off);
+      }
+      break;
+    case CODEC_VFS_JOURNAL:
+    case CODEC_VFS_WAL:
+      if ((codec = CodecVfsFileCodec(p)) != NULL)
+      {
+        return CodecVfsWriteLog(p, codec, (const unsigned char*) buf, amt, off);
+      }
+      break;
+    case CODEC_VFS_TEMP:
+      return CodecVfsTempWrite(p, (const unsigned char*) buf, amt, off);
+    default:
+      break;
+  }
+  return p->m_real->pMethods->xWrite(p->m_real, buf, amt, off);
+}
+
+static int CodecVfsTruncate(sqlite3_file* pFile, sqlite3_int64 size)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  int rc;
+  if (p->m_type == CODEC_VFS_TEMP)
+  {
+    return CodecVfsTempTruncate(p, size);
+  }
+  rc = CodecVfsFlush(p);
+  if (rc == SQLITE_OK)
+  {
+    rc = (p->m_queue != NULL && p->m_type == CODEC_VFS_WAL) ? CodecVfsQueueSync(p->m_queue) : CodecVfsSyncWal(p);
+  }
+  CodecVfsAheadDrop(p);
+  return (rc != SQLITE_OK) ? rc : p->m_real->pMethods->xTruncate(p->m_real, size);
+}
+
+static int CodecVfsSync(sqlite3_file* pFile, int flags)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  int rc;
+  if (p->m_type == CODEC_VFS_WAL && p->m_queue != NULL && p->m_main != NULL && p->m_main->m_window > 0)
+  {
+    /* Commits within the durability window share one sync */
+    return CodecVfsQueueDefer(p->m_queue, flags, p->m_main->m_window);
+  }
+  rc = CodecVfsFlush(p);
+  return (rc != SQLITE_OK) ? rc : p->m_real->pMethods->xSync(p->m_real, flags);
+}
+
+static int CodecVfsFileSize(sqlite3_file* pFile, sqlite3_int64* pSize)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  int rc;
+  if (p->m_type == CODEC_VFS_TEMP)
+  {
+    *pSize = p->m_temp->m_size;
+    return SQLITE_OK;
+  }
+  rc = CodecVfsFlush(p);
+  return (rc != SQLITE_OK) ? rc : p->m_real->pMethods->xFileSize(p->m_real, pSize);
+}
+
+static int CodecVfsLock(sqlite3_file* pFile, int eLock)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  int rc;
+  if (p->m_lock < SQLITE_LOCK_SHARED)
+  {
+    /* Other connections may have changed the file */
+    CodecVfsAheadDrop(p);
+  }
+  rc = p->m_real->pMethods->xLock(p->m_real, eLock);
+  if (rc == SQLITE_OK && eLock > p->m_lock)
+  {
+    p->m_lock = eLock;
+  }
+  return rc;
+}
+
+static int CodecVfsUnlock(sqlite3_file* pFile, int eLock)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  /* Other connections may read the pages once the lock is gone */
+  int rc = CodecVfsFlush(p);
+  int rc2 = p->m_real->pMethods->xUnlock(p->m_real, eLock);
+  CodecVfsAheadDrop(p);
+  if (rc2 == SQLITE_OK && eLock < p->m_lock)
+  {
+    p->m_lock = eLock;
+  }
+  return (rc != SQLITE_OK) ? rc : rc2;
+}
+
+static int CodecVfsCheckReservedLock(sqlite3_file* pFile, int* pResOut)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  return p->m_real->pMethods->xCheckReservedLock(p->m_real, pResOut);
+}
+
+static int CodecVfsFileControl(sqlite3_file* pFile, int op, void* pArg)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  int rc = CodecVfsFlush(p);
+  return (rc != SQLITE_OK) ? rc : p->m_real->pMethods->xFileControl(p->m_real, op, pArg);
+}
+
+static int CodecVfsSectorSize(sqlite3_file* pFile)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  return p->m_real->pMethods->xSectorSize(p->m_real);
+}
+
+static int CodecVfsDeviceCharacteristics(sqlite3_file* pFile)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  return p->m_real->pMethods->xDeviceCharacteristics(p->m_real);
+}
+
+/*
+// In WAL mode the database file is written by checkpoints, which other
+// connections see through the WAL index rather than through file locks,
+// so page writes are no longer collected.
+*/
+static int CodecVfsShmMap(sqlite3_file* pFile, int iPg, int pgsz, int bExtend, void volatile** pp)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  int rc = CodecVfsFlush(p);
+  p->m_shm = 1;
+  return (rc != SQLITE_OK) ? rc : p->m_real->pMethods->xShmMap(p->m_real, iPg, pgsz, bExtend, pp);
+}
+
+static int CodecVfsShmLock(sqlite3_file* pFile, int offset, int n, int flags)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  /* A new snapshot may see pages written by a checkpoint */
+  CodecVfsAheadDrop(p);
+  return p->m_real->pMethods->xShmLock(p->m_real, offset, n, flags);
+}
+
+static void CodecVfsShmBarrier(sqlite3_file* pFile)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  p->m_real->pMethods->xShmBarrier(p->m_real);
+}
+
+static int CodecVfsShmUnmap(sqlite3_file* pFile, int deleteFlag)
+{
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  return p->m_real->pMethods->xShmUnmap(p->m_real, deleteFlag);
+}
+
+static const sqlite3_io_methods codecVfsMethods1 =
+{
+  1,
+  CodecVfsClose,
+  CodecVfsRead,
+  CodecVfsWrite,
+  CodecVfsTruncate,
+  CodecVfsSync,
+  CodecVfsFileSize,
+  CodecVfsLock,
+  CodecVfsUnlock,
+  CodecVfsCheckReservedLock,
+  CodecVfsFileControl,
+  CodecVfsSectorSize,
+  CodecVfsDeviceCharacteristics,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+static const sqlite3_io_methods codecVfsMethods2 =
+{
+  2,
+  CodecVfsClose,
+  CodecVfsRead,
+  CodecVfsWrite,
+  CodecVfsTruncate,
+  CodecVfsSync,
+  CodecVfsFileSize,
+  CodecVfsLock,
+  CodecVfsUnlock,
+  CodecVfsCheckReservedLock,
+  CodecVfsFileControl,
+  CodecVfsSectorSize,
+  CodecVfsDeviceCharacteristics,
+  CodecVfsShmMap,
+  CodecVfsShmLock,
+  CodecVfsShmBarrier,
+  CodecVfsShmUnmap
+};
+
+/*
+// ----------------
+// VFS methods
+// ----------------
+*/
+
+/*
+// Finds the main database file a journal or WAL belongs to: the open main
+// database files whose name followed by zSuffix is zName. The file is
+// linked to the candidate if there is only one, or else to the only one
+// holding a RESERVED lock or higher, i.e. the connection writing the
+// journal or rolling back a hot one. Otherwise, with several connections
+// to the same database in this process, the file cannot tell which one
+// opened it and gets a copy of the codec of a candidate; all connections
+// to a database are expected to use the same key.
+*/
+static int CodecVfsFindMain(CodecVfsFile* p, const char* zName, const char* zSuffix)
+{
+  CodecVfsFile* first = NULL;
+  CodecVfsFile* keyed = NULL;
+  CodecVfsFile* locked = NULL;
+  CodecVfsFile* f;
+  int candidates = 0;
+  int nLocked = 0;
+  int rc = SQLITE_OK;
+  int n;
+
+  if (zName == NULL)
+  {
+    return SQLITE_OK;
+  }
+  sqlite3_mutex_enter(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+  for (f = codecVfsFiles; f != NULL; f = f->m_next)
+  {
+    n = (int) strlen(f->m_name);
+    if (strncmp(zName, f->m_name, n) != 0 || strcmp(zName + n, zSuffix) != 0)
+    {
+      continue;
+    }
+    if (first == NULL)
+    {
+      first = f;
+    }
+    if (keyed == NULL && f->m_codec != NULL)
+    {
+      keyed = f;
+    }
+    candidates++;
+    if (f->m_lock >= SQLITE_LOCK_RESERVED)
+    {
+      locked = f;
+      nLocked++;
+    }
+  }
+  if (candidates == 1 || nLocked == 1)
+  {
+    p->m_main = (candidates == 1) ? first : locked;
+    if (p->m_type == CODEC_VFS_WAL)
+    {
+      p->m_main->m_wal = p;
+    }
+  }
+  else if (keyed != NULL)
+  {
+    p->m_codec = (Codec*) sqlite3_malloc(sizeof(Codec));
+    if (p->m_codec != NULL)
+    {
+      CodecInit(p->m_codec);
+      CodecCopy(p->m_codec, keyed->m_codec);
+    }
+    else
+    {
+      rc = SQLITE_NOMEM;
+    }
+  }
+  sqlite3_mutex_leave(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+  return rc;
+}
+
+static int CodecVfsOpen(sqlite3_vfs* pVfs, const char* zName, sqlite3_file* pFile, int flags, int* pOutFlags)
+{
+  sqlite3_vfs* parent = CodecVfsParent(pVfs);
+  CodecVfsFile* p = (CodecVfsFile*) pFile;
+  int rc;
+
+  memset(p, 0, sizeof(CodecVfsFile));
+  p->m_real = (sqlite3_file*) &p[1];
+  p->m_name = zName;
+  p->m_window = -1;
+  p->m_imageOffset = -1;
+  rc = parent->xOpen(parent, zName, p->m_real, flags, pOutFlags);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+
+  if (flags & SQLITE_OPEN_MAIN_DB)
+  {
+    p->m_type = (zName != NULL) ? CODEC_VFS_MAIN : CODEC_VFS_TEMP;
+  }
+  else if (flags & SQLITE_OPEN_MAIN_JOURNAL)
+  {
+    p->m_type = CODEC_VFS_JOURNAL;
+    rc = CodecVfsFindMain(p, zName, "-journal");
+  }
+  else if (flags & SQLITE_OPEN_WAL)
+  {
+    p->m_type = CODEC_VFS_WAL;
+    rc = CodecVfsFindMain(p, zName, "-wal");
+  }
+  else if (flags & (SQLITE_OPEN_TEMP_DB | SQLITE_OPEN_TEMP_JOURNAL |
+                    SQLITE_OPEN_SUBJOURNAL | SQLITE_OPEN_TRANSIENT_DB))
+  {
+    p->m_type = CODEC_VFS_TEMP;
+  }
+  if (p->m_type == CODEC_VFS_TEMP)
+  {
+    rc = CodecVfsTempOpen(p);
+  }
+  if (rc != SQLITE_OK)
+  {
+    p->m_real->pMethods->xClose(p->m_real);
+    return rc;
+  }
+  if (p->m_type == CODEC_VFS_MAIN)
+  {
+    sqlite3_mutex_enter(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+    p->m_next = codecVfsFiles;
+    codecVfsFiles = p;
+    sqlite3_mutex_leave(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+  }
+  p->m_base.pMethods = (p->m_real->pMethods->iVersion >= 2) ? &codecVfsMethods2 : &codecVfsMethods1;
+  return SQLITE_OK;
+}
+
+static int CodecVfsDelete(sqlite3_vfs* pVfs, const char* zName, int syncDir)
+{
+  return CodecVfsParent(pVfs)->xDelete(CodecVfsParent(pVfs), zName, syncDir);
+}
+
+static int CodecVfsAccess(sqlite3_vfs* pVfs, const char* zName, int flags, int* pResOut)
+{
+  return CodecVfsParent(pVfs)->xAccess(CodecVfsParent(pVfs), zName, flags, pResOut);
+}
+
+static int CodecVfsFullPathname(sqlite3_vfs* pVfs, const char* zName, int nOut, char* zOut)
+{
+  return CodecVfsParent(pVfs)->xFullPathname(CodecVfsParent(pVfs), zName, nOut, zOut);
+}
+
+static void* CodecVfsDlOpen(sqlite3_vfs* pVfs, const char* zFilename)
+{
+  return CodecVfsParent(pVfs)->xDlOpen(CodecVfsParent(pVfs), zFilename);
+}
+
+static void CodecVfsDlError(sqlite3_vfs* pVfs, int nByte, char* zErrMsg)
+{
+  CodecVfsParent(pVfs)->xDlError(CodecVfsParent(pVfs), nByte, zErrMsg);
+}
+
+static void (*CodecVfsDlSym(sqlite3_vfs* pVfs, void* pHandle, const char* zSymbol))(void)
+{
+  return CodecVfsParent(pVfs)->xDlSym(CodecVfsParent(pVfs), pHandle, zSymbol);
+}
+
+static void CodecVfsDlClose(sqlite3_vfs* pVfs, void* pHandle)
+{
+  CodecVfsParent(pVfs)->xDlClose(CodecVfsParent(pVfs), pHandle);
+}
+
+static int CodecVfsRandomness(sqlite3_vfs* pVfs, int nByte, char* zOut)
+{
+  return CodecVfsParent(pVfs)->xRandomness(CodecVfsParent(pVfs), nByte, zOut);
+}
+
+static int CodecVfsSleep(sqlite3_vfs* pVfs, int microseconds)
+{
+  return CodecVfsParent(pVfs)->xSleep(CodecVfsParent(pVfs), microseconds);
+}
+
+static int CodecVfsCurrentTime(sqlite3_vfs* pVfs, double* pTime)
+{
+  return CodecVfsParent(pVfs)->xCurrentTime(CodecVfsParent(pVfs), pTime);
+}
+
+static int CodecVfsGetLastError(sqlite3_vfs* pVfs, int nByte, char* zErrMsg)
+{
+  return CodecVfsParent(pVfs)->xGetLastError(CodecVfsParent(pVfs), nByte, zErrMsg);
+}
+
+static int CodecVfsCurrentTimeInt64(sqlite3_vfs* pVfs, sqlite3_int64* pTime)
+{
+  return CodecVfsParent(pVfs)->xCurrentTimeInt64(CodecVfsParent(pVfs), pTime);
+}
+
+int sqlite3_codec_vfs_register(const char *zParent, int makeDflt)
+{
+  sqlite3_vfs* parent = sqlite3_vfs_find(zParent);
+  if (parent == NULL || parent == &codecVfs)
+  {
+    return SQLITE_ERROR;
+  }
+  sqlite3_mutex_enter(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+  if (codecVfs.zName == NULL)
+  {
+    codecVfs.iVersion          = (parent->iVersion >= 2 && parent->xCurrentTimeInt64 != NULL) ? 2 : 1;
+    codecVfs.szOsFile          = (int) sizeof(CodecVfsFile) + parent->szOsFile;
+    codecVfs.mxPathname        = parent->mxPathname;
+    codecVfs.pAppData          = parent;
+    codecVfs.xOpen             = CodecVfsOpen;
+    codecVfs.xDelete           = CodecVfsDelete;
+    codecVfs.xAccess           = CodecVfsAccess;
+    codecVfs.xFullPathname     = CodecVfsFullPathname;
+    codecVfs.xDlOpen           = CodecVfsDlOpen;
+    codecVfs.xDlError          = CodecVfsDlError;
+    codecVfs.xDlSym            = CodecVfsDlSym;
+    codecVfs.xDlClose          = CodecVfsDlClose;
+    codecVfs.xRandomness       = CodecVfsRandomness;
+    codecVfs.xSleep            = CodecVfsSleep;
+    codecVfs.xCurrentTime      = CodecVfsCurrentTime;
+    codecVfs.xGetLastError     = CodecVfsGetLastError;
+    codecVfs.xCurrentTimeInt64 = CodecVfsCurrentTimeInt64;
+    codecVfs.zName             = SQLITE_CODEC_VFS;
+  }
+  sqlite3_mutex_leave(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER));
+  return sqlite3_vfs_register(&codecVfs, makeDflt);
+}
+
+#endif /* SQLITE_HAS_CODEC */
+
+#endif /* SQLITE_OMIT_DISKIO */
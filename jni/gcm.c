@@ -0,0 +1,485 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        gcm.c
+// Purpose:     AES-GCM authenticated encryption (NIST SP 800-38D)
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file gcm.c Implementation of AES-GCM
+//
+// The counter blocks of a chunk are encrypted with one ECB call, so the
+// hardware AES backends keep several blocks in flight, and the chunk is
+// hashed while it is still in the cache. GHASH uses carry-less
+// multiplication where the CPU has it (PCLMULQDQ on x86, PMULL on arm64),
+// four blocks per reduction with the precomputed powers of H, and Shoup's
+// 4 bit table otherwise.
+*/
+
+#include "gcm.h"
+
+#include <string.h>
+
+/*
+// Carry-less multiply backends. x86 keeps field elements byte reflected
+// and shifts the product left by one bit before the reduction (Gueron and
+// Kounavis); arm64 reverses the bits of each byte, which turns the GCM bit
+// order into plain polynomial order and needs no shift.
+*/
+#if !defined(GCM_NO_CLMUL) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GCM_HAVE_CLMUL 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#define GCM_TARGET_CLMUL __attribute__((target("pclmul,ssse3")))
+#endif
+
+#if !defined(GCM_NO_CLMUL) && defined(__GNUC__) && defined(__aarch64__) && defined(__linux__) && \
+    (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define GCM_HAVE_CLMUL 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#define GCM_TARGET_CLMUL
+#endif
+
+#define GCM_CHUNK_BLOCKS 32
+
+static void GcmPutBE32(UINT8* p, unsigned int v)
+{
+  p[0] = (UINT8) (v >> 24);
+  p[1] = (UINT8) (v >> 16);
+  p[2] = (UINT8) (v >> 8);
+  p[3] = (UINT8) v;
+}
+
+static void GcmPutBE64(UINT8* p, unsigned long long v)
+{
+  GcmPutBE32(p, (unsigned int) (v >> 32));
+  GcmPutBE32(p + 4, (unsigned int) v);
+}
+
+static unsigned long long GcmGetBE64(const UINT8* p)
+{
+  unsigned long long v = 0;
+  int i;
+  for (i = 0; i < 8; i++)
+  {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+/*
+// Portable GHASH: x = x * H with the 4 bit table built by GcmTableInit.
+*/
+static const unsigned long long gcmLast4[16] =
+{
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static void GcmTableInit(GcmKey* gcm, const UINT8 h[16])
+{
+  unsigned long long vh = GcmGetBE64(h);
+  unsigned long long vl = GcmGetBE64(h + 8);
+  unsigned long long t;
+  int i, j;
+
+  gcm->m_hh[0] = 0;
+  gcm->m_hl[0] = 0;
+  gcm->m_hh[8] = vh;
+  gcm->m_hl[8] = vl;
+  for (i = 4; i > 0; i >>= 1)
+  {
+    t = (vl & 1) * 0xe1000000U;
+    vl = (vh << 63) | (vl >> 1);
+    vh = (vh >> 1) ^ (t << 32);
+    gcm->m_hh[i] = vh;
+    gcm->m_hl[i] = vl;
+  }
+  for (i = 2; i <= 8; i *= 2)
+  {
+    for (j = 1; j < i; j++)
+    {
+      gcm->m_hh[i + j] = gcm->m_hh[i] ^ gcm->m_hh[j];
+      gcm->m_hl[i + j] = gcm->m_hl[i] ^ gcm->m_hl[j];
+    }
+  }
+}
+
+static void GcmTableMult(const GcmKey* gcm, UINT8 x[16])
+{
+  unsigned long long zh, zl;
+  int i, lo, hi, rem;
+
+  lo = x[15] & 0xf;
+  zh = gcm->m_hh[lo];
+  zl = gcm->m_hl[lo];
+  for (i = 15; i >= 0; i--)
+  {
+    lo = x[i] & 0xf;
+    hi = x[i] >> 4;
+    if (i != 15)
+    {
+      rem = (int) (zl & 0xf);
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ (gcmLast4[rem] << 48);
+      zh ^= gcm->m_hh[lo];
+      zl ^= gcm->m_hl[lo];
+    }
+    rem = (int) (zl & 0xf);
+    zl = (zh << 60) | (zl >> 4);
+    zh = (zh >> 4) ^ (gcmLast4[rem] << 48);
+    zh ^= gcm->m_hh[hi];
+    zl ^= gcm->m_hl[hi];
+  }
+  GcmPutBE64(x, zh);
+  GcmPutBE64(x + 8, zl);
+}
+
+static void GcmHashTable(const GcmKey* gcm, UINT8 y[16], const UINT8* data, int blocks)
+{
+  int i;
+  for (; blocks > 0; blocks--, data += 16)
+  {
+    for (i = 0; i < 16; i++)
+    {
+      y[i] ^= data[i];
+    }
+    GcmTableMult(gcm, y);
+  }
+}
+
+#if GCM_HAVE_CLMUL
+
+#if defined(__x86_64__) || defined(__i386__)
+
+typedef __m128i GCMVEC;
+
+#define GCM_BSWAP_MASK _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+GCM_TARGET_CLMUL static __inline GCMVEC GcmClmulLoad(const UINT8* p)
+{
+  return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) p), GCM_BSWAP_MASK);
+}
+
+GCM_TARGET_CLMUL static __inline void GcmClmulStore(UINT8* p, GCMVEC v)
+{
+  _mm_storeu_si128((__m128i*) p, _mm_shuffle_epi8(v, GCM_BSWAP_MASK));
+}
+
+#define GcmClmulXor(a, b) _mm_xor_si128(a, b)
+#define GcmClmulZero()    _mm_setzero_si128()
+
+/* Accumulates the unreduced 256 bit product a * b into hi:lo */
+GCM_TARGET_CLMUL static __inline void GcmClmulMul(GCMVEC a, GCMVEC b, GCMVEC* lo, GCMVEC* hi)
+{
+  __m128i m = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+  *lo = _mm_xor_si128(*lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(m, 8)));
+  *hi = _mm_xor_si128(*hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(m, 8)));
+}
+
+GCM_TARGET_CLMUL static __inline GCMVEC GcmClmulReduce(GCMVEC lo, GCMVEC hi)
+{
+  __m128i t1, t2, t3, t4, t5;
+
+  /* Shift hi:lo left by one bit */
+  t1 = _mm_srli_epi32(lo, 31);
+  t2 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  t3 = _mm_srli_si128(t1, 12);
+  t2 = _mm_slli_si128(t2, 4);
+  t1 = _mm_slli_si128(t1, 4);
+  lo = _mm_or_si128(lo, t1);
+  hi = _mm_or_si128(hi, t2);
+  hi = _mm_or_si128(hi, t3);
+
+  /* Reduce modulo x^128 + x^7 + x^2 + x + 1 */
+  t1 = _mm_slli_epi32(lo, 31);
+  t2 = _mm_slli_epi32(lo, 30);
+  t3 = _mm_slli_epi32(lo, 25);
+  t1 = _mm_xor_si128(t1, _mm_xor_si128(t2, t3));
+  t2 = _mm_srli_si128(t1, 4);
+  t1 = _mm_slli_si128(t1, 12);
+  lo = _mm_xor_si128(lo, t1);
+  t3 = _mm_srli_epi32(lo, 1);
+  t4 = _mm_srli_epi32(lo, 2);
+  t5 = _mm_srli_epi32(lo, 7);
+  t3 = _mm_xor_si128(t3, _mm_xor_si128(t4, t5));
+  t3 = _mm_xor_si128(t3, t2);
+  lo = _mm_xor_si128(lo, t3);
+  return _mm_xor_si128(hi, lo);
+}
+
+#else /* arm64 */
+
+typedef uint64x2_t GCMVEC;
+
+static __inline GCMVEC GcmClmulLoad(const UINT8* p)
+{
+  return vreinterpretq_u64_u8(vrbitq_u8(vld1q_u8(p)));
+}
+
+static __inline void GcmClmulStore(UINT8* p, GCMVEC v)
+{
+  vst1q_u8(p, vrbitq_u8(vreinterpretq_u8_u64(v)));
+}
+
+#define GcmClmulXor(a, b) veorq_u64(a, b)
+#define GcmClmulZero()    vdupq_n_u64(0)
+
+#define GCM_PMULL(a, i, b, j) \
+  vreinterpretq_u64_p128(vmull_p64((poly64_t) vgetq_lane_u64(a, i), (poly64_t) vgetq_lane_u64(b, j)))
+
+/* Accumulates the unreduced 256 bit product a * b into hi:lo */
+static __inline void GcmClmulMul(GCMVEC a, GCMVEC b, GCMVEC* lo, GCMVEC* hi)
+{
+  uint64x2_t m = veorq_u64(GCM_PMULL(a, 0, b, 1), GCM_PMULL(a, 1, b, 0));
+  *lo = veorq_u64(*lo, veorq_u64(GCM_PMULL(a, 0, b, 0), vextq_u64(vdupq_n_u64(0), m, 1)));
+  *hi = veorq_u64(*hi, veorq_u64(GCM_PMULL(a, 1, b, 1), vextq_u64(m, vdupq_n_u64(0), 1)));
+}
+
+/* Reduces modulo x^128 + x^7 + x^2 + x + 1, folding hi in twice */
+static __inline GCMVEC GcmClmulReduce(GCMVEC lo, GCMVEC hi)
+{
+  const uint64x2_t p = vdupq_n_u64(0x87);
+  uint64x2_t t0 = GCM_PMULL(hi, 0, p, 0);
+  uint64x2_t t1 = GCM_PMULL(hi, 1, p, 0);
+  uint64x2_t t2 = GCM_PMULL(t1, 1, p, 0);
+  lo = veorq_u64(lo, t0);
+  lo = veorq_u64(lo, vextq_u64(vdupq_n_u64(0), t1, 1));
+  return veorq_u64(lo, t2);
+}
+
+#endif
+
+GCM_TARGET_CLMUL static void GcmHashClmul(const GcmKey* gcm, UINT8 y[16], const UINT8* data, int blocks)
+{
+  GCMVEC h1 = GcmClmulLoad(gcm->m_hpow[0]);
+  GCMVEC h2 = GcmClmulLoad(gcm->m_hpow[1]);
+  GCMVEC h3 = GcmClmulLoad(gcm->m_hpow[2]);
+  GCMVEC h4 = GcmClmulLoad(gcm->m_hpow[3]);
+  GCMVEC x = GcmClmulLoad(y);
+  GCMVEC lo, hi;
+
+  /* Y = (Y + X1) H^4 + X2 H^3 + X3 H^2 + X4 H, reduced once */
+  for (; blocks >= 4; blocks -= 4, data += 64)
+  {
+    lo = hi = GcmClmulZero();
+    GcmClmulMul(GcmClmulXor(x, GcmClmulLoad(data)), h4, &lo, &hi);
+    GcmClmulMul(GcmClmulLoad(data + 16), h3, &lo, &hi);
+    GcmClmulMul(GcmClmulLoad(data + 32), h2, &lo, &hi);
+    GcmClmulMul(GcmClmulLoad(data + 48), h1, &lo, &hi);
+    x = GcmClmulReduce(lo, hi);
+  }
+  for (; blocks > 0; blocks--, data += 16)
+  {
+    lo = hi = GcmClmulZero();
+    GcmClmulMul(GcmClmulXor(x, GcmClmulLoad(data)), h1, &lo, &hi);
+    x = GcmClmulReduce(lo, hi);
+  }
+  GcmClmulStore(y, x);
+}
+
+#endif /* GCM_HAVE_CLMUL */
+
+static int gcmBackend = -1;
+
+static int GcmHasBackend(int backend)
+{
+#if GCM_HAVE_CLMUL && (defined(__x86_64__) || defined(__i386__))
+  unsigned int eax, ebx, ecx, edx;
+#endif
+  switch (backend)
+  {
+    case GCM_Backend_Table:
+      return 1;
+#if GCM_HAVE_CLMUL
+    case GCM_Backend_CLMUL:
+#if defined(__x86_64__) || defined(__i386__)
+      return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+#else
+      return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+#endif
+#endif
+    default:
+      return 0;
+  }
+}
+
+int GcmGetBackend(void)
+{
+  if (gcmBackend < 0)
+  {
+    if (GcmHasBackend(GCM_Backend_CLMUL))
+      gcmBackend = GCM_Backend_CLMUL;
+    else
+      gcmBackend = GCM_Backend_Table;
+  }
+  return gcmBackend;
+}
+
+int GcmSetBackend(int backend)
+{
+  if (!GcmHasBackend(backend))
+  {
+    return GCM_UNSUPPORTED_BACKEND;
+  }
+  gcmBackend = backend;
+  return GCM_SUCCESS;
+}
+
+/*
+// Hashes len bytes into y; a partial last block is padded with zeros.
+*/
+static void GcmHash(const GcmKey* gcm, UINT8 y[16], const UINT8* data, int len)
+{
+  UINT8 last[16];
+  int blocks = len / 16;
+  int rest = len % 16;
+
+  if (rest > 0)
+  {
+    memset(last, 0, 16);
+    memcpy(last, data + 16 * blocks, rest);
+  }
+#if GCM_HAVE_CLMUL
+  if (GcmGetBackend() == GCM_Backend_CLMUL)
+  {
+    GcmHashClmul(gcm, y, data, blocks);
+    if (rest > 0)
+    {
+      GcmHashClmul(gcm, y, last, 1);
+    }
+    return;
+  }
+#endif
+  GcmHashTable(gcm, y, data, blocks);
+  if (rest > 0)
+  {
+    GcmHashTable(gcm, y, last, 1);
+  }
+}
+
+int GcmInit(GcmKey* gcm, UINT8* key, int keyLen)
+{
+  UINT8 h[16];
+  int rc, i;
+
+  RijndaelCreate(&gcm->m_aes);
+  rc = RijndaelInit(&gcm->m_aes, RIJNDAEL_Direction_Mode_ECB, RIJNDAEL_Direction_Encrypt, key, keyLen, NULL);
+  if (rc != RIJNDAEL_SUCCESS)
+  {
+    return rc;
+  }
+  memset(h, 0, 16);
+  RijndaelEncrypt(&gcm->m_aes, h, h);
+  GcmTableInit(gcm, h);
+
+  /* H^1..H^4 for the aggregated reduction */
+  memcpy(gcm->m_hpow[0], h, 16);
+  for (i = 1; i < 4; i++)
+  {
+    memcpy(gcm->m_hpow[i], gcm->m_hpow[i - 1], 16);
+    GcmTableMult(gcm, gcm->m_hpow[i]);
+  }
+  memset(h, 0, 16);
+  return GCM_SUCCESS;
+}
+
+/*
+// XOR n bytes of the key stream into data, a word at a time
+*/
+static void GcmXor(UINT8* out, const UINT8* in, const UINT8* stream, int n)
+{
+  unsigned long long a, b;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8)
+  {
+    memcpy(&a, in + i, 8);
+    memcpy(&b, stream + i, 8);
+    a ^= b;
+    memcpy(out + i, &a, 8);
+  }
+  for (; i < n; i++)
+  {
+    out[i] = in[i] ^ stream[i];
+  }
+}
+
+static void GcmCrypt(GcmKey* gcm, const UINT8 nonce[GCM_NONCE_LENGTH], const UINT8* aad, int aadLen,
+                     const UINT8* in, UINT8* out, int len, int encrypt, UINT8 tag[GCM_TAG_LENGTH])
+{
+  UINT8 counters[16 * GCM_CHUNK_BLOCKS];
+  UINT8 stream[16 * GCM_CHUNK_BLOCKS];
+  UINT8 y[16];
+  unsigned int counter = 2;
+  int total = len;
+  int n, blocks, i;
+
+  memset(y, 0, 16);
+  GcmHash(gcm, y, aad, aadLen);
+  for (i = 0; i < GCM_CHUNK_BLOCKS; i++)
+  {
+    memcpy(counters + 16 * i, nonce, GCM_NONCE_LENGTH);
+  }
+  while (len > 0)
+  {
+    n = (len < (int) sizeof(stream)) ? len : (int) sizeof(stream);
+    blocks = (n + 15) / 16;
+    for (i = 0; i < blocks; i++)
+    {
+      GcmPutBE32(counters + 16 * i + GCM_NONCE_LENGTH, counter++);
+    }
+    RijndaelBlockEncrypt(&gcm->m_aes, counters, 128 * blocks, stream);
+    if (!encrypt)
+    {
+      GcmHash(gcm, y, in, n);
+    }
+    GcmXor(out, in, stream, n);
+    if (encrypt)
+    {
+      GcmHash(gcm, y, out, n);
+    }
+    in += n;
+    out += n;
+    len -= n;
+  }
+
+  /* Length block, then the tag is Y xor E(J0) with J0 = nonce || 1 */
+  GcmPutBE64(stream, (unsigned long long) aadLen * 8);
+  GcmPutBE64(stream + 8, (unsigned long long) total * 8);
+  GcmHash(gcm, y, stream, 16);
+  memcpy(stream, nonce, GCM_NONCE_LENGTH);
+  GcmPutBE32(stream + GCM_NONCE_LENGTH, 1);
+  RijndaelEncrypt(&gcm->m_aes, stream, stream);
+  for (i = 0; i < GCM_TAG_LENGTH; i++)
+  {
+    tag[i] = y[i] ^ stream[i];
+  }
+  memset(stream, 0, sizeof(stream));
+}
+
+void GcmEncrypt(GcmKey* gcm, const UINT8 nonce[GCM_NONCE_LENGTH], const UINT8* aad, int aadLen,
+                const UINT8* input, int len, UINT8* output, UINT8 tag[GCM_TAG_LENGTH])
+{
+  GcmCrypt(gcm, nonce, aad, aadLen, input, output, len, 1, tag);
+}
+
+int GcmDecrypt(GcmKey* gcm, const UINT8 nonce[GCM_NONCE_LENGTH], const UINT8* aad, int aadLen,
+               UINT8* data, int len, const UINT8 tag[GCM_TAG_LENGTH])
+{
+  UINT8 check[GCM_TAG_LENGTH];
+  UINT8 diff = 0;
+  int i;
+
+  GcmCrypt(gcm, nonce, aad, aadLen, data, data, len, 0, check);
+  for (i = 0; i < GCM_TAG_LENGTH; i++)
+  {
+    diff |= check[i] ^ tag[i];
+  }
+  return (diff == 0) ? GCM_SUCCESS : GCM_AUTH_FAILED;
+}
@@ -0,0 +1,69 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        gcm.h
+// Purpose:     AES-GCM authenticated encryption (NIST SP 800-38D)
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file gcm.h Interface of AES-GCM
+*/
+
+#ifndef _GCM_H_
+#define _GCM_H_
+
+#include "rijndael.h"
+
+#define GCM_NONCE_LENGTH 12
+#define GCM_TAG_LENGTH   16
+
+#define GCM_SUCCESS              0
+#define GCM_AUTH_FAILED         -1
+#define GCM_UNSUPPORTED_BACKEND -2
+
+#define GCM_Backend_Table 0
+#define GCM_Backend_CLMUL 1
+
+/*
+/// Expanded AES-GCM key. (For internal use only)
+/// m_hpow holds H, H^2, H^3 and H^4 for the carry-less multiply backend,
+/// m_hl/m_hh the table of the portable GHASH.
+*/
+typedef struct _GcmKey
+{
+  Rijndael           m_aes;
+  UINT8              m_hpow[4][16];
+  unsigned long long m_hl[16];
+  unsigned long long m_hh[16];
+} GcmKey;
+
+/*
+// Expands key (keyLen as for RijndaelInit). Returns GCM_SUCCESS or a
+// Rijndael error code.
+*/
+int GcmInit(GcmKey* gcm, UINT8* key, int keyLen);
+
+/*
+// Encrypts len bytes of input into output (which may be the same buffer)
+// and computes the tag over the additional data aad and the ciphertext,
+// in a single pass.
+*/
+void GcmEncrypt(GcmKey* gcm, const UINT8 nonce[GCM_NONCE_LENGTH], const UINT8* aad, int aadLen,
+                const UINT8* input, int len, UINT8* output, UINT8 tag[GCM_TAG_LENGTH]);
+
+/*
+// Decrypts len bytes of data in place, checking the tag in the same pass.
+// Returns GCM_AUTH_FAILED if the tag does not match; data must then be
+// discarded.
+*/
+int GcmDecrypt(GcmKey* gcm, const UINT8 nonce[GCM_NONCE_LENGTH], const UINT8* aad, int aadLen,
+               UINT8* data, int len, const UINT8 tag[GCM_TAG_LENGTH]);
+
+/*
+// GHASH backend. On first use carry-less multiplication is selected if
+// the CPU has it (PCLMULQDQ on x86, PMULL on arm64), the portable table
+// code otherwise. GcmSetBackend forces a backend (e.g. for benchmarks) and
+// returns GCM_UNSUPPORTED_BACKEND if the CPU lacks it.
+*/
+int GcmGetBackend(void);
+int GcmSetBackend(int backend);
+
+#endif /* _GCM_H_ */
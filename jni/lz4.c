@@ -0,0 +1,257 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        lz4.c
+// Purpose:     LZ4 block compression of database pages
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file lz4.c Implementation of the LZ4 block compressor
+//
+// A block is a sequence of tokens. The high nibble of a token is the
+// number of literals that follow it, the low nibble the length of the
+// match after them minus 4; a nibble of 15 continues in further bytes of
+// 255 and a last byte below it. The literals are followed by the 16 bit
+// little endian distance back to the match. The last sequence has
+// literals only, and the last 5 bytes of the input are always literals.
+*/
+
+#include "lz4.h"
+
+#include <string.h>
+
+#define LZ4_HASH_LOG      12
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT      12  /* No match starts in the last 12 bytes */
+#define LZ4_SKIP_TRIGGER  6   /* Search faster through incompressible data */
+
+static unsigned int
+Lz4Read32(const unsigned char* p)
+{
+  return (unsigned int) p[0] | ((unsigned int) p[1] << 8) | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static unsigned int
+Lz4Hash(unsigned int v)
+{
+  return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static unsigned char*
+Lz4PutLength(unsigned char* op, int n)
+{
+  while (n >= 255)
+  {
+    *op++ = 255;
+    n -= 255;
+  }
+  *op++ = (unsigned char) n;
+  return op;
+}
+
+/*
+// Append a sequence of litLen literals from anchor and a match. Returns
+// NULL if the sequence does not fit before oend.
+*/
+static unsigned char*
+Lz4PutSequence(unsigned char* op, unsigned char* oend, const unsigned char* anchor, int litLen,
+               int offset, int matchLen)
+{
+  unsigned char* token = op++;
+
+  if (litLen + litLen / 255 + matchLen / 255 + 5 > oend - op)
+  {
+    return NULL;
+  }
+  if (litLen >= 15)
+  {
+    *token = 15 << 4;
+    op = Lz4PutLength(op, litLen - 15);
+  }
+  else
+  {
+    *token = (unsigned char) (litLen << 4);
+  }
+  memcpy(op, anchor, litLen);
+  op += litLen;
+  if (offset == 0)
+  {
+    /* Last sequence */
+    return op;
+  }
+  *op++ = (unsigned char) offset;
+  *op++ = (unsigned char) (offset >> 8);
+  matchLen -= LZ4_MIN_MATCH;
+  if (matchLen >= 15)
+  {
+    *token |= 15;
+    op = Lz4PutLength(op, matchLen - 15);
+  }
+  else
+  {
+    *token |= (unsigned char) matchLen;
+  }
+  return op;
+}
+
+int
+Lz4Compress(const unsigned char* in, int len, unsigned char* out, int outLimit)
+{
+  unsigned short table[1 << LZ4_HASH_LOG];
+  const unsigned char* ip = in;
+  const unsigned char* anchor = in;
+  const unsigned char* end = in + len;
+  const unsigned char* mflimit = end - LZ4_MF_LIMIT;
+  const unsigned char* matchlimit = end - LZ4_LAST_LITERALS;
+  const unsigned char* ref;
+  const unsigned char* mp;
+  unsigned char* op = out;
+  unsigned char* oend = out + outLimit;
+  unsigned int h;
+  int searches = 1 << LZ4_SKIP_TRIGGER;
+
+  if (len < 0 || len > LZ4_MAX_INPUT)
+  {
+    return 0;
+  }
+  if (len > LZ4_MF_LIMIT)
+  {
+    memset(table, 0, sizeof(table));
+    ip++;
+    while (ip <= mflimit)
+    {
+      h = Lz4Hash(Lz4Read32(ip));
+      ref = in + table[h];
+      table[h] = (unsigned short) (ip - in);
+      if (ref >= ip || Lz4Read32(ref) != Lz4Read32(ip))
+      {
+        ip += searches++ >> LZ4_SKIP_TRIGGER;
+        continue;
+      }
+      searches = 1 << LZ4_SKIP_TRIGGER;
+
+      /* Extend the match backwards into the literals, then forwards */
+      while (ip > anchor && ref > in && ip[-1] == ref[-1])
+      {
+        ip--;
+        ref--;
+      }
+      mp = ip + LZ4_MIN_MATCH;
+      ref += LZ4_MIN_MATCH;
+      while (mp < matchlimit && *mp == *ref)
+      {
+        mp++;
+        ref++;
+      }
+      op = Lz4PutSequence(op, oend, anchor, (int) (ip - anchor), (int) (mp - ref), (int) (mp - ip));
+      if (op == NULL)
+      {
+        return 0;
+      }
+      ip = anchor = mp;
+      if (ip <= mflimit)
+      {
+        table[Lz4Hash(Lz4Read32(ip - 2))] = (unsigned short) (ip - 2 - in);
+      }
+    }
+  }
+  op = Lz4PutSequence(op, oend, anchor, (int) (end - anchor), 0, 0);
+  return (op != NULL) ? (int) (op - out) : 0;
+}
+
+/*
+// Read the continuation bytes of a length nibble of 15
+*/
+static const unsigned char*
+Lz4GetLength(const unsigned char* ip, const unsigned char* iend, int* len, int limit)
+{
+  unsigned char b;
+  do
+  {
+    if (ip >= iend || *len > limit)
+    {
+      return NULL;
+    }
+    b = *ip++;
+    *len += b;
+  }
+  while (b == 255);
+  return ip;
+}
+
+int
+Lz4Decompress(const unsigned char* in, int inLen, unsigned char* out, int outLen)
+{
+  const unsigned char* ip = in;
+  const unsigned char* iend = in + inLen;
+  const unsigned char* ref;
+  unsigned char* op = out;
+  unsigned char* oend = out + outLen;
+  int token, len, offset;
+
+  for (;;)
+  {
+    if (ip >= iend)
+    {
+      return -1;
+    }
+    token = *ip++;
+    len = token >> 4;
+    if (len == 15 && (ip = Lz4GetLength(ip, iend, &len, inLen)) == NULL)
+    {
+      return -1;
+    }
+    if (len > iend - ip || len > oend - op)
+    {
+      return -1;
+    }
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+    if (ip == iend)
+    {
+      /* The last sequence has no match */
+      break;
+    }
+
+    if (iend - ip < 2)
+    {
+      return -1;
+    }
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op - out)
+    {
+      return -1;
+    }
+    len = token & 15;
+    if (len == 15 && (ip = Lz4GetLength(ip, iend, &len, outLen)) == NULL)
+    {
+      return -1;
+    }
+    len += LZ4_MIN_MATCH;
+    if (len > oend - op)
+    {
+      return -1;
+    }
+    ref = op - offset;
+    if (offset >= len)
+    {
+      memcpy(op, ref, len);
+    }
+    else if (offset == 1)
+    {
+      /* A run of one byte, as in the free space of a page */
+      memset(op, *ref, len);
+    }
+    else
+    {
+      int j;
+      for (j = 0; j < len; j++)
+      {
+        op[j] = ref[j];
+      }
+    }
+    op += len;
+  }
+  return (int) (op - out);
+}
@@ -0,0 +1,34 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        lz4.h
+// Purpose:     LZ4 block compression of database pages
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file lz4.h Interface of the LZ4 block compressor
+*/
+
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+/*
+// Largest input of Lz4Compress: match offsets and the positions in the
+// hash table are 16 bit, which covers the largest database page.
+*/
+#define LZ4_MAX_INPUT 65536
+
+/*
+// Compress len bytes of in into out in the LZ4 block format (greedy
+// matching with a single hash table, as the fast mode of the reference
+// implementation). Returns the compressed length, or 0 if it would exceed
+// outLimit bytes or len exceeds LZ4_MAX_INPUT.
+*/
+int Lz4Compress(const unsigned char* in, int len, unsigned char* out, int outLimit);
+
+/*
+// Decompress an LZ4 block of inLen bytes into out, which has room for
+// outLen bytes. Returns the decompressed length, or -1 if the block is
+// malformed or does not fit; the input is never trusted.
+*/
+int Lz4Decompress(const unsigned char* in, int inLen, unsigned char* out, int outLen);
+
+#endif /* _LZ4_H_ */
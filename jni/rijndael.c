@@ -53,6 +53,83 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+// Hardware AES support
+// AES-NI is reached through function level target attributes, so no
+// special compiler flags are needed on x86. The ARMv8 intrinsics are only
+// declared when the compiler targets the Crypto Extensions (see Android.mk);
+// they are executed only after a runtime check in both cases.
+*/
+#if !defined(RIJNDAEL_NO_HWAES) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RIJNDAEL_HAVE_AESNI 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define RIJNDAEL_TARGET_AESNI __attribute__((target("aes,sse2")))
+#endif
+
+#if !defined(RIJNDAEL_NO_HWAES) && defined(__GNUC__) && defined(__aarch64__) && defined(__linux__) && \
+    (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define RIJNDAEL_HAVE_ARMV8 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#endif
+
+/*
+// Bitsliced AES for CPUs without AES instructions: SSSE3 on x86, NEON on
+// arm64 and on armeabi-v7a builds that enable NEON. The vector primitives
+// below are all the bitsliced code needs from the instruction set.
+*/
+#if !defined(RIJNDAEL_NO_BITSLICE) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RIJNDAEL_HAVE_BITSLICE 1
+#include <cpuid.h>
+#include <tmmintrin.h>
+#define RIJNDAEL_TARGET_BS __attribute__((target("ssse3")))
+typedef __m128i BSVEC;
+#define BS_LOAD(p)       _mm_loadu_si128((const __m128i*) (p))
+#define BS_STORE(p, v)   _mm_storeu_si128((__m128i*) (p), v)
+#define BS_XOR(a, b)     _mm_xor_si128(a, b)
+#define BS_AND(a, b)     _mm_and_si128(a, b)
+#define BS_SET1(b)       _mm_set1_epi8((char) (b))
+#define BS_SHR(v, n)     _mm_srli_epi16(v, n)
+#define BS_SHL(v, n)     _mm_slli_epi16(v, n)
+#define BS_SHUF(v, idx)  _mm_shuffle_epi8(v, idx)
+#define BS_TEST(v, bit)  _mm_cmpeq_epi8(_mm_and_si128(v, bit), bit)
+#endif
+
+#if !defined(RIJNDAEL_NO_BITSLICE) && defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+    defined(__linux__)
+#define RIJNDAEL_HAVE_BITSLICE 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define RIJNDAEL_TARGET_BS
+typedef uint8x16_t BSVEC;
+#define BS_LOAD(p)       vld1q_u8(p)
+#define BS_STORE(p, v)   vst1q_u8(p, v)
+#define BS_XOR(a, b)     veorq_u8(a, b)
+#define BS_AND(a, b)     vandq_u8(a, b)
+#define BS_SET1(b)       vdupq_n_u8(b)
+#define BS_SHR(v, n)     vshrq_n_u8(v, n)
+#define BS_SHL(v, n)     vshlq_n_u8(v, n)
+#define BS_TEST(v, bit)  vtstq_u8(v, bit)
+#if defined(__aarch64__)
+#define BS_SHUF(v, idx)  vqtbl1q_u8(v, idx)
+#else
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+static __inline uint8x16_t BS_SHUF(uint8x16_t v, uint8x16_t idx)
+{
+  uint8x8x2_t t;
+  t.val[0] = vget_low_u8(v);
+  t.val[1] = vget_high_u8(v);
+  return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+}
+#endif
+#endif
+
 
 static UINT8 S[256]=
 {
@@ -969,6 +1046,1192 @@ static UINT32 rcon[30]=
 };
 
 
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// HARDWARE BACKENDS
+//
+// All backends use the expanded key exactly as built by RijndaelKeySched.
+// The decryption schedule produced by RijndaelKeyEncToDec already has
+// InvMixColumns applied to the inner round keys, which is the form the
+// equivalent inverse cipher of AESDEC/AESD+AESIMC expects; the bitsliced
+// code decrypts the same way.
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+static int rijndaelBackend = -1;
+
+static int RijndaelHasBackend(int backend)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  unsigned int eax, ebx, ecx, edx;
+#endif
+  switch (backend)
+  {
+    case RIJNDAEL_Backend_Table:
+      return 1;
+#if RIJNDAEL_HAVE_AESNI
+    case RIJNDAEL_Backend_AESNI:
+      return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) && (edx & bit_SSE2);
+#endif
+#if RIJNDAEL_HAVE_ARMV8
+    case RIJNDAEL_Backend_ARMv8:
+      return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#endif
+#if RIJNDAEL_HAVE_BITSLICE
+    case RIJNDAEL_Backend_Bitslice:
+#if defined(__x86_64__) || defined(__i386__)
+      return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3);
+#elif defined(__aarch64__)
+      return 1;
+#else
+      return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+#endif
+    default:
+      return 0;
+  }
+}
+
+int RijndaelGetBackend(void)
+{
+  if (rijndaelBackend < 0)
+  {
+    if (RijndaelHasBackend(RIJNDAEL_Backend_AESNI))
+      rijndaelBackend = RIJNDAEL_Backend_AESNI;
+    else if (RijndaelHasBackend(RIJNDAEL_Backend_ARMv8))
+      rijndaelBackend = RIJNDAEL_Backend_ARMv8;
+    else if (RijndaelHasBackend(RIJNDAEL_Backend_Bitslice))
+      rijndaelBackend = RIJNDAEL_Backend_Bitslice;
+    else
+      rijndaelBackend = RIJNDAEL_Backend_Table;
+  }
+  return rijndaelBackend;
+}
+
+int RijndaelSetBackend(int backend)
+{
+  if (!RijndaelHasBackend(backend))
+  {
+    return RIJNDAEL_UNSUPPORTED_BACKEND;
+  }
+  rijndaelBackend = backend;
+  return RIJNDAEL_SUCCESS;
+}
+
+#if RIJNDAEL_HAVE_AESNI
+
+#define AESNI_ENC(x, k, rounds) \
+  { int r_; x = _mm_xor_si128(x, k[0]); \
+    for (r_ = 1; r_ < rounds; r_++) x = _mm_aesenc_si128(x, k[r_]); \
+    x = _mm_aesenclast_si128(x, k[rounds]); }
+
+RIJNDAEL_TARGET_AESNI
+static void RijndaelAesniLoadKey(Rijndael* rijndael, __m128i k[_MAX_ROUNDS+1])
+{
+  UINT32 r;
+  for (r = 0; r <= rijndael->m_uRounds; r++)
+  {
+    k[r] = _mm_loadu_si128((const __m128i*) rijndael->m_expandedKey[r]);
+  }
+}
+
+RIJNDAEL_TARGET_AESNI
+static void RijndaelAesniEncrypt(Rijndael* rijndael, int cbc, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  __m128i k[_MAX_ROUNDS+1];
+  __m128i x, iv;
+  int rounds = (int) rijndael->m_uRounds;
+
+  RijndaelAesniLoadKey(rijndael, k);
+  iv = _mm_loadu_si128((const __m128i*) rijndael->m_initVector);
+
+  /* Without chaining the blocks are independent, keep four of them in flight */
+  for (; !cbc && numBlocks >= 4; numBlocks -= 4)
+  {
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input     )), k[0]);
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input + 16)), k[0]);
+    __m128i x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input + 32)), k[0]);
+    __m128i x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input + 48)), k[0]);
+    int r;
+    for (r = 1; r < rounds; r++)
+    {
+      x0 = _mm_aesenc_si128(x0, k[r]);
+      x1 = _mm_aesenc_si128(x1, k[r]);
+      x2 = _mm_aesenc_si128(x2, k[r]);
+      x3 = _mm_aesenc_si128(x3, k[r]);
+    }
+    _mm_storeu_si128((__m128i*) (outBuffer     ), _mm_aesenclast_si128(x0, k[rounds]));
+    _mm_storeu_si128((__m128i*) (outBuffer + 16), _mm_aesenclast_si128(x1, k[rounds]));
+    _mm_storeu_si128((__m128i*) (outBuffer + 32), _mm_aesenclast_si128(x2, k[rounds]));
+    _mm_storeu_si128((__m128i*) (outBuffer + 48), _mm_aesenclast_si128(x3, k[rounds]));
+    input += 64;
+    outBuffer += 64;
+  }
+  for (; numBlocks > 0; numBlocks--)
+  {
+    x = _mm_loadu_si128((const __m128i*) input);
+    if (cbc) x = _mm_xor_si128(x, iv);
+    AESNI_ENC(x, k, rounds);
+    _mm_storeu_si128((__m128i*) outBuffer, x);
+    iv = x;
+    input += 16;
+    outBuffer += 16;
+  }
+}
+
+RIJNDAEL_TARGET_AESNI
+static void RijndaelAesniDecrypt(Rijndael* rijndael, int cbc, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  __m128i k[_MAX_ROUNDS+1];
+  __m128i x0, x1, x2, x3, c0, c1, c2, c3, iv;
+  int r, rounds = (int) rijndael->m_uRounds;
+
+  RijndaelAesniLoadKey(rijndael, k);
+  iv = (cbc) ? _mm_loadu_si128((const __m128i*) rijndael->m_initVector) : _mm_setzero_si128();
+
+  /* Blocks are independent when decrypting, keep four of them in flight */
+  for (; numBlocks >= 4; numBlocks -= 4)
+  {
+    c0 = _mm_loadu_si128((const __m128i*) (input     ));
+    c1 = _mm_loadu_si128((const __m128i*) (input + 16));
+    c2 = _mm_loadu_si128((const __m128i*) (input + 32));
+    c3 = _mm_loadu_si128((const __m128i*) (input + 48));
+    x0 = _mm_xor_si128(c0, k[rounds]);
+    x1 = _mm_xor_si128(c1, k[rounds]);
+    x2 = _mm_xor_si128(c2, k[rounds]);
+    x3 = _mm_xor_si128(c3, k[rounds]);
+    for (r = rounds - 1; r > 0; r--)
+    {
+      x0 = _mm_aesdec_si128(x0, k[r]);
+      x1 = _mm_aesdec_si128(x1, k[r]);
+      x2 = _mm_aesdec_si128(x2, k[r]);
+      x3 = _mm_aesdec_si128(x3, k[r]);
+    }
+    x0 = _mm_aesdeclast_si128(x0, k[0]);
+    x1 = _mm_aesdeclast_si128(x1, k[0]);
+    x2 = _mm_aesdeclast_si128(x2, k[0]);
+    x3 = _mm_aesdeclast_si128(x3, k[0]);
+    if (cbc)
+    {
+      x0 = _mm_xor_si128(x0, iv);
+      x1 = _mm_xor_si128(x1, c0);
+      x2 = _mm_xor_si128(x2, c1);
+      x3 = _mm_xor_si128(x3, c2);
+      iv = c3;
+    }
+    _mm_storeu_si128((__m128i*) (outBuffer     ), x0);
+    _mm_storeu_si128((__m128i*) (outBuffer + 16), x1);
+    _mm_storeu_si128((__m128i*) (outBuffer + 32), x2);
+    _mm_storeu_si128((__m128i*) (outBuffer + 48), x3);
+    input += 64;
+    outBuffer += 64;
+  }
+  for (; numBlocks > 0; numBlocks--)
+  {
+    c0 = _mm_loadu_si128((const __m128i*) input);
+    x0 = _mm_xor_si128(c0, k[rounds]);
+    for (r = rounds - 1; r > 0; r--)
+    {
+      x0 = _mm_aesdec_si128(x0, k[r]);
+    }
+    x0 = _mm_aesdeclast_si128(x0, k[0]);
+    if (cbc)
+    {
+      x0 = _mm_xor_si128(x0, iv);
+      iv = c0;
+    }
+    _mm_storeu_si128((__m128i*) outBuffer, x0);
+    input += 16;
+    outBuffer += 16;
+  }
+}
+
+/*
+// XEX mode with the tweak kept in a register: doubling in GF(2^128) is a
+// 64 bit lane shift plus the carries, four blocks are in flight.
+*/
+RIJNDAEL_TARGET_AESNI
+static __m128i RijndaelAesniXexDouble(__m128i t)
+{
+  __m128i carry = _mm_srai_epi32(_mm_shuffle_epi32(t, 0x13), 31);
+  return _mm_xor_si128(_mm_add_epi64(t, t), _mm_and_si128(carry, _mm_set_epi32(0, 1, 0, 0x87)));
+}
+
+RIJNDAEL_TARGET_AESNI
+static void RijndaelAesniXex(Rijndael* rijndael, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  __m128i k[_MAX_ROUNDS+1];
+  __m128i x0, x1, x2, x3, t0, t1, t2, t3;
+  int r, rounds = (int) rijndael->m_uRounds;
+  int decrypt = (rijndael->m_direction == RIJNDAEL_Direction_Decrypt);
+
+  RijndaelAesniLoadKey(rijndael, k);
+  t0 = _mm_loadu_si128((const __m128i*) rijndael->m_initVector);
+  for (; numBlocks >= 4; numBlocks -= 4)
+  {
+    t1 = RijndaelAesniXexDouble(t0);
+    t2 = RijndaelAesniXexDouble(t1);
+    t3 = RijndaelAesniXexDouble(t2);
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input     )), t0);
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input + 16)), t1);
+    x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input + 32)), t2);
+    x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (input + 48)), t3);
+    if (decrypt)
+    {
+      x0 = _mm_xor_si128(x0, k[rounds]);
+      x1 = _mm_xor_si128(x1, k[rounds]);
+      x2 = _mm_xor_si128(x2, k[rounds]);
+      x3 = _mm_xor_si128(x3, k[rounds]);
+      for (r = rounds - 1; r > 0; r--)
+      {
+        x0 = _mm_aesdec_si128(x0, k[r]);
+        x1 = _mm_aesdec_si128(x1, k[r]);
+        x2 = _mm_aesdec_si128(x2, k[r]);
+        x3 = _mm_aesdec_si128(x3, k[r]);
+      }
+      x0 = _mm_aesdeclast_si128(x0, k[0]);
+      x1 = _mm_aesdeclast_si128(x1, k[0]);
+      x2 = _mm_aesdeclast_si128(x2, k[0]);
+      x3 = _mm_aesdeclast_si128(x3, k[0]);
+    }
+    else
+    {
+      x0 = _mm_xor_si128(x0, k[0]);
+      x1 = _mm_xor_si128(x1, k[0]);
+      x2 = _mm_xor_si128(x2, k[0]);
+      x3 = _mm_xor_si128(x3, k[0]);
+      for (r = 1; r < rounds; r++)
+      {
+        x0 = _mm_aesenc_si128(x0, k[r]);
+        x1 = _mm_aesenc_si128(x1, k[r]);
+        x2 = _mm_aesenc_si128(x2, k[r]);
+        x3 = _mm_aesenc_si128(x3, k[r]);
+      }
+      x0 = _mm_aesenclast_si128(x0, k[rounds]);
+      x1 = _mm_aesenclast_si128(x1, k[rounds]);
+      x2 = _mm_aesenclast_si128(x2, k[rounds]);
+      x3 = _mm_aesenclast_si128(x3, k[rounds]);
+    }
+    _mm_storeu_si128((__m128i*) (outBuffer     ), _mm_xor_si128(x0, t0));
+    _mm_storeu_si128((__m128i*) (outBuffer + 16), _mm_xor_si128(x1, t1));
+    _mm_storeu_si128((__m128i*) (outBuffer + 32), _mm_xor_si128(x2, t2));
+    _mm_storeu_si128((__m128i*) (outBuffer + 48), _mm_xor_si128(x3, t3));
+    t0 = RijndaelAesniXexDouble(t3);
+    input += 64;
+    outBuffer += 64;
+  }
+  for (; numBlocks > 0; numBlocks--)
+  {
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) input), t0);
+    if (decrypt)
+    {
+      x0 = _mm_xor_si128(x0, k[rounds]);
+      for (r = rounds - 1; r > 0; r--)
+      {
+        x0 = _mm_aesdec_si128(x0, k[r]);
+      }
+      x0 = _mm_aesdeclast_si128(x0, k[0]);
+    }
+    else
+    {
+      AESNI_ENC(x0, k, rounds);
+    }
+    _mm_storeu_si128((__m128i*) outBuffer, _mm_xor_si128(x0, t0));
+    t0 = RijndaelAesniXexDouble(t0);
+    input += 16;
+    outBuffer += 16;
+  }
+}
+
+/*
+// CBC encryption of four independent streams. Each chain is serial, so
+// the blocks of the four streams are interleaved to keep the AES unit busy.
+// The round keys differ per stream and are read from memory.
+*/
+RIJNDAEL_TARGET_AESNI
+static void RijndaelAesniEncryptCbc4(Rijndael* rijndael[RIJNDAEL_STREAMS], UINT8* input[RIJNDAEL_STREAMS],
+                                     int numBlocks, UINT8* outBuffer[RIJNDAEL_STREAMS])
+{
+  const __m128i* k0 = (const __m128i*) rijndael[0]->m_expandedKey;
+  const __m128i* k1 = (const __m128i*) rijndael[1]->m_expandedKey;
+  const __m128i* k2 = (const __m128i*) rijndael[2]->m_expandedKey;
+  const __m128i* k3 = (const __m128i*) rijndael[3]->m_expandedKey;
+  __m128i x0 = _mm_loadu_si128((const __m128i*) rijndael[0]->m_initVector);
+  __m128i x1 = _mm_loadu_si128((const __m128i*) rijndael[1]->m_initVector);
+  __m128i x2 = _mm_loadu_si128((const __m128i*) rijndael[2]->m_initVector);
+  __m128i x3 = _mm_loadu_si128((const __m128i*) rijndael[3]->m_initVector);
+  int rounds = (int) rijndael[0]->m_uRounds;
+  int j, r;
+
+  for (j = 0; j < 16 * numBlocks; j += 16)
+  {
+    x0 = _mm_xor_si128(_mm_xor_si128(x0, _mm_loadu_si128((const __m128i*) (input[0] + j))), _mm_loadu_si128(k0));
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*) (input[1] + j))), _mm_loadu_si128(k1));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, _mm_loadu_si128((const __m128i*) (input[2] + j))), _mm_loadu_si128(k2));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, _mm_loadu_si128((const __m128i*) (input[3] + j))), _mm_loadu_si128(k3));
+    for (r = 1; r < rounds; r++)
+    {
+      x0 = _mm_aesenc_si128(x0, _mm_loadu_si128(k0 + r));
+      x1 = _mm_aesenc_si128(x1, _mm_loadu_si128(k1 + r));
+      x2 = _mm_aesenc_si128(x2, _mm_loadu_si128(k2 + r));
+      x3 = _mm_aesenc_si128(x3, _mm_loadu_si128(k3 + r));
+    }
+    x0 = _mm_aesenclast_si128(x0, _mm_loadu_si128(k0 + rounds));
+    x1 = _mm_aesenclast_si128(x1, _mm_loadu_si128(k1 + rounds));
+    x2 = _mm_aesenclast_si128(x2, _mm_loadu_si128(k2 + rounds));
+    x3 = _mm_aesenclast_si128(x3, _mm_loadu_si128(k3 + rounds));
+    _mm_storeu_si128((__m128i*) (outBuffer[0] + j), x0);
+    _mm_storeu_si128((__m128i*) (outBuffer[1] + j), x1);
+    _mm_storeu_si128((__m128i*) (outBuffer[2] + j), x2);
+    _mm_storeu_si128((__m128i*) (outBuffer[3] + j), x3);
+  }
+}
+
+#endif /* RIJNDAEL_HAVE_AESNI */
+
+#if RIJNDAEL_HAVE_ARMV8
+
+static void RijndaelArmv8LoadKey(Rijndael* rijndael, uint8x16_t k[_MAX_ROUNDS+1])
+{
+  UINT32 r;
+  for (r = 0; r <= rijndael->m_uRounds; r++)
+  {
+    k[r] = vld1q_u8(rijndael->m_expandedKey[r][0]);
+  }
+}
+
+static void RijndaelArmv8Encrypt(Rijndael* rijndael, int cbc, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  uint8x16_t k[_MAX_ROUNDS+1];
+  uint8x16_t x, iv;
+  int r, rounds = (int) rijndael->m_uRounds;
+
+  RijndaelArmv8LoadKey(rijndael, k);
+  iv = vld1q_u8(rijndael->m_initVector);
+
+  /* Without chaining the blocks are independent, keep four of them in flight */
+  for (; !cbc && numBlocks >= 4; numBlocks -= 4)
+  {
+    uint8x16_t x0 = vld1q_u8(input     );
+    uint8x16_t x1 = vld1q_u8(input + 16);
+    uint8x16_t x2 = vld1q_u8(input + 32);
+    uint8x16_t x3 = vld1q_u8(input + 48);
+    for (r = 0; r < rounds - 1; r++)
+    {
+      x0 = vaesmcq_u8(vaeseq_u8(x0, k[r]));
+      x1 = vaesmcq_u8(vaeseq_u8(x1, k[r]));
+      x2 = vaesmcq_u8(vaeseq_u8(x2, k[r]));
+      x3 = vaesmcq_u8(vaeseq_u8(x3, k[r]));
+    }
+    vst1q_u8(outBuffer     , veorq_u8(vaeseq_u8(x0, k[rounds-1]), k[rounds]));
+    vst1q_u8(outBuffer + 16, veorq_u8(vaeseq_u8(x1, k[rounds-1]), k[rounds]));
+    vst1q_u8(outBuffer + 32, veorq_u8(vaeseq_u8(x2, k[rounds-1]), k[rounds]));
+    vst1q_u8(outBuffer + 48, veorq_u8(vaeseq_u8(x3, k[rounds-1]), k[rounds]));
+    input += 64;
+    outBuffer += 64;
+  }
+  for (; numBlocks > 0; numBlocks--)
+  {
+    x = vld1q_u8(input);
+    if (cbc) x = veorq_u8(x, iv);
+    for (r = 0; r < rounds - 1; r++)
+    {
+      x = vaesmcq_u8(vaeseq_u8(x, k[r]));
+    }
+    x = veorq_u8(vaeseq_u8(x, k[rounds-1]), k[rounds]);
+    vst1q_u8(outBuffer, x);
+    iv = x;
+    input += 16;
+    outBuffer += 16;
+  }
+}
+
+static void RijndaelArmv8Decrypt(Rijndael* rijndael, int cbc, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  uint8x16_t k[_MAX_ROUNDS+1];
+  uint8x16_t x0, x1, x2, x3, c0, c1, c2, c3, iv;
+  int r, rounds = (int) rijndael->m_uRounds;
+
+  RijndaelArmv8LoadKey(rijndael, k);
+  iv = (cbc) ? vld1q_u8(rijndael->m_initVector) : vdupq_n_u8(0);
+
+  for (; numBlocks >= 4; numBlocks -= 4)
+  {
+    c0 = x0 = vld1q_u8(input     );
+    c1 = x1 = vld1q_u8(input + 16);
+    c2 = x2 = vld1q_u8(input + 32);
+    c3 = x3 = vld1q_u8(input + 48);
+    for (r = rounds; r > 1; r--)
+    {
+      x0 = vaesimcq_u8(vaesdq_u8(x0, k[r]));
+      x1 = vaesimcq_u8(vaesdq_u8(x1, k[r]));
+      x2 = vaesimcq_u8(vaesdq_u8(x2, k[r]));
+      x3 = vaesimcq_u8(vaesdq_u8(x3, k[r]));
+    }
+    x0 = veorq_u8(vaesdq_u8(x0, k[1]), k[0]);
+    x1 = veorq_u8(vaesdq_u8(x1, k[1]), k[0]);
+    x2 = veorq_u8(vaesdq_u8(x2, k[1]), k[0]);
+    x3 = veorq_u8(vaesdq_u8(x3, k[1]), k[0]);
+    if (cbc)
+    {
+      x0 = veorq_u8(x0, iv);
+      x1 = veorq_u8(x1, c0);
+      x2 = veorq_u8(x2, c1);
+      x3 = veorq_u8(x3, c2);
+      iv = c3;
+    }
+    vst1q_u8(outBuffer     , x0);
+    vst1q_u8(outBuffer + 16, x1);
+    vst1q_u8(outBuffer + 32, x2);
+    vst1q_u8(outBuffer + 48, x3);
+    input += 64;
+    outBuffer += 64;
+  }
+  for (; numBlocks > 0; numBlocks--)
+  {
+    c0 = x0 = vld1q_u8(input);
+    for (r = rounds; r > 1; r--)
+    {
+      x0 = vaesimcq_u8(vaesdq_u8(x0, k[r]));
+    }
+    x0 = veorq_u8(vaesdq_u8(x0, k[1]), k[0]);
+    if (cbc)
+    {
+      x0 = veorq_u8(x0, iv);
+      iv = c0;
+    }
+    vst1q_u8(outBuffer, x0);
+    input += 16;
+    outBuffer += 16;
+  }
+}
+
+static uint8x16_t RijndaelArmv8XexDouble(uint8x16_t t)
+{
+  uint64x2_t v = vreinterpretq_u64_u8(t);
+  uint64x2_t carry = vreinterpretq_u64_s64(vshrq_n_s64(vreinterpretq_s64_u64(v), 63));
+  carry = vandq_u64(vextq_u64(carry, carry, 1), vcombine_u64(vcreate_u64(0x87), vcreate_u64(1)));
+  return vreinterpretq_u8_u64(veorq_u64(vshlq_n_u64(v, 1), carry));
+}
+
+static void RijndaelArmv8Xex(Rijndael* rijndael, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  uint8x16_t k[_MAX_ROUNDS+1];
+  uint8x16_t x0, x1, x2, x3, t0, t1, t2, t3;
+  int r, rounds = (int) rijndael->m_uRounds;
+  int decrypt = (rijndael->m_direction == RIJNDAEL_Direction_Decrypt);
+
+  RijndaelArmv8LoadKey(rijndael, k);
+  t0 = vld1q_u8(rijndael->m_initVector);
+  for (; numBlocks >= 4; numBlocks -= 4)
+  {
+    t1 = RijndaelArmv8XexDouble(t0);
+    t2 = RijndaelArmv8XexDouble(t1);
+    t3 = RijndaelArmv8XexDouble(t2);
+    x0 = veorq_u8(vld1q_u8(input     ), t0);
+    x1 = veorq_u8(vld1q_u8(input + 16), t1);
+    x2 = veorq_u8(vld1q_u8(input + 32), t2);
+    x3 = veorq_u8(vld1q_u8(input + 48), t3);
+    if (decrypt)
+    {
+      for (r = rounds; r > 1; r--)
+      {
+        x0 = vaesimcq_u8(vaesdq_u8(x0, k[r]));
+        x1 = vaesimcq_u8(vaesdq_u8(x1, k[r]));
+        x2 = vaesimcq_u8(vaesdq_u8(x2, k[r]));
+        x3 = vaesimcq_u8(vaesdq_u8(x3, k[r]));
+      }
+      x0 = veorq_u8(vaesdq_u8(x0, k[1]), k[0]);
+      x1 = veorq_u8(vaesdq_u8(x1, k[1]), k[0]);
+      x2 = veorq_u8(vaesdq_u8(x2, k[1]), k[0]);
+      x3 = veorq_u8(vaesdq_u8(x3, k[1]), k[0]);
+    }
+    else
+    {
+      for (r = 0; r < rounds - 1; r++)
+      {
+        x0 = vaesmcq_u8(vaeseq_u8(x0, k[r]));
+        x1 = vaesmcq_u8(vaeseq_u8(x1, k[r]));
+        x2 = vaesmcq_u8(vaeseq_u8(x2, k[r]));
+        x3 = vaesmcq_u8(vaeseq_u8(x3, k[r]));
+      }
+      x0 = veorq_u8(vaeseq_u8(x0, k[rounds-1]), k[rounds]);
+      x1 = veorq_u8(vaeseq_u8(x1, k[rounds-1]), k[rounds]);
+      x2 = veorq_u8(vaeseq_u8(x2, k[rounds-1]), k[rounds]);
+      x3 = veorq_u8(vaeseq_u8(x3, k[rounds-1]), k[rounds]);
+    }
+    vst1q_u8(outBuffer     , veorq_u8(x0, t0));
+    vst1q_u8(outBuffer + 16, veorq_u8(x1, t1));
+    vst1q_u8(outBuffer + 32, veorq_u8(x2, t2));
+    vst1q_u8(outBuffer + 48, veorq_u8(x3, t3));
+    t0 = RijndaelArmv8XexDouble(t3);
+    input += 64;
+    outBuffer += 64;
+  }
+  for (; numBlocks > 0; numBlocks--)
+  {
+    x0 = veorq_u8(vld1q_u8(input), t0);
+    if (decrypt)
+    {
+      for (r = rounds; r > 1; r--)
+      {
+        x0 = vaesimcq_u8(vaesdq_u8(x0, k[r]));
+      }
+      x0 = veorq_u8(vaesdq_u8(x0, k[1]), k[0]);
+    }
+    else
+    {
+      for (r = 0; r < rounds - 1; r++)
+      {
+        x0 = vaesmcq_u8(vaeseq_u8(x0, k[r]));
+      }
+      x0 = veorq_u8(vaeseq_u8(x0, k[rounds-1]), k[rounds]);
+    }
+    vst1q_u8(outBuffer, veorq_u8(x0, t0));
+    t0 = RijndaelArmv8XexDouble(t0);
+    input += 16;
+    outBuffer += 16;
+  }
+}
+
+/*
+// CBC encryption of four independent streams, see RijndaelAesniEncryptCbc4
+*/
+static void RijndaelArmv8EncryptCbc4(Rijndael* rijndael[RIJNDAEL_STREAMS], UINT8* input[RIJNDAEL_STREAMS],
+                                     int numBlocks, UINT8* outBuffer[RIJNDAEL_STREAMS])
+{
+  uint8x16_t x0 = vld1q_u8(rijndael[0]->m_initVector);
+  uint8x16_t x1 = vld1q_u8(rijndael[1]->m_initVector);
+  uint8x16_t x2 = vld1q_u8(rijndael[2]->m_initVector);
+  uint8x16_t x3 = vld1q_u8(rijndael[3]->m_initVector);
+  int rounds = (int) rijndael[0]->m_uRounds;
+  int j, r;
+
+  for (j = 0; j < 16 * numBlocks; j += 16)
+  {
+    x0 = veorq_u8(x0, vld1q_u8(input[0] + j));
+    x1 = veorq_u8(x1, vld1q_u8(input[1] + j));
+    x2 = veorq_u8(x2, vld1q_u8(input[2] + j));
+    x3 = veorq_u8(x3, vld1q_u8(input[3] + j));
+    for (r = 0; r < rounds - 1; r++)
+    {
+      x0 = vaesmcq_u8(vaeseq_u8(x0, vld1q_u8(rijndael[0]->m_expandedKey[r][0])));
+      x1 = vaesmcq_u8(vaeseq_u8(x1, vld1q_u8(rijndael[1]->m_expandedKey[r][0])));
+      x2 = vaesmcq_u8(vaeseq_u8(x2, vld1q_u8(rijndael[2]->m_expandedKey[r][0])));
+      x3 = vaesmcq_u8(vaeseq_u8(x3, vld1q_u8(rijndael[3]->m_expandedKey[r][0])));
+    }
+    x0 = veorq_u8(vaeseq_u8(x0, vld1q_u8(rijndael[0]->m_expandedKey[rounds-1][0])), vld1q_u8(rijndael[0]->m_expandedKey[rounds][0]));
+    x1 = veorq_u8(vaeseq_u8(x1, vld1q_u8(rijndael[1]->m_expandedKey[rounds-1][0])), vld1q_u8(rijndael[1]->m_expandedKey[rounds][0]));
+    x2 = veorq_u8(vaeseq_u8(x2, vld1q_u8(rijndael[2]->m_expandedKey[rounds-1][0])), vld1q_u8(rijndael[2]->m_expandedKey[rounds][0]));
+    x3 = veorq_u8(vaeseq_u8(x3, vld1q_u8(rijndael[3]->m_expandedKey[rounds-1][0])), vld1q_u8(rijndael[3]->m_expandedKey[rounds][0]));
+    vst1q_u8(outBuffer[0] + j, x0);
+    vst1q_u8(outBuffer[1] + j, x1);
+    vst1q_u8(outBuffer[2] + j, x2);
+    vst1q_u8(outBuffer[3] + j, x3);
+  }
+}
+
+#endif /* RIJNDAEL_HAVE_ARMV8 */
+
+#if RIJNDAEL_HAVE_BITSLICE
+
+/*
+// Bitsliced representation of eight blocks: register q[p] holds bit p of
+// every state byte, byte j of the register belongs to state byte j and bit i
+// of that byte to block i. ShiftRows and the column rotations of MixColumns
+// are then byte shuffles, SubBytes is a boolean circuit over the eight
+// registers, and nothing depends on secret data for addressing or timing.
+*/
+
+static const UINT8 BsShiftRows[16]    = { 0, 5,10,15,  4, 9,14, 3,  8,13, 2, 7, 12, 1, 6,11 };
+static const UINT8 BsInvShiftRows[16] = { 0,13,10, 7,  4, 1,14,11,  8, 5, 2,15, 12, 9, 6, 3 };
+static const UINT8 BsRotate1[16]      = { 1, 2, 3, 0,  5, 6, 7, 4,  9,10,11, 8, 13,14,15,12 };
+static const UINT8 BsRotate2[16]      = { 2, 3, 0, 1,  6, 7, 4, 5, 10,11, 8, 9, 14,15,12,13 };
+
+#define BS_SWAPMOVE(a, b, n, m) \
+  { BSVEC t_ = BS_AND(BS_XOR(BS_SHR(a, n), b), m); b = BS_XOR(b, t_); a = BS_XOR(a, BS_SHL(t_, n)); }
+
+/* Converts between eight blocks and bit planes (the transform is an involution) */
+RIJNDAEL_TARGET_BS
+static void RijndaelBsTranspose(BSVEC q[8])
+{
+  BSVEC m1 = BS_SET1(0x55), m2 = BS_SET1(0x33), m4 = BS_SET1(0x0f);
+  BS_SWAPMOVE(q[0], q[1], 1, m1)
+  BS_SWAPMOVE(q[2], q[3], 1, m1)
+  BS_SWAPMOVE(q[4], q[5], 1, m1)
+  BS_SWAPMOVE(q[6], q[7], 1, m1)
+  BS_SWAPMOVE(q[0], q[2], 2, m2)
+  BS_SWAPMOVE(q[1], q[3], 2, m2)
+  BS_SWAPMOVE(q[4], q[6], 2, m2)
+  BS_SWAPMOVE(q[5], q[7], 2, m2)
+  BS_SWAPMOVE(q[0], q[4], 4, m4)
+  BS_SWAPMOVE(q[1], q[5], 4, m4)
+  BS_SWAPMOVE(q[2], q[6], 4, m4)
+  BS_SWAPMOVE(q[3], q[7], 4, m4)
+}
+
+/* SubBytes, using the circuit of Boyar and Peralta */
+RIJNDAEL_TARGET_BS
+static void RijndaelBsSubBytes(BSVEC q[8])
+{
+  BSVEC x0, x1, x2, x3, x4, x5, x6, x7, ones;
+  BSVEC y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11;
+  BSVEC y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+  BSVEC z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+  BSVEC t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16;
+  BSVEC t17, t18, t19, t20, t21, t22, t23, t24, t25, t26, t27, t28, t29, t30, t31;
+  BSVEC t32, t33, t34, t35, t36, t37, t38, t39, t40, t41, t42, t43, t44, t45, t46;
+  BSVEC t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59, t60, t61;
+  BSVEC t62, t63, t64, t65, t66, t67;
+  BSVEC s0, s1, s2, s3, s4, s5, s6, s7;
+
+  ones = BS_SET1(0xff);
+  x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+  x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+  /* Top linear transformation */
+  y14 = BS_XOR(x3, x5);
+  y13 = BS_XOR(x0, x6);
+  y9  = BS_XOR(x0, x3);
+  y8  = BS_XOR(x0, x5);
+  t0  = BS_XOR(x1, x2);
+  y1  = BS_XOR(t0, x7);
+  y4  = BS_XOR(y1, x3);
+  y12 = BS_XOR(y13, y14);
+  y2  = BS_XOR(y1, x0);
+  y5  = BS_XOR(y1, x6);
+  y3  = BS_XOR(y5, y8);
+  t1  = BS_XOR(x4, y12);
+  y15 = BS_XOR(t1, x5);
+  y20 = BS_XOR(t1, x1);
+  y6  = BS_XOR(y15, x7);
+  y10 = BS_XOR(y15, t0);
+  y11 = BS_XOR(y20, y9);
+  y7  = BS_XOR(x7, y11);
+  y17 = BS_XOR(y10, y11);
+  y19 = BS_XOR(y10, y8);
+  y16 = BS_XOR(t0, y11);
+  y21 = BS_XOR(y13, y16);
+  y18 = BS_XOR(x0, y16);
+
+  /* Non-linear section */
+  t2  = BS_AND(y12, y15);
+  t3  = BS_AND(y3, y6);
+  t4  = BS_XOR(t3, t2);
+  t5  = BS_AND(y4, x7);
+  t6  = BS_XOR(t5, t2);
+  t7  = BS_AND(y13, y16);
+  t8  = BS_AND(y5, y1);
+  t9  = BS_XOR(t8, t7);
+  t10 = BS_AND(y2, y7);
+  t11 = BS_XOR(t10, t7);
+  t12 = BS_AND(y9, y11);
+  t13 = BS_AND(y14, y17);
+  t14 = BS_XOR(t13, t12);
+  t15 = BS_AND(y8, y10);
+  t16 = BS_XOR(t15, t12);
+  t17 = BS_XOR(t4, t14);
+  t18 = BS_XOR(t6, t16);
+  t19 = BS_XOR(t9, t14);
+  t20 = BS_XOR(t11, t16);
+  t21 = BS_XOR(t17, y20);
+  t22 = BS_XOR(t18, y19);
+  t23 = BS_XOR(t19, y21);
+  t24 = BS_XOR(t20, y18);
+
+  t25 = BS_XOR(t21, t22);
+  t26 = BS_AND(t21, t23);
+  t27 = BS_XOR(t24, t26);
+  t28 = BS_AND(t25, t27);
+  t29 = BS_XOR(t28, t22);
+  t30 = BS_XOR(t23, t24);
+  t31 = BS_XOR(t22, t26);
+  t32 = BS_AND(t31, t30);
+  t33 = BS_XOR(t32, t24);
+  t34 = BS_XOR(t23, t33);
+  t35 = BS_XOR(t27, t33);
+  t36 = BS_AND(t24, t35);
+  t37 = BS_XOR(t36, t34);
+  t38 = BS_XOR(t27, t36);
+  t39 = BS_AND(t29, t38);
+  t40 = BS_XOR(t25, t39);
+
+  t41 = BS_XOR(t40, t37);
+  t42 = BS_XOR(t29, t33);
+  t43 = BS_XOR(t29, t40);
+  t44 = BS_XOR(t33, t37);
+  t45 = BS_XOR(t42, t41);
+  z0  = BS_AND(t44, y15);
+  z1  = BS_AND(t37, y6);
+  z2  = BS_AND(t33, x7);
+  z3  = BS_AND(t43, y16);
+  z4  = BS_AND(t40, y1);
+  z5  = BS_AND(t29, y7);
+  z6  = BS_AND(t42, y11);
+  z7  = BS_AND(t45, y17);
+  z8  = BS_AND(t41, y10);
+  z9  = BS_AND(t44, y12);
+  z10 = BS_AND(t37, y3);
+  z11 = BS_AND(t33, y4);
+  z12 = BS_AND(t43, y13);
+  z13 = BS_AND(t40, y5);
+  z14 = BS_AND(t29, y2);
+  z15 = BS_AND(t42, y9);
+  z16 = BS_AND(t45, y14);
+  z17 = BS_AND(t41, y8);
+
+  /* Bottom linear transformation */
+  t46 = BS_XOR(z15, z16);
+  t47 = BS_XOR(z10, z11);
+  t48 = BS_XOR(z5, z13);
+  t49 = BS_XOR(z9, z10);
+  t50 = BS_XOR(z2, z12);
+  t51 = BS_XOR(z2, z5);
+  t52 = BS_XOR(z7, z8);
+  t53 = BS_XOR(z0, z3);
+  t54 = BS_XOR(z6, z7);
+  t55 = BS_XOR(z16, z17);
+  t56 = BS_XOR(z12, t48);
+  t57 = BS_XOR(t50, t53);
+  t58 = BS_XOR(z4, t46);
+  t59 = BS_XOR(z3, t54);
+  t60 = BS_XOR(t46, t57);
+  t61 = BS_XOR(z14, t57);
+  t62 = BS_XOR(t52, t58);
+  t63 = BS_XOR(t49, t58);
+  t64 = BS_XOR(z4, t59);
+  t65 = BS_XOR(t61, t62);
+  t66 = BS_XOR(z1, t63);
+  s0  = BS_XOR(t59, t63);
+  s6  = BS_XOR(t56, BS_XOR(t62, ones));
+  s7  = BS_XOR(t48, BS_XOR(t60, ones));
+  t67 = BS_XOR(t64, t65);
+  s3  = BS_XOR(t53, t66);
+  s4  = BS_XOR(t51, t66);
+  s5  = BS_XOR(t47, t65);
+  s1  = BS_XOR(t64, BS_XOR(s3, ones));
+  s2  = BS_XOR(t55, BS_XOR(t67, ones));
+
+  q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+  q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+/* Inverse of the SubBytes affine transform: b[i] = a[i+2] ^ a[i+5] ^ a[i+7] ^ 0x05 */
+RIJNDAEL_TARGET_BS
+static void RijndaelBsInvAffine(BSVEC q[8])
+{
+  BSVEC a[8], ones = BS_SET1(0xff);
+  int i;
+  for (i = 0; i < 8; i++) a[i] = q[i];
+  for (i = 0; i < 8; i++)
+  {
+    q[i] = BS_XOR(BS_XOR(a[(i+2) & 7], a[(i+5) & 7]), a[(i+7) & 7]);
+  }
+  q[0] = BS_XOR(q[0], ones);
+  q[2] = BS_XOR(q[2], ones);
+}
+
+/* InvSubBytes(x) = InvAffine(SubBytes(InvAffine(x))) */
+RIJNDAEL_TARGET_BS
+static void RijndaelBsInvSubBytes(BSVEC q[8])
+{
+  RijndaelBsInvAffine(q);
+  RijndaelBsSubBytes(q);
+  RijndaelBsInvAffine(q);
+}
+
+RIJNDAEL_TARGET_BS
+static void RijndaelBsShuffle(BSVEC q[8], const UINT8 idx[16])
+{
+  BSVEC k = BS_LOAD(idx);
+  int i;
+  for (i = 0; i < 8; i++) q[i] = BS_SHUF(q[i], k);
+}
+
+/* Multiplication by x in GF(2^8) on the bit planes */
+#define BS_XTIME(d, s) \
+  { BSVEC h_ = s[7]; \
+    d[7] = s[6]; d[6] = s[5]; d[5] = s[4]; \
+    d[4] = BS_XOR(s[3], h_); d[3] = BS_XOR(s[2], h_); \
+    d[2] = s[1]; d[1] = BS_XOR(s[0], h_); d[0] = h_; }
+
+/* MixColumns: out[r] = 2*(a[r]^a[r+1]) ^ a[r+1] ^ a[r+2] ^ a[r+3] */
+RIJNDAEL_TARGET_BS
+static void RijndaelBsMixColumns(BSVEC q[8])
+{
+  BSVEC r1[8], t[8], x[8];
+  BSVEC rot1 = BS_LOAD(BsRotate1), rot2 = BS_LOAD(BsRotate2);
+  int i;
+  for (i = 0; i < 8; i++)
+  {
+    r1[i] = BS_SHUF(q[i], rot1);
+    t[i] = BS_XOR(q[i], r1[i]);
+  }
+  BS_XTIME(x, t)
+  for (i = 0; i < 8; i++)
+  {
+    q[i] = BS_XOR(BS_XOR(x[i], r1[i]), BS_SHUF(t[i], rot2));
+  }
+}
+
+/* InvMixColumns = MixColumns after multiplying each column by {04}x^2 + {05} */
+RIJNDAEL_TARGET_BS
+static void RijndaelBsInvMixColumns(BSVEC q[8])
+{
+  BSVEC w[8], x[8];
+  BSVEC rot2 = BS_LOAD(BsRotate2);
+  int i;
+  for (i = 0; i < 8; i++)
+  {
+    w[i] = BS_XOR(q[i], BS_SHUF(q[i], rot2));
+  }
+  BS_XTIME(x, w)
+  BS_XTIME(w, x)
+  for (i = 0; i < 8; i++)
+  {
+    q[i] = BS_XOR(q[i], w[i]);
+  }
+  RijndaelBsMixColumns(q);
+}
+
+RIJNDAEL_TARGET_BS
+static void RijndaelBsAddRoundKey(BSVEC q[8], const BSVEC k[8])
+{
+  int i;
+  for (i = 0; i < 8; i++) q[i] = BS_XOR(q[i], k[i]);
+}
+
+/* Expands every round key byte into 0x00/0xff masks, one register per bit */
+RIJNDAEL_TARGET_BS
+static void RijndaelBsKeySchedule(Rijndael* rijndael, BSVEC k[_MAX_ROUNDS+1][8])
+{
+  UINT32 r;
+  int i;
+  BSVEC key;
+  for (r = 0; r <= rijndael->m_uRounds; r++)
+  {
+    key = BS_LOAD(rijndael->m_expandedKey[r][0]);
+    for (i = 0; i < 8; i++)
+    {
+      k[r][i] = BS_TEST(key, BS_SET1(1 << i));
+    }
+  }
+}
+
+RIJNDAEL_TARGET_BS
+static void RijndaelBsEncrypt8(BSVEC k[_MAX_ROUNDS+1][8], int rounds, UINT8 block[128])
+{
+  BSVEC q[8];
+  int i, r;
+  for (i = 0; i < 8; i++) q[i] = BS_LOAD(block + 16*i);
+  RijndaelBsTranspose(q);
+  RijndaelBsAddRoundKey(q, k[0]);
+  for (r = 1; r < rounds; r++)
+  {
+    RijndaelBsSubBytes(q);
+    RijndaelBsShuffle(q, BsShiftRows);
+    RijndaelBsMixColumns(q);
+    RijndaelBsAddRoundKey(q, k[r]);
+  }
+  RijndaelBsSubBytes(q);
+  RijndaelBsShuffle(q, BsShiftRows);
+  RijndaelBsAddRoundKey(q, k[rounds]);
+  RijndaelBsTranspose(q);
+  for (i = 0; i < 8; i++) BS_STORE(block + 16*i, q[i]);
+}
+
+RIJNDAEL_TARGET_BS
+static void RijndaelBsDecrypt8(BSVEC k[_MAX_ROUNDS+1][8], int rounds, UINT8 block[128])
+{
+  BSVEC q[8];
+  int i, r;
+  for (i = 0; i < 8; i++) q[i] = BS_LOAD(block + 16*i);
+  RijndaelBsTranspose(q);
+  RijndaelBsAddRoundKey(q, k[rounds]);
+  for (r = rounds - 1; r > 0; r--)
+  {
+    RijndaelBsInvSubBytes(q);
+    RijndaelBsShuffle(q, BsInvShiftRows);
+    RijndaelBsInvMixColumns(q);
+    RijndaelBsAddRoundKey(q, k[r]);
+  }
+  RijndaelBsInvSubBytes(q);
+  RijndaelBsShuffle(q, BsInvShiftRows);
+  RijndaelBsAddRoundKey(q, k[0]);
+  RijndaelBsTranspose(q);
+  for (i = 0; i < 8; i++) BS_STORE(block + 16*i, q[i]);
+}
+
+/*
+// ECB in both directions and CBC decryption, eight blocks at a time.
+// A short final batch is padded, so it takes the same time as a full one.
+*/
+RIJNDAEL_TARGET_BS
+static void RijndaelBsBlocks(Rijndael* rijndael, int cbc, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  BSVEC k[_MAX_ROUNDS+1][8];
+  UINT8 block[128];
+  UINT32 chain[9][4];
+  int i, j, n;
+  int rounds = (int) rijndael->m_uRounds;
+  int decrypt = (rijndael->m_direction == RIJNDAEL_Direction_Decrypt);
+
+  RijndaelBsKeySchedule(rijndael, k);
+  memcpy(chain[0], rijndael->m_initVector, 16);
+  for (i = numBlocks; i > 0; i -= n)
+  {
+    n = (i < 8) ? i : 8;
+    memcpy(block, input, 16*n);
+    memset(block + 16*n, 0, 128 - 16*n);
+    if (decrypt)
+    {
+      memcpy(chain[1], input, 16*n);
+      RijndaelBsDecrypt8(k, rounds, block);
+    }
+    else
+    {
+      RijndaelBsEncrypt8(k, rounds, block);
+    }
+    if (cbc)
+    {
+      for (j = 0; j < n; j++)
+      {
+        ((UINT32*)block)[4*j  ] ^= chain[j][0];
+        ((UINT32*)block)[4*j+1] ^= chain[j][1];
+        ((UINT32*)block)[4*j+2] ^= chain[j][2];
+        ((UINT32*)block)[4*j+3] ^= chain[j][3];
+      }
+      memcpy(chain[0], chain[n], 16);
+    }
+    memcpy(outBuffer, block, 16*n);
+    input += 16*n;
+    outBuffer += 16*n;
+  }
+  memset(block, 0, sizeof(block));
+}
+
+#endif /* RIJNDAEL_HAVE_BITSLICE */
+
+/*
+// Run ECB or CBC mode on the selected backend, if it is not the table
+// implementation. The bitsliced code cannot speed up the serial CBC
+// encryption, which stays on the tables.
+// Returns 0 if the caller has to use the table implementation.
+*/
+static int RijndaelBackendRun(Rijndael* rijndael, int cbc, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  switch (RijndaelGetBackend())
+  {
+#if RIJNDAEL_HAVE_AESNI
+    case RIJNDAEL_Backend_AESNI:
+      if (rijndael->m_direction == RIJNDAEL_Direction_Encrypt)
+        RijndaelAesniEncrypt(rijndael, cbc, input, numBlocks, outBuffer);
+      else
+        RijndaelAesniDecrypt(rijndael, cbc, input, numBlocks, outBuffer);
+      return 1;
+#endif
+#if RIJNDAEL_HAVE_ARMV8
+    case RIJNDAEL_Backend_ARMv8:
+      if (rijndael->m_direction == RIJNDAEL_Direction_Encrypt)
+        RijndaelArmv8Encrypt(rijndael, cbc, input, numBlocks, outBuffer);
+      else
+        RijndaelArmv8Decrypt(rijndael, cbc, input, numBlocks, outBuffer);
+      return 1;
+#endif
+#if RIJNDAEL_HAVE_BITSLICE
+    case RIJNDAEL_Backend_Bitslice:
+      if (cbc && rijndael->m_direction == RIJNDAEL_Direction_Encrypt) return 0;
+      RijndaelBsBlocks(rijndael, cbc, input, numBlocks, outBuffer);
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
+
+static int RijndaelBackendBlocks(Rijndael* rijndael, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  if (rijndael->m_mode != RIJNDAEL_Direction_Mode_ECB && rijndael->m_mode != RIJNDAEL_Direction_Mode_CBC)
+  {
+    return 0;
+  }
+  return RijndaelBackendRun(rijndael, rijndael->m_mode == RIJNDAEL_Direction_Mode_CBC, input, numBlocks, outBuffer);
+}
+
+/*
+// Multi-block ECB decryption with the table implementation.
+// Blocks are independent, so four of them are interleaved round by round
+// to keep several table lookups in flight. Input and output may overlap
+// exactly (in-place decryption).
+*/
+
+#define RIJNDAEL_BATCH_BLOCKS 4
+
+#define RIJNDAEL_ADDKEY(t, a, k) \
+  *((UINT32*)t[0]) = *((UINT32*)(a   )) ^ *((UINT32*)k[0]); \
+  *((UINT32*)t[1]) = *((UINT32*)(a+ 4)) ^ *((UINT32*)k[1]); \
+  *((UINT32*)t[2]) = *((UINT32*)(a+ 8)) ^ *((UINT32*)k[2]); \
+  *((UINT32*)t[3]) = *((UINT32*)(a+12)) ^ *((UINT32*)k[3]);
+
+#define RIJNDAEL_INVROUND(b, t) \
+  *((UINT32*)(b   )) = *((UINT32*)T5[t[0][0]]) ^ *((UINT32*)T6[t[3][1]]) \
+                     ^ *((UINT32*)T7[t[2][2]]) ^ *((UINT32*)T8[t[1][3]]); \
+  *((UINT32*)(b+ 4)) = *((UINT32*)T5[t[1][0]]) ^ *((UINT32*)T6[t[0][1]]) \
+                     ^ *((UINT32*)T7[t[3][2]]) ^ *((UINT32*)T8[t[2][3]]); \
+  *((UINT32*)(b+ 8)) = *((UINT32*)T5[t[2][0]]) ^ *((UINT32*)T6[t[1][1]]) \
+                     ^ *((UINT32*)T7[t[0][2]]) ^ *((UINT32*)T8[t[3][3]]); \
+  *((UINT32*)(b+12)) = *((UINT32*)T5[t[3][0]]) ^ *((UINT32*)T6[t[2][1]]) \
+                     ^ *((UINT32*)T7[t[1][2]]) ^ *((UINT32*)T8[t[0][3]]);
+
+#define RIJNDAEL_INVLAST(b, t, k) \
+  b[ 0] = S5[t[0][0]]; b[ 1] = S5[t[3][1]]; b[ 2] = S5[t[2][2]]; b[ 3] = S5[t[1][3]]; \
+  b[ 4] = S5[t[1][0]]; b[ 5] = S5[t[0][1]]; b[ 6] = S5[t[3][2]]; b[ 7] = S5[t[2][3]]; \
+  b[ 8] = S5[t[2][0]]; b[ 9] = S5[t[1][1]]; b[10] = S5[t[0][2]]; b[11] = S5[t[3][3]]; \
+  b[12] = S5[t[3][0]]; b[13] = S5[t[2][1]]; b[14] = S5[t[1][2]]; b[15] = S5[t[0][3]]; \
+  *((UINT32*)(b   )) ^= *((UINT32*)k[0]); \
+  *((UINT32*)(b+ 4)) ^= *((UINT32*)k[1]); \
+  *((UINT32*)(b+ 8)) ^= *((UINT32*)k[2]); \
+  *((UINT32*)(b+12)) ^= *((UINT32*)k[3]);
+
+void RijndaelDecrypt4(Rijndael* rijndael, UINT8 a[64], UINT8 b[64])
+{
+  int r;
+  UINT8 t0[4][4], t1[4][4], t2[4][4], t3[4][4];
+  UINT8 (*key)[4];
+
+  key = rijndael->m_expandedKey[rijndael->m_uRounds];
+  RIJNDAEL_ADDKEY(t0, a     , key)
+  RIJNDAEL_ADDKEY(t1, a + 16, key)
+  RIJNDAEL_ADDKEY(t2, a + 32, key)
+  RIJNDAEL_ADDKEY(t3, a + 48, key)
+  RIJNDAEL_INVROUND(b     , t0)
+  RIJNDAEL_INVROUND(b + 16, t1)
+  RIJNDAEL_INVROUND(b + 32, t2)
+  RIJNDAEL_INVROUND(b + 48, t3)
+  for (r = rijndael->m_uRounds-1; r > 1; r--)
+  {
+    key = rijndael->m_expandedKey[r];
+    RIJNDAEL_ADDKEY(t0, b     , key)
+    RIJNDAEL_ADDKEY(t1, b + 16, key)
+    RIJNDAEL_ADDKEY(t2, b + 32, key)
+    RIJNDAEL_ADDKEY(t3, b + 48, key)
+    RIJNDAEL_INVROUND(b     , t0)
+    RIJNDAEL_INVROUND(b + 16, t1)
+    RIJNDAEL_INVROUND(b + 32, t2)
+    RIJNDAEL_INVROUND(b + 48, t3)
+  }
+  key = rijndael->m_expandedKey[1];
+  RIJNDAEL_ADDKEY(t0, b     , key)
+  RIJNDAEL_ADDKEY(t1, b + 16, key)
+  RIJNDAEL_ADDKEY(t2, b + 32, key)
+  RIJNDAEL_ADDKEY(t3, b + 48, key)
+  key = rijndael->m_expandedKey[0];
+  RIJNDAEL_INVLAST((b     ), t0, key)
+  RIJNDAEL_INVLAST((b + 16), t1, key)
+  RIJNDAEL_INVLAST((b + 32), t2, key)
+  RIJNDAEL_INVLAST((b + 48), t3, key)
+}
+
+static void RijndaelDecryptBlocks(Rijndael* rijndael, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  for (; numBlocks >= 4; numBlocks -= 4)
+  {
+    RijndaelDecrypt4(rijndael, input, outBuffer);
+    input += 64;
+    outBuffer += 64;
+  }
+  for (; numBlocks > 0; numBlocks--)
+  {
+    RijndaelDecrypt(rijndael, input, outBuffer);
+    input += 16;
+    outBuffer += 16;
+  }
+}
+
+/*
+// XEX mode. The hardware backends have dedicated kernels; otherwise the
+// tweaks of a chunk of blocks are computed up front by doubling in
+// GF(2^128) (little endian, as in XTS), then the whitened blocks go
+// through the ECB kernels in one batch. Input and output may overlap
+// exactly.
+*/
+
+#define RIJNDAEL_XEX_CHUNK 16
+
+static void RijndaelXexBlocks(Rijndael* rijndael, UINT8* input, int numBlocks, UINT8* outBuffer)
+{
+  UINT32 t[4], carry;
+  UINT8 tweaks[RIJNDAEL_XEX_CHUNK*16];
+  int i, j, n;
+
+  switch (RijndaelGetBackend())
+  {
+#if RIJNDAEL_HAVE_AESNI
+    case RIJNDAEL_Backend_AESNI:
+      RijndaelAesniXex(rijndael, input, numBlocks, outBuffer);
+      return;
+#endif
+#if RIJNDAEL_HAVE_ARMV8
+    case RIJNDAEL_Backend_ARMv8:
+      RijndaelArmv8Xex(rijndael, input, numBlocks, outBuffer);
+      return;
+#endif
+    default:
+      break;
+  }
+
+  /* The tweak as four little endian words */
+  for (j = 0; j < 4; j++)
+  {
+    UINT8* b = rijndael->m_initVector + 4*j;
+    t[j] = (UINT32) b[0] | ((UINT32) b[1] << 8) | ((UINT32) b[2] << 16) | ((UINT32) b[3] << 24);
+  }
+  for (; numBlocks > 0; numBlocks -= n)
+  {
+    n = (numBlocks < RIJNDAEL_XEX_CHUNK) ? numBlocks : RIJNDAEL_XEX_CHUNK;
+    for (i = 0; i < n; i++)
+    {
+      for (j = 0; j < 4; j++)
+      {
+        UINT8* b = tweaks + 16*i + 4*j;
+        b[0] = (UINT8) t[j];
+        b[1] = (UINT8) (t[j] >> 8);
+        b[2] = (UINT8) (t[j] >> 16);
+        b[3] = (UINT8) (t[j] >> 24);
+      }
+      carry = t[3] >> 31;
+      t[3] = (t[3] << 1) | (t[2] >> 31);
+      t[2] = (t[2] << 1) | (t[1] >> 31);
+      t[1] = (t[1] << 1) | (t[0] >> 31);
+      t[0] = (t[0] << 1) ^ (carry * 0x87);
+    }
+    for (i = 0; i < 4*n; i++)
+    {
+      ((UINT32*)outBuffer)[i] = ((UINT32*)input)[i] ^ ((UINT32*)tweaks)[i];
+    }
+    if (!RijndaelBackendRun(rijndael, 0, outBuffer, n, outBuffer))
+    {
+      if (rijndael->m_direction == RIJNDAEL_Direction_Decrypt)
+      {
+        RijndaelDecryptBlocks(rijndael, outBuffer, n, outBuffer);
+      }
+      else
+      {
+        for (i = 0; i < n; i++)
+        {
+          RijndaelEncrypt(rijndael, outBuffer + 16*i, outBuffer + 16*i);
+        }
+      }
+    }
+    for (i = 0; i < 4*n; i++)
+    {
+      ((UINT32*)outBuffer)[i] ^= ((UINT32*)tweaks)[i];
+    }
+    input += 16*n;
+    outBuffer += 16*n;
+  }
+}
+
 /*
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // API
@@ -990,7 +2253,7 @@ int RijndaelInit(Rijndael* rijndael, int mode, int dir, UINT8* key, int keyLen,
   rijndael->m_state = RIJNDAEL_State_Invalid;
 
   /* Check the mode */
-  if ((mode != RIJNDAEL_Direction_Mode_CBC) && (mode != RIJNDAEL_Direction_Mode_ECB) && (mode != RIJNDAEL_Direction_Mode_CFB1)) return RIJNDAEL_UNSUPPORTED_MODE;
+  if ((mode != RIJNDAEL_Direction_Mode_CBC) && (mode != RIJNDAEL_Direction_Mode_ECB) && (mode != RIJNDAEL_Direction_Mode_CFB1) && (mode != RIJNDAEL_Direction_Mode_XEX)) return RIJNDAEL_UNSUPPORTED_MODE;
   rijndael->m_mode = mode;
 
   /* And the direction */
@@ -1043,6 +2306,9 @@ int RijndaelInit(Rijndael* rijndael, int mode, int dir, UINT8* key, int keyLen,
 
   RijndaelKeySched(rijndael, keyMatrix);
 
+  /* XEX keeps the first tweak, which needs the encryption schedule */
+  if (rijndael->m_mode == RIJNDAEL_Direction_Mode_XEX) RijndaelEncrypt(rijndael, rijndael->m_initVector, rijndael->m_initVector);
+
   if (rijndael->m_direction == RIJNDAEL_Direction_Decrypt) RijndaelKeyEncToDec(rijndael);
 
   rijndael->m_state = RIJNDAEL_State_Valid;
@@ -1061,6 +2327,7 @@ int RijndaelBlockEncrypt(Rijndael* rijndael, UINT8 *input,int inputLen,UINT8 *ou
   if (input == 0 || inputLen <= 0) return 0;
 
   numBlocks = inputLen/128;
+  if (numBlocks > 0 && RijndaelBackendBlocks(rijndael, input, numBlocks, outBuffer)) return 128 * numBlocks;
   
   switch (rijndael->m_mode)
   {
@@ -1090,6 +2357,9 @@ int RijndaelBlockEncrypt(Rijndael* rijndael, UINT8 *input,int inputLen,UINT8 *ou
         input += 16;
       }
     break;
+    case RIJNDAEL_Direction_Mode_XEX:
+      RijndaelXexBlocks(rijndael, input, numBlocks, outBuffer);
+    break;
     case RIJNDAEL_Direction_Mode_CFB1:
 #if STRICT_ALIGN 
       memcpy(iv,rijndael->m_initVector,16); 
@@ -1136,6 +2406,55 @@ int RijndaelBlockEncrypt(Rijndael* rijndael, UINT8 *input,int inputLen,UINT8 *ou
   return 128 * numBlocks;
 }
 
+/*
+// The streams are interleaved only if all of them are CBC encryptions with
+// the same key length
+*/
+int RijndaelBlockEncrypt4(Rijndael* rijndael[RIJNDAEL_STREAMS], UINT8* input[RIJNDAEL_STREAMS],
+                          int inputLen, UINT8* outBuffer[RIJNDAEL_STREAMS])
+{
+  int j, rc = 0, numBlocks = inputLen/128;
+  int interleave = (numBlocks > 0);
+
+  for (j = 0; j < RIJNDAEL_STREAMS; j++)
+  {
+    if (rijndael[j]->m_state != RIJNDAEL_State_Valid ||
+        rijndael[j]->m_direction != RIJNDAEL_Direction_Encrypt ||
+        rijndael[j]->m_mode != RIJNDAEL_Direction_Mode_CBC ||
+        rijndael[j]->m_uRounds != rijndael[0]->m_uRounds)
+    {
+      interleave = 0;
+    }
+  }
+  if (interleave)
+  {
+    switch (RijndaelGetBackend())
+    {
+#if RIJNDAEL_HAVE_AESNI
+      case RIJNDAEL_Backend_AESNI:
+        RijndaelAesniEncryptCbc4(rijndael, input, numBlocks, outBuffer);
+        return 128 * numBlocks;
+#endif
+#if RIJNDAEL_HAVE_ARMV8
+      case RIJNDAEL_Backend_ARMv8:
+        RijndaelArmv8EncryptCbc4(rijndael, input, numBlocks, outBuffer);
+        return 128 * numBlocks;
+#endif
+      default:
+        break;
+    }
+  }
+  for (j = 0; j < RIJNDAEL_STREAMS; j++)
+  {
+    rc = RijndaelBlockEncrypt(rijndael[j], input[j], inputLen, outBuffer[j]);
+    if (rc < 0)
+    {
+      return rc;
+    }
+  }
+  return rc;
+}
+
 int RijndaelPadEncrypt(Rijndael* rijndael, UINT8 *input, int inputOctets, UINT8 *outBuffer)
 {
   int i, numBlocks, padLen;
@@ -1196,8 +2515,9 @@ int RijndaelPadEncrypt(Rijndael* rijndael, UINT8 *input, int inputOctets, UINT8
   
 int RijndaelBlockDecrypt(Rijndael* rijndael, UINT8 *input, int inputLen, UINT8 *outBuffer)
 {
-  int i, k, numBlocks;
+  int i, k, n, numBlocks;
   UINT8 block[16], iv[4][4];
+  UINT32 chain[RIJNDAEL_BATCH_BLOCKS+1][4];
 
   if (rijndael->m_state != RIJNDAEL_State_Valid) return RIJNDAEL_NOT_INITIALIZED;
   if ((rijndael->m_mode != RIJNDAEL_Direction_Mode_CFB1) && (rijndael->m_direction == RIJNDAEL_Direction_Encrypt)) return RIJNDAEL_BAD_DIRECTION;
@@ -1205,46 +2525,36 @@ int RijndaelBlockDecrypt(Rijndael* rijndael, UINT8 *input, int inputLen, UINT8 *
   if (input == 0 || inputLen <= 0)return 0;
 
   numBlocks = inputLen/128;
+  if (numBlocks > 0 && RijndaelBackendBlocks(rijndael, input, numBlocks, outBuffer)) return 128*numBlocks;
 
   switch (rijndael->m_mode)
   {
     case RIJNDAEL_Direction_Mode_ECB: 
-      for (i = numBlocks; i > 0; i--)
-      {
-        RijndaelDecrypt(rijndael, input, outBuffer);
-        input += 16;
-        outBuffer += 16;
-      }
+      RijndaelDecryptBlocks(rijndael, input, numBlocks, outBuffer);
     break;
     case RIJNDAEL_Direction_Mode_CBC:
-#if STRICT_ALIGN 
-      memcpy(iv,rijndael->m_initVector,16); 
-#else
-      *((UINT32*)iv[0]) = *((UINT32*)(rijndael->m_initVector  ));
-      *((UINT32*)iv[1]) = *((UINT32*)(rijndael->m_initVector+ 4));
-      *((UINT32*)iv[2]) = *((UINT32*)(rijndael->m_initVector+ 8));
-      *((UINT32*)iv[3]) = *((UINT32*)(rijndael->m_initVector+12));
-#endif
-      for (i = numBlocks; i > 0; i--)
+      /* chain[0] is the running IV, chain[1..n] the ciphertext of the current batch */
+      memcpy(chain[0], rijndael->m_initVector, 16);
+      for (i = numBlocks; i > 0; i -= n)
       {
-        RijndaelDecrypt(rijndael, input, block);
-        ((UINT32*)block)[0] ^= *((UINT32*)iv[0]);
-        ((UINT32*)block)[1] ^= *((UINT32*)iv[1]);
-        ((UINT32*)block)[2] ^= *((UINT32*)iv[2]);
-        ((UINT32*)block)[3] ^= *((UINT32*)iv[3]);
-#if STRICT_ALIGN
-        memcpy(iv, input, 16);
-        memcpy(outBuf, block, 16);
-#else
-        *((UINT32*)iv[0]) = ((UINT32*)input)[0]; ((UINT32*)outBuffer)[0] = ((UINT32*)block)[0];
-        *((UINT32*)iv[1]) = ((UINT32*)input)[1]; ((UINT32*)outBuffer)[1] = ((UINT32*)block)[1];
-        *((UINT32*)iv[2]) = ((UINT32*)input)[2]; ((UINT32*)outBuffer)[2] = ((UINT32*)block)[2];
-        *((UINT32*)iv[3]) = ((UINT32*)input)[3]; ((UINT32*)outBuffer)[3] = ((UINT32*)block)[3];
-#endif
-        input += 16;
-        outBuffer += 16;
+        n = (i < RIJNDAEL_BATCH_BLOCKS) ? i : RIJNDAEL_BATCH_BLOCKS;
+        memcpy(chain[1], input, 16*n);
+        RijndaelDecryptBlocks(rijndael, input, n, outBuffer);
+        for (k = 0; k < n; k++)
+        {
+          ((UINT32*)outBuffer)[0] ^= chain[k][0];
+          ((UINT32*)outBuffer)[1] ^= chain[k][1];
+          ((UINT32*)outBuffer)[2] ^= chain[k][2];
+          ((UINT32*)outBuffer)[3] ^= chain[k][3];
+          outBuffer += 16;
+        }
+        memcpy(chain[0], chain[n], 16);
+        input += 16*n;
       }
-      break;
+    break;
+    case RIJNDAEL_Direction_Mode_XEX:
+      RijndaelXexBlocks(rijndael, input, numBlocks, outBuffer);
+    break;
     case RIJNDAEL_Direction_Mode_CFB1:
 #if STRICT_ALIGN 
       memcpy(iv, rijndael->m_initVector, 16); 
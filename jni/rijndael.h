@@ -95,6 +95,7 @@ typedef unsigned short UINT16;
 #define RIJNDAEL_NOT_INITIALIZED -5
 #define RIJNDAEL_BAD_DIRECTION -6
 #define RIJNDAEL_CORRUPTED_DATA -7
+#define RIJNDAEL_UNSUPPORTED_BACKEND -8
 
 #define RIJNDAEL_Direction_Encrypt 0
 #define RIJNDAEL_Direction_Decrypt 1
@@ -102,6 +103,7 @@ typedef unsigned short UINT16;
 #define RIJNDAEL_Direction_Mode_ECB  0
 #define RIJNDAEL_Direction_Mode_CBC  1
 #define RIJNDAEL_Direction_Mode_CFB1 2
+#define RIJNDAEL_Direction_Mode_XEX  3
 
 #define RIJNDAEL_Direction_KeyLength_Key16Bytes  0
 #define RIJNDAEL_Direction_KeyLength_Key24Bytes  1
@@ -110,6 +112,11 @@ typedef unsigned short UINT16;
 #define RIJNDAEL_State_Valid   0
 #define RIJNDAEL_State_Invalid 1
 
+#define RIJNDAEL_Backend_Table 0
+#define RIJNDAEL_Backend_AESNI 1
+#define RIJNDAEL_Backend_ARMv8 2
+#define RIJNDAEL_Backend_Bitslice 3
+
 /*
 /// Class implementing the Rijndael cipher. (For internal use only)
 */
@@ -133,8 +140,10 @@ void RijndaelCreate(Rijndael* rijndael);
 
 // init(): Initializes the crypt session
 // Returns RIJNDAEL_SUCCESS or an error code
-// mode      : Rijndael::ECB, Rijndael::CBC or Rijndael::CFB1
+// mode      : Rijndael::ECB, Rijndael::CBC, Rijndael::CFB1 or Rijndael::XEX
 //             You have to use the same mode for encrypting and decrypting
+//             XEX whitens block j with the tweak E(initVector)*x^j and,
+//             unlike CBC, encrypts all blocks independently
 // dir       : Rijndael::Encrypt or Rijndael::Decrypt
 //             A cipher instance works only in one direction
 //             (Well , it could be easily modified to work in both
@@ -159,6 +168,17 @@ int RijndaelInit(Rijndael* rijndael, int mode, int dir, UINT8* key, int keyLen,
 */
 int RijndaelBlockEncrypt(Rijndael* rijndael, UINT8 *input, int inputLen, UINT8 *outBuffer);
 
+/*
+// Encrypts RIJNDAEL_STREAMS buffers of the same length, each with its own
+// cipher instance. CBC streams are interleaved on the hardware backends,
+// other modes and backends encrypt the buffers one by one.
+// Input len is in BITS!
+// Returns the encrypted length of each buffer in BITS or an error code < 0
+*/
+#define RIJNDAEL_STREAMS 4
+int RijndaelBlockEncrypt4(Rijndael* rijndael[RIJNDAEL_STREAMS], UINT8* input[RIJNDAEL_STREAMS],
+                          int inputLen, UINT8* outBuffer[RIJNDAEL_STREAMS]);
+
 /*
 // Encrypts the input array (can be binary data)
 // The input array can be any length , it is automatically padded on a 16 byte boundary.
@@ -184,10 +204,23 @@ int RijndaelBlockDecrypt(Rijndael* rijndael, UINT8 *input, int inputLen, UINT8 *
 */
 int RijndaelPadDecrypt(Rijndael* rijndael, UINT8 *input, int inputOctets, UINT8 *outBuffer);
 
+/*
+// Block cipher backend used by RijndaelBlockEncrypt/RijndaelBlockDecrypt
+// in ECB and CBC mode. On first use the fastest backend supported by the
+// CPU is selected: AES-NI on x86, the ARMv8 Crypto Extensions on arm64,
+// constant-time bitsliced code on SSSE3/NEON without AES instructions,
+// the portable table implementation otherwise.
+// RijndaelSetBackend forces a backend (e.g. for benchmarks) and returns
+// RIJNDAEL_UNSUPPORTED_BACKEND if the CPU lacks it.
+*/
+int RijndaelGetBackend(void);
+int RijndaelSetBackend(int backend);
+
 void RijndaelInvalidate(Rijndael* rijndael);
 void RijndaelKeySched(Rijndael* rijndael, UINT8 key[_MAX_KEY_COLUMNS][4]);
 void RijndaelKeyEncToDec(Rijndael* rijndael);
 void RijndaelEncrypt(Rijndael* rijndael, UINT8 a[16], UINT8 b[16]);
 void RijndaelDecrypt(Rijndael* rijndael, UINT8 a[16], UINT8 b[16]);
+void RijndaelDecrypt4(Rijndael* rijndael, UINT8 a[64], UINT8 b[64]);
 	
 #endif /* _RIJNDAEL_H_ */
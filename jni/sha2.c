@@ -0,0 +1,570 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        sha2.c
+// Purpose:     SHA-256 message digest (FIPS 180-2)
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file sha2.c Implementation of the SHA-256 message digest
+//
+// Besides the portable code there are two accelerated paths. The SHA
+// instructions of x86 (SHA-NI) and arm64 (Crypto Extensions) compute two
+// resp. four rounds per instruction. Without them, sha256_x4 hashes four
+// messages at once with one message per 32 bit lane of the SSE2 or NEON
+// registers, which pays off when several page keys are derived together.
+*/
+
+#include "sha2.h"
+
+#include <string.h>
+
+/*
+// SHA instructions. Like the AES instructions in rijndael.c they are
+// reached through function level target attributes on x86; the arm64
+// intrinsics need a compiler targeting the Crypto Extensions (see
+// Android.mk). Both are only executed after a runtime check.
+*/
+#if !defined(SHA256_NO_HW) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_HAVE_HW 1
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_TARGET_HW __attribute__((target("sha,sse4.1,ssse3")))
+#ifndef bit_SHA
+#define bit_SHA (1 << 29)
+#endif
+#endif
+
+#if !defined(SHA256_NO_HW) && defined(__GNUC__) && defined(__aarch64__) && defined(__linux__) && \
+    (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#define SHA256_HAVE_HW 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#define SHA256_TARGET_HW
+#endif
+
+/*
+// Vector primitives of the four lane code: SSE2 on x86, NEON on arm64 and
+// on armeabi-v7a builds that enable NEON.
+*/
+#if !defined(SHA256_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_HAVE_SIMD 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#define SHA256_TARGET_SIMD __attribute__((target("sse2")))
+typedef __m128i SHVEC;
+#define SH_STORE(p, v)  _mm_storeu_si128((__m128i*) (p), v)
+#define SH_ADD(a, b)    _mm_add_epi32(a, b)
+#define SH_XOR(a, b)    _mm_xor_si128(a, b)
+#define SH_AND(a, b)    _mm_and_si128(a, b)
+#define SH_OR(a, b)     _mm_or_si128(a, b)
+#define SH_SET1(w)      _mm_set1_epi32((int) (w))
+#define SH_SHR(v, n)    _mm_srli_epi32(v, n)
+#define SH_ROTR(v, n)   _mm_or_si128(_mm_srli_epi32(v, n), _mm_slli_epi32(v, 32-(n)))
+#define SH_LOAD(p)      _mm_loadu_si128((const __m128i*) (p))
+#define SH_BSWAP(v)     sha256_bswap_sse2(v)
+#define SH_TRANSPOSE(a, b, c, d) \
+  { __m128i t0_ = _mm_unpacklo_epi32(a, b), t1_ = _mm_unpacklo_epi32(c, d); \
+    __m128i t2_ = _mm_unpackhi_epi32(a, b), t3_ = _mm_unpackhi_epi32(c, d); \
+    a = _mm_unpacklo_epi64(t0_, t1_); b = _mm_unpackhi_epi64(t0_, t1_); \
+    c = _mm_unpacklo_epi64(t2_, t3_); d = _mm_unpackhi_epi64(t2_, t3_); }
+static SHA256_TARGET_SIMD __m128i sha256_bswap_sse2(__m128i v)
+{
+  v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#endif
+
+#if !defined(SHA256_NO_SIMD) && defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+    defined(__linux__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define SHA256_HAVE_SIMD 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#if !defined(__aarch64__) && !defined(HWCAP_NEON)
+#define HWCAP_NEON (1 << 12)
+#endif
+#define SHA256_TARGET_SIMD
+typedef uint32x4_t SHVEC;
+#define SH_STORE(p, v)  vst1q_u8(p, vreinterpretq_u8_u32(v))
+#define SH_ADD(a, b)    vaddq_u32(a, b)
+#define SH_XOR(a, b)    veorq_u32(a, b)
+#define SH_AND(a, b)    vandq_u32(a, b)
+#define SH_OR(a, b)     vorrq_u32(a, b)
+#define SH_SET1(w)      vdupq_n_u32(w)
+#define SH_SHR(v, n)    vshrq_n_u32(v, n)
+#define SH_ROTR(v, n)   vsliq_n_u32(vshrq_n_u32(v, n), v, 32-(n))
+#define SH_LOAD(p)      vreinterpretq_u32_u8(vld1q_u8(p))
+#define SH_BSWAP(v)     vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(v)))
+#define SH_TRANSPOSE(a, b, c, d) \
+  { uint32x4x2_t p_ = vtrnq_u32(a, b), q_ = vtrnq_u32(c, d); \
+    a = vcombine_u32(vget_low_u32(p_.val[0]), vget_low_u32(q_.val[0])); \
+    b = vcombine_u32(vget_low_u32(p_.val[1]), vget_low_u32(q_.val[1])); \
+    c = vcombine_u32(vget_high_u32(p_.val[0]), vget_high_u32(q_.val[0])); \
+    d = vcombine_u32(vget_high_u32(p_.val[1]), vget_high_u32(q_.val[1])); }
+#endif
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SHA256_F1(x) (SHA256_ROTR(x,  2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+#define SHA256_F2(x) (SHA256_ROTR(x,  6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+#define SHA256_F3(x) (SHA256_ROTR(x,  7) ^ SHA256_ROTR(x, 18) ^ ((x) >>  3))
+#define SHA256_F4(x) (SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+
+static const unsigned int sha256_h0[8] =
+{
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const unsigned int sha256_k[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static unsigned int sha256_get_be32(const unsigned char* p)
+{
+  return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16) |
+         ((unsigned int) p[2] <<  8) |  (unsigned int) p[3];
+}
+
+static void sha256_put_be32(unsigned char* p, unsigned int v)
+{
+  p[0] = (unsigned char) (v >> 24);
+  p[1] = (unsigned char) (v >> 16);
+  p[2] = (unsigned char) (v >>  8);
+  p[3] = (unsigned char)  v;
+}
+
+/*
+// Process nBlocks consecutive 64 byte blocks
+*/
+static void sha256_transf_scalar(unsigned int h[8], const unsigned char* message, unsigned int nBlocks)
+{
+  unsigned int w[64];
+  unsigned int wv[8];
+  unsigned int t1, t2;
+  unsigned int i;
+  int j;
+
+  for (i = 0; i < nBlocks; i++, message += SHA256_BLOCK_SIZE)
+  {
+    for (j = 0; j < 16; j++)
+    {
+      w[j] = sha256_get_be32(message + 4*j);
+    }
+    for (j = 16; j < 64; j++)
+    {
+      w[j] = SHA256_F4(w[j-2]) + w[j-7] + SHA256_F3(w[j-15]) + w[j-16];
+    }
+    memcpy(wv, h, sizeof(wv));
+    for (j = 0; j < 64; j++)
+    {
+      t1 = wv[7] + SHA256_F2(wv[4]) + SHA256_CH(wv[4], wv[5], wv[6]) + sha256_k[j] + w[j];
+      t2 = SHA256_F1(wv[0]) + SHA256_MAJ(wv[0], wv[1], wv[2]);
+      wv[7] = wv[6];
+      wv[6] = wv[5];
+      wv[5] = wv[4];
+      wv[4] = wv[3] + t1;
+      wv[3] = wv[2];
+      wv[2] = wv[1];
+      wv[1] = wv[0];
+      wv[0] = t1 + t2;
+    }
+    for (j = 0; j < 8; j++)
+    {
+      h[j] += wv[j];
+    }
+  }
+}
+
+#if SHA256_HAVE_HW
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+// SHA-NI keeps the state as ABEF and CDGH; each sha256rnds2 computes two
+// rounds, sha256msg1/sha256msg2 compute four words of the message schedule.
+*/
+static SHA256_TARGET_HW void sha256_transf_hw(unsigned int h[8], const unsigned char* message, unsigned int nBlocks)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, save0, save1, msg, tmp;
+  __m128i m[4];
+  int j;
+
+  tmp    = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &h[0]), 0xB1);  /* CDAB */
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &h[4]), 0x1B);  /* EFGH */
+  state0 = _mm_alignr_epi8(tmp, state1, 8);                                    /* ABEF */
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                 /* CDGH */
+
+  for (; nBlocks > 0; nBlocks--, message += SHA256_BLOCK_SIZE)
+  {
+    save0 = state0;
+    save1 = state1;
+    for (j = 0; j < 16; j++)
+    {
+      if (j < 4)
+      {
+        m[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (message + 16*j)), mask);
+      }
+      else
+      {
+        /* m[j&3] holds words 4j-16.., the other three the words up to 4j-1 */
+        tmp = _mm_add_epi32(_mm_sha256msg1_epu32(m[j&3], m[(j+1)&3]),
+                            _mm_alignr_epi8(m[(j+3)&3], m[(j+2)&3], 4));
+        m[j&3] = _mm_sha256msg2_epu32(tmp, m[(j+3)&3]);
+      }
+      msg = _mm_add_epi32(m[j&3], _mm_loadu_si128((const __m128i*) &sha256_k[4*j]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+    }
+    state0 = _mm_add_epi32(state0, save0);
+    state1 = _mm_add_epi32(state1, save1);
+  }
+
+  tmp    = _mm_shuffle_epi32(state0, 0x1B);                                    /* FEBA */
+  state1 = _mm_shuffle_epi32(state1, 0xB1);                                    /* DCHG */
+  _mm_storeu_si128((__m128i*) &h[0], _mm_blend_epi16(tmp, state1, 0xF0));      /* DCBA */
+  _mm_storeu_si128((__m128i*) &h[4], _mm_alignr_epi8(state1, tmp, 8));         /* HGFE */
+}
+
+#else
+
+/*
+// The Crypto Extensions compute four rounds per sha256h/sha256h2 pair and
+// four words of the message schedule per sha256su0/sha256su1 pair.
+*/
+static void sha256_transf_hw(unsigned int h[8], const unsigned char* message, unsigned int nBlocks)
+{
+  uint32x4_t state0 = vld1q_u32(&h[0]);
+  uint32x4_t state1 = vld1q_u32(&h[4]);
+  uint32x4_t save0, save1, msg, tmp;
+  uint32x4_t m[4];
+  int j;
+
+  for (; nBlocks > 0; nBlocks--, message += SHA256_BLOCK_SIZE)
+  {
+    save0 = state0;
+    save1 = state1;
+    for (j = 0; j < 16; j++)
+    {
+      if (j < 4)
+      {
+        m[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 16*j)));
+      }
+      else
+      {
+        m[j&3] = vsha256su1q_u32(vsha256su0q_u32(m[j&3], m[(j+1)&3]), m[(j+2)&3], m[(j+3)&3]);
+      }
+      msg = vaddq_u32(m[j&3], vld1q_u32(&sha256_k[4*j]));
+      tmp = state0;
+      state0 = vsha256hq_u32(state0, state1, msg);
+      state1 = vsha256h2q_u32(state1, tmp, msg);
+    }
+    state0 = vaddq_u32(state0, save0);
+    state1 = vaddq_u32(state1, save1);
+  }
+  vst1q_u32(&h[0], state0);
+  vst1q_u32(&h[4], state1);
+}
+
+#endif
+#endif /* SHA256_HAVE_HW */
+
+#if SHA256_HAVE_SIMD
+
+/*
+// One block of each of the four lanes. state[j] holds word j of the state
+// of all four messages.
+*/
+static SHA256_TARGET_SIMD void sha256_transf_x4(SHVEC state[8], const unsigned char* block[SHA256_LANES])
+{
+  SHVEC w[16];
+  SHVEC wv[8];
+  SHVEC t1, t2;
+  int j;
+
+  /* Load four words of each lane, transpose to one word per vector, and
+     convert from big endian */
+  for (j = 0; j < 16; j += 4)
+  {
+    w[j]   = SH_LOAD(block[0] + 4*j);
+    w[j+1] = SH_LOAD(block[1] + 4*j);
+    w[j+2] = SH_LOAD(block[2] + 4*j);
+    w[j+3] = SH_LOAD(block[3] + 4*j);
+    SH_TRANSPOSE(w[j], w[j+1], w[j+2], w[j+3]);
+    w[j]   = SH_BSWAP(w[j]);
+    w[j+1] = SH_BSWAP(w[j+1]);
+    w[j+2] = SH_BSWAP(w[j+2]);
+    w[j+3] = SH_BSWAP(w[j+3]);
+  }
+  for (j = 0; j < 8; j++)
+  {
+    wv[j] = state[j];
+  }
+  for (j = 0; j < 64; j++)
+  {
+    if (j >= 16)
+    {
+      /* w[t] = F4(w[t-2]) + w[t-7] + F3(w[t-15]) + w[t-16], in a ring of 16 words */
+      t1 = w[(j-2)&15];
+      t2 = w[(j-15)&15];
+      t1 = SH_XOR(SH_XOR(SH_ROTR(t1, 17), SH_ROTR(t1, 19)), SH_SHR(t1, 10));
+      t2 = SH_XOR(SH_XOR(SH_ROTR(t2,  7), SH_ROTR(t2, 18)), SH_SHR(t2,  3));
+      w[j&15] = SH_ADD(SH_ADD(t1, w[(j-7)&15]), SH_ADD(t2, w[j&15]));
+    }
+    t1 = SH_XOR(SH_XOR(SH_ROTR(wv[4], 6), SH_ROTR(wv[4], 11)), SH_ROTR(wv[4], 25));
+    t1 = SH_ADD(SH_ADD(wv[7], t1), SH_XOR(wv[6], SH_AND(wv[4], SH_XOR(wv[5], wv[6]))));
+    t1 = SH_ADD(t1, SH_ADD(SH_SET1(sha256_k[j]), w[j&15]));
+    t2 = SH_XOR(SH_XOR(SH_ROTR(wv[0], 2), SH_ROTR(wv[0], 13)), SH_ROTR(wv[0], 22));
+    t2 = SH_ADD(t2, SH_OR(SH_AND(wv[0], wv[1]), SH_AND(wv[2], SH_OR(wv[0], wv[1]))));
+    wv[7] = wv[6];
+    wv[6] = wv[5];
+    wv[5] = wv[4];
+    wv[4] = SH_ADD(wv[3], t1);
+    wv[3] = wv[2];
+    wv[2] = wv[1];
+    wv[1] = wv[0];
+    wv[0] = SH_ADD(t1, t2);
+  }
+  for (j = 0; j < 8; j++)
+  {
+    state[j] = SH_ADD(state[j], wv[j]);
+  }
+}
+
+/*
+// sha256_x4 on the four lane code: the full blocks are read in place, the
+// final one or two blocks are padded in a buffer per lane
+*/
+static SHA256_TARGET_SIMD void sha256_x4_simd(const unsigned char* message[SHA256_LANES], unsigned int len,
+                                              unsigned char* digest[SHA256_LANES])
+{
+  SHVEC state[8];
+  unsigned char tail[SHA256_LANES][2*SHA256_BLOCK_SIZE];
+  const unsigned char* block[SHA256_LANES];
+  unsigned int offset, rest, tailLen;
+  int j, k;
+
+  for (j = 0; j < 8; j++)
+  {
+    state[j] = SH_SET1(sha256_h0[j]);
+  }
+  for (offset = 0; len - offset >= SHA256_BLOCK_SIZE; offset += SHA256_BLOCK_SIZE)
+  {
+    for (k = 0; k < SHA256_LANES; k++)
+    {
+      block[k] = message[k] + offset;
+    }
+    sha256_transf_x4(state, block);
+  }
+
+  rest = len - offset;
+  tailLen = (rest < SHA256_BLOCK_SIZE - 8) ? SHA256_BLOCK_SIZE : 2*SHA256_BLOCK_SIZE;
+  for (k = 0; k < SHA256_LANES; k++)
+  {
+    memcpy(tail[k], message[k] + offset, rest);
+    tail[k][rest] = 0x80;
+    memset(tail[k] + rest + 1, 0, tailLen - rest - 1);
+    sha256_put_be32(tail[k] + tailLen - 8, len >> 29);
+    sha256_put_be32(tail[k] + tailLen - 4, len << 3);
+    block[k] = tail[k];
+  }
+  sha256_transf_x4(state, block);
+  if (tailLen > SHA256_BLOCK_SIZE)
+  {
+    for (k = 0; k < SHA256_LANES; k++)
+    {
+      block[k] = tail[k] + SHA256_BLOCK_SIZE;
+    }
+    sha256_transf_x4(state, block);
+  }
+
+  /* Lane k of the transposed state is the digest of message k */
+  SH_TRANSPOSE(state[0], state[1], state[2], state[3]);
+  SH_TRANSPOSE(state[4], state[5], state[6], state[7]);
+  for (k = 0; k < SHA256_LANES; k++)
+  {
+    SH_STORE(digest[k],      SH_BSWAP(state[k]));
+    SH_STORE(digest[k] + 16, SH_BSWAP(state[k+4]));
+  }
+}
+
+#endif /* SHA256_HAVE_SIMD */
+
+static int sha256Backend = -1;
+
+static int sha256_has_backend(int backend)
+{
+#if (SHA256_HAVE_HW || SHA256_HAVE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+  unsigned int eax, ebx, ecx, edx;
+#endif
+  switch (backend)
+  {
+    case SHA256_Backend_Scalar:
+      return 1;
+#if SHA256_HAVE_SIMD
+    case SHA256_Backend_SIMD:
+#if defined(__x86_64__) || defined(__i386__)
+      return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+#elif defined(__aarch64__)
+      return 1;
+#else
+      return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+#endif
+#if SHA256_HAVE_HW
+    case SHA256_Backend_HW:
+#if defined(__x86_64__) || defined(__i386__)
+      if (__get_cpuid_max(0, 0) < 7 ||
+          !__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+      {
+        return 0;
+      }
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      return (ebx & bit_SHA) != 0;
+#else
+      return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#endif
+#endif
+    default:
+      return 0;
+  }
+}
+
+int sha256_get_backend(void)
+{
+  if (sha256Backend < 0)
+  {
+    if (sha256_has_backend(SHA256_Backend_HW))
+      sha256Backend = SHA256_Backend_HW;
+    else if (sha256_has_backend(SHA256_Backend_SIMD))
+      sha256Backend = SHA256_Backend_SIMD;
+    else
+      sha256Backend = SHA256_Backend_Scalar;
+  }
+  return sha256Backend;
+}
+
+int sha256_set_backend(int backend)
+{
+  if (!sha256_has_backend(backend))
+  {
+    return SHA256_UNSUPPORTED_BACKEND;
+  }
+  sha256Backend = backend;
+  return SHA256_SUCCESS;
+}
+
+static void sha256_transf(sha256_ctx* ctx, const unsigned char* message, unsigned int nBlocks)
+{
+  if (nBlocks == 0)
+  {
+    return;
+  }
+#if SHA256_HAVE_HW
+  if (sha256_get_backend() == SHA256_Backend_HW)
+  {
+    sha256_transf_hw(ctx->h, message, nBlocks);
+    return;
+  }
+#endif
+  sha256_transf_scalar(ctx->h, message, nBlocks);
+}
+
+void sha256_init(sha256_ctx* ctx)
+{
+  memcpy(ctx->h, sha256_h0, sizeof(ctx->h));
+  ctx->len = 0;
+  ctx->tot_len[0] = 0;
+  ctx->tot_len[1] = 0;
+}
+
+void sha256_update(sha256_ctx* ctx, const unsigned char* message, unsigned int len)
+{
+  unsigned int n;
+
+  ctx->tot_len[0] += len;
+  if (ctx->tot_len[0] < len)
+  {
+    ctx->tot_len[1]++;
+  }
+  if (ctx->len > 0)
+  {
+    n = SHA256_BLOCK_SIZE - ctx->len;
+    if (n > len) n = len;
+    memcpy(ctx->block + ctx->len, message, n);
+    ctx->len += n;
+    message += n;
+    len -= n;
+    if (ctx->len < SHA256_BLOCK_SIZE)
+    {
+      return;
+    }
+    sha256_transf(ctx, ctx->block, 1);
+    ctx->len = 0;
+  }
+  n = len / SHA256_BLOCK_SIZE;
+  sha256_transf(ctx, message, n);
+  message += n * SHA256_BLOCK_SIZE;
+  len -= n * SHA256_BLOCK_SIZE;
+  memcpy(ctx->block, message, len);
+  ctx->len = len;
+}
+
+void sha256_final(sha256_ctx* ctx, unsigned char* digest)
+{
+  unsigned int hi = (ctx->tot_len[1] << 3) | (ctx->tot_len[0] >> 29);
+  unsigned int lo = ctx->tot_len[0] << 3;
+  int j;
+
+  ctx->block[ctx->len++] = 0x80;
+  if (ctx->len > SHA256_BLOCK_SIZE - 8)
+  {
+    memset(ctx->block + ctx->len, 0, SHA256_BLOCK_SIZE - ctx->len);
+    sha256_transf(ctx, ctx->block, 1);
+    ctx->len = 0;
+  }
+  memset(ctx->block + ctx->len, 0, SHA256_BLOCK_SIZE - 8 - ctx->len);
+  sha256_put_be32(ctx->block + SHA256_BLOCK_SIZE - 8, hi);
+  sha256_put_be32(ctx->block + SHA256_BLOCK_SIZE - 4, lo);
+  sha256_transf(ctx, ctx->block, 1);
+  for (j = 0; j < 8; j++)
+  {
+    sha256_put_be32(digest + 4*j, ctx->h[j]);
+  }
+}
+
+void sha256(const unsigned char* message, unsigned int len, unsigned char* digest)
+{
+  sha256_ctx ctx;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, message, len);
+  sha256_final(&ctx, digest);
+}
+
+void sha256_x4(const unsigned char* message[SHA256_LANES], unsigned int len,
+               unsigned char* digest[SHA256_LANES])
+{
+  int k;
+#if SHA256_HAVE_SIMD
+  if (sha256_get_backend() == SHA256_Backend_SIMD)
+  {
+    sha256_x4_simd(message, len, digest);
+    return;
+  }
+#endif
+  for (k = 0; k < SHA256_LANES; k++)
+  {
+    sha256(message[k], len, digest[k]);
+  }
+}
@@ -0,0 +1,58 @@
+/*
+///////////////////////////////////////////////////////////////////////////////
+// Name:        sha2.h
+// Purpose:     SHA-256 message digest (FIPS 180-2)
+///////////////////////////////////////////////////////////////////////////////
+
+/// \file sha2.h Interface of the SHA-256 message digest
+*/
+
+#ifndef _SHA2_H_
+#define _SHA2_H_
+
+#define SHA256_DIGEST_SIZE (256 / 8)
+#define SHA256_BLOCK_SIZE  (512 / 8)
+
+/* Number of messages hashed together by sha256_x4 */
+#define SHA256_LANES 4
+
+#define SHA256_SUCCESS              0
+#define SHA256_UNSUPPORTED_BACKEND -1
+
+#define SHA256_Backend_Scalar 0
+#define SHA256_Backend_SIMD   1
+#define SHA256_Backend_HW     2
+
+typedef struct
+{
+  unsigned int  h[8];
+  unsigned int  len;                       /* Bytes in block */
+  unsigned int  tot_len[2];                /* Bytes hashed so far, low word first */
+  unsigned char block[SHA256_BLOCK_SIZE];
+} sha256_ctx;
+
+void sha256_init(sha256_ctx* ctx);
+void sha256_update(sha256_ctx* ctx, const unsigned char* message, unsigned int len);
+void sha256_final(sha256_ctx* ctx, unsigned char* digest);
+void sha256(const unsigned char* message, unsigned int len, unsigned char* digest);
+
+/*
+// Hash SHA256_LANES messages of the same length at once. The SIMD backend
+// computes one message per 32 bit vector lane; the other backends hash
+// the messages one after the other.
+*/
+void sha256_x4(const unsigned char* message[SHA256_LANES], unsigned int len,
+               unsigned char* digest[SHA256_LANES]);
+
+/*
+// Backend used for hashing. On first use the SHA instructions (SHA-NI on
+// x86, the SHA2 Crypto Extensions on arm64) are selected if the CPU has
+// them, else the four lane SIMD code (SSE2 resp. NEON), which only speeds
+// up sha256_x4, else the portable code. sha256_set_backend forces a
+// backend (e.g. for benchmarks) and returns SHA256_UNSUPPORTED_BACKEND if
+// the CPU lacks it.
+*/
+int sha256_get_backend(void);
+int sha256_set_backend(int backend);
+
+#endif /* _SHA2_H_ */
@@ -3993,6 +3993,19 @@ SQLITE_API int sqlite3_collation_needed16(
 ** Specify the key for an encrypted database.  This routine should be
 ** called right after sqlite3_open().
 **
+** A key of the form "cipher=NAME;password" selects the cipher: "aes128",
+** "aes256", "aes128-xex", "aes256-xex", "aes128-xts", "aes256-xts",
+** "aes128-gcm", "aes256-gcm", "chacha20" or "chacha20-lz4"; other keys
+** use the cipher the library was built for (CODEC_TYPE, "aes128" by
+** default). The cipher fixes the key derivation and the page format of a
+** new database; the page format of an existing database is detected, but
+** a database must be opened with the cipher it was created with. The
+** same prefix is accepted by PRAGMA key and by the rekey functions;
+** rekeying with a prefix also rewrites the pages in the format of the
+** named cipher, which migrates an existing database to it; a prefix
+** with an empty password is SQLITE_MISUSE there rather than a request to
+** decrypt. SQLITE_ERROR is returned for an unknown cipher.
+**
 ** The code to implement this API is not available in the public release
 ** of SQLite.
 */
@@ -4001,6 +4014,138 @@ SQLITE_API int sqlite3_key(
   const void *pKey, int nKey     /* The key */
 );
 
+/*
+** Key derivation is deliberately slow. sqlite3_key_derive() runs it once
+** for a key as accepted by sqlite3_key(), writes the derived key to pRaw,
+** which must have room for 32 bytes, and returns its length (0 for an
+** unknown cipher). sqlite3_key_raw() then opens a database with the
+** derived key, without deriving it again. Its key is the derived key,
+** optionally after the same "cipher=NAME;" prefix, and must have the
+** key length of the cipher (16 bytes for "aes128", "aes128-xex",
+** "aes128-xts" and "aes128-gcm", 32 bytes otherwise); SQLITE_MISUSE is
+** returned if it does not.
+**
+** Alternatively sqlite3_key_cache(1) enables a process-wide cache of
+** recently derived keys, indexed by a digest of the password, so that
+** opening further connections with the same password skips the
+** derivation. sqlite3_key_cache(0) disables the cache and wipes it. The
+** cache is disabled by default.
+*/
+SQLITE_API int sqlite3_key_raw(
+  sqlite3 *db,                   /* Database to be keyed */
+  const void *pKey, int nKey     /* The derived key */
+);
+SQLITE_API int sqlite3_key_derive(
+  const void *pKey, int nKey,    /* The key, as for sqlite3_key() */
+  unsigned char *pRaw            /* Receives the derived key */
+);
+SQLITE_API int sqlite3_key_cache(int bEnable);
+
+/*
+** Select the page format of a new encrypted database. Call this after
+** sqlite3_key() and before anything is written; an existing database
+** keeps the format it was created with, which is detected when it is
+** opened. SQLITE_CODEC_FORMAT_CBC is the original format and the default,
+** SQLITE_CODEC_FORMAT_XEX encrypts the blocks of a page independently and
+** therefore writes faster. SQLITE_CODEC_FORMAT_CHACHA20 uses the ChaCha20
+** stream cipher, the fastest choice on CPUs without AES instructions; it
+** reserves 12 bytes at the end of each page for a nonce.
+** SQLITE_CODEC_FORMAT_XTS is AES-XTS with keys expanded once per database
+** and the page number as tweak, the cheapest format per page I/O.
+** SQLITE_CODEC_FORMAT_GCM is AES-GCM: it reserves 28 bytes at the end of
+** each page for a random nonce and an authentication tag, and every page
+** is checked when it is loaded. A page that was tampered with reads as
+** corrupt (SQLITE_CORRUPT, or SQLITE_NOTADB for page 1) and the failure
+** is reported through sqlite3_log(). As the nonces are random, at most
+** 2^32 page writes should be made under one key (NIST SP 800-38D), so a
+** GCM database must be rekeyed well before that many page writes (16 TiB
+** with 4 KiB pages). SQLITE_CODEC_FORMAT_LZ4 compresses
+** each page with LZ4 before encrypting it with ChaCha20 and fills the rest
+** of the page with zeros, which file system compression and compressed
+** backups remove; it reserves 16 bytes for the compressed length and the
+** nonce. Pages do not get smaller in the file itself, and the size of a
+** compressed page reveals how compressible its content is. Returns
+** SQLITE_MISUSE if no key is set or the database already exists.
+*/
+#define SQLITE_CODEC_FORMAT_CBC      0
+#define SQLITE_CODEC_FORMAT_XEX      1
+#define SQLITE_CODEC_FORMAT_CHACHA20 2
+#define SQLITE_CODEC_FORMAT_XTS      3
+#define SQLITE_CODEC_FORMAT_GCM      4
+#define SQLITE_CODEC_FORMAT_LZ4      5
+
+SQLITE_API int sqlite3_codec_format(sqlite3 *db, int nFormat);
+
+/*
+** Encrypt (bEncrypt nonzero) or decrypt nPage pages of the main database
+** in place, e.g. for converting a database file offline. aPgno[i] is the
+** page number of the page at apData[i]; every buffer holds one page of the
+** database's page size. Pages are encrypted with the current key, and a
+** rekey in progress encrypts with the new key. The pages are processed
+** together and spread over several threads if there are many of them.
+** Returns SQLITE_CORRUPT if a page fails authentication (GCM format; the
+** page is cleared), SQLITE_MISUSE if the database is not encrypted or an
+** incremental rekey is in progress.
+*/
+SQLITE_API int sqlite3_codec_pages(
+  sqlite3 *db,                   /* Database whose keys are used */
+  int nPage,                     /* Number of pages */
+  const unsigned int *aPgno,     /* Page numbers */
+  void **apData,                 /* Page buffers */
+  int bEncrypt                   /* Nonzero to encrypt, zero to decrypt */
+);
+
+/*
+** Register the encrypting VFS "codec" on top of the VFS zParent (the
+** default VFS if zParent is NULL); makeDflt makes it the default VFS. A
+** key set with sqlite3_key() for a database opened through this VFS is
+** applied by the VFS instead of the pager: runs of adjacent pages are
+** encrypted and written together, multi-page reads are decrypted as a
+** batch, sequential scans are read ahead and decrypted in advance (by a
+** thread of its own on multi-core devices), and page images in the
+** rollback journal and the WAL as well as temporary files are encrypted
+** too. The database file has the same format as with the pager codec, but
+** a hot journal or WAL left by one can not be recovered by the other.
+** sqlite3_rekey() and sqlite3_rekey_begin() return SQLITE_MISUSE for such
+** a database. Registering again is harmless; the parent of the first call
+** is kept.
+*/
+#define SQLITE_CODEC_VFS "codec"
+
+SQLITE_API int sqlite3_codec_vfs_register(const char *zParent, int makeDflt);
+
+/*
+** Turn on write-behind for the main database of db, opened through the
+** "codec" VFS: encrypted pages of the database and frames of the WAL are
+** written by an I/O thread of the file while the next pages are being
+** encrypted. Reads, syncs and commits still wait until the writes are
+** done. With nMillis > 0 in WAL mode with synchronous=FULL, the sync of a
+** commit is deferred by up to nMillis milliseconds so that the commits
+** within that window share one sync; a crash may lose them, but not the
+** consistency of the database. nMillis == 0 turns on write-behind without
+** deferring syncs, nMillis < 0 turns it off (the default). If the I/O
+** thread cannot be started, pages are written and synced at once. Returns
+** SQLITE_MISUSE if the database does not use the "codec" VFS.
+*/
+SQLITE_API int sqlite3_codec_write_behind(sqlite3 *db, int nMillis);
+
+/*
+** Report the memory used by the codecs of the databases of db (the main
+** database and attached ones), in the manner of sqlite3_db_status():
+** the current value is written to *pCurrent, the highwater mark to
+** *pHighwater, and resetFlag resets the highwater mark to the current
+** value. SQLITE_CODEC_STATUS_MEMORY_USED counts all bytes allocated for
+** the codecs, including their key caches and page buffers;
+** SQLITE_CODEC_STATUS_BUFFER_USED only the page buffers, which are
+** allocated when pages are first written, at the page size of the
+** database. Buffers of the "codec" VFS itself are not included. Returns
+** SQLITE_ERROR for an unknown op.
+*/
+#define SQLITE_CODEC_STATUS_MEMORY_USED 0
+#define SQLITE_CODEC_STATUS_BUFFER_USED 1
+
+SQLITE_API int sqlite3_codec_status(sqlite3 *db, int op, int *pCurrent, int *pHighwater, int resetFlag);
+
 /*
 ** Change the key on an open database.  If the current database is not
 ** encrypted, this routine will encrypt it.  If pNew==0 or nNew==0, the
@@ -4014,6 +4159,51 @@ SQLITE_API int sqlite3_rekey(
   const void *pKey, int nKey     /* The new key */
 );
 
+/*
+** Like sqlite3_rekey(), but decrypts and re-encrypts pages on several
+** threads and reports progress. xProgress, if not NULL, is invoked with
+** the number of pages processed so far and the total number of pages;
+** a nonzero return rolls the rekey back and makes sqlite3_rekey_v2()
+** return SQLITE_ABORT. Pages are rewritten in place and keep the reserved
+** bytes of the database, so a key whose cipher needs them (ChaCha20, GCM,
+** LZ4) fails with SQLITE_ERROR and leaves the database unchanged unless the
+** database is empty or already reserves enough; this also applies to
+** sqlite3_rekey() and sqlite3_rekey_begin().
+*/
+SQLITE_API int sqlite3_rekey_v2(
+  sqlite3 *db,                   /* Database to be rekeyed */
+  const void *pKey, int nKey,    /* The new key */
+  int (*xProgress)(void*,int,int), /* Progress callback or NULL */
+  void *pArg                     /* First argument to xProgress */
+);
+
+/*
+** Incremental rekey, in the manner of sqlite3_backup_step().
+** sqlite3_rekey_begin() sets up the new key; each call to
+** sqlite3_rekey_step() then re-encrypts up to nPage further pages (all
+** remaining pages if nPage is negative) in a transaction of its own and
+** returns SQLITE_OK, or SQLITE_DONE once the whole database uses the new key.
+** Progress is stored in page 1 in place of the file format string, so an
+** interrupted rekey is resumed by calling sqlite3_rekey_begin() with the
+** same key again. The database must be encrypted already, as a plaintext
+** page 1 cannot carry the progress: sqlite3_rekey_begin() returns
+** SQLITE_MISUSE for an unencrypted database, which sqlite3_rekey() or
+** sqlite3_rekey_v2() encrypt in one transaction instead.
+**
+** Every connection to the database must call sqlite3_rekey_begin() before
+** accessing it while a rekey is incomplete, others fail with SQLITE_NOTADB;
+** the database must not be VACUUMed until the rekey is done.
+** sqlite3_rekey_remaining() and sqlite3_rekey_pagecount() report the pages
+** still to be rekeyed and the size of the database seen by the last step.
+*/
+SQLITE_API int sqlite3_rekey_begin(
+  sqlite3 *db,                   /* Database to be rekeyed */
+  const void *pKey, int nKey     /* The new key */
+);
+SQLITE_API int sqlite3_rekey_step(sqlite3 *db, int nPage);
+SQLITE_API int sqlite3_rekey_remaining(sqlite3 *db);
+SQLITE_API int sqlite3_rekey_pagecount(sqlite3 *db);
+
 /*
 ** Specify the activation key for a SEE database.  Unless 
 ** activated, none of the SEE routines will work.
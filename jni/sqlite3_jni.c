@@ -27,6 +27,15 @@ typedef struct {
 	jobject tr; /* Trace object */
 	jobject pr; /* Profile object */
 	jobject ph; /* ProgressHandler object */
+	jmethodID bhmid; /* BusyHandler.busy() */
+	jmethodID aimid; /* Authorizer.authorize() */
+	jmethodID trmid; /* Trace.trace() */
+	jmethodID prmid; /* Profile.profile() */
+	jmethodID phmid; /* ProgressHandler.progress() */
+	jclass cbcls; /* class of last Callback object */
+	jmethodID cbcolumns; /* its columns() */
+	jmethodID cbtypes; /* its types() */
+	jmethodID cbnewrow; /* its newrow() */
 	JNIEnv *env; /* Java environment for callbacks */
 	int row1; /* true while processing first row */
 	int haveutf; /* true for SQLite UTF-8 support */
@@ -47,6 +56,11 @@ typedef struct hfunc {
 	jobject db; /* Database object */
 	handle *h; /* SQLite database handle */
 	void *sf; /* SQLite function handle */
+	jmethodID callmid; /* Function.function() or step() */
+	jmethodID finalmid; /* Function.last_step() */
+	jobject fa; /* FunctionArgs object, typed functions only */
+	sqlite3_value **args; /* arguments of the running typed call */
+	int nargs; /* number of arguments of the running typed call */
 	JNIEnv *env; /* Java environment for callbacks */
 } hfunc;
 
@@ -93,6 +107,7 @@ static jclass C_SQLite3_exception = 0;
 static jfieldID F_SQLite3_Database_handle = 0;
 static jfieldID F_SQLite3_Database_error_code = 0;
 static jfieldID F_SQLite3_FunctionContext_handle = 0;
+static jfieldID F_SQLite3_FunctionArgs_handle = 0;
 static jfieldID F_SQLite3_Vm_handle = 0;
 static jfieldID F_SQLite3_Vm_error_code = 0;
 static jfieldID F_SQLite3_Stmt_handle = 0;
@@ -100,6 +115,14 @@ static jfieldID F_SQLite3_Stmt_error_code = 0;
 static jfieldID F_SQLite3_Blob_handle = 0;
 static jfieldID F_SQLite3_Blob_size = 0;
 static jfieldID F_SQLite3_Backup_handle = 0;
+static jfieldID F_SQLite3_RowBatch_rows = 0;
+static jfieldID F_SQLite3_RowBatch_columns = 0;
+static jfieldID F_SQLite3_RowBatch_done = 0;
+static jfieldID F_SQLite3_RowBatch_types = 0;
+static jfieldID F_SQLite3_RowBatch_longs = 0;
+static jfieldID F_SQLite3_RowBatch_doubles = 0;
+static jfieldID F_SQLite3_RowBatch_offsets = 0;
+static jfieldID F_SQLite3_RowBatch_data = 0;
 
 static jmethodID M_java_lang_String_getBytes = 0;
 static jmethodID M_java_lang_String_getBytes2 = 0;
@@ -210,6 +233,25 @@ static void globrefset(JNIEnv *env, jobject obj, jobject *ref) {
 	}
 }
 
+/* method id of a callback object, or 0 without pending exception */
+
+static jmethodID getcbmethod(JNIEnv *env, jobject obj, const char *name,
+		const char *sig) {
+	jclass cls;
+	jmethodID mid;
+
+	if (!obj) {
+		return 0;
+	}
+	cls = (*env)->GetObjectClass(env, obj);
+	mid = (*env)->GetMethodID(env, cls, name, sig);
+	if (!mid) {
+		(*env)->ExceptionClear(env);
+	}
+	(*env)->DeleteLocalRef(env, cls);
+	return mid;
+}
+
 static void freep(char **strp) {
 	if (strp && *strp) {
 		free(*strp);
@@ -345,18 +387,9 @@ static int busyhandler3(void *udata, int count) {
 	JNIEnv *env = h->env;
 	int ret = 0;
 
-	if (env && h->bh) {
-		jclass cls = (*env)->GetObjectClass(env, h->bh);
-		jmethodID mid = (*env)->GetMethodID(env, cls, "busy",
-				"(Ljava/lang/String;I)Z");
-
-		if (mid == 0) {
-			(*env)->DeleteLocalRef(env, cls);
-			return ret;
-		}
-		ret = (*env)->CallBooleanMethod(env, h->bh, mid, 0, (jint) count)
+	if (env && h->bh && h->bhmid) {
+		ret = (*env)->CallBooleanMethod(env, h->bh, h->bhmid, 0, (jint) count)
 				!= JNI_FALSE;
-		(*env)->DeleteLocalRef(env, cls);
 	}
 	return ret;
 }
@@ -366,16 +399,8 @@ static int progresshandler(void *udata) {
 	JNIEnv *env = h->env;
 	int ret = 0;
 
-	if (env && h->ph) {
-		jclass cls = (*env)->GetObjectClass(env, h->ph);
-		jmethodID mid = (*env)->GetMethodID(env, cls, "progress", "()Z");
-
-		if (mid == 0) {
-			(*env)->DeleteLocalRef(env, cls);
-			return ret;
-		}
-		ret = (*env)->CallBooleanMethod(env, h->ph, mid) != JNI_TRUE;
-		(*env)->DeleteLocalRef(env, cls);
+	if (env && h->ph && h->phmid) {
+		ret = (*env)->CallBooleanMethod(env, h->ph, h->phmid) != JNI_TRUE;
 	}
 	return ret;
 }
@@ -391,9 +416,19 @@ static int callback(void *udata, int ncol, char **data, char **cols) {
 		jobjectArray arr = 0;
 		jint i;
 
-		if (h->row1) {
-			mid = (*env)->GetMethodID(env, cls, "columns",
+		if (!h->cbcls || !(*env)->IsSameObject(env, cls, h->cbcls)) {
+			/* resolve methods once per Callback class */
+			delglobrefp(env, (jobject *) &h->cbcls);
+			globrefset(env, cls, (jobject *) &h->cbcls);
+			h->cbcolumns = getcbmethod(env, h->cb, "columns",
 					"([Ljava/lang/String;)V");
+			h->cbtypes = getcbmethod(env, h->cb, "types",
+					"([Ljava/lang/String;)V");
+			h->cbnewrow = getcbmethod(env, h->cb, "newrow",
+					"([Ljava/lang/String;)Z");
+		}
+		if (h->row1) {
+			mid = h->cbcolumns;
 
 			if (mid) {
 				arr = (*env)->NewObjectArray(env, ncol, C_java_lang_String, 0);
@@ -421,8 +456,7 @@ static int callback(void *udata, int ncol, char **data, char **cols) {
 				(*env)->DeleteLocalRef(env, arr);
 			}
 
-			mid = (*env)->GetMethodID(env, cls, "types",
-					"([Ljava/lang/String;)V");
+			mid = h->cbtypes;
 
 			if (mid && h->stmt) {
 				arr = (*env)->NewObjectArray(env, ncol, C_java_lang_String, 0);
@@ -478,8 +512,7 @@ static int callback(void *udata, int ncol, char **data, char **cols) {
 			}
 		}
 		if (data) {
-			mid = (*env)->GetMethodID(env, cls, "newrow",
-					"([Ljava/lang/String;)Z");
+			mid = h->cbnewrow;
 			if (mid) {
 				jboolean rc;
 
@@ -547,9 +580,14 @@ static void doclose(JNIEnv *env, jobject obj, int final) {
 				(*env)->SetLongField(env, f->fc,
 						F_SQLite3_FunctionContext_handle, 0);
 			}
+			if (f->fa) {
+				(*env)->SetLongField(env, f->fa,
+						F_SQLite3_FunctionArgs_handle, 0);
+			}
 			delglobrefp(env, &f->db);
 			delglobrefp(env, &f->fi);
 			delglobrefp(env, &f->fc);
+			delglobrefp(env, &f->fa);
 			free(f);
 		}
 		while ((bl = h->blobs)) {
@@ -575,6 +613,7 @@ static void doclose(JNIEnv *env, jobject obj, int final) {
 		delglobrefp(env, &h->ai);
 		delglobrefp(env, &h->tr);
 		delglobrefp(env, &h->ph);
+		delglobrefp(env, (jobject *) &h->cbcls);
 		delglobrefp(env, &h->enc);
 		free(h);
 		(*env)->SetLongField(env, obj, F_SQLite3_Database_handle, 0);
@@ -697,6 +736,9 @@ Java_SQLite3_Database__1open4(JNIEnv *env, jobject obj, jstring file,
 		}
 		h->sqlite = 0;
 		h->bh = h->cb = h->ai = h->tr = h->pr = h->ph = 0;
+		h->bhmid = h->aimid = h->trmid = h->prmid = h->phmid = 0;
+		h->cbcls = 0;
+		h->cbcolumns = h->cbtypes = h->cbnewrow = 0;
 		/* CHECK THIS */
 		h->stmt = 0;
 		h->haveutf = 1;
@@ -726,6 +768,10 @@ Java_SQLite3_Database__1open4(JNIEnv *env, jobject obj, jstring file,
 			(*env)->DeleteLocalRef(env, exc);
 			return;
 		}
+		/* the encrypting VFS is registered on first use */
+		if (vfsname.result && strcmp(vfsname.result, SQLITE_CODEC_VFS) == 0) {
+			sqlite3_codec_vfs_register(0, 0);
+		}
 	}
 	int rc = sqlite3_open_v2(filename.result, (sqlite3 **) &h->sqlite,
 			(int) mode, vfsname.result);
@@ -781,6 +827,7 @@ Java_SQLite3_Database__1busy_1handler(JNIEnv *env, jobject obj, jobject bh) {
 	if (h && h->sqlite) {
 		delglobrefp(env, &h->bh);
 		globrefset(env, bh, &h->bh);
+		h->bhmid = getcbmethod(env, h->bh, "busy", "(Ljava/lang/String;I)Z");
 		sqlite3_busy_handler((sqlite3 *) h->sqlite, busyhandler3, h);
 		return;
 	}
@@ -1034,14 +1081,23 @@ static void call3_common(sqlite3_context *sf, int isstep, int nargs,
 
 	if (f && f->env && f->fi) {
 		JNIEnv *env = f->env;
-		jclass cls = (*env)->GetObjectClass(env, f->fi);
-		jmethodID mid = (*env)->GetMethodID(env, cls, isstep ? "step"
-				: "function", "(LSQLite/FunctionContext;[Ljava/lang/String;)V");
 		jobjectArray arr;
 		int i;
 
-		if (mid == 0) {
-			(*env)->DeleteLocalRef(env, cls);
+		if (f->callmid == 0) {
+			return;
+		}
+		if (f->fa) {
+			/* typed function: arguments are fetched on demand */
+			sqlite3_value **oldargs = f->args;
+			int oldnargs = f->nargs;
+
+			f->sf = sf;
+			f->args = args;
+			f->nargs = nargs;
+			(*env)->CallVoidMethod(env, f->fi, f->callmid, f->fc, f->fa);
+			f->args = oldargs;
+			f->nargs = oldnargs;
 			return;
 		}
 		arr = (*env)->NewObjectArray(env, nargs, C_java_lang_String, 0);
@@ -1061,9 +1117,8 @@ static void call3_common(sqlite3_context *sf, int isstep, int nargs,
 			}
 		}
 		f->sf = sf;
-		(*env)->CallVoidMethod(env, f->fi, mid, f->fc, arr);
+		(*env)->CallVoidMethod(env, f->fi, f->callmid, f->fc, arr);
 		(*env)->DeleteLocalRef(env, arr);
-		(*env)->DeleteLocalRef(env, cls);
 	}
 }
 
@@ -1080,25 +1135,21 @@ static void call3_final(sqlite3_context *sf) {
 
 	if (f && f->env && f->fi) {
 		JNIEnv *env = f->env;
-		jclass cls = (*env)->GetObjectClass(env, f->fi);
-		jmethodID mid = (*env)->GetMethodID(env, cls, "last_step",
-				"(LSQLite/FunctionContext;)V");
-		if (mid == 0) {
-			(*env)->DeleteLocalRef(env, cls);
+
+		if (f->finalmid == 0) {
 			return;
 		}
 		f->sf = sf;
-		(*env)->CallVoidMethod(env, f->fi, mid, f->fc);
-		(*env)->DeleteLocalRef(env, cls);
+		(*env)->CallVoidMethod(env, f->fi, f->finalmid, f->fc);
 	}
 }
 
-static void mkfunc_common(JNIEnv *env, int isagg, jobject obj, jstring name,
-		jint nargs, jobject fi) {
+static void mkfunc_common(JNIEnv *env, int isagg, int typed, jobject obj,
+		jstring name, jint nargs, jobject fi) {
 	handle *h = gethandle(env, obj);
 
 	if (h && h->sqlite) {
-		jclass cls = (*env)->FindClass(env, "SQLite/FunctionContext");
+		jclass cls;
 		jobject fc;
 		hfunc *f;
 		int ret;
@@ -1106,19 +1157,60 @@ static void mkfunc_common(JNIEnv *env, int isagg, jobject obj, jstring name,
 		jvalue v;
 		jthrowable exc;
 
-		fc = (*env)->AllocObject(env, cls);
 		if (!fi) {
-			throwex(env, "null SQLite.Function not allowed");
+			throwex(env, "null SQLite3.Function not allowed");
+			return;
+		}
+		/* on failure the NoClassDefFoundError or the like is pending */
+		cls = (*env)->FindClass(env, "SQLite3/FunctionContext");
+		if (!cls) {
+			return;
+		}
+		fc = (*env)->AllocObject(env, cls);
+		(*env)->DeleteLocalRef(env, cls);
+		if (!fc) {
 			return;
 		}
 		f = malloc(sizeof(hfunc));
 		if (!f) {
-			throwoom(env, "unable to get SQLite.FunctionContext handle");
+			(*env)->DeleteLocalRef(env, fc);
+			throwoom(env, "unable to get SQLite3.FunctionContext handle");
 			return;
 		}
 		globrefset(env, fc, &f->fc);
+		(*env)->DeleteLocalRef(env, fc);
 		globrefset(env, fi, &f->fi);
 		globrefset(env, obj, &f->db);
+		f->fa = 0;
+		f->args = 0;
+		f->nargs = 0;
+		if (typed) {
+			jclass acls = (*env)->FindClass(env, "SQLite3/FunctionArgs");
+			jobject fa = 0;
+
+			if (acls) {
+				fa = (*env)->AllocObject(env, acls);
+				(*env)->DeleteLocalRef(env, acls);
+			}
+			if (!fa) {
+				/* the exception of FindClass or AllocObject is pending */
+				delglobrefp(env, &f->fc);
+				delglobrefp(env, &f->fi);
+				delglobrefp(env, &f->db);
+				free(f);
+				return;
+			}
+			globrefset(env, fa, &f->fa);
+			(*env)->DeleteLocalRef(env, fa);
+			v.j = 0;
+			v.l = (jobject) f;
+			(*env)->SetLongField(env, f->fa, F_SQLite3_FunctionArgs_handle, v.j);
+		}
+		f->callmid = getcbmethod(env, f->fi, isagg ? "step" : "function",
+				typed ? "(LSQLite3/FunctionContext;LSQLite3/FunctionArgs;)V"
+						: "(LSQLite3/FunctionContext;[Ljava/lang/String;)V");
+		f->finalmid = isagg ? getcbmethod(env, f->fi, "last_step",
+				"(LSQLite3/FunctionContext;)V") : 0;
 		f->h = h;
 		f->next = h->funcs;
 		h->funcs = f;
@@ -1148,13 +1240,25 @@ static void mkfunc_common(JNIEnv *env, int isagg, jobject obj, jstring name,
 JNIEXPORT void JNICALL
 Java_SQLite3_Database__1create_1aggregate(JNIEnv *env, jobject obj,
 		jstring name, jint nargs, jobject fi) {
-	mkfunc_common(env, 1, obj, name, nargs, fi);
+	mkfunc_common(env, 1, 0, obj, name, nargs, fi);
 }
 
 JNIEXPORT void JNICALL
 Java_SQLite3_Database__1create_1function(JNIEnv *env, jobject obj,
 		jstring name, jint nargs, jobject fi) {
-	mkfunc_common(env, 0, obj, name, nargs, fi);
+	mkfunc_common(env, 0, 0, obj, name, nargs, fi);
+}
+
+JNIEXPORT void JNICALL
+Java_SQLite3_Database__1create_1typed_1aggregate(JNIEnv *env, jobject obj,
+		jstring name, jint nargs, jobject fi) {
+	mkfunc_common(env, 1, 1, obj, name, nargs, fi);
+}
+
+JNIEXPORT void JNICALL
+Java_SQLite3_Database__1create_1typed_1function(JNIEnv *env, jobject obj,
+		jstring name, jint nargs, jobject fi) {
+	mkfunc_common(env, 0, 1, obj, name, nargs, fi);
 }
 
 JNIEXPORT void JNICALL
@@ -1265,6 +1369,107 @@ Java_SQLite3_FunctionContext_set_1result_1zeroblob(JNIEnv *env, jobject obj,
 	}
 }
 
+static sqlite3_value *
+getfuncarg(JNIEnv *env, jobject obj, jint i) {
+	jvalue v;
+	hfunc *f;
+
+	v.j = (*env)->GetLongField(env, obj, F_SQLite3_FunctionArgs_handle);
+	f = (hfunc *) v.l;
+	if (!f || !f->args) {
+		throwex(env, "function arguments not available");
+		return 0;
+	}
+	if (i < 0 || i >= f->nargs) {
+		throwex(env, "argument out of bounds");
+		return 0;
+	}
+	return f->args[i];
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_FunctionArgs_count(JNIEnv *env, jobject obj) {
+	jvalue v;
+	hfunc *f;
+
+	v.j = (*env)->GetLongField(env, obj, F_SQLite3_FunctionArgs_handle);
+	f = (hfunc *) v.l;
+	return (f && f->args) ? f->nargs : 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_FunctionArgs_value_1type(JNIEnv *env, jobject obj, jint i) {
+	sqlite3_value *arg = getfuncarg(env, obj, i);
+
+	return arg ? sqlite3_value_type(arg) : 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_FunctionArgs_value_1int(JNIEnv *env, jobject obj, jint i) {
+	sqlite3_value *arg = getfuncarg(env, obj, i);
+
+	return arg ? sqlite3_value_int(arg) : 0;
+}
+
+JNIEXPORT jlong JNICALL
+Java_SQLite3_FunctionArgs_value_1long(JNIEnv *env, jobject obj, jint i) {
+	sqlite3_value *arg = getfuncarg(env, obj, i);
+
+	return arg ? sqlite3_value_int64(arg) : 0;
+}
+
+JNIEXPORT jdouble JNICALL
+Java_SQLite3_FunctionArgs_value_1double(JNIEnv *env, jobject obj, jint i) {
+	sqlite3_value *arg = getfuncarg(env, obj, i);
+
+	return arg ? sqlite3_value_double(arg) : 0;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_SQLite3_FunctionArgs_value_1bytes(JNIEnv *env, jobject obj, jint i) {
+	sqlite3_value *arg = getfuncarg(env, obj, i);
+	const void *data;
+	jbyteArray b;
+	int nbytes;
+
+	if (!arg || !(data = sqlite3_value_blob(arg))) {
+		return 0;
+	}
+	nbytes = sqlite3_value_bytes(arg);
+	b = (*env)->NewByteArray(env, nbytes);
+	if (!b) {
+		throwoom(env, "unable to get blob argument data");
+		return 0;
+	}
+	(*env)->SetByteArrayRegion(env, b, 0, nbytes, data);
+	return b;
+}
+
+JNIEXPORT jstring JNICALL
+Java_SQLite3_FunctionArgs_value_1string(JNIEnv *env, jobject obj, jint i) {
+	sqlite3_value *arg = getfuncarg(env, obj, i);
+	const jchar *data;
+	jstring s;
+	int nbytes;
+
+	if (!arg || !(data = sqlite3_value_text16(arg))) {
+		return 0;
+	}
+	nbytes = sqlite3_value_bytes16(arg);
+	s = (*env)->NewString(env, data, nbytes / sizeof(jchar));
+	if (!s) {
+		throwoom(env, "unable to get string argument data");
+		return 0;
+	}
+	return s;
+}
+
+JNIEXPORT void JNICALL
+Java_SQLite3_FunctionArgs_internal_1init(JNIEnv *env, jclass cls) {
+	F_SQLite3_FunctionArgs_handle = (*env)->GetFieldID(env, cls, "handle",
+			"J");
+}
+
 JNIEXPORT jstring JNICALL
 Java_SQLite3_Database_error_1string(JNIEnv *env, jclass c, jint err) {
 	return (*env)->NewStringUTF(env, "unkown error");
@@ -1298,12 +1503,9 @@ doauth(void *arg, int what, const char *arg1, const char *arg2,
 
 	if (env && h->ai) {
 		jthrowable exc;
-		jclass cls = (*env)->GetObjectClass(env, h->ai);
-		jmethodID mid;
+		jmethodID mid = h->aimid;
 		jint i = what;
 
-		mid = (*env)->GetMethodID(env, cls, "authorize",
-				"(ILjava/lang/String;Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)I");
 		if (mid) {
 			jstring s1 = 0, s2 = 0, s3 = 0, s4 = 0;
 			transstr tr;
@@ -1361,6 +1563,8 @@ Java_SQLite3_Database__1set_1authorizer(JNIEnv *env, jobject obj, jobject auth)
 	if (h && h->sqlite) {
 		delglobrefp(env, &h->ai);
 		globrefset(env, auth, &h->ai);
+		h->aimid = getcbmethod(env, h->ai, "authorize",
+				"(ILjava/lang/String;Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)I");
 #if HAVE_SQLITE_SET_AUTHORIZER
 		h->env = env;
 		sqlite3_set_authorizer((sqlite3 *) h->sqlite, h->ai ? doauth : 0, h);
@@ -1376,10 +1580,8 @@ static void dotrace(void *arg, const char *msg) {
 
 	if (env && h->tr && msg) {
 		jthrowable exc;
-		jclass cls = (*env)->GetObjectClass(env, h->tr);
-		jmethodID mid;
+		jmethodID mid = h->trmid;
 
-		mid = (*env)->GetMethodID(env, cls, "trace", "(Ljava/lang/String;)V");
 		if (mid) {
 			transstr tr;
 
@@ -1406,6 +1608,7 @@ Java_SQLite3_Database__1trace(JNIEnv *env, jobject obj, jobject tr) {
 	if (h && h->sqlite) {
 		delglobrefp(env, &h->tr);
 		globrefset(env, tr, &h->tr);
+		h->trmid = getcbmethod(env, h->tr, "trace", "(Ljava/lang/String;)V");
 		sqlite3_trace((sqlite3 *) h->sqlite, h->tr ? dotrace : 0, h);
 		return;
 	}
@@ -1989,6 +2192,7 @@ Java_SQLite3_Database__1progress_1handler(JNIEnv *env, jobject obj, jint n,
 		delglobrefp(env, &h->ph);
 		if (ph) {
 			globrefset(env, ph, &h->ph);
+			h->phmid = getcbmethod(env, h->ph, "progress", "()Z");
 			sqlite3_progress_handler((sqlite3 *) h->sqlite, n, progresshandler,
 					h);
 		} else {
@@ -2512,7 +2716,7 @@ Java_SQLite3_Stmt_column_1double(JNIEnv *env, jobject obj, jint col) {
 }
 
 JNIEXPORT jbyteArray JNICALL
-Java_SQLite3_Stmt_column_1bytes(JNIEnv *env, jobject obj, jint col) {
+Java_SQLite3_Stmt_column_1bytes__I(JNIEnv *env, jobject obj, jint col) {
 	hvm *v = gethstmt(env, obj);
 
 	if (v && v->vm && v->h) {
@@ -2543,6 +2747,75 @@ Java_SQLite3_Stmt_column_1bytes(JNIEnv *env, jobject obj, jint col) {
 	return 0;
 }
 
+/* address of len bytes at off in a direct ByteBuffer, or 0 with exception */
+
+static jbyte *getdirectbuf(JNIEnv *env, jobject buf, jint off, jint len) {
+	jbyte *addr;
+	jlong cap;
+
+	if (!buf) {
+		throwex(env, "null buffer");
+		return 0;
+	}
+	addr = (*env)->GetDirectBufferAddress(env, buf);
+	cap = (*env)->GetDirectBufferCapacity(env, buf);
+	if (!addr || cap < 0) {
+		throwex(env, "not a direct buffer");
+		return 0;
+	}
+	if (off < 0 || len < 0 || (jlong) off + len > cap) {
+		throwex(env, "buffer index out of bounds");
+		return 0;
+	}
+	return addr + off;
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_Stmt_column_1bytes__ILjava_nio_ByteBuffer_2I(JNIEnv *env,
+		jobject obj, jint col, jobject buf, jint off) {
+	hvm *v = gethstmt(env, obj);
+
+	if (v && v->vm && v->h) {
+		int ncol = sqlite3_data_count((sqlite3_stmt *) v->vm);
+		int nbytes, ncopy;
+		const void *data;
+		jbyte *dest;
+		jlong cap;
+
+		if (col < 0 || col >= ncol) {
+			throwex(env, "column out of bounds");
+			return 0;
+		}
+		/* -1 for NULL only, an empty value has no data but 0 bytes */
+		if (sqlite3_column_type((sqlite3_stmt *) v->vm, col) == SQLITE_NULL) {
+			return -1;
+		}
+		data = sqlite3_column_blob((sqlite3_stmt *) v->vm, col);
+		nbytes = sqlite3_column_bytes((sqlite3_stmt *) v->vm, col);
+		if (nbytes == 0) {
+			return 0;
+		}
+		if (!data) {
+			throwoom(env, "unable to get blob column data");
+			return 0;
+		}
+		cap = buf ? (*env)->GetDirectBufferCapacity(env, buf) : 0;
+		ncopy = (cap - off < nbytes) ? (int) (cap - off) : nbytes;
+		if (ncopy < 0) {
+			ncopy = 0;
+		}
+		/* copy what fits, the caller compares the result with its room */
+		dest = getdirectbuf(env, buf, off, ncopy);
+		if (!dest) {
+			return 0;
+		}
+		memcpy(dest, data, ncopy);
+		return nbytes;
+	}
+	throwex(env, "stmt already closed");
+	return 0;
+}
+
 JNIEXPORT jstring JNICALL
 Java_SQLite3_Stmt_column_1string(JNIEnv *env, jobject obj, jint col) {
 	hvm *v = gethstmt(env, obj);
@@ -2731,6 +3004,237 @@ Java_SQLite3_Stmt_finalize(JNIEnv *env, jobject obj) {
 	dostmtfinal(env, obj);
 }
 
+/* native staging area for Stmt.fetch_batch() */
+
+typedef struct {
+	int nrows; /* rows fetched */
+	int maxrows; /* rows the cell arrays have room for */
+	jbyte *types; /* column types, row-major */
+	jlong *longs; /* integer values */
+	jdouble *doubles; /* floating point values */
+	jint *offsets; /* start of text/blob values in data, plus end */
+	jbyte *data; /* UTF-8 text and blob bytes */
+	int ndata; /* bytes used in data */
+	int datasize; /* bytes allocated for data */
+} rowbatch;
+
+static void rowbatchfree(rowbatch *rb) {
+	free(rb->types);
+	free(rb->longs);
+	free(rb->doubles);
+	free(rb->offsets);
+	free(rb->data);
+}
+
+static int rowbatchgrow(rowbatch *rb, int ncol, int nrows) {
+	void *p;
+	int ncells = nrows * ncol + 1; /* one spare cell for the end offset */
+
+	if ((p = realloc(rb->types, ncells * sizeof(jbyte))) == 0) {
+		return 0;
+	}
+	rb->types = p;
+	if ((p = realloc(rb->longs, ncells * sizeof(jlong))) == 0) {
+		return 0;
+	}
+	rb->longs = p;
+	if ((p = realloc(rb->doubles, ncells * sizeof(jdouble))) == 0) {
+		return 0;
+	}
+	rb->doubles = p;
+	if ((p = realloc(rb->offsets, ncells * sizeof(jint))) == 0) {
+		return 0;
+	}
+	rb->offsets = p;
+	rb->maxrows = nrows;
+	return 1;
+}
+
+static int rowbatchadd(rowbatch *rb, const void *data, int len) {
+	if (len > rb->datasize - rb->ndata) {
+		int size = rb->datasize ? rb->datasize : 4096;
+		void *p;
+
+		while (size - rb->ndata < len) {
+			if (size > 0x3fffffff) {
+				return 0;
+			}
+			size *= 2;
+		}
+		if ((p = realloc(rb->data, size)) == 0) {
+			return 0;
+		}
+		rb->data = p;
+		rb->datasize = size;
+	}
+	memcpy(rb->data + rb->ndata, data, len);
+	rb->ndata += len;
+	return 1;
+}
+
+/* get the array in a RowBatch field, replacing it if smaller than len */
+
+static jarray getbatcharray(JNIEnv *env, jobject batch, jfieldID fid,
+		char type, jsize len) {
+	jarray arr = (*env)->GetObjectField(env, batch, fid);
+
+	if (arr && (*env)->GetArrayLength(env, arr) >= len) {
+		return arr;
+	}
+	if (arr) {
+		(*env)->DeleteLocalRef(env, arr);
+	}
+	switch (type) {
+	case 'B':
+		arr = (*env)->NewByteArray(env, len);
+		break;
+	case 'J':
+		arr = (*env)->NewLongArray(env, len);
+		break;
+	case 'D':
+		arr = (*env)->NewDoubleArray(env, len);
+		break;
+	default:
+		arr = (*env)->NewIntArray(env, len);
+		break;
+	}
+	if (arr) {
+		(*env)->SetObjectField(env, batch, fid, arr);
+	}
+	return arr;
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_Stmt_fetch_1batch(JNIEnv *env, jobject obj, jint maxrows,
+		jobject batch) {
+	hvm *v = gethstmt(env, obj);
+	sqlite3_stmt *stmt;
+	rowbatch rb;
+	jarray arr;
+	int ncol, ncells, i, ret = SQLITE_ROW;
+
+	if (!v || !v->vm || !v->h) {
+		throwex(env, "stmt already closed");
+		return 0;
+	}
+	if (!batch) {
+		throwex(env, "null batch");
+		return 0;
+	}
+	stmt = (sqlite3_stmt *) v->vm;
+	ncol = sqlite3_column_count(stmt);
+	if (maxrows <= 0 || (ncol > 0 && maxrows > 0x7ffffff / ncol)) {
+		throwex(env, "invalid row count");
+		return 0;
+	}
+	memset(&rb, 0, sizeof(rb));
+	if (!rowbatchgrow(&rb, ncol, maxrows < 64 ? maxrows : 64)) {
+		goto oom;
+	}
+	rb.offsets[0] = 0;
+	while (rb.nrows < maxrows) {
+		jbyte *types;
+
+		ret = sqlite3_step(stmt);
+		if (ret != SQLITE_ROW) {
+			break;
+		}
+		if (rb.nrows == rb.maxrows) {
+			int n = rb.maxrows * 2;
+
+			if (!rowbatchgrow(&rb, ncol, n < maxrows ? n : maxrows)) {
+				goto oom;
+			}
+		}
+		ncells = rb.nrows * ncol;
+		types = rb.types + ncells;
+		for (i = 0; i < ncol; i++) {
+			int type = sqlite3_column_type(stmt, i);
+			const void *data = 0;
+			int len = 0;
+
+			types[i] = (jbyte) type;
+			rb.longs[ncells + i] = 0;
+			rb.doubles[ncells + i] = 0;
+			switch (type) {
+			case SQLITE_INTEGER:
+				rb.longs[ncells + i] = sqlite3_column_int64(stmt, i);
+				break;
+			case SQLITE_FLOAT:
+				rb.doubles[ncells + i] = sqlite3_column_double(stmt, i);
+				break;
+			case SQLITE_TEXT:
+				data = sqlite3_column_text(stmt, i);
+				len = sqlite3_column_bytes(stmt, i);
+				break;
+			case SQLITE_BLOB:
+				data = sqlite3_column_blob(stmt, i);
+				len = sqlite3_column_bytes(stmt, i);
+				break;
+			}
+			if (len > 0 && !rowbatchadd(&rb, data, len)) {
+				goto oom;
+			}
+			rb.offsets[ncells + i + 1] = rb.ndata;
+		}
+		rb.nrows++;
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE) {
+		const char *err = sqlite3_errmsg(v->h->sqlite);
+
+		rowbatchfree(&rb);
+		setstmterr(env, obj, ret);
+		throwex(env, err ? err : "error in step");
+		return 0;
+	}
+
+	/* hand everything over in one go */
+	ncells = rb.nrows * ncol;
+	(*env)->SetIntField(env, batch, F_SQLite3_RowBatch_rows, rb.nrows);
+	(*env)->SetIntField(env, batch, F_SQLite3_RowBatch_columns, ncol);
+	(*env)->SetBooleanField(env, batch, F_SQLite3_RowBatch_done,
+			ret == SQLITE_DONE ? JNI_TRUE : JNI_FALSE);
+	if (!(arr = getbatcharray(env, batch, F_SQLite3_RowBatch_types, 'B',
+			ncells))) {
+		goto oom;
+	}
+	(*env)->SetByteArrayRegion(env, arr, 0, ncells, rb.types);
+	(*env)->DeleteLocalRef(env, arr);
+	if (!(arr = getbatcharray(env, batch, F_SQLite3_RowBatch_longs, 'J',
+			ncells))) {
+		goto oom;
+	}
+	(*env)->SetLongArrayRegion(env, arr, 0, ncells, rb.longs);
+	(*env)->DeleteLocalRef(env, arr);
+	if (!(arr = getbatcharray(env, batch, F_SQLite3_RowBatch_doubles, 'D',
+			ncells))) {
+		goto oom;
+	}
+	(*env)->SetDoubleArrayRegion(env, arr, 0, ncells, rb.doubles);
+	(*env)->DeleteLocalRef(env, arr);
+	if (!(arr = getbatcharray(env, batch, F_SQLite3_RowBatch_offsets, 'I',
+			ncells + 1))) {
+		goto oom;
+	}
+	(*env)->SetIntArrayRegion(env, arr, 0, ncells + 1, rb.offsets);
+	(*env)->DeleteLocalRef(env, arr);
+	if (!(arr = getbatcharray(env, batch, F_SQLite3_RowBatch_data, 'B',
+			rb.ndata))) {
+		goto oom;
+	}
+	(*env)->SetByteArrayRegion(env, arr, 0, rb.ndata, rb.data);
+	(*env)->DeleteLocalRef(env, arr);
+	rowbatchfree(&rb);
+	return rb.nrows;
+
+oom:
+	rowbatchfree(&rb);
+	if (!(*env)->ExceptionCheck(env)) {
+		throwoom(env, "unable to get row batch");
+	}
+	return 0;
+}
+
 JNIEXPORT void JNICALL
 Java_SQLite3_Database__1open_1blob(JNIEnv *env, jobject obj, jstring dbname,
 		jstring table, jstring column, jlong row, jboolean rw, jobject blobj) {
@@ -2801,7 +3305,7 @@ Java_SQLite3_Database__1open_1blob(JNIEnv *env, jobject obj, jstring dbname,
 }
 
 JNIEXPORT jint JNICALL
-Java_SQLite3_Blob_write(JNIEnv *env, jobject obj, jbyteArray b, jint off,
+Java_SQLite3_Blob_write___3BIII(JNIEnv *env, jobject obj, jbyteArray b, jint off,
 		jint pos, jint len) {
 	hbl *bl = gethbl(env, obj);
 
@@ -2837,7 +3341,7 @@ Java_SQLite3_Blob_write(JNIEnv *env, jobject obj, jbyteArray b, jint off,
 }
 
 JNIEXPORT jint JNICALL
-Java_SQLite3_Blob_read(JNIEnv *env, jobject obj, jbyteArray b, jint off,
+Java_SQLite3_Blob_read___3BIII(JNIEnv *env, jobject obj, jbyteArray b, jint off,
 		jint pos, jint len) {
 	hbl *bl = gethbl(env, obj);
 
@@ -2872,6 +3376,60 @@ Java_SQLite3_Blob_read(JNIEnv *env, jobject obj, jbyteArray b, jint off,
 	return 0;
 }
 
+JNIEXPORT jint JNICALL
+Java_SQLite3_Blob_write__Ljava_nio_ByteBuffer_2III(JNIEnv *env, jobject obj,
+		jobject b, jint off, jint pos, jint len) {
+	hbl *bl = gethbl(env, obj);
+
+	if (bl && bl->h && bl->blob) {
+		jbyte *buf;
+		int ret;
+
+		if (len <= 0) {
+			return 0;
+		}
+		buf = getdirectbuf(env, b, off, len);
+		if (!buf) {
+			return 0;
+		}
+		ret = sqlite3_blob_write(bl->blob, buf, len, pos);
+		if (ret != SQLITE_OK) {
+			throwioex(env, "blob write error");
+			return 0;
+		}
+		return len;
+	}
+	throwex(env, "blob already closed");
+	return 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_Blob_read__Ljava_nio_ByteBuffer_2III(JNIEnv *env, jobject obj,
+		jobject b, jint off, jint pos, jint len) {
+	hbl *bl = gethbl(env, obj);
+
+	if (bl && bl->h && bl->blob) {
+		jbyte *buf;
+		int ret;
+
+		if (len <= 0) {
+			return 0;
+		}
+		buf = getdirectbuf(env, b, off, len);
+		if (!buf) {
+			return 0;
+		}
+		ret = sqlite3_blob_read(bl->blob, buf, len, pos);
+		if (ret != SQLITE_OK) {
+			throwioex(env, "blob read error");
+			return 0;
+		}
+		return len;
+	}
+	throwex(env, "blob already closed");
+	return 0;
+}
+
 JNIEXPORT void JNICALL
 Java_SQLite3_Blob_close(JNIEnv *env, jobject obj) {
 	doblobfinal(env, obj);
@@ -2897,10 +3455,15 @@ JNICALL Java_SQLite3_Database__1key(JNIEnv *env, jobject obj, jbyteArray key) {
 		len = 0;
 	}
 	if (h && h->sqlite) {
-		sqlite3_key((sqlite3 *) h->sqlite, data, len);
+		/* the key may select the cipher with a "cipher=<name>;" prefix */
+		int rc = sqlite3_key((sqlite3 *) h->sqlite, data, len);
+
 		if (data) {
 			memset(data, 0, len);
 		}
+		if (rc != SQLITE_OK) {
+			throwex(env, "unknown cipher");
+		}
 	} else {
 		if (data) {
 			memset(data, 0, len);
@@ -2909,6 +3472,82 @@ JNICALL Java_SQLite3_Database__1key(JNIEnv *env, jobject obj, jbyteArray key) {
 	}
 }
 
+JNIEXPORT void JNICALL
+Java_SQLite3_Database__1key_1raw(JNIEnv *env, jobject obj, jbyteArray key) {
+	jsize len = 0;
+	jbyte *data = 0;
+	handle *h = gethandle(env, obj);
+	int rc;
+
+	if (!h || !h->sqlite) {
+		throwclosed(env);
+		return;
+	}
+	if (key) {
+		len = (*env)->GetArrayLength(env, key);
+	}
+	if (len > 0) {
+		data = (*env)->GetByteArrayElements(env, key, 0);
+		if (!data) {
+			throwoom(env, "unable to get key");
+			return;
+		}
+	}
+	/* the derived key, optionally after a "cipher=<name>;" prefix */
+	rc = sqlite3_key_raw((sqlite3 *) h->sqlite, data, len);
+	if (data) {
+		memset(data, 0, len);
+		(*env)->ReleaseByteArrayElements(env, key, data, JNI_ABORT);
+	}
+	if (rc == SQLITE_ERROR) {
+		throwex(env, "unknown cipher");
+	} else if (rc != SQLITE_OK) {
+		throwex(env, "invalid raw key");
+	}
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_SQLite3_Database__1key_1derive(JNIEnv *env, jclass cls, jbyteArray key) {
+	jsize len = 0;
+	jbyte *data = 0;
+	unsigned char raw[32];
+	jbyteArray result = 0;
+	int n;
+
+	if (key) {
+		len = (*env)->GetArrayLength(env, key);
+	}
+	if (len > 0) {
+		data = (*env)->GetByteArrayElements(env, key, 0);
+		if (!data) {
+			throwoom(env, "unable to get key");
+			return 0;
+		}
+	}
+	n = sqlite3_key_derive(data, len, raw);
+	if (data) {
+		memset(data, 0, len);
+		(*env)->ReleaseByteArrayElements(env, key, data, JNI_ABORT);
+	}
+	if (n <= 0) {
+		throwex(env, "unknown cipher");
+		return 0;
+	}
+	result = (*env)->NewByteArray(env, n);
+	if (result) {
+		(*env)->SetByteArrayRegion(env, result, 0, n, (jbyte *) raw);
+	} else {
+		throwoom(env, "unable to get key");
+	}
+	memset(raw, 0, sizeof(raw));
+	return result;
+}
+
+JNIEXPORT void JNICALL
+Java_SQLite3_Database__1key_1cache(JNIEnv *env, jclass cls, jboolean enable) {
+	sqlite3_key_cache(enable == JNI_TRUE);
+}
+
 JNIEXPORT void JNICALL
 Java_SQLite3_Database__1rekey(JNIEnv *env, jobject obj, jbyteArray key) {
 	jsize len;
@@ -2936,6 +3575,177 @@ Java_SQLite3_Database__1rekey(JNIEnv *env, jobject obj, jbyteArray key) {
 	}
 }
 
+/* state for sqlite3_rekey_v2() progress callbacks */
+
+typedef struct {
+	JNIEnv *env; /* Java environment of the rekeying thread */
+	jobject rl; /* RekeyListener object */
+	jmethodID mid; /* RekeyListener.progress(int, int) */
+} hrekey;
+
+static int rekeyprogress(void *udata, int done, int total) {
+	hrekey *r = (hrekey *) udata;
+	JNIEnv *env = r->env;
+	jboolean ret;
+
+	ret = (*env)->CallBooleanMethod(env, r->rl, r->mid, (jint) done,
+			(jint) total);
+	if ((*env)->ExceptionCheck(env)) {
+		return 1;
+	}
+	return ret != JNI_TRUE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_SQLite3_Database__1rekey_1progress(JNIEnv *env, jobject obj,
+		jbyteArray key, jobject rl) {
+	jsize len = 0;
+	jbyte *data = 0;
+	handle *h = gethandle(env, obj);
+	hrekey r;
+	int rc;
+
+	if (!h || !h->sqlite) {
+		throwclosed(env);
+		return JNI_FALSE;
+	}
+	r.env = env;
+	r.rl = rl;
+	r.mid = 0;
+	if (rl) {
+		jclass cls = (*env)->GetObjectClass(env, rl);
+
+		r.mid = (*env)->GetMethodID(env, cls, "progress", "(II)Z");
+		(*env)->DeleteLocalRef(env, cls);
+		if (!r.mid) {
+			return JNI_FALSE;
+		}
+	}
+	if (key) {
+		len = (*env)->GetArrayLength(env, key);
+	}
+	if (len > 0) {
+		data = (*env)->GetByteArrayElements(env, key, 0);
+		if (!data) {
+			throwoom(env, "unable to get key");
+			return JNI_FALSE;
+		}
+	}
+	rc = sqlite3_rekey_v2((sqlite3 *) h->sqlite, data, len,
+			r.mid ? rekeyprogress : 0, &r);
+	if (data) {
+		memset(data, 0, len);
+		(*env)->ReleaseByteArrayElements(env, key, data, JNI_ABORT);
+	}
+	if (rc == SQLITE_OK) {
+		return JNI_TRUE;
+	}
+	if (rc != SQLITE_ABORT) {
+		throwex(env, "rekey failed");
+	}
+	/* aborted by the listener, or its exception is pending */
+	return JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL
+Java_SQLite3_Database__1rekey_1begin(JNIEnv *env, jobject obj, jbyteArray key) {
+	jsize len = 0;
+	jbyte *data = 0;
+	handle *h = gethandle(env, obj);
+	int rc;
+
+	if (!h || !h->sqlite) {
+		throwclosed(env);
+		return;
+	}
+	if (key) {
+		len = (*env)->GetArrayLength(env, key);
+	}
+	if (len > 0) {
+		data = (*env)->GetByteArrayElements(env, key, 0);
+		if (!data) {
+			throwoom(env, "unable to get key");
+			return;
+		}
+	}
+	rc = sqlite3_rekey_begin((sqlite3 *) h->sqlite, data, len);
+	if (data) {
+		memset(data, 0, len);
+		(*env)->ReleaseByteArrayElements(env, key, data, JNI_ABORT);
+	}
+	if (rc != SQLITE_OK) {
+		throwex(env, "rekey begin failed");
+	}
+}
+
+JNIEXPORT jboolean JNICALL
+Java_SQLite3_Database__1rekey_1step(JNIEnv *env, jobject obj, jint n) {
+	handle *h = gethandle(env, obj);
+	int rc;
+
+	if (!h || !h->sqlite) {
+		throwclosed(env);
+		return JNI_FALSE;
+	}
+	rc = sqlite3_rekey_step((sqlite3 *) h->sqlite, (int) n);
+	switch (rc) {
+	case SQLITE_DONE:
+		return JNI_TRUE;
+	case SQLITE_OK:
+	case SQLITE_BUSY:
+	case SQLITE_LOCKED:
+		break;
+	default:
+		throwex(env, "rekey step failed");
+		break;
+	}
+	return JNI_FALSE;
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_Database__1rekey_1remaining(JNIEnv *env, jobject obj) {
+	handle *h = gethandle(env, obj);
+
+	if (!h || !h->sqlite) {
+		throwclosed(env);
+		return 0;
+	}
+	return (jint) sqlite3_rekey_remaining((sqlite3 *) h->sqlite);
+}
+
+JNIEXPORT void JNICALL
+Java_SQLite3_Database__1write_1behind(JNIEnv *env, jobject obj, jint ms) {
+	handle *h = gethandle(env, obj);
+
+	if (!h || !h->sqlite) {
+		throwclosed(env);
+		return;
+	}
+	if (sqlite3_codec_write_behind((sqlite3 *) h->sqlite, (int) ms) != SQLITE_OK) {
+		throwex(env, "write behind failed");
+	}
+}
+
+JNIEXPORT jint JNICALL
+Java_SQLite3_Database__1codec_1status(JNIEnv *env, jobject obj, jint op,
+		jintArray info, jboolean flag) {
+	jint ret = SQLITE_ERROR;
+	handle *h = gethandle(env, obj);
+	int data[2] = { 0, 0 };
+	jint jdata[2];
+
+	if (h && h->sqlite) {
+		ret = sqlite3_codec_status((sqlite3 *) h->sqlite, op, &data[0], &data[1],
+				flag);
+		if (ret == SQLITE_OK) {
+			jdata[0] = data[0];
+			jdata[1] = data[1];
+			(*env)->SetIntArrayRegion(env, info, 0, 2, jdata);
+		}
+	}
+	return ret;
+}
+
 JNIEXPORT jboolean JNICALL
 Java_SQLite3_Database__1enable_1shared_1cache(JNIEnv *env, jclass cls,
 		jboolean onoff) {
@@ -3112,12 +3922,8 @@ static void doprofile(void *arg, const char *msg, sqlite_uint64 est) {
 
 	if (env && h->pr && msg) {
 		jthrowable exc;
-		jclass cls = (*env)->GetObjectClass(env, h->pr);
-		jmethodID mid;
+		jmethodID mid = h->prmid;
 
-		mid
-				= (*env)->GetMethodID(env, cls, "profile",
-						"(Ljava/lang/String;J)V");
 		if (mid) {
 			transstr tr;
 #if _MSC_VER && (_MSC_VER < 1300)
@@ -3149,6 +3955,7 @@ Java_SQLite3_Database__1profile(JNIEnv *env, jobject obj, jobject tr) {
 	if (h && h->sqlite) {
 		delglobrefp(env, &h->pr);
 		globrefset(env, tr, &h->pr);
+		h->prmid = getcbmethod(env, h->pr, "profile", "(Ljava/lang/String;J)V");
 		sqlite3_profile((sqlite3 *) h->sqlite, h->pr ? doprofile : 0, h);
 	}
 }
@@ -3211,6 +4018,18 @@ Java_SQLite3_Backup_internal_1init(JNIEnv *env, jclass cls) {
 	F_SQLite3_Backup_handle = (*env)->GetFieldID(env, cls, "handle", "J");
 }
 
+JNIEXPORT void JNICALL
+Java_SQLite3_RowBatch_internal_1init(JNIEnv *env, jclass cls) {
+	F_SQLite3_RowBatch_rows = (*env)->GetFieldID(env, cls, "rows", "I");
+	F_SQLite3_RowBatch_columns = (*env)->GetFieldID(env, cls, "columns", "I");
+	F_SQLite3_RowBatch_done = (*env)->GetFieldID(env, cls, "done", "Z");
+	F_SQLite3_RowBatch_types = (*env)->GetFieldID(env, cls, "types", "[B");
+	F_SQLite3_RowBatch_longs = (*env)->GetFieldID(env, cls, "longs", "[J");
+	F_SQLite3_RowBatch_doubles = (*env)->GetFieldID(env, cls, "doubles", "[D");
+	F_SQLite3_RowBatch_offsets = (*env)->GetFieldID(env, cls, "offsets", "[I");
+	F_SQLite3_RowBatch_data = (*env)->GetFieldID(env, cls, "data", "[B");
+}
+
 JNIEXPORT void JNICALL
 Java_SQLite3_Database_internal_1init(JNIEnv *env, jclass cls) {
 #if defined(DONT_USE_JNI_ONLOAD) || !defined(JNI_VERSION_1_2)
@@ -135,6 +135,22 @@ JNIEXPORT void JNICALL Java_SQLite3_Database__1create_1function
 JNIEXPORT void JNICALL Java_SQLite3_Database__1create_1aggregate
   (JNIEnv *, jobject, jstring, jint, jobject);
 
+/*
+ * Class:     SQLite3_Database
+ * Method:    _create_typed_function
+ * Signature: (Ljava/lang/String;ILSQLite/TypedFunction;)V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_Database__1create_1typed_1function
+  (JNIEnv *, jobject, jstring, jint, jobject);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _create_typed_aggregate
+ * Signature: (Ljava/lang/String;ILSQLite/TypedFunction;)V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_Database__1create_1typed_1aggregate
+  (JNIEnv *, jobject, jstring, jint, jobject);
+
 /*
  * Class:     SQLite3_Database
  * Method:    _function_type
@@ -263,6 +279,30 @@ JNIEXPORT void JNICALL Java_SQLite3_Database__1progress_1handler
 JNIEXPORT void JNICALL Java_SQLite3_Database__1key
   (JNIEnv *, jobject, jbyteArray);
 
+/*
+ * Class:     SQLite3_Database
+ * Method:    _key_raw
+ * Signature: ([B)V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_Database__1key_1raw
+  (JNIEnv *, jobject, jbyteArray);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _key_derive
+ * Signature: ([B)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_SQLite3_Database__1key_1derive
+  (JNIEnv *, jclass, jbyteArray);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _key_cache
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_Database__1key_1cache
+  (JNIEnv *, jclass, jboolean);
+
 /*
  * Class:     SQLite3_Database
  * Method:    _rekey
@@ -271,6 +311,54 @@ JNIEXPORT void JNICALL Java_SQLite3_Database__1key
 JNIEXPORT void JNICALL Java_SQLite3_Database__1rekey
   (JNIEnv *, jobject, jbyteArray);
 
+/*
+ * Class:     SQLite3_Database
+ * Method:    _rekey_progress
+ * Signature: ([BLSQLite3/RekeyListener;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_SQLite3_Database__1rekey_1progress
+  (JNIEnv *, jobject, jbyteArray, jobject);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _rekey_begin
+ * Signature: ([B)V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_Database__1rekey_1begin
+  (JNIEnv *, jobject, jbyteArray);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _rekey_step
+ * Signature: (I)Z
+ */
+JNIEXPORT jboolean JNICALL Java_SQLite3_Database__1rekey_1step
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _rekey_remaining
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_Database__1rekey_1remaining
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _write_behind
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_Database__1write_1behind
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_Database
+ * Method:    _codec_status
+ * Signature: (I[IZ)I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_Database__1codec_1status
+  (JNIEnv *, jobject, jint, jintArray, jboolean);
+
 /*
  * Class:     SQLite3_Database
  * Method:    _enable_shared_cache
@@ -413,6 +501,81 @@ JNIEXPORT jint JNICALL Java_SQLite3_FunctionContext_count
 JNIEXPORT void JNICALL Java_SQLite3_FunctionContext_internal_1init
   (JNIEnv *, jclass);
 
+#ifdef __cplusplus
+}
+#endif
+#endif
+/* Header for class SQLite3_FunctionArgs */
+
+#ifndef _Included_SQLite3_FunctionArgs
+#define _Included_SQLite3_FunctionArgs
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    count
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_FunctionArgs_count
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    value_type
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_FunctionArgs_value_1type
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    value_int
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_FunctionArgs_value_1int
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    value_long
+ * Signature: (I)J
+ */
+JNIEXPORT jlong JNICALL Java_SQLite3_FunctionArgs_value_1long
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    value_double
+ * Signature: (I)D
+ */
+JNIEXPORT jdouble JNICALL Java_SQLite3_FunctionArgs_value_1double
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    value_bytes
+ * Signature: (I)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_SQLite3_FunctionArgs_value_1bytes
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    value_string
+ * Signature: (I)Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_SQLite3_FunctionArgs_value_1string
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     SQLite3_FunctionArgs
+ * Method:    internal_init
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_FunctionArgs_internal_1init
+  (JNIEnv *, jclass);
+
 #ifdef __cplusplus
 }
 #endif
@@ -573,9 +736,17 @@ JNIEXPORT jdouble JNICALL Java_SQLite3_Stmt_column_1double
  * Method:    column_bytes
  * Signature: (I)[B
  */
-JNIEXPORT jbyteArray JNICALL Java_SQLite3_Stmt_column_1bytes
+JNIEXPORT jbyteArray JNICALL Java_SQLite3_Stmt_column_1bytes__I
   (JNIEnv *, jobject, jint);
 
+/*
+ * Class:     SQLite3_Stmt
+ * Method:    column_bytes
+ * Signature: (ILjava/nio/ByteBuffer;I)I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_Stmt_column_1bytes__ILjava_nio_ByteBuffer_2I
+  (JNIEnv *, jobject, jint, jobject, jint);
+
 /*
  * Class:     SQLite3_Stmt
  * Method:    column_string
@@ -640,6 +811,14 @@ JNIEXPORT jstring JNICALL Java_SQLite3_Stmt_column_1decltype
 JNIEXPORT jstring JNICALL Java_SQLite3_Stmt_column_1origin_1name
   (JNIEnv *, jobject, jint);
 
+/*
+ * Class:     SQLite3_Stmt
+ * Method:    fetch_batch
+ * Signature: (ILSQLite3/RowBatch;)I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_Stmt_fetch_1batch
+  (JNIEnv *, jobject, jint, jobject);
+
 /*
  * Class:     SQLite3_Stmt
  * Method:    status
@@ -688,17 +867,33 @@ JNIEXPORT void JNICALL Java_SQLite3_Blob_close
  * Method:    write
  * Signature: ([BIII)I
  */
-JNIEXPORT jint JNICALL Java_SQLite3_Blob_write
+JNIEXPORT jint JNICALL Java_SQLite3_Blob_write___3BIII
   (JNIEnv *, jobject, jbyteArray, jint, jint, jint);
 
+/*
+ * Class:     SQLite3_Blob
+ * Method:    write
+ * Signature: (Ljava/nio/ByteBuffer;III)I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_Blob_write__Ljava_nio_ByteBuffer_2III
+  (JNIEnv *, jobject, jobject, jint, jint, jint);
+
 /*
  * Class:     SQLite3_Blob
  * Method:    read
  * Signature: ([BIII)I
  */
-JNIEXPORT jint JNICALL Java_SQLite3_Blob_read
+JNIEXPORT jint JNICALL Java_SQLite3_Blob_read___3BIII
   (JNIEnv *, jobject, jbyteArray, jint, jint, jint);
 
+/*
+ * Class:     SQLite3_Blob
+ * Method:    read
+ * Signature: (Ljava/nio/ByteBuffer;III)I
+ */
+JNIEXPORT jint JNICALL Java_SQLite3_Blob_read__Ljava_nio_ByteBuffer_2III
+  (JNIEnv *, jobject, jobject, jint, jint, jint);
+
 /*
  * Class:     SQLite3_Blob
  * Method:    finalize
@@ -781,3 +976,22 @@ extern "C" {
 }
 #endif
 #endif
+/* Header for class SQLite3_RowBatch */
+
+#ifndef _Included_SQLite3_RowBatch
+#define _Included_SQLite3_RowBatch
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     SQLite3_RowBatch
+ * Method:    internal_init
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_SQLite3_RowBatch_internal_1init
+  (JNIEnv *, jclass);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -33,7 +33,11 @@ void mySqlite3PagerSetCodec(
 }
 
 #include "rijndael.c"
+#include "chacha20.c"
+#include "gcm.c"
+#include "lz4.c"
 #include "codec.c"
+#include "codecvfs.c"
 #include "codecext.c"
 
 #endif